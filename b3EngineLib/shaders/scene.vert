@@ -7,12 +7,26 @@ layout(set = 0, binding = 0) uniform SceneUBO {
   vec3 lightPos;
 } sceneUBO;
 
-// モデル毎
-layout(set = 1, binding = 0) uniform UniformBufferObject {
+// ノード毎（インスタンスのノードの index で参照する）
+struct NodeData {
   mat4 model;
-  mat4 shadowMatrix;
+  mat4 depthMVP;
+  // 量子化した頂点を戻す変換（Float の頂点では何もしない値）
+  vec4 positionScale;
+  vec4 positionOffset;
+  vec4 texCoordTransform;
   uint texIndex;
-} ubo;
+};
+layout(std430, set = 1, binding = 0) readonly buffer NodeBuffer {
+  NodeData nodes[];
+};
+// インスタンス毎のノードの index（gl_InstanceIndex で参照する）
+layout(std430, set = 1, binding = 1) readonly buffer InstanceBuffer {
+  uint instanceNodes[];
+};
+
+// true なら頂点は PackedVertex（法線は八面体の 2 成分）
+layout(constant_id = 0) const bool PACKED_VERTICES = false;
 
 layout(location = 0) in vec3 in_position;
 layout(location = 1) in vec3 in_normal;
@@ -30,19 +44,34 @@ const mat4 biasMat = mat4(
   0.0, 0.0, 1.0, 0.0,
   0.5, 0.5, 0.0, 1.0 );
 
+vec3 decodeOctahedral(vec2 e)
+{
+  vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+  float t = max(-n.z, 0.0);
+  n.x += n.x >= 0.0 ? -t : t;
+  n.y += n.y >= 0.0 ? -t : t;
+  return normalize(n);
+}
+
 void main()
 {
-  mat4 mvp = sceneUBO.proj * sceneUBO.view * ubo.model;
-  gl_Position = mvp * vec4(in_position, 1.0);
+  NodeData node = nodes[instanceNodes[gl_InstanceIndex]];
+  vec3 position = in_position * node.positionScale.xyz + node.positionOffset.xyz;
+  vec3 normal = PACKED_VERTICES ? decodeOctahedral(in_normal.xy) : in_normal;
+  vec2 texCoord =
+      in_texCoord * node.texCoordTransform.xy + node.texCoordTransform.zw;
+
+  mat4 mvp = sceneUBO.proj * sceneUBO.view * node.model;
+  gl_Position = mvp * vec4(position, 1.0);
 
-  out_normal = mat3(ubo.model) * in_normal;
+  out_normal = mat3(node.model) * normal;
 
-  out_texCoord = in_texCoord;
+  out_texCoord = texCoord;
 
-  vec3 worldPos = vec3(ubo.model * vec4(in_position, 1.0));
+  vec3 worldPos = vec3(node.model * vec4(position, 1.0));
   out_lightDir = sceneUBO.lightPos - worldPos;
 
-  out_shadowCoord = ubo.shadowMatrix * vec4(in_position, 1.0);  
+  out_shadowCoord = biasMat * node.depthMVP * vec4(position, 1.0);
 
-  out_texIndex = ubo.texIndex;
+  out_texIndex = node.texIndex;
 }
\ No newline at end of file
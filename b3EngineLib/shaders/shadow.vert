@@ -2,10 +2,21 @@
 
 layout (location = 0) in vec3 inPos;
 
-layout (binding = 0) uniform UBO
-{
+// ノード毎（scene.vert と同じバッファ）
+struct NodeData {
+  mat4 model;
   mat4 depthMVP;
-} ubo;
+  vec4 positionScale;
+  vec4 positionOffset;
+  vec4 texCoordTransform;
+  uint texIndex;
+};
+layout(std430, binding = 0) readonly buffer NodeBuffer {
+  NodeData nodes[];
+};
+layout(std430, binding = 1) readonly buffer InstanceBuffer {
+  uint instanceNodes[];
+};
 
 out gl_PerVertex
 {
@@ -14,5 +25,8 @@ out gl_PerVertex
 
 void main()
 {
-  gl_Position =  ubo.depthMVP * vec4(inPos, 1.0);
+  NodeData node = nodes[instanceNodes[gl_InstanceIndex]];
+  // 量子化した位置を戻す（Float の頂点ではそのまま）
+  vec3 position = inPos * node.positionScale.xyz + node.positionOffset.xyz;
+  gl_Position = node.depthMVP * vec4(position, 1.0);
 }
\ No newline at end of file
@@ -0,0 +1,1045 @@
+#include "bcn.hpp"
+
+#include "b3/job_system.hpp"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+namespace b3 {
+
+namespace {
+
+constexpr uint32_t BLOCK_PIXELS = 16;
+
+// 4x4 の画素（RGBA を並べたもの）を取り出す。画像の外は端の画素を使う。
+void loadBlock(const uint8_t *rgba, uint32_t width, uint32_t height,
+               uint32_t bx, uint32_t by, uint8_t out[BLOCK_PIXELS * 4]) {
+  for (uint32_t y = 0; y < 4; ++y) {
+    const uint32_t sy = std::min(by * 4 + y, height - 1);
+    for (uint32_t x = 0; x < 4; ++x) {
+      const uint32_t sx = std::min(bx * 4 + x, width - 1);
+      std::memcpy(out + (y * 4 + x) * 4, rgba + (size_t(sy) * width + sx) * 4,
+                  4);
+    }
+  }
+}
+
+void storeLE16(uint8_t *out, uint16_t v) {
+  out[0] = static_cast<uint8_t>(v);
+  out[1] = static_cast<uint8_t>(v >> 8);
+}
+
+uint16_t loadLE16(const uint8_t *p) { return uint16_t(p[0] | p[1] << 8); }
+
+uint32_t loadLE32(const uint8_t *p) {
+  return uint32_t(p[0]) | uint32_t(p[1]) << 8 | uint32_t(p[2]) << 16 |
+         uint32_t(p[3]) << 24;
+}
+
+// ---- BC1 の色ブロック ----
+
+uint16_t pack565(int r, int g, int b) {
+  return static_cast<uint16_t>(((r * 31 + 127) / 255) << 11 |
+                               ((g * 63 + 127) / 255) << 5 |
+                               ((b * 31 + 127) / 255));
+}
+
+void unpack565(uint16_t c, uint8_t out[4]) {
+  const int r = c >> 11;
+  const int g = (c >> 5) & 0x3f;
+  const int b = c & 0x1f;
+  out[0] = static_cast<uint8_t>(r << 3 | r >> 2);
+  out[1] = static_cast<uint8_t>(g << 2 | g >> 4);
+  out[2] = static_cast<uint8_t>(b << 3 | b >> 2);
+  out[3] = 255;
+}
+
+// 4 色（RGBA）のパレット。fourColor でなければ BC1 の 3 色と透明の黒。
+void colorPalette(uint16_t c0, uint16_t c1, bool fourColor,
+                  uint8_t palette[16]) {
+  unpack565(c0, palette);
+  unpack565(c1, palette + 4);
+  for (int c = 0; c < 3; ++c) {
+    const int a = palette[c];
+    const int b = palette[4 + c];
+    if (fourColor) {
+      palette[8 + c] = static_cast<uint8_t>((2 * a + b + 1) / 3);
+      palette[12 + c] = static_cast<uint8_t>((a + 2 * b + 1) / 3);
+    } else {
+      palette[8 + c] = static_cast<uint8_t>((a + b + 1) / 2);
+      palette[12 + c] = 0;
+    }
+  }
+  palette[11] = 255;
+  palette[15] = fourColor ? 255 : 0;
+}
+
+struct Indices {
+  // 画素 i のインデックスを bits の i * bitsPerIndex ビット目から置く
+  uint64_t bits = 0;
+  // パレットとの距離の合計（RGB の二乗誤差）
+  uint32_t error = 0;
+};
+
+Indices colorIndicesScalar(const uint8_t *pixels, const uint8_t *palette) {
+  Indices result;
+  for (uint32_t i = 0; i < BLOCK_PIXELS; ++i) {
+    uint32_t best = std::numeric_limits<uint32_t>::max();
+    uint32_t index = 0;
+    for (uint32_t j = 0; j < 4; ++j) {
+      uint32_t d = 0;
+      for (int c = 0; c < 3; ++c) {
+        const int diff = pixels[i * 4 + c] - palette[j * 4 + c];
+        d += diff * diff;
+      }
+      if (d < best) {
+        best = d;
+        index = j;
+      }
+    }
+    result.bits |= uint64_t(index) << (i * 2);
+    result.error += best;
+  }
+  return result;
+}
+
+// 8 段階（または 6 段階と 0, 255）のパレット
+void channelPalette(uint8_t v0, uint8_t v1, uint8_t palette[8]) {
+  palette[0] = v0;
+  palette[1] = v1;
+  if (v0 > v1) {
+    for (int i = 2; i < 8; ++i) {
+      palette[i] = static_cast<uint8_t>(((8 - i) * v0 + (i - 1) * v1 + 3) / 7);
+    }
+  } else {
+    for (int i = 2; i < 6; ++i) {
+      palette[i] = static_cast<uint8_t>(((6 - i) * v0 + (i - 1) * v1 + 2) / 5);
+    }
+    palette[6] = 0;
+    palette[7] = 255;
+  }
+}
+
+Indices channelIndicesScalar(const uint8_t *values, const uint8_t *palette) {
+  Indices result;
+  for (uint32_t i = 0; i < BLOCK_PIXELS; ++i) {
+    int best = std::numeric_limits<int>::max();
+    uint32_t index = 0;
+    for (uint32_t j = 0; j < 8; ++j) {
+      const int d = std::abs(values[i] - palette[j]);
+      if (d < best) {
+        best = d;
+        index = j;
+      }
+    }
+    result.bits |= uint64_t(index) << (i * 3);
+    result.error += static_cast<uint32_t>(best * best);
+  }
+  return result;
+}
+
+#if defined(B3_SIMD_X86)
+
+inline __m128i select(__m128i mask, __m128i a, __m128i b) {
+  return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+// 4 画素ずつ、4 色との距離を 32 bit で求めて比べる
+Indices colorIndicesSSE(const uint8_t *pixels, const uint8_t *palette) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i rgbMask = _mm_set_epi16(0, -1, -1, -1, 0, -1, -1, -1);
+  __m128i colors[4];
+  for (int j = 0; j < 4; ++j) {
+    int32_t color;
+    std::memcpy(&color, palette + j * 4, sizeof(color));
+    colors[j] =
+        _mm_and_si128(_mm_unpacklo_epi8(_mm_set1_epi32(color), zero), rgbMask);
+  }
+
+  alignas(16) uint32_t index[BLOCK_PIXELS];
+  alignas(16) uint32_t distance[BLOCK_PIXELS];
+  for (uint32_t q = 0; q < BLOCK_PIXELS; q += 4) {
+    const __m128i p =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(pixels + q * 4));
+    const __m128i lo = _mm_unpacklo_epi8(p, zero);
+    const __m128i hi = _mm_unpackhi_epi8(p, zero);
+    __m128i best = _mm_set1_epi32(std::numeric_limits<int32_t>::max());
+    __m128i bestIndex = zero;
+    for (int j = 0; j < 4; ++j) {
+      __m128i dl = _mm_and_si128(_mm_sub_epi16(lo, colors[j]), rgbMask);
+      __m128i dh = _mm_and_si128(_mm_sub_epi16(hi, colors[j]), rgbMask);
+      // (r^2 + g^2, b^2) の組を画素ごとに足す（偶数のレーンに入る）
+      dl = _mm_madd_epi16(dl, dl);
+      dh = _mm_madd_epi16(dh, dh);
+      dl = _mm_add_epi32(dl, _mm_srli_epi64(dl, 32));
+      dh = _mm_add_epi32(dh, _mm_srli_epi64(dh, 32));
+      const __m128i d = _mm_castps_si128(
+          _mm_shuffle_ps(_mm_castsi128_ps(dl), _mm_castsi128_ps(dh),
+                         _MM_SHUFFLE(2, 0, 2, 0)));
+      const __m128i less = _mm_cmplt_epi32(d, best);
+      best = select(less, d, best);
+      bestIndex = select(less, _mm_set1_epi32(j), bestIndex);
+    }
+    _mm_store_si128(reinterpret_cast<__m128i *>(index + q), bestIndex);
+    _mm_store_si128(reinterpret_cast<__m128i *>(distance + q), best);
+  }
+
+  Indices result;
+  for (uint32_t i = 0; i < BLOCK_PIXELS; ++i) {
+    result.bits |= uint64_t(index[i]) << (i * 2);
+    result.error += distance[i];
+  }
+  return result;
+}
+
+// 16 個の値を 16 bit で、8 段階との差を比べる
+Indices channelIndicesSSE(const uint8_t *values, const uint8_t *palette) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i v =
+      _mm_loadu_si128(reinterpret_cast<const __m128i *>(values));
+  const __m128i lo = _mm_unpacklo_epi8(v, zero);
+  const __m128i hi = _mm_unpackhi_epi8(v, zero);
+  __m128i bestLo = _mm_set1_epi16(std::numeric_limits<int16_t>::max());
+  __m128i bestHi = bestLo;
+  __m128i indexLo = zero;
+  __m128i indexHi = zero;
+  for (int j = 0; j < 8; ++j) {
+    const __m128i p = _mm_set1_epi16(palette[j]);
+    const __m128i j16 = _mm_set1_epi16(static_cast<int16_t>(j));
+    const __m128i dl =
+        _mm_max_epi16(_mm_sub_epi16(lo, p), _mm_sub_epi16(p, lo));
+    const __m128i dh =
+        _mm_max_epi16(_mm_sub_epi16(hi, p), _mm_sub_epi16(p, hi));
+    const __m128i lessLo = _mm_cmplt_epi16(dl, bestLo);
+    const __m128i lessHi = _mm_cmplt_epi16(dh, bestHi);
+    bestLo = select(lessLo, dl, bestLo);
+    bestHi = select(lessHi, dh, bestHi);
+    indexLo = select(lessLo, j16, indexLo);
+    indexHi = select(lessHi, j16, indexHi);
+  }
+
+  alignas(16) uint16_t index[BLOCK_PIXELS];
+  alignas(16) uint16_t distance[BLOCK_PIXELS];
+  _mm_store_si128(reinterpret_cast<__m128i *>(index), indexLo);
+  _mm_store_si128(reinterpret_cast<__m128i *>(index + 8), indexHi);
+  _mm_store_si128(reinterpret_cast<__m128i *>(distance), bestLo);
+  _mm_store_si128(reinterpret_cast<__m128i *>(distance + 8), bestHi);
+  Indices result;
+  for (uint32_t i = 0; i < BLOCK_PIXELS; ++i) {
+    result.bits |= uint64_t(index[i]) << (i * 3);
+    result.error += uint32_t(distance[i]) * distance[i];
+  }
+  return result;
+}
+
+#endif
+
+Indices colorIndices(const uint8_t *pixels, const uint8_t *palette,
+                     SimdLevel level) {
+#if defined(B3_SIMD_X86)
+  if (level != SimdLevel::Scalar) {
+    return colorIndicesSSE(pixels, palette);
+  }
+#endif
+  return colorIndicesScalar(pixels, palette);
+}
+
+Indices channelIndices(const uint8_t *values, const uint8_t *palette,
+                       SimdLevel level) {
+#if defined(B3_SIMD_X86)
+  if (level != SimdLevel::Scalar) {
+    return channelIndicesSSE(values, palette);
+  }
+#endif
+  return channelIndicesScalar(values, palette);
+}
+
+// 主成分の方向で両端にある2画素を端点にする
+void principalEndpoints(const uint8_t *pixels, uint16_t &c0, uint16_t &c1) {
+  float mean[3] = {0.0f, 0.0f, 0.0f};
+  int minColor[3] = {255, 255, 255};
+  int maxColor[3] = {0, 0, 0};
+  for (uint32_t i = 0; i < BLOCK_PIXELS; ++i) {
+    for (int c = 0; c < 3; ++c) {
+      const int v = pixels[i * 4 + c];
+      mean[c] += v;
+      minColor[c] = std::min(minColor[c], v);
+      maxColor[c] = std::max(maxColor[c], v);
+    }
+  }
+  for (float &m : mean) {
+    m /= BLOCK_PIXELS;
+  }
+
+  // 共分散行列（対称なので 6 要素）
+  float cov[6] = {};
+  for (uint32_t i = 0; i < BLOCK_PIXELS; ++i) {
+    const float r = pixels[i * 4 + 0] - mean[0];
+    const float g = pixels[i * 4 + 1] - mean[1];
+    const float b = pixels[i * 4 + 2] - mean[2];
+    cov[0] += r * r;
+    cov[1] += r * g;
+    cov[2] += r * b;
+    cov[3] += g * g;
+    cov[4] += g * b;
+    cov[5] += b * b;
+  }
+  // べき乗法。初期値は色の範囲の対角線にする。
+  float axis[3] = {float(maxColor[0] - minColor[0]),
+                   float(maxColor[1] - minColor[1]),
+                   float(maxColor[2] - minColor[2])};
+  for (int iteration = 0; iteration < 4; ++iteration) {
+    const float x = cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2];
+    const float y = cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2];
+    const float z = cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2];
+    const float norm = std::max({std::abs(x), std::abs(y), std::abs(z)});
+    if (norm == 0.0f) {
+      break;
+    }
+    axis[0] = x / norm;
+    axis[1] = y / norm;
+    axis[2] = z / norm;
+  }
+
+  uint32_t lowest = 0;
+  uint32_t highest = 0;
+  float minDot = std::numeric_limits<float>::max();
+  float maxDot = std::numeric_limits<float>::lowest();
+  for (uint32_t i = 0; i < BLOCK_PIXELS; ++i) {
+    const float dot = pixels[i * 4 + 0] * axis[0] +
+                      pixels[i * 4 + 1] * axis[1] +
+                      pixels[i * 4 + 2] * axis[2];
+    if (dot < minDot) {
+      minDot = dot;
+      lowest = i;
+    }
+    if (dot > maxDot) {
+      maxDot = dot;
+      highest = i;
+    }
+  }
+  const uint8_t *hi = pixels + highest * 4;
+  const uint8_t *lo = pixels + lowest * 4;
+  c0 = pack565(hi[0], hi[1], hi[2]);
+  c1 = pack565(lo[0], lo[1], lo[2]);
+}
+
+// 選んだインデックスのもとで二乗誤差が最小になる端点を求める。
+// 解けなければ false。
+bool refineEndpoints(const uint8_t *pixels, uint64_t indices, uint16_t &c0,
+                     uint16_t &c1) {
+  // インデックスごとの c0 と c1 の重み
+  constexpr float weights[4][2] = {
+      {1.0f, 0.0f}, {0.0f, 1.0f}, {2.0f / 3.0f, 1.0f / 3.0f},
+      {1.0f / 3.0f, 2.0f / 3.0f}};
+  float aa = 0.0f;
+  float ab = 0.0f;
+  float bb = 0.0f;
+  float ax[3] = {};
+  float bx[3] = {};
+  for (uint32_t i = 0; i < BLOCK_PIXELS; ++i) {
+    const auto index = (indices >> (i * 2)) & 3;
+    const float a = weights[index][0];
+    const float b = weights[index][1];
+    aa += a * a;
+    ab += a * b;
+    bb += b * b;
+    for (int c = 0; c < 3; ++c) {
+      ax[c] += a * pixels[i * 4 + c];
+      bx[c] += b * pixels[i * 4 + c];
+    }
+  }
+  const float det = aa * bb - ab * ab;
+  if (std::abs(det) < 1e-4f) {
+    return false;
+  }
+  int e0[3];
+  int e1[3];
+  for (int c = 0; c < 3; ++c) {
+    e0[c] = std::clamp(
+        static_cast<int>(std::lround((bb * ax[c] - ab * bx[c]) / det)), 0, 255);
+    e1[c] = std::clamp(
+        static_cast<int>(std::lround((aa * bx[c] - ab * ax[c]) / det)), 0, 255);
+  }
+  c0 = pack565(e0[0], e0[1], e0[2]);
+  c1 = pack565(e1[0], e1[1], e1[2]);
+  return true;
+}
+
+// 4 色モードの色ブロック（8 バイト）
+void encodeColorBlock(const uint8_t *pixels, SimdLevel level, uint8_t *out) {
+  uint16_t c0;
+  uint16_t c1;
+  principalEndpoints(pixels, c0, c1);
+  if (c0 < c1) {
+    std::swap(c0, c1);
+  }
+
+  uint8_t palette[16];
+  Indices indices;
+  if (c0 != c1) {
+    colorPalette(c0, c1, true, palette);
+    indices = colorIndices(pixels, palette, level);
+
+    uint16_t r0;
+    uint16_t r1;
+    if (refineEndpoints(pixels, indices.bits, r0, r1)) {
+      if (r0 < r1) {
+        std::swap(r0, r1);
+      }
+      if (r0 != r1) {
+        colorPalette(r0, r1, true, palette);
+        const auto refined = colorIndices(pixels, palette, level);
+        if (refined.error < indices.error) {
+          c0 = r0;
+          c1 = r1;
+          indices = refined;
+        }
+      }
+    }
+  }
+  // c0 == c1 ならインデックスはすべて 0（c0 の色）
+  storeLE16(out, c0);
+  storeLE16(out + 2, c1);
+  for (int i = 0; i < 4; ++i) {
+    out[4 + i] = static_cast<uint8_t>(indices.bits >> (i * 8));
+  }
+}
+
+// 1 チャンネルのブロック（8 バイト、BC3 のアルファと BC5 の各チャンネル）
+void encodeChannelBlock(const uint8_t *pixels, int channel, SimdLevel level,
+                        uint8_t *out) {
+  alignas(16) uint8_t values[BLOCK_PIXELS];
+  uint8_t lo = 255;
+  uint8_t hi = 0;
+  for (uint32_t i = 0; i < BLOCK_PIXELS; ++i) {
+    values[i] = pixels[i * 4 + channel];
+    lo = std::min(lo, values[i]);
+    hi = std::max(hi, values[i]);
+  }
+  // hi > lo なら 8 段階、等しければすべて 0 番（hi）
+  uint8_t palette[8];
+  channelPalette(hi, lo, palette);
+  const auto indices = channelIndices(values, palette, level);
+  out[0] = hi;
+  out[1] = lo;
+  for (int i = 0; i < 6; ++i) {
+    out[2 + i] = static_cast<uint8_t>(indices.bits >> (i * 8));
+  }
+}
+
+void decodeColorBlock(const uint8_t *block, bool alwaysFourColor,
+                      uint8_t out[BLOCK_PIXELS * 4]) {
+  const uint16_t c0 = loadLE16(block);
+  const uint16_t c1 = loadLE16(block + 2);
+  uint8_t palette[16];
+  colorPalette(c0, c1, alwaysFourColor || c0 > c1, palette);
+  const uint32_t indices = loadLE32(block + 4);
+  for (uint32_t i = 0; i < BLOCK_PIXELS; ++i) {
+    std::memcpy(out + i * 4, palette + ((indices >> (i * 2)) & 3) * 4, 4);
+  }
+}
+
+void decodeChannelBlock(const uint8_t *block, int channel,
+                        uint8_t out[BLOCK_PIXELS * 4]) {
+  uint8_t palette[8];
+  channelPalette(block[0], block[1], palette);
+  uint64_t indices = 0;
+  for (int i = 0; i < 6; ++i) {
+    indices |= uint64_t(block[2 + i]) << (i * 8);
+  }
+  for (uint32_t i = 0; i < BLOCK_PIXELS; ++i) {
+    out[i * 4 + channel] = palette[(indices >> (i * 3)) & 7];
+  }
+}
+
+// BC7 のエンコードはモード 6 だけを使う（1 サブセット、RGBA 各 7 bit の端点と
+// 端点ごとの P ビット、4 bit のインデックス）。128 ビットを下位から順に並べる。
+constexpr uint32_t BC7_MODE6 = 6;
+// 4 bit のインデックスの c1 側の重み（/64）
+constexpr int BC7_WEIGHTS[16] = {0,  4,  9,  13, 17, 21, 26, 30,
+                                 34, 38, 43, 47, 51, 55, 60, 64};
+
+struct Bc7Endpoints {
+  // 7 bit の端点と P ビット（8 bit の値は c << 1 | p）
+  uint8_t color[2][4];
+  uint8_t pbit[2];
+};
+
+// 8 bit の端点を 7 bit と P ビットに丸める。P ビットは誤差の小さい方。
+void quantizeBc7Endpoint(const int value[4], uint8_t color[4], uint8_t &pbit) {
+  int bestError = std::numeric_limits<int>::max();
+  for (int p = 0; p < 2; ++p) {
+    uint8_t q[4];
+    int error = 0;
+    for (int c = 0; c < 4; ++c) {
+      q[c] = static_cast<uint8_t>(std::clamp((value[c] - p + 1) >> 1, 0, 127));
+      const int diff = (q[c] << 1 | p) - value[c];
+      error += diff * diff;
+    }
+    if (error < bestError) {
+      bestError = error;
+      std::memcpy(color, q, 4);
+      pbit = static_cast<uint8_t>(p);
+    }
+  }
+}
+
+void bc7Palette(const Bc7Endpoints &endpoints, uint8_t palette[64]) {
+  for (int c = 0; c < 4; ++c) {
+    const int a = endpoints.color[0][c] << 1 | endpoints.pbit[0];
+    const int b = endpoints.color[1][c] << 1 | endpoints.pbit[1];
+    for (int i = 0; i < 16; ++i) {
+      const int w = BC7_WEIGHTS[i];
+      palette[i * 4 + c] =
+          static_cast<uint8_t>(((64 - w) * a + w * b + 32) >> 6);
+    }
+  }
+}
+
+// 画素ごとに RGBA の二乗誤差が最小のインデックスを選ぶ
+Indices bc7Indices(const uint8_t *pixels, const uint8_t palette[64]) {
+  Indices result;
+  for (uint32_t i = 0; i < BLOCK_PIXELS; ++i) {
+    uint32_t best = std::numeric_limits<uint32_t>::max();
+    uint32_t index = 0;
+    for (uint32_t j = 0; j < 16; ++j) {
+      uint32_t d = 0;
+      for (int c = 0; c < 4; ++c) {
+        const int diff = pixels[i * 4 + c] - palette[j * 4 + c];
+        d += diff * diff;
+      }
+      if (d < best) {
+        best = d;
+        index = j;
+      }
+    }
+    result.bits |= uint64_t(index) << (i * 4);
+    result.error += best;
+  }
+  return result;
+}
+
+// RGBA の主成分の方向で一番離れた2画素を端点にする
+void bc7PrincipalEndpoints(const uint8_t *pixels, int e0[4], int e1[4]) {
+  float mean[4] = {};
+  int minValue[4] = {255, 255, 255, 255};
+  int maxValue[4] = {};
+  for (uint32_t i = 0; i < BLOCK_PIXELS; ++i) {
+    for (int c = 0; c < 4; ++c) {
+      mean[c] += pixels[i * 4 + c];
+      minValue[c] = std::min<int>(minValue[c], pixels[i * 4 + c]);
+      maxValue[c] = std::max<int>(maxValue[c], pixels[i * 4 + c]);
+    }
+  }
+  for (auto &m : mean) {
+    m /= BLOCK_PIXELS;
+  }
+  float cov[4][4] = {};
+  for (uint32_t i = 0; i < BLOCK_PIXELS; ++i) {
+    float d[4];
+    for (int c = 0; c < 4; ++c) {
+      d[c] = pixels[i * 4 + c] - mean[c];
+    }
+    for (int r = 0; r < 4; ++r) {
+      for (int c = 0; c < 4; ++c) {
+        cov[r][c] += d[r] * d[c];
+      }
+    }
+  }
+  // べき乗法。初期値は範囲の対角線にする。
+  float axis[4];
+  for (int c = 0; c < 4; ++c) {
+    axis[c] = float(maxValue[c] - minValue[c]);
+  }
+  for (int iteration = 0; iteration < 4; ++iteration) {
+    float next[4] = {};
+    float norm = 0.0f;
+    for (int r = 0; r < 4; ++r) {
+      for (int c = 0; c < 4; ++c) {
+        next[r] += cov[r][c] * axis[c];
+      }
+      norm = std::max(norm, std::abs(next[r]));
+    }
+    if (norm == 0.0f) {
+      break;
+    }
+    for (int c = 0; c < 4; ++c) {
+      axis[c] = next[c] / norm;
+    }
+  }
+
+  uint32_t lowest = 0;
+  uint32_t highest = 0;
+  float minDot = std::numeric_limits<float>::max();
+  float maxDot = std::numeric_limits<float>::lowest();
+  for (uint32_t i = 0; i < BLOCK_PIXELS; ++i) {
+    float dot = 0.0f;
+    for (int c = 0; c < 4; ++c) {
+      dot += pixels[i * 4 + c] * axis[c];
+    }
+    if (dot < minDot) {
+      minDot = dot;
+      lowest = i;
+    }
+    if (dot > maxDot) {
+      maxDot = dot;
+      highest = i;
+    }
+  }
+  for (int c = 0; c < 4; ++c) {
+    e0[c] = pixels[lowest * 4 + c];
+    e1[c] = pixels[highest * 4 + c];
+  }
+}
+
+// 選んだインデックスのもとで二乗誤差が最小になる端点（8 bit）を求める。
+// 解けなければ false。
+bool refineBc7Endpoints(const uint8_t *pixels, uint64_t indices, int e0[4],
+                        int e1[4]) {
+  float aa = 0.0f;
+  float ab = 0.0f;
+  float bb = 0.0f;
+  float ax[4] = {};
+  float bx[4] = {};
+  for (uint32_t i = 0; i < BLOCK_PIXELS; ++i) {
+    const float b = BC7_WEIGHTS[(indices >> (i * 4)) & 15] / 64.0f;
+    const float a = 1.0f - b;
+    aa += a * a;
+    ab += a * b;
+    bb += b * b;
+    for (int c = 0; c < 4; ++c) {
+      ax[c] += a * pixels[i * 4 + c];
+      bx[c] += b * pixels[i * 4 + c];
+    }
+  }
+  const float det = aa * bb - ab * ab;
+  if (std::abs(det) < 1e-4f) {
+    return false;
+  }
+  for (int c = 0; c < 4; ++c) {
+    e0[c] = std::clamp(
+        static_cast<int>(std::lround((bb * ax[c] - ab * bx[c]) / det)), 0, 255);
+    e1[c] = std::clamp(
+        static_cast<int>(std::lround((aa * bx[c] - ab * ax[c]) / det)), 0, 255);
+  }
+  return true;
+}
+
+// 8 bit の端点を丸めてインデックスを選ぶ
+Indices bc7Fit(const uint8_t *pixels, const int e0[4], const int e1[4],
+               Bc7Endpoints &endpoints) {
+  quantizeBc7Endpoint(e0, endpoints.color[0], endpoints.pbit[0]);
+  quantizeBc7Endpoint(e1, endpoints.color[1], endpoints.pbit[1]);
+  uint8_t palette[64];
+  bc7Palette(endpoints, palette);
+  return bc7Indices(pixels, palette);
+}
+
+// value の下位 count ビットを bit ビット目から書く
+void putBits(uint8_t *out, uint32_t &bit, uint32_t value, uint32_t count) {
+  for (uint32_t i = 0; i < count; ++i, ++bit) {
+    out[bit / 8] |= static_cast<uint8_t>(((value >> i) & 1) << (bit % 8));
+  }
+}
+
+uint32_t getBits(const uint8_t *block, uint32_t &bit, uint32_t count) {
+  uint32_t value = 0;
+  for (uint32_t i = 0; i < count; ++i, ++bit) {
+    value |= uint32_t((block[bit / 8] >> (bit % 8)) & 1) << i;
+  }
+  return value;
+}
+
+// モード 6 のブロック（16 バイト）
+void encodeBc7Block(const uint8_t *pixels, uint8_t *out) {
+  int e0[4];
+  int e1[4];
+  bc7PrincipalEndpoints(pixels, e0, e1);
+  Bc7Endpoints endpoints;
+  auto indices = bc7Fit(pixels, e0, e1, endpoints);
+  if (refineBc7Endpoints(pixels, indices.bits, e0, e1)) {
+    Bc7Endpoints refinedEndpoints;
+    const auto refined = bc7Fit(pixels, e0, e1, refinedEndpoints);
+    if (refined.error < indices.error) {
+      endpoints = refinedEndpoints;
+      indices = refined;
+    }
+  }
+  // 画素 0 のインデックスは最上位ビットを省くので、立っていれば端点を
+  // 入れ替えてインデックスを反転する
+  if ((indices.bits & 8) != 0) {
+    std::swap(endpoints.color[0], endpoints.color[1]);
+    std::swap(endpoints.pbit[0], endpoints.pbit[1]);
+    indices.bits = ~indices.bits;
+  }
+
+  std::memset(out, 0, 16);
+  uint32_t bit = 0;
+  putBits(out, bit, 1u << BC7_MODE6, BC7_MODE6 + 1);
+  for (int c = 0; c < 4; ++c) {
+    putBits(out, bit, endpoints.color[0][c], 7);
+    putBits(out, bit, endpoints.color[1][c], 7);
+  }
+  putBits(out, bit, endpoints.pbit[0], 1);
+  putBits(out, bit, endpoints.pbit[1], 1);
+  putBits(out, bit, static_cast<uint32_t>(indices.bits & 7), 3);
+  for (uint32_t i = 1; i < BLOCK_PIXELS; ++i) {
+    putBits(out, bit, static_cast<uint32_t>(indices.bits >> (i * 4)) & 15, 4);
+  }
+}
+
+// ---- BC7 の展開（全モード） ----
+
+struct Bc7Mode {
+  uint8_t subsets;
+  uint8_t partitionBits;
+  uint8_t rotationBits;
+  uint8_t indexSelectionBits;
+  uint8_t colorBits;
+  uint8_t alphaBits;
+  // 端点ごとの P ビットか、サブセットで共有する P ビットか
+  uint8_t endpointPBits;
+  uint8_t sharedPBits;
+  uint8_t indexBits;
+  uint8_t secondaryIndexBits;
+};
+
+constexpr Bc7Mode BC7_MODES[8] = {
+    {3, 4, 0, 0, 4, 0, 1, 0, 3, 0}, {2, 6, 0, 0, 6, 0, 0, 1, 3, 0},
+    {3, 6, 0, 0, 5, 0, 0, 0, 2, 0}, {2, 6, 0, 0, 7, 0, 1, 0, 2, 0},
+    {1, 0, 2, 1, 5, 6, 0, 0, 2, 3}, {1, 0, 2, 0, 7, 8, 0, 0, 2, 2},
+    {1, 0, 0, 0, 7, 7, 1, 0, 4, 0}, {2, 6, 0, 0, 5, 5, 1, 0, 2, 0},
+};
+
+constexpr int BC7_WEIGHTS2[4] = {0, 21, 43, 64};
+constexpr int BC7_WEIGHTS3[8] = {0, 9, 18, 27, 37, 46, 55, 64};
+
+// 2 サブセットの分け方（画素 i のビットが立っていればサブセット 1）
+constexpr uint16_t BC7_PARTITIONS2[64] = {
+    0xcccc, 0x8888, 0xeeee, 0xecc8, 0xc880, 0xfeec, 0xfec8, 0xec80,
+    0xc800, 0xffec, 0xfe80, 0xe800, 0xffe8, 0xff00, 0xfff0, 0xf000,
+    0xf710, 0x008e, 0x7100, 0x08ce, 0x008c, 0x7310, 0x3100, 0x8cce,
+    0x088c, 0x3110, 0x6666, 0x366c, 0x17e8, 0x0ff0, 0x718e, 0x399c,
+    0xaaaa, 0xf0f0, 0x5a5a, 0x33cc, 0x3c3c, 0x55aa, 0x9696, 0xa55a,
+    0x73ce, 0x13c8, 0x324c, 0x3bdc, 0x6996, 0xc33c, 0x9966, 0x0660,
+    0x0272, 0x04e4, 0x4e40, 0x2720, 0xc936, 0x936c, 0x39c6, 0x639c,
+    0x9336, 0x9cc6, 0x817e, 0xe718, 0xccf0, 0x0fcc, 0x7744, 0xee22,
+};
+// 3 サブセットの分け方（画素 i のサブセットを 2i ビット目から 2 ビット）
+constexpr uint32_t BC7_PARTITIONS3[64] = {
+    0xaa685050, 0x6a5a5040, 0x5a5a4200, 0x5450a0a8, 0xa5a50000, 0xa0a05050,
+    0x5555a0a0, 0x5a5a5050, 0xaa550000, 0xaa555500, 0xaaaa5500, 0x90909090,
+    0x94949494, 0xa4a4a4a4, 0xa9a59450, 0x2a0a4250, 0xa5945040, 0x0a425054,
+    0xa5a5a500, 0x55a0a0a0, 0xa8a85454, 0x6a6a4040, 0xa4a45000, 0x1a1a0500,
+    0x0050a4a4, 0xaaa59090, 0x14696914, 0x69691400, 0xa08585a0, 0xaa821414,
+    0x50a4a450, 0x6a5a0200, 0xa9a58000, 0x5090a0a8, 0xa8a09050, 0x24242424,
+    0x00aa5500, 0x24924924, 0x24499224, 0x50a50a50, 0x500aa550, 0xaaaa4444,
+    0x66660000, 0xa5a0a5a0, 0x50a050a0, 0x69286928, 0x44aaaa44, 0x66666600,
+    0xaa444444, 0x54a854a8, 0x95809580, 0x96969600, 0xa85454a8, 0x80959580,
+    0xaa141414, 0x96960000, 0xaaaa1414, 0xa05050a0, 0xa0a5a5a0, 0x96000000,
+    0x40804080, 0xa9a8a9a8, 0xaaaaaa44, 0x2a4a5254,
+};
+// サブセット 1, 2 のアンカー画素（インデックスの最上位ビットを省く画素）
+constexpr uint8_t BC7_ANCHORS2[64] = {
+    15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,
+    15, 2,  8,  2,  2,  8,  8,  15, 2,  8,  2,  2,  8,  8,  2,  2,
+    15, 15, 6,  8,  2,  8,  15, 15, 2,  8,  2,  2,  2,  15, 15, 6,
+    6,  2,  6,  8,  15, 15, 2,  2,  15, 15, 15, 15, 15, 2,  2,  15,
+};
+constexpr uint8_t BC7_ANCHORS3_1[64] = {
+    3,  3,  15, 15, 8,  3,  15, 15, 8,  8,  6,  6,  6,  5,  3,  3,
+    3,  3,  8,  15, 3,  3,  6,  10, 5,  8,  8,  6,  8,  5,  15, 15,
+    8,  15, 3,  5,  6,  10, 8,  15, 15, 3,  15, 5,  15, 15, 15, 15,
+    3,  15, 5,  5,  5,  8,  5,  10, 5,  10, 8,  13, 15, 12, 3,  3,
+};
+constexpr uint8_t BC7_ANCHORS3_2[64] = {
+    15, 8,  8,  3,  15, 15, 3,  8,  15, 15, 15, 15, 15, 15, 15, 8,
+    15, 8,  15, 3,  15, 8,  15, 8,  3,  15, 6,  10, 15, 15, 10, 8,
+    15, 3,  15, 10, 10, 8,  9,  10, 6,  15, 8,  15, 3,  6,  6,  8,
+    15, 3,  15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 3,  15, 15, 8,
+};
+
+const int *bc7Weights(uint32_t bits) {
+  return bits == 2 ? BC7_WEIGHTS2 : bits == 3 ? BC7_WEIGHTS3 : BC7_WEIGHTS;
+}
+
+// 画素 pixel のサブセットと、それがアンカー画素か
+uint32_t bc7Subset(const Bc7Mode &mode, uint32_t partition, uint32_t pixel,
+                   bool &anchor) {
+  switch (mode.subsets) {
+  case 2: {
+    const uint32_t subset = (BC7_PARTITIONS2[partition] >> pixel) & 1;
+    anchor = pixel == 0 || pixel == BC7_ANCHORS2[partition];
+    return subset;
+  }
+  case 3: {
+    const uint32_t subset = (BC7_PARTITIONS3[partition] >> (pixel * 2)) & 3;
+    anchor = pixel == 0 || pixel == BC7_ANCHORS3_1[partition] ||
+             pixel == BC7_ANCHORS3_2[partition];
+    return subset;
+  }
+  default:
+    anchor = pixel == 0;
+    return 0;
+  }
+}
+
+// bits ビットの値を上位ビットの繰り返しで 8 bit に広げる
+int expandBits(uint32_t value, uint32_t bits) {
+  value <<= 8 - bits;
+  return static_cast<int>(value | (value >> bits));
+}
+
+// 全モードに対応する。予約されたモード（先頭バイトが 0）は透明な黒にする。
+void decodeBc7Block(const uint8_t *block, uint8_t out[BLOCK_PIXELS * 4]) {
+  if (block[0] == 0) {
+    std::memset(out, 0, BLOCK_PIXELS * 4);
+    return;
+  }
+  const auto modeIndex = static_cast<uint32_t>(std::countr_zero(block[0]));
+  const Bc7Mode &mode = BC7_MODES[modeIndex];
+  uint32_t bit = modeIndex + 1;
+  const uint32_t partition = getBits(block, bit, mode.partitionBits);
+  const uint32_t rotation = getBits(block, bit, mode.rotationBits);
+  const uint32_t indexSelection =
+      getBits(block, bit, mode.indexSelectionBits);
+
+  // サブセットごとの 2 端点を、チャンネル、サブセット、端点の順に読む
+  const uint32_t endpointCount = mode.subsets * 2u;
+  uint32_t endpoints[6][4] = {};
+  for (uint32_t c = 0; c < 4; ++c) {
+    const uint32_t bits = c < 3 ? mode.colorBits : mode.alphaBits;
+    for (uint32_t e = 0; e < endpointCount; ++e) {
+      endpoints[e][c] = getBits(block, bit, bits);
+    }
+  }
+  uint32_t pbits[6] = {};
+  if (mode.endpointPBits != 0) {
+    for (uint32_t e = 0; e < endpointCount; ++e) {
+      pbits[e] = getBits(block, bit, 1);
+    }
+  } else if (mode.sharedPBits != 0) {
+    for (uint32_t s = 0; s < mode.subsets; ++s) {
+      pbits[s * 2] = pbits[s * 2 + 1] = getBits(block, bit, 1);
+    }
+  }
+  const bool hasPBit = mode.endpointPBits != 0 || mode.sharedPBits != 0;
+  int colors[6][4];
+  for (uint32_t e = 0; e < endpointCount; ++e) {
+    for (uint32_t c = 0; c < 4; ++c) {
+      uint32_t bits = c < 3 ? mode.colorBits : mode.alphaBits;
+      if (bits == 0) {
+        colors[e][c] = 255;
+        continue;
+      }
+      uint32_t value = endpoints[e][c];
+      if (hasPBit) {
+        value = value << 1 | pbits[e];
+        ++bits;
+      }
+      colors[e][c] = expandBits(value, bits);
+    }
+  }
+
+  // インデックス。アンカー画素は最上位ビットを省いて 1 ビット少ない。
+  uint32_t indices[BLOCK_PIXELS];
+  uint32_t secondary[BLOCK_PIXELS] = {};
+  uint32_t subsets[BLOCK_PIXELS];
+  for (uint32_t i = 0; i < BLOCK_PIXELS; ++i) {
+    bool anchor;
+    subsets[i] = bc7Subset(mode, partition, i, anchor);
+    indices[i] = getBits(block, bit, mode.indexBits - (anchor ? 1 : 0));
+  }
+  if (mode.secondaryIndexBits != 0) {
+    for (uint32_t i = 0; i < BLOCK_PIXELS; ++i) {
+      secondary[i] =
+          getBits(block, bit, mode.secondaryIndexBits - (i == 0 ? 1 : 0));
+    }
+  }
+
+  // モード 4, 5 は色とアルファで別のインデックスを使う（モード 4 は
+  // インデックス選択ビットで入れ替える）
+  uint32_t colorIndexBits = mode.indexBits;
+  uint32_t alphaIndexBits = mode.indexBits;
+  const uint32_t *colorIndices = indices;
+  const uint32_t *alphaIndices = indices;
+  if (mode.secondaryIndexBits != 0) {
+    alphaIndexBits = mode.secondaryIndexBits;
+    alphaIndices = secondary;
+    if (indexSelection != 0) {
+      std::swap(colorIndexBits, alphaIndexBits);
+      std::swap(colorIndices, alphaIndices);
+    }
+  }
+  const int *colorWeights = bc7Weights(colorIndexBits);
+  const int *alphaWeights = bc7Weights(alphaIndexBits);
+  for (uint32_t i = 0; i < BLOCK_PIXELS; ++i) {
+    const int *e0 = colors[subsets[i] * 2];
+    const int *e1 = colors[subsets[i] * 2 + 1];
+    uint8_t *pixel = out + i * 4;
+    for (int c = 0; c < 4; ++c) {
+      const int w = c < 3 ? colorWeights[colorIndices[i]]
+                          : alphaWeights[alphaIndices[i]];
+      pixel[c] =
+          static_cast<uint8_t>(((64 - w) * e0[c] + w * e1[c] + 32) >> 6);
+    }
+    // 回転: アルファと入れ替えていたチャンネルを戻す
+    if (rotation != 0) {
+      std::swap(pixel[3], pixel[rotation - 1]);
+    }
+  }
+}
+
+// 圧縮しない形式はブロックの符号化・復号に対応しない
+void checkSupported(TextureFormat format) {
+  if (!isBlockCompressed(format)) {
+    throw std::invalid_argument(std::string("unsupported block format ") +
+                                toString(format));
+  }
+}
+
+} // namespace
+
+std::vector<uint8_t> compressBlocks(const uint8_t *rgba, uint32_t width,
+                                    uint32_t height, TextureFormat format,
+                                    JobSystem *jobs) {
+  return compressBlocks(rgba, width, height, format, jobs, detectSimdLevel());
+}
+
+std::vector<uint8_t> compressBlocks(const uint8_t *rgba, uint32_t width,
+                                    uint32_t height, TextureFormat format,
+                                    JobSystem *jobs, SimdLevel level) {
+  checkSupported(format);
+  const uint32_t blocksX = (width + 3) / 4;
+  const uint32_t blocksY = (height + 3) / 4;
+  const uint32_t bytes = blockBytes(format);
+  std::vector<uint8_t> blocks(levelSize(format, width, height));
+
+  // ブロックの行ごとに独立なので、そのまま分けて並列にできる
+  const auto encodeRows = [&](size_t begin, size_t end) {
+    alignas(16) uint8_t pixels[BLOCK_PIXELS * 4];
+    for (size_t by = begin; by < end; ++by) {
+      for (uint32_t bx = 0; bx < blocksX; ++bx) {
+        loadBlock(rgba, width, height, bx, static_cast<uint32_t>(by), pixels);
+        uint8_t *out = &blocks[(by * blocksX + bx) * bytes];
+        switch (format) {
+        case TextureFormat::BC1:
+          encodeColorBlock(pixels, level, out);
+          break;
+        case TextureFormat::BC3:
+          encodeChannelBlock(pixels, 3, level, out);
+          encodeColorBlock(pixels, level, out + 8);
+          break;
+        case TextureFormat::BC5:
+          encodeChannelBlock(pixels, 0, level, out);
+          encodeChannelBlock(pixels, 1, level, out + 8);
+          break;
+        case TextureFormat::BC7:
+          encodeBc7Block(pixels, out);
+          break;
+        default:
+          break;
+        }
+      }
+    }
+  };
+  if (jobs != nullptr) {
+    jobs->parallelFor(blocksY, jobs->grainFor(blocksY), encodeRows);
+  } else {
+    encodeRows(0, blocksY);
+  }
+  return blocks;
+}
+
+CompressedImage compressMipChain(const uint8_t *chain, uint32_t width,
+                                 uint32_t height, uint32_t levelCount,
+                                 TextureFormat format, bool sRGB,
+                                 JobSystem *jobs) {
+  checkSupported(format);
+  const auto source = mipChainLayout(TextureFormat::RGBA8, width, height,
+                                     levelCount);
+  const auto target = mipChainLayout(format, width, height, levelCount);
+  CompressedImage image{.format = format,
+                        .sRGB = sRGB && format != TextureFormat::BC5,
+                        .width = width,
+                        .height = height,
+                        .levelCount = levelCount,
+                        .data = {}};
+  image.data.resize(target.back().offset + target.back().size);
+  for (uint32_t i = 0; i < levelCount; ++i) {
+    const auto blocks = compressBlocks(chain + source[i].offset,
+                                       source[i].width, source[i].height,
+                                       format, jobs);
+    std::copy(blocks.begin(), blocks.end(),
+              image.data.begin() + target[i].offset);
+  }
+  return image;
+}
+
+std::vector<uint8_t> decompressBlocks(const uint8_t *blocks, uint32_t width,
+                                      uint32_t height, TextureFormat format) {
+  checkSupported(format);
+  const uint32_t blocksX = (width + 3) / 4;
+  const uint32_t blocksY = (height + 3) / 4;
+  const uint32_t bytes = blockBytes(format);
+  std::vector<uint8_t> rgba(size_t(width) * height * 4);
+  uint8_t pixels[BLOCK_PIXELS * 4];
+  for (uint32_t by = 0; by < blocksY; ++by) {
+    for (uint32_t bx = 0; bx < blocksX; ++bx) {
+      const uint8_t *block = blocks + (size_t(by) * blocksX + bx) * bytes;
+      switch (format) {
+      case TextureFormat::BC1:
+        decodeColorBlock(block, false, pixels);
+        break;
+      case TextureFormat::BC3:
+        decodeColorBlock(block + 8, true, pixels);
+        decodeChannelBlock(block, 3, pixels);
+        break;
+      case TextureFormat::BC5:
+        for (uint32_t i = 0; i < BLOCK_PIXELS; ++i) {
+          pixels[i * 4 + 2] = 0;
+          pixels[i * 4 + 3] = 255;
+        }
+        decodeChannelBlock(block, 0, pixels);
+        decodeChannelBlock(block + 8, 1, pixels);
+        break;
+      case TextureFormat::BC7:
+        decodeBc7Block(block, pixels);
+        break;
+      default:
+        break;
+      }
+      // 画像の外にはみ出した画素は捨てる
+      for (uint32_t y = 0; y < 4 && by * 4 + y < height; ++y) {
+        for (uint32_t x = 0; x < 4 && bx * 4 + x < width; ++x) {
+          std::memcpy(&rgba[((by * 4 + y) * size_t(width) + bx * 4 + x) * 4],
+                      pixels + (y * 4 + x) * 4, 4);
+        }
+      }
+    }
+  }
+  return rgba;
+}
+
+std::vector<uint8_t> decompressMipChain(const CompressedImage &image) {
+  const auto source = mipChainLayout(image.format, image.width, image.height,
+                                     image.levelCount);
+  const auto target = mipChainLayout(TextureFormat::RGBA8, image.width,
+                                     image.height, image.levelCount);
+  std::vector<uint8_t> chain(target.back().offset + target.back().size);
+  for (uint32_t i = 0; i < image.levelCount; ++i) {
+    const auto rgba =
+        decompressBlocks(&image.data[source[i].offset], source[i].width,
+                         source[i].height, image.format);
+    std::copy(rgba.begin(), rgba.end(), chain.begin() + target[i].offset);
+  }
+  return chain;
+}
+
+} // namespace b3
@@ -0,0 +1,49 @@
+#ifndef __BCN_HPP__
+#define __BCN_HPP__
+
+#include "b3/simd.hpp"
+#include "b3/texture_format.hpp"
+
+#include <cstdint>
+#include <vector>
+
+namespace b3 {
+
+class JobSystem;
+
+// RGBA8 の画像を 4x4 画素のブロックごとに BC1/BC3/BC5/BC7 に圧縮する。
+//
+// - 端点は 16 画素の主成分の方向で一番離れた2画素から選び、選んだ
+//   インデックスで最小二乗法により1回だけ調整する（誤差が減るときだけ）。
+// - インデックスの選択（パレットとの距離の比較）は整数で行い、SIMD でも
+//   スカラーと同じ結果になる。
+// - jobs を渡すとブロックの行を並列に圧縮する。
+// - 4 で割り切れない大きさは、端の画素を繰り返して埋める。
+// - BC1 はアルファを無視し（常に 4 色モード）、BC5 は R と G だけを使う。
+//   sRGB でも色空間の変換はしない（GPU が展開後に変換する）。
+// - BC7 はモード 6（1 サブセット、RGBA の端点、4 bit のインデックス）だけを
+//   使う。インデックスの選択はスカラーのみ。
+std::vector<uint8_t> compressBlocks(const uint8_t *rgba, uint32_t width,
+                                    uint32_t height, TextureFormat format,
+                                    JobSystem *jobs = nullptr);
+std::vector<uint8_t> compressBlocks(const uint8_t *rgba, uint32_t width,
+                                    uint32_t height, TextureFormat format,
+                                    JobSystem *jobs, SimdLevel level);
+
+// RGBA8 のミップチェーン（mipChainLayout(width, height) の最初の
+// levelCount レベル）をレベルごとに圧縮する
+CompressedImage compressMipChain(const uint8_t *chain, uint32_t width,
+                                 uint32_t height, uint32_t levelCount,
+                                 TextureFormat format, bool sRGB,
+                                 JobSystem *jobs = nullptr);
+
+// BC1/BC3/BC5/BC7 を RGBA8 に展開する（BC5 は B = 0, A = 255）。
+// BC7 は全モード（0-7）に対応する。
+std::vector<uint8_t> decompressBlocks(const uint8_t *blocks, uint32_t width,
+                                      uint32_t height, TextureFormat format);
+// 全レベルを展開して RGBA8 のミップチェーンにする
+std::vector<uint8_t> decompressMipChain(const CompressedImage &image);
+
+} // namespace b3
+
+#endif
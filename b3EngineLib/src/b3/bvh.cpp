@@ -0,0 +1,337 @@
+#include "bvh.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+namespace b3 {
+
+void Bvh::build(const BoundingSphereArray &spheres) {
+  const auto n = static_cast<uint32_t>(spheres.size());
+  m_nodes.clear();
+  m_maxDepth = 0;
+  m_buildItems.resize(n);
+  for (uint32_t i = 0; i < n; ++i) {
+    const auto sphere = spheres.get(i);
+    m_buildItems[i] = {Aabb::fromSphere(sphere), sphere.center, i};
+  }
+  if (n > 0) {
+    // 葉1つあたり MAX_LEAF_SIZE 個なら、ノード数は 2n / MAX_LEAF_SIZE 程度
+    m_nodes.reserve(2 * (n / MAX_LEAF_SIZE + 1));
+    buildNode(0, n, NO_PARENT, 0);
+  }
+
+  m_items.resize(n);
+  m_itemSlot.resize(n);
+  m_spheres.resize(n);
+  for (uint32_t k = 0; k < n; ++k) {
+    m_items[k] = m_buildItems[k].index;
+    m_itemSlot[m_items[k]] = k;
+    m_spheres.set(k, spheres.get(m_items[k]));
+  }
+  m_slotLeaf.resize(n);
+  for (uint32_t i = 0; i < m_nodes.size(); ++i) {
+    if (m_nodes[i].isLeaf()) {
+      std::fill_n(m_slotLeaf.begin() + m_nodes[i].begin, m_nodes[i].count, i);
+    }
+  }
+  m_nodeDirty.assign(m_nodes.size(), 0);
+  m_source = spheres;
+  m_lastMovedCount = n;
+
+  m_weightedArea = 0.0;
+  for (const auto &node : m_nodes) {
+    m_weightedArea += weightedArea(node);
+  }
+  m_buildCost = sahCost();
+  m_refitsSinceBuild = 0;
+  ++m_stats.builds;
+}
+
+uint32_t Bvh::buildNode(uint32_t begin, uint32_t count, uint32_t parent,
+                        uint32_t depth) {
+  m_maxDepth = std::max(m_maxDepth, depth);
+  const auto index = static_cast<uint32_t>(m_nodes.size());
+  m_nodes.push_back({.bounds = {},
+                     .begin = begin,
+                     .count = count,
+                     .right = 0,
+                     .parent = parent});
+
+  const auto first = m_buildItems.begin() + begin;
+  const auto last = first + count;
+  Aabb bounds;
+  Aabb centroidBounds;
+  for (auto it = first; it != last; ++it) {
+    bounds.expand(it->bounds);
+    centroidBounds.expand(it->centroid);
+  }
+  m_nodes[index].bounds = bounds;
+  if (count <= MAX_LEAF_SIZE) {
+    return index;
+  }
+
+  // binned SAH: 重心の広がりが最も大きい軸で BIN_COUNT 個のビンに分け、
+  // ビンの境界で分割したときのコストが最小になる位置を探す
+  const glm::vec3 centroidExtent = centroidBounds.max - centroidBounds.min;
+  int axis = 0;
+  if (centroidExtent.y > centroidExtent[axis]) {
+    axis = 1;
+  }
+  if (centroidExtent.z > centroidExtent[axis]) {
+    axis = 2;
+  }
+  const float lo = centroidBounds.min[axis];
+  const float scale =
+      centroidExtent[axis] > 0.0f ? BIN_COUNT / centroidExtent[axis] : 0.0f;
+  auto binOf = [&](const glm::vec3 &c) {
+    return std::min(BIN_COUNT - 1,
+                    static_cast<uint32_t>((c[axis] - lo) * scale));
+  };
+
+  struct Bin {
+    Aabb bounds;
+    uint32_t count = 0;
+  };
+  std::array<Bin, BIN_COUNT> bins{};
+  for (auto it = first; it != last; ++it) {
+    auto &bin = bins[binOf(it->centroid)];
+    bin.bounds.expand(it->bounds);
+    ++bin.count;
+  }
+
+  // 右から累積した面積と要素数
+  std::array<float, BIN_COUNT> rightArea{};
+  std::array<uint32_t, BIN_COUNT> rightCount{};
+  Aabb acc;
+  uint32_t accCount = 0;
+  for (uint32_t b = BIN_COUNT - 1; b > 0; --b) {
+    acc.expand(bins[b].bounds);
+    accCount += bins[b].count;
+    rightArea[b] = acc.area();
+    rightCount[b] = accCount;
+  }
+  float bestCost = std::numeric_limits<float>::max();
+  int bestSplit = -1;
+  acc = Aabb{};
+  accCount = 0;
+  for (uint32_t b = 0; b + 1 < BIN_COUNT; ++b) {
+    acc.expand(bins[b].bounds);
+    accCount += bins[b].count;
+    if (accCount == 0 || rightCount[b + 1] == 0) {
+      continue;
+    }
+    const float cost =
+        acc.area() * accCount + rightArea[b + 1] * rightCount[b + 1];
+    if (cost < bestCost) {
+      bestCost = cost;
+      bestSplit = static_cast<int>(b);
+    }
+  }
+
+  uint32_t mid = begin + count / 2;
+  if (bestSplit >= 0) {
+    auto it = std::partition(first, last, [&](const BuildItem &item) {
+      return binOf(item.centroid) <= static_cast<uint32_t>(bestSplit);
+    });
+    mid = static_cast<uint32_t>(it - m_buildItems.begin());
+  }
+  // 重心がすべて同じ位置にあるなど、分割できない場合は半分に分ける
+  if (mid == begin || mid == begin + count) {
+    mid = begin + count / 2;
+  }
+
+  buildNode(begin, mid - begin, index, depth + 1);
+  const auto right = buildNode(mid, begin + count - mid, index, depth + 1);
+  m_nodes[index].right = right;
+  return index;
+}
+
+void Bvh::refit(const BoundingSphereArray &spheres) {
+  assert(spheres.size() == m_items.size());
+  m_source = spheres;
+  for (size_t k = 0; k < m_items.size(); ++k) {
+    m_spheres.set(k, spheres.get(m_items[k]));
+  }
+  std::fill(m_nodeDirty.begin(), m_nodeDirty.end(), 1);
+  refitDirty();
+  ++m_refitsSinceBuild;
+  ++m_stats.refits;
+}
+
+void Bvh::markDirty(uint32_t nodeIndex) {
+  // 親が dirty ならその祖先もすべて dirty なので、そこで止める
+  while (nodeIndex != NO_PARENT && !m_nodeDirty[nodeIndex]) {
+    m_nodeDirty[nodeIndex] = 1;
+    nodeIndex = m_nodes[nodeIndex].parent;
+  }
+}
+
+void Bvh::refitDirty() {
+  // 子は必ず親より後ろにあるので、後ろから更新すれば子が先に確定する
+  for (size_t i = m_nodes.size(); i-- > 0;) {
+    if (!m_nodeDirty[i]) {
+      continue;
+    }
+    m_nodeDirty[i] = 0;
+    auto &node = m_nodes[i];
+    m_weightedArea -= weightedArea(node);
+    if (node.isLeaf()) {
+      Aabb bounds;
+      for (uint32_t k = node.begin; k < node.begin + node.count; ++k) {
+        bounds.expand(Aabb::fromSphere(m_spheres.get(k)));
+      }
+      node.bounds = bounds;
+    } else {
+      node.bounds = m_nodes[i + 1].bounds;
+      node.bounds.expand(m_nodes[node.right].bounds);
+    }
+    m_weightedArea += weightedArea(node);
+  }
+}
+
+void Bvh::update(const BoundingSphereArray &spheres) {
+  if (spheres.size() != m_items.size() || m_nodes.empty()) {
+    build(spheres);
+    return;
+  }
+
+  // 前回から動いた要素を探して、その葉から根までを更新対象にする。
+  // 大半の要素が止まっている前提で、まずブロック単位で比較する。
+  constexpr size_t BLOCK = 64;
+  auto sameRange = [](const std::vector<float> &a,
+                      const std::vector<float> &b, size_t begin,
+                      size_t count) {
+    return std::memcmp(a.data() + begin, b.data() + begin,
+                       count * sizeof(float)) == 0;
+  };
+  size_t moved = 0;
+  const size_t n = spheres.size();
+  for (size_t block = 0; block < n; block += BLOCK) {
+    const size_t count = std::min(BLOCK, n - block);
+    if (sameRange(spheres.cx, m_source.cx, block, count) &&
+        sameRange(spheres.cy, m_source.cy, block, count) &&
+        sameRange(spheres.cz, m_source.cz, block, count) &&
+        sameRange(spheres.radius, m_source.radius, block, count)) {
+      continue;
+    }
+    for (size_t i = block; i < block + count; ++i) {
+      const auto sphere = spheres.get(i);
+      const auto old = m_source.get(i);
+      if (sphere.center == old.center && sphere.radius == old.radius) {
+        continue;
+      }
+      m_source.set(i, sphere);
+      const auto slot = m_itemSlot[i];
+      m_spheres.set(slot, sphere);
+      markDirty(m_slotLeaf[slot]);
+      ++moved;
+    }
+  }
+  if (moved == 0) {
+    m_lastMovedCount = 0;
+    return;
+  }
+  refitDirty();
+  ++m_refitsSinceBuild;
+  ++m_stats.refits;
+
+  if (m_refitsSinceBuild >= m_rebuildInterval ||
+      sahCost() > m_buildCost * m_rebuildThreshold) {
+    build(spheres);
+  }
+  m_lastMovedCount = moved;
+}
+
+float Bvh::sahCost() const {
+  if (m_nodes.empty()) {
+    return 0.0f;
+  }
+  const float rootArea = m_nodes.front().bounds.area();
+  if (rootArea <= 0.0f) {
+    return 0.0f;
+  }
+  return static_cast<float>(m_weightedArea / rootArea);
+}
+
+size_t Bvh::cullFrustum(const FrustumPlanes &planes,
+                        std::vector<uint32_t> &visibleIndices) const {
+  visibleIndices.clear();
+  if (m_nodes.empty()) {
+    return 0;
+  }
+
+  constexpr uint32_t ALL_PLANES = (1u << 6) - 1;
+  // 判定が済んでいない平面をビットで持って、部分木に引き継ぐ
+  struct Entry {
+    uint32_t node;
+    uint32_t planeMask;
+  };
+  // 深さ優先で辿るので、スタックは木の深さ + 1 あれば足りる
+  std::vector<Entry> stack(m_maxDepth + 2);
+  size_t top = 0;
+  stack[top++] = {0, ALL_PLANES};
+  size_t visited = 0;
+
+  while (top > 0) {
+    auto [nodeIndex, mask] = stack[--top];
+    const auto &node = m_nodes[nodeIndex];
+    ++visited;
+
+    const glm::vec3 c = node.bounds.center();
+    const glm::vec3 e = node.bounds.extent();
+    bool outside = false;
+    for (int p = 0; p < 6; ++p) {
+      if ((mask & (1u << p)) == 0) {
+        continue;
+      }
+      const float dist = planes.nx[p] * c.x + planes.ny[p] * c.y +
+                         planes.nz[p] * c.z + planes.d[p];
+      const float r = std::abs(planes.nx[p]) * e.x +
+                      std::abs(planes.ny[p]) * e.y +
+                      std::abs(planes.nz[p]) * e.z;
+      if (dist < -r) {
+        // 完全に外側
+        outside = true;
+        break;
+      }
+      if (dist >= r) {
+        // この平面に対しては完全に内側なので、子では判定しない
+        mask &= ~(1u << p);
+      }
+    }
+    if (outside) {
+      continue;
+    }
+
+    if (mask == 0) {
+      // 完全に内側: 部分木の要素をすべて受け入れる
+      visibleIndices.insert(visibleIndices.end(),
+                            m_items.begin() + node.begin,
+                            m_items.begin() + node.begin + node.count);
+    } else if (node.isLeaf()) {
+      for (uint32_t k = node.begin; k < node.begin + node.count; ++k) {
+        bool inside = true;
+        for (int p = 0; p < 6 && inside; ++p) {
+          if ((mask & (1u << p)) == 0) {
+            continue;
+          }
+          const float dist =
+              planes.nx[p] * m_spheres.cx[k] + planes.ny[p] * m_spheres.cy[k] +
+              planes.nz[p] * m_spheres.cz[k] + planes.d[p];
+          inside = dist >= -m_spheres.radius[k];
+        }
+        if (inside) {
+          visibleIndices.push_back(m_items[k]);
+        }
+      }
+    } else {
+      assert(top + 2 <= stack.size());
+      stack[top++] = {node.right, mask};
+      stack[top++] = {nodeIndex + 1, mask};
+    }
+  }
+  return visited;
+}
+
+} // namespace b3
@@ -0,0 +1,127 @@
+#ifndef __BVH_HPP__
+#define __BVH_HPP__
+
+#include "common.hpp"
+#include "frustum_culling.hpp"
+
+#include <vector>
+
+namespace b3 {
+
+// Bounding Sphere の配列に対する Bounding Volume Hierarchy。
+//
+// 要素は BoundingSphereArray の index で表す。
+// build() で binned SAH により木を作り、要素が動いたら refit() で
+// 木の形を変えずに境界ボックスだけを更新する。update() は動いた要素を
+// 含む葉から根までだけを更新し、refit を繰り返して木の品質（SAH コスト）
+// が落ちたら作り直す。
+//
+// Frustum の判定では、完全に内側の部分木は中身を判定せずに受け入れ、
+// 完全に外側の部分木は丸ごと捨てるので、コストは可視な要素数に比例する。
+class Bvh {
+public:
+  // 葉に入れる要素の最大数
+  static constexpr uint32_t MAX_LEAF_SIZE = 4;
+  // binned SAH のビン数
+  static constexpr uint32_t BIN_COUNT = 16;
+
+  // 木を作り直す
+  void build(const BoundingSphereArray &spheres);
+  // 木の形はそのままで、境界ボックスを更新する。
+  // 要素数は build() したときと同じであること。
+  void refit(const BoundingSphereArray &spheres);
+  // 要素数が変わっていれば build()、そうでなければ動いた要素の祖先だけを
+  // refit する。refit 後の SAH コストが build 直後の rebuildThreshold 倍を
+  // 超えたとき、または refit が rebuildInterval 回続いたときも build() する。
+  void update(const BoundingSphereArray &spheres);
+
+  // Frustum と重なる要素の index を visibleIndices に書き込む（順不同）。
+  // 判定結果は sphereInFrustum と同じ。戻り値は訪れたノード数。
+  // 木を変更しないので、複数のスレッドから同時に呼んでよい。
+  size_t cullFrustum(const FrustumPlanes &planes,
+                     std::vector<uint32_t> &visibleIndices) const;
+
+  void setRebuildThreshold(float ratio) { m_rebuildThreshold = ratio; }
+  void setRebuildInterval(uint32_t refits) { m_rebuildInterval = refits; }
+
+  size_t size() const { return m_items.size(); }
+  // 最後の update() で動いていた要素の数
+  size_t lastMovedCount() const { return m_lastMovedCount; }
+  size_t nodeCount() const { return m_nodes.size(); }
+  const Aabb &bounds() const {
+    assert(!m_nodes.empty());
+    return m_nodes.front().bounds;
+  }
+
+  // SAH コスト（ルートの表面積に対する、内部ノードの表面積の合計）
+  float sahCost() const;
+
+  struct Stats {
+    uint64_t builds = 0;
+    uint64_t refits = 0;
+  };
+  const Stats &stats() const { return m_stats; }
+
+private:
+  static constexpr uint32_t NO_PARENT = ~0u;
+
+  struct Node {
+    Aabb bounds;
+    // 部分木に含まれる要素は m_items[begin, begin + count)
+    uint32_t begin = 0;
+    uint32_t count = 0;
+    // 内部ノードの右の子（左の子は必ず自分の次）。葉では 0。
+    uint32_t right = 0;
+    uint32_t parent = NO_PARENT;
+
+    bool isLeaf() const { return right == 0; }
+  };
+
+  // 前順（親 → 左の部分木 → 右の部分木）に並べる
+  std::vector<Node> m_nodes;
+  // 木の並びに並べた要素の index
+  std::vector<uint32_t> m_items;
+  // m_items と同じ並びの Bounding Sphere（葉の判定を連続アクセスにする）
+  BoundingSphereArray m_spheres;
+  // 要素の index から m_items 上の位置
+  std::vector<uint32_t> m_itemSlot;
+  // m_items 上の位置から、それを含む葉
+  std::vector<uint32_t> m_slotLeaf;
+  // 前回の update() で受け取った Bounding Sphere（動いた要素の検出用）
+  BoundingSphereArray m_source;
+  // 境界ボックスを更新するノード
+  std::vector<uint8_t> m_nodeDirty;
+
+  // build() 中だけ使う作業領域。分割に合わせて並べ替える。
+  struct BuildItem {
+    Aabb bounds;
+    glm::vec3 centroid;
+    uint32_t index;
+  };
+  std::vector<BuildItem> m_buildItems;
+
+  float m_buildCost = 0.0f;
+  // 各ノードの表面積 × 判定コストの合計（refit のたびに差分で更新する）
+  double m_weightedArea = 0.0;
+  float m_rebuildThreshold = 1.3f;
+  uint32_t m_rebuildInterval = 240;
+  uint32_t m_refitsSinceBuild = 0;
+  uint32_t m_maxDepth = 0;
+  size_t m_lastMovedCount = 0;
+  Stats m_stats;
+
+  uint32_t buildNode(uint32_t begin, uint32_t count, uint32_t parent,
+                     uint32_t depth);
+  // 葉と、その祖先を更新対象にする
+  void markDirty(uint32_t nodeIndex);
+  // 更新対象のノードの境界ボックスを作り直す
+  void refitDirty();
+  float weightedArea(const Node &node) const {
+    // 内部ノードの判定コストを 1、要素の判定コストを 1 とする
+    return node.bounds.area() * (node.isLeaf() ? node.count : 1.0f);
+  }
+};
+
+} // namespace b3
+
+#endif
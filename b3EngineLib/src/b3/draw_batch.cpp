@@ -0,0 +1,43 @@
+#include "draw_batch.hpp"
+
+#include <cassert>
+
+namespace b3 {
+
+void DrawBatcher::build(const std::vector<uint32_t> &nodes,
+                        const std::vector<uint32_t> &meshIds,
+                        uint32_t meshCount, uint32_t firstInstance) {
+  m_batches.clear();
+  m_counts.assign(meshCount, 0);
+
+  for (const auto node : nodes) {
+    const uint32_t mesh = meshIds[node];
+    assert(mesh < meshCount || mesh == NO_MESH);
+    if (mesh != NO_MESH) {
+      ++m_counts[mesh];
+    }
+  }
+
+  // 使われているメッシュごとに描画を1つ作り、m_counts を書き込み位置にする
+  uint32_t offset = 0;
+  for (uint32_t mesh = 0; mesh < meshCount; ++mesh) {
+    const uint32_t count = m_counts[mesh];
+    if (count > 0) {
+      m_batches.push_back({.meshId = mesh,
+                           .firstInstance = firstInstance + offset,
+                           .instanceCount = count});
+    }
+    m_counts[mesh] = offset;
+    offset += count;
+  }
+
+  m_instanceNodes.resize(offset);
+  for (const auto node : nodes) {
+    const uint32_t mesh = meshIds[node];
+    if (mesh != NO_MESH) {
+      m_instanceNodes[m_counts[mesh]++] = node;
+    }
+  }
+}
+
+} // namespace b3
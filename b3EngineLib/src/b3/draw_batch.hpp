@@ -0,0 +1,47 @@
+#ifndef __DRAW_BATCH_HPP__
+#define __DRAW_BATCH_HPP__
+
+#include <cstdint>
+#include <vector>
+
+namespace b3 {
+
+// 同じメッシュを使うノードをまとめた、1回のインスタンス描画
+struct DrawBatch {
+  uint32_t meshId;
+  // インスタンスの範囲（instanceNodes() 上の位置に、バッファ上の先頭を足したもの）
+  uint32_t firstInstance;
+  uint32_t instanceCount;
+};
+
+// 描画するノードをメッシュごとにまとめ、インスタンス描画の単位に分ける。
+//
+// メッシュの id は 0 から meshCount - 1 までの連番で、計数ソートで並べるので
+// 手間はノード数 + メッシュ数に比例する。同じメッシュの中ではノードの順番を
+// 保つ。
+class DrawBatcher {
+public:
+  // 描画しないノードのメッシュの id
+  static constexpr uint32_t NO_MESH = UINT32_MAX;
+
+  // nodes の各ノードを meshIds[node] でまとめる（NO_MESH のノードは除く）。
+  // firstInstance はインスタンスのバッファ上で、この結果を置く先頭の位置。
+  void build(const std::vector<uint32_t> &nodes,
+             const std::vector<uint32_t> &meshIds, uint32_t meshCount,
+             uint32_t firstInstance = 0);
+
+  // メッシュの id の順に並べた描画
+  const std::vector<DrawBatch> &batches() const { return m_batches; }
+  // インスタンスの順に並べたノードの index
+  const std::vector<uint32_t> &instanceNodes() const { return m_instanceNodes; }
+
+private:
+  std::vector<DrawBatch> m_batches;
+  std::vector<uint32_t> m_instanceNodes;
+  // メッシュごとのインスタンス数（作業用）
+  std::vector<uint32_t> m_counts;
+};
+
+} // namespace b3
+
+#endif
@@ -1,8 +1,10 @@
 #include "engine.hpp"
 
+#include "b3/bcn.hpp"
 #include "b3/common.hpp"
 #include "b3/frustum_culling.hpp"
 #include "b3/mesh.hpp"
+#include "b3/mesh_optimizer.hpp"
 #include "b3/node.hpp"
 #include "b3/texture.hpp"
 
@@ -12,6 +14,10 @@
 #include <spdlog/sinks/stdout_color_sinks.h>
 
 #include <algorithm>
+#include <array>
+#include <cassert>
+#include <chrono>
+#include <cstring>
 #include <filesystem>
 #include <format>
 #include <fstream>
@@ -84,6 +90,7 @@ void Engine::initDevice() {
       .descriptorBindingPartiallyBound = VK_TRUE,
       .descriptorBindingVariableDescriptorCount = VK_TRUE,
       .runtimeDescriptorArray = VK_TRUE,
+      .timelineSemaphore = VK_TRUE,
   };
 
   VkPhysicalDeviceFeatures features10{
@@ -104,8 +111,13 @@ void Engine::initDevice() {
   }
   m_context.physicalDevice = phys_ret.value();
   m_msaaSamples = getMaxUsableSampleCount();
+  // BC 圧縮テクスチャ（なければ CPU で展開して RGBA8 で送る）
+  m_context.textureCompressionBC =
+      m_context.physicalDevice.enable_features_if_present(
+          VkPhysicalDeviceFeatures{.textureCompressionBC = VK_TRUE});
+  LOGI("BC texture compression: {}", m_context.textureCompressionBC);
 
-  vkb::DeviceBuilder device_builder{phys_ret.value()};
+  vkb::DeviceBuilder device_builder{m_context.physicalDevice};
   auto dev_ret = device_builder.build();
   if (!dev_ret) {
     LOGE("Failed to create Vulkan device");
@@ -123,12 +135,21 @@ void Engine::initDevice() {
       m_context.device.get_queue_index(vkb::QueueType::graphics).value();
   m_context.queue = graphics_queue_ret.value();
 
-  VkCommandPoolCreateInfo cmd_pool_info{
-      .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
-      .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
-      .queueFamilyIndex = static_cast<uint32_t>(m_context.graphicsQueueIndex)};
-  VK_CHECK(vkCreateCommandPool(m_context.device, &cmd_pool_info, nullptr,
-                               &m_context.commandPool));
+  // 転送専用のキューファミリーがあればアップロードに使い、
+  // なければグラフィックスキューで行う
+  auto transfer_queue_ret =
+      m_context.device.get_dedicated_queue(vkb::QueueType::transfer);
+  if (transfer_queue_ret) {
+    m_context.transferQueue = transfer_queue_ret.value();
+    m_context.transferQueueIndex =
+        m_context.device.get_dedicated_queue_index(vkb::QueueType::transfer)
+            .value();
+  } else {
+    m_context.transferQueue = m_context.queue;
+    m_context.transferQueueIndex = m_context.graphicsQueueIndex;
+  }
+  LOGI("upload queue family: {} (graphics {})", m_context.transferQueueIndex,
+       m_context.graphicsQueueIndex);
 
   VmaVulkanFunctions functions{
       .vkGetInstanceProcAddr = vkGetInstanceProcAddr,
@@ -143,100 +164,395 @@ void Engine::initDevice() {
       .vulkanApiVersion = VK_API_VERSION_1_3,
   };
   VK_CHECK(vmaCreateAllocator(&createInfo, &m_context.vmaAllocator));
+
+  m_context.uploader.init(m_context.device, m_context.vmaAllocator,
+                          m_context.transferQueue,
+                          static_cast<uint32_t>(m_context.transferQueueIndex),
+                          static_cast<uint32_t>(m_context.graphicsQueueIndex));
 }
 
 /**
  * Vertex Bufferの初期化
  */
 void Engine::initVertexBuffer() {
+  if (m_vertexFormat == VertexFormat::Packed &&
+      !(supportsVertexFormat(VK_FORMAT_R16G16B16A16_SNORM) &&
+        supportsVertexFormat(VK_FORMAT_R16G16_SNORM) &&
+        supportsVertexFormat(VK_FORMAT_R16G16_UNORM))) {
+    LOGW("16-bit vertex formats are not supported, using float vertices");
+    m_vertexFormat = VertexFormat::Float;
+  }
+
+  // 全メッシュが収まる大きさで共有バッファを作っておく
+  std::unordered_set<const Mesh *> uniqueMeshes;
+  uint64_t vertexCount = 0;
+  uint64_t indexCount = 0;
+  uint64_t index16Count = 0;
   for (const auto &node : m_nodes) {
     const auto &mesh = node->mesh();
-    if (!m_context.meshBufferMap.contains(mesh)) {
-      auto vertex = uploadBuffer(mesh->vertices().data(),
-                                 mesh->vertices().size() * sizeof(Vertex),
-                                 VK_BUFFER_USAGE_VERTEX_BUFFER_BIT);
-      auto index = uploadBuffer(mesh->indices().data(),
-                                mesh->indices().size() * sizeof(IndexType),
-                                VK_BUFFER_USAGE_INDEX_BUFFER_BIT);
-      MeshData meshBuffer{vertex, index};
-      m_context.meshBufferMap[mesh] = meshBuffer;
+    if (uniqueMeshes.insert(mesh.get()).second) {
+      vertexCount += mesh->numberOfVertices();
+      // LOD は三角形を 0.4 倍ずつ減らすので、全レベルでおよそ元の 2 倍
+      // （足りなければ acquireMesh() で拡張する）
+      (mesh->fitsIndex16() ? index16Count : indexCount) +=
+          mesh->numberOfIndices() * (m_meshLods ? 2 : 1);
     }
   }
-}
+  const auto streams = vertexStreamLayout(m_vertexFormat);
+  growGeometryArena(m_context.vertexArena,
+                    std::max(vertexCount, INITIAL_VERTEX_CAPACITY),
+                    streams.positionStride, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+                    streams.attributeStride);
+  growGeometryArena(m_context.indexArena,
+                    std::max(indexCount, INITIAL_INDEX_CAPACITY),
+                    sizeof(IndexType), VK_BUFFER_USAGE_INDEX_BUFFER_BIT);
+  growGeometryArena(m_context.index16Arena,
+                    std::max(index16Count, INITIAL_INDEX_CAPACITY),
+                    sizeof(uint16_t), VK_BUFFER_USAGE_INDEX_BUFFER_BIT);
 
-void Engine::initTexture() {
   for (const auto &node : m_nodes) {
-    const auto &texture = node->texture();
-    VkDeviceSize size = texture->width() * texture->height() * 4;
-    // ステージングバッファの作成
-    auto staging = createBuffer(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-                                VMA_MEMORY_USAGE_CPU_TO_GPU);
-    // 画像データのステージングバッファへのコピー
-    VK_CHECK(vmaCopyMemoryToAllocation(m_context.vmaAllocator,
-                                       texture->pixels(), staging.allocation, 0,
-                                       size));
-    VkImageCreateInfo imageInfo{
-        .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
-        .imageType = VK_IMAGE_TYPE_2D,
-        .format = texture->sRGB() ? VK_FORMAT_R8G8B8A8_SRGB
-                                  : VK_FORMAT_R8G8B8A8_UNORM,
-        .extent = {texture->width(), texture->height(), 1},
-        .mipLevels = 1,
-        .arrayLayers = 1,
-        .samples = VK_SAMPLE_COUNT_1_BIT,
-        .tiling = VK_IMAGE_TILING_OPTIMAL,
-        .usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
-        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
-        .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+    acquireMesh(node->mesh());
+  }
+  if (m_stats.meshTriangles > 0) {
+    const double triangles = double(m_stats.meshTriangles);
+    LOGI("mesh optimization: {} meshes in {:.2f} ms, ACMR {:.3f} -> {:.3f}",
+         m_stats.optimizedMeshes, m_stats.meshOptimizeMs,
+         m_stats.meshTransformedBefore / triangles,
+         m_stats.meshTransformedAfter / triangles);
+  }
+  LOGI("geometry arena: {}/{} vertices, {}/{} indices, {}/{} 16-bit indices",
+       m_context.vertexArena.allocator.used(),
+       m_context.vertexArena.allocator.capacity(),
+       m_context.indexArena.allocator.used(),
+       m_context.indexArena.allocator.capacity(),
+       m_context.index16Arena.allocator.used(),
+       m_context.index16Arena.allocator.capacity());
+  LOGI("vertex streams ({}): {} bytes of position for depth passes, {} "
+       "bytes of normal and uv",
+       toString(m_vertexFormat), streams.positionStride,
+       streams.attributeStride);
+  LOGI("16-bit indices: {}/{} meshes, {:.2f} KiB saved",
+       m_stats.index16Meshes, uniqueMeshes.size(),
+       m_stats.indexBytesSaved / 1024.0);
+  if (m_meshLods) {
+    LOGI("mesh lods: {}/{} meshes in {:.2f} ms, {} extra indices",
+         m_stats.lodMeshes, uniqueMeshes.size(), m_stats.lodMs,
+         m_stats.lodIndices);
+  }
+  if (m_vertexFormat == VertexFormat::Packed) {
+    const auto &error = m_stats.quantizationError;
+    LOGI("packed vertices: {} meshes, {:.2f} KiB saved, max error: "
+         "position {:.3g}, normal {:.3g} deg, uv {:.3g}",
+         m_stats.packedMeshes, m_stats.vertexBytesSaved / 1024.0,
+         error.position, error.normalDegrees, error.texCoord);
+  }
+}
+
+uint64_t Engine::uploadVertexStreams(uint64_t vertexOffset,
+                                     const void *vertices, size_t count) {
+  // インターリーブした頂点を、ステージングの上で位置と、法線と UV の
+  // ストリームに分ける
+  const auto streams = vertexStreamLayout(m_vertexFormat);
+  const size_t stride = streams.positionStride + streams.attributeStride;
+  const auto &arena = m_context.vertexArena;
+  const auto positionUpload = m_context.uploader.uploadBuffer(
+      arena.buffer.buffer, vertexOffset * streams.positionStride,
+      count * streams.positionStride, [&](uint8_t *mapped) {
+        copyVertexStream(vertices, count, stride, 0, streams.positionStride,
+                         mapped);
+      });
+  const auto attributeUpload = m_context.uploader.uploadBuffer(
+      arena.attributeBuffer.buffer, vertexOffset * streams.attributeStride,
+      count * streams.attributeStride, [&](uint8_t *mapped) {
+        copyVertexStream(vertices, count, stride, streams.positionStride,
+                         streams.attributeStride, mapped);
+      });
+  return std::max(positionUpload, attributeUpload);
+}
+
+void Engine::acquireMesh(const std::shared_ptr<Mesh> &mesh) {
+  const auto found = m_context.meshBufferMap.find(mesh);
+  if (found != m_context.meshBufferMap.end()) {
+    ++found->second.users;
+    return;
+  }
+
+  // 並べ替えは GPU に送るコピーに対して行い、アプリの Mesh には触らない
+  std::vector<Vertex> vertices = mesh->vertices();
+  std::vector<IndexType> indices = mesh->indices();
+  if (m_optimizeMeshes) {
+    const auto report = optimizeMesh(vertices, indices);
+    LOGD("mesh optimized: {} triangles, ACMR {:.3f} -> {:.3f}, "
+         "ATVR {:.3f} -> {:.3f}",
+         report.after.triangles, report.before.acmr, report.after.acmr,
+         report.before.atvr, report.after.atvr);
+    ++m_stats.optimizedMeshes;
+    m_stats.meshOptimizeMs += report.ms;
+    m_stats.meshTransformedBefore += report.before.transformed;
+    m_stats.meshTransformedAfter += report.after.transformed;
+    m_stats.meshTriangles += report.after.triangles;
+  }
+
+  const auto streams = vertexStreamLayout(m_vertexFormat);
+  const auto vertexOffset = allocateGeometry(
+      m_context.vertexArena, vertices.size(), streams.positionStride,
+      VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, streams.attributeStride);
+  VertexDequantization dequantization;
+  uint64_t vertexUpload;
+  if (m_vertexFormat == VertexFormat::Packed) {
+    // 16 bit に量子化して、頂点の読み込みと VRAM を半分にする
+    const auto quantized = quantizeVertices(vertices);
+    const auto &error = quantized.error;
+    LOGD("mesh quantized: {} vertices, error: position {:.3g}, "
+         "normal {:.3g} deg, uv {:.3g}",
+         vertices.size(), error.position, error.normalDegrees,
+         error.texCoord);
+    vertexUpload = uploadVertexStreams(vertexOffset, quantized.vertices.data(),
+                                       quantized.vertices.size());
+    dequantization = quantized.dequantization;
+    auto &total = m_stats.quantizationError;
+    total.position = std::max(total.position, error.position);
+    total.normalDegrees = std::max(total.normalDegrees, error.normalDegrees);
+    total.texCoord = std::max(total.texCoord, error.texCoord);
+    ++m_stats.packedMeshes;
+    m_stats.vertexBytesSaved +=
+        vertices.size() * (sizeof(Vertex) - sizeof(PackedVertex));
+  } else {
+    vertexUpload =
+        uploadVertexStreams(vertexOffset, vertices.data(), vertices.size());
+  }
+
+  // LOD は頂点を共有し、全レベルのインデックスを細かい順に 1 つの領域に
+  // 続けて置く（レベル 0 が先頭）
+  // 粗いレベルは一部の頂点しか参照しないので、数え直す
+  std::vector<uint8_t> referenced;
+  const auto countVertices = [&](const std::vector<IndexType> &lodIndices) {
+    referenced.assign(vertices.size(), 0);
+    uint32_t count = 0;
+    for (const auto index : lodIndices) {
+      count += referenced[index] == 0;
+      referenced[index] = 1;
+    }
+    return count;
+  };
+  std::vector<MeshData::Lod> lods = {
+      {.firstIndex = 0,
+       .indexCount = static_cast<uint32_t>(indices.size()),
+       .vertexCount = countVertices(indices)}};
+  std::vector<float> lodErrors = {0.f};
+  if (m_meshLods) {
+    const auto lodStart = std::chrono::steady_clock::now();
+    auto chain = buildLodChain(vertices, indices, MESH_LOD_LEVELS);
+    for (size_t level = 1; level < chain.size(); ++level) {
+      auto &lod = chain[level];
+      if (m_optimizeMeshes) {
+        lod.indices = optimizeVertexCache(lod.indices, vertices.size());
+      }
+      lods.push_back({.firstIndex = static_cast<uint32_t>(indices.size()),
+                      .indexCount = static_cast<uint32_t>(lod.indices.size()),
+                      .vertexCount = countVertices(lod.indices)});
+      lodErrors.push_back(lod.error);
+      indices.insert(indices.end(), lod.indices.begin(), lod.indices.end());
+    }
+    m_stats.lodMs += std::chrono::duration<double, std::milli>(
+                         std::chrono::steady_clock::now() - lodStart)
+                         .count();
+    if (lods.size() > 1) {
+      ++m_stats.lodMeshes;
+      m_stats.lodIndices += indices.size() - lods[0].indexCount;
+    }
+    LOGD("mesh lods: {} levels, coarsest {} triangles, error {:.3g}",
+         lods.size(), lods.back().indexCount / 3, lodErrors.back());
+  }
+
+  // 頂点数が許せばインデックスを 16 bit に詰めて、メモリと帯域を半分にする
+  const bool index16 = vertices.size() <= INDEX16_VERTEX_LIMIT;
+  const size_t indexCount = indices.size();
+  const size_t indexSize = index16 ? sizeof(uint16_t) : sizeof(IndexType);
+  auto &indexArena = index16 ? m_context.index16Arena : m_context.indexArena;
+  const auto firstIndex = allocateGeometry(
+      indexArena, indexCount, indexSize, VK_BUFFER_USAGE_INDEX_BUFFER_BIT);
+  for (auto &lod : lods) {
+    lod.firstIndex += static_cast<uint32_t>(firstIndex);
+  }
+  uint64_t indexUpload;
+  if (index16) {
+    const auto narrowed = narrowIndices(indices);
+    indexUpload = uploadToBuffer(indexArena.buffer.buffer,
+                                 firstIndex * indexSize, narrowed.data(),
+                                 indexCount * indexSize);
+    ++m_stats.index16Meshes;
+    m_stats.indexBytesSaved +=
+        indexCount * (sizeof(IndexType) - sizeof(uint16_t));
+  } else {
+    indexUpload = uploadToBuffer(indexArena.buffer.buffer,
+                                 firstIndex * indexSize, indices.data(),
+                                 indexCount * indexSize);
+  }
+
+  // 削除したメッシュの id を再利用して、id を詰めておく
+  uint32_t id;
+  if (!m_context.freeMeshIds.empty()) {
+    id = m_context.freeMeshIds.back();
+    m_context.freeMeshIds.pop_back();
+    m_context.meshes[id] = mesh;
+  } else {
+    id = static_cast<uint32_t>(m_context.meshes.size());
+    m_context.meshes.push_back(mesh);
+  }
+  m_context.meshBufferMap[mesh] = {
+      .vertexOffset = static_cast<int32_t>(vertexOffset),
+      .vertexCount = static_cast<uint32_t>(vertices.size()),
+      .dequantization = dequantization,
+      .firstIndex = static_cast<uint32_t>(firstIndex),
+      .indexCount = static_cast<uint32_t>(indexCount),
+      .indexType = index16 ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32,
+      .lods = std::move(lods),
+      .lodErrors = std::move(lodErrors),
+      .id = id,
+      .uploadValue = std::max(vertexUpload, indexUpload),
+      .users = 1,
+  };
+}
+
+void Engine::releaseMesh(const std::shared_ptr<Mesh> &mesh) {
+  const auto found = m_context.meshBufferMap.find(mesh);
+  assert(found != m_context.meshBufferMap.end());
+  assert(found->second.users > 0);
+  if (--found->second.users > 0) {
+    return;
+  }
+  const MeshData meshData = found->second;
+  m_context.meshBufferMap.erase(found);
+  // id はすぐに再利用してよい（描画中のフレームのコマンドは記録済み）
+  m_context.meshes[meshData.id] = nullptr;
+  m_context.freeMeshIds.push_back(meshData.id);
+  // 共有バッファの領域は、描画中のフレームが使い終わってから解放する
+  deferDeletion(meshData.uploadValue, [this, meshData] {
+    if (meshData.vertexCount > 0) {
+      m_context.vertexArena.allocator.free(meshData.vertexOffset);
+    }
+    if (meshData.indexCount > 0) {
+      auto &indexArena = meshData.indexType == VK_INDEX_TYPE_UINT16
+                             ? m_context.index16Arena
+                             : m_context.indexArena;
+      indexArena.allocator.free(meshData.firstIndex);
+    }
+  });
+}
+
+uint64_t Engine::allocateGeometry(GeometryArena &arena, uint64_t count,
+                                  VkDeviceSize elementSize,
+                                  VkBufferUsageFlags usage,
+                                  VkDeviceSize attributeSize) {
+  if (count == 0) {
+    // 空のメッシュは領域を持たない
+    return 0;
+  }
+  auto offset = arena.allocator.allocate(count);
+  if (offset == FreeListAllocator::INVALID_OFFSET) {
+    const auto capacity = arena.allocator.capacity();
+    growGeometryArena(arena, std::max(capacity * 2, capacity + count),
+                      elementSize, usage, attributeSize);
+    offset = arena.allocator.allocate(count);
+  }
+  assert(offset != FreeListAllocator::INVALID_OFFSET);
+  return offset;
+}
+
+void Engine::growGeometryArena(GeometryArena &arena, uint64_t capacity,
+                               VkDeviceSize elementSize,
+                               VkBufferUsageFlags usage,
+                               VkDeviceSize attributeSize) {
+  const auto oldCapacity = arena.allocator.capacity();
+  if (capacity <= oldCapacity) {
+    return;
+  }
+  LOGD("grow geometry arena: {} -> {}", oldCapacity, capacity);
+  // 描画中のフレームが古いバッファを使っているかもしれないので、キューは
+  // 待たずに、コピーが終わるまで古いバッファで描画を続ける
+  const bool retire = arena.retiredBuffer.buffer == VK_NULL_HANDLE;
+  const auto grow = [&](AllocatedBuffer &old, AllocatedBuffer &retired,
+                        VkDeviceSize size) {
+    // 拡張時に今までの内容をコピーするので、転送元にもなる。
+    // アップロード用のキューからも書き込むので、両方のキューで共有する。
+    VkBufferCreateInfo bufferInfo{
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .size = capacity * size,
+        .usage = usage | VK_BUFFER_USAGE_TRANSFER_SRC_BIT |
+                 VK_BUFFER_USAGE_TRANSFER_DST_BIT,
     };
-    VmaAllocationCreateInfo allocationCreateInfo = {
-        .flags = 0,
-        .usage = VMA_MEMORY_USAGE_AUTO,
-        .requiredFlags = 0,
+    m_context.uploader.shareBuffer(bufferInfo);
+    VmaAllocationCreateInfo allocationInfo{
+        .usage = VMA_MEMORY_USAGE_GPU_ONLY,
     };
-    VkImage textureImage;
-    VmaAllocation allocation;
-    // イメージの作成
-    VK_CHECK(vmaCreateImage(m_context.vmaAllocator, &imageInfo,
-                            &allocationCreateInfo, &textureImage, &allocation,
-                            nullptr));
-
-    // イメージを転送先に最適化する
-    transitionImageLayout(textureImage, VK_FORMAT_R8G8B8A8_SRGB,
-                          VK_IMAGE_LAYOUT_UNDEFINED,
-                          VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-    // バッファからイメージへコピーする
-    copyBufferToImage(staging.buffer, textureImage, texture->width(),
-                      texture->height());
-    // イメージをシェーダー読み込みに最適化する
-    transitionImageLayout(textureImage, VK_FORMAT_R8G8B8A8_SRGB,
-                          VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-                          VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
-    // ステージングバッファの削除
-    vmaDestroyBuffer(m_context.vmaAllocator, staging.buffer,
-                     staging.allocation);
-
-    // VkImageViewの作成
-    VkImageViewCreateInfo viewInfo{};
-    viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-    viewInfo.image = textureImage;
-    viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
-    viewInfo.format = imageInfo.format;
-    viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    viewInfo.subresourceRange.baseMipLevel = 0;
-    viewInfo.subresourceRange.levelCount = 1;
-    viewInfo.subresourceRange.baseArrayLayer = 0;
-    viewInfo.subresourceRange.layerCount = 1;
-    VkImageView imageView;
-    VK_CHECK(
-        vkCreateImageView(m_context.device, &viewInfo, nullptr, &imageView));
-    assert(imageView != VK_NULL_HANDLE);
+    AllocatedBuffer buffer;
+    VK_CHECK(vmaCreateBuffer(m_context.vmaAllocator, &bufferInfo,
+                             &allocationInfo, &buffer.buffer,
+                             &buffer.allocation, nullptr));
+    if (old.buffer != VK_NULL_HANDLE) {
+      // 記録済みのアップロードの後にコピーする
+      arena.readyValue = m_context.uploader.copyBuffer(
+          old.buffer, buffer.buffer, oldCapacity * size);
+      if (retire) {
+        // 描画で使っているバッファは retireGrownArenas() で破棄する
+        retired = old;
+      } else {
+        // 前回の拡張のコピーが終わる前にまた拡張した。間のバッファは
+        // 描画で使っていないので、コピーが終わったら破棄してよい
+        m_context.uploader.destroyAfterUpload(old.buffer, old.allocation);
+      }
+    }
+    old = buffer;
+  };
+  grow(arena.buffer, arena.retiredBuffer, elementSize);
+  if (attributeSize > 0) {
+    grow(arena.attributeBuffer, arena.retiredAttributeBuffer, attributeSize);
+  }
+  arena.allocator.grow(capacity);
+}
 
-    TextureData textureData = {.image = textureImage,
-                               .allocation = allocation,
-                               .imageView = imageView};
-    m_context.textureMap[texture] = textureData;
+void Engine::retireGrownArenas() {
+  for (auto *arena : {&m_context.vertexArena, &m_context.indexArena,
+                      &m_context.index16Arena}) {
+    if (arena->retiredBuffer.buffer == VK_NULL_HANDLE ||
+        arena->readyValue > m_uploadCompleted) {
+      continue;
+    }
+    // このフレームから新しいバッファで描画する
+    const auto buffer = arena->retiredBuffer;
+    const auto attribute = arena->retiredAttributeBuffer;
+    deferDeletion(arena->readyValue, [this, buffer, attribute] {
+      vmaDestroyBuffer(m_context.vmaAllocator, buffer.buffer,
+                       buffer.allocation);
+      vmaDestroyBuffer(m_context.vmaAllocator, attribute.buffer,
+                       attribute.allocation);
+    });
+    arena->retiredBuffer = {};
+    arena->retiredAttributeBuffer = {};
   }
+}
+
+void Engine::initTexture() {
+  for (const auto &node : m_nodes) {
+    acquireTexture(node->texture());
+  }
+  const auto &registry = m_context.textureRegistry;
+  LOGI("textures: {} unique for {} nodes ({} shared by content)",
+       registry.textureCount(), m_nodes.size(),
+       registry.stats().deduplicated);
+  LOGI("mipmaps: {} generated on GPU, {} on CPU ({:.2f} ms)",
+       m_stats.gpuMipTextures, m_stats.cpuMipTextures, m_stats.cpuMipMs);
+  LOGI("texture memory: {:.2f} MiB ({:.2f} MiB as RGBA8, {} block "
+       "compressed, {} expanded on CPU)",
+       m_stats.textureBytes / (1024.0 * 1024.0),
+       m_stats.textureRGBA8Bytes / (1024.0 * 1024.0),
+       m_stats.compressedTextures, m_stats.decompressedTextures);
+  LOGI("texture formats: {} single/dual channel", m_stats.narrowTextures);
+  LOGI("texture staging: {} decoded directly into staging, {:.2f} MiB of "
+       "CPU pixels released after upload",
+       m_stats.streamedTextures,
+       m_stats.releasedTextureBytes / (1024.0 * 1024.0));
 
   // VkSamplerの作成
   VkSamplerCreateInfo samplerInfo{};
@@ -253,11 +569,269 @@ void Engine::initTexture() {
   samplerInfo.compareEnable = VK_FALSE;
   samplerInfo.compareOp = VK_COMPARE_OP_ALWAYS;
   samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+  // 0 のままだとレベル 0 しか使われない
+  samplerInfo.minLod = 0.0f;
+  samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
 
   VK_CHECK(vkCreateSampler(m_context.device, &samplerInfo, nullptr,
                            &m_context.textureSampler));
 }
 
+static VkFormat toVkFormat(TextureFormat format, bool sRGB) {
+  switch (format) {
+  case TextureFormat::RGBA8:
+    return sRGB ? VK_FORMAT_R8G8B8A8_SRGB : VK_FORMAT_R8G8B8A8_UNORM;
+  case TextureFormat::R8:
+    return sRGB ? VK_FORMAT_R8_SRGB : VK_FORMAT_R8_UNORM;
+  case TextureFormat::RG8:
+    return sRGB ? VK_FORMAT_R8G8_SRGB : VK_FORMAT_R8G8_UNORM;
+  case TextureFormat::R16:
+    return VK_FORMAT_R16_UNORM;
+  case TextureFormat::RG16:
+    return VK_FORMAT_R16G16_UNORM;
+  case TextureFormat::BC1:
+    return sRGB ? VK_FORMAT_BC1_RGB_SRGB_BLOCK : VK_FORMAT_BC1_RGB_UNORM_BLOCK;
+  case TextureFormat::BC3:
+    return sRGB ? VK_FORMAT_BC3_SRGB_BLOCK : VK_FORMAT_BC3_UNORM_BLOCK;
+  case TextureFormat::BC5:
+    return VK_FORMAT_BC5_UNORM_BLOCK;
+  case TextureFormat::BC7:
+    return sRGB ? VK_FORMAT_BC7_SRGB_BLOCK : VK_FORMAT_BC7_UNORM_BLOCK;
+  }
+  return VK_FORMAT_UNDEFINED;
+}
+
+void Engine::acquireTexture(const std::shared_ptr<Texture> &texture) {
+  // 同じポインタか、内容が同じテクスチャがあればそのスロットを使う
+  const auto acquired = m_context.textureRegistry.acquire(texture);
+  if (!acquired.created) {
+    return;
+  }
+
+  // 1 / 2 チャンネルの形式はそのまま置く。サンプリングできなければ
+  // （R8_SRGB などは任意）RGBA8 に広げる。
+  const bool compressed = texture->isCompressed();
+  const TextureFormat pixelFormat =
+      compressed || supportsSampledFormat(
+                        toVkFormat(texture->format(), texture->sRGB()))
+          ? texture->format()
+          : TextureFormat::RGBA8;
+
+  // 画素を手放したテクスチャは、レベル 0 だけをそのままの形式で送るなら
+  // ステージングに直接デコードする（CPU 側に画素を持たない）。
+  // それ以外は読み直す。
+  const auto mipGeneration = texture->mipGeneration();
+  const bool streamed =
+      !texture->resident() && !compressed &&
+      pixelFormat == texture->format() &&
+      (mipGeneration == MipGeneration::None ||
+       (mipGeneration == MipGeneration::GpuBlit &&
+        supportsLinearBlit(toVkFormat(pixelFormat, texture->sRGB()))));
+  if (!streamed) {
+    texture->reload(&m_jobs);
+  }
+
+  TextureFormat textureFormat = pixelFormat;
+  // ミップの作り方を決める。設定済みのチェーンがあればそれを使い、
+  // 線形の blit ができないフォーマットは CPU で作る（RGBA8 になる）。
+  uint32_t mipLevels = mipLevelCount(texture->width(), texture->height());
+  uint32_t levelsInData = mipLevels;
+  const uint8_t *data = texture->pixels();
+  VkDeviceSize size =
+      levelSize(pixelFormat, texture->width(), texture->height());
+  std::vector<uint8_t> decompressed;
+  if (!compressed && pixelFormat != texture->format()) {
+    decompressed = texture->rgba8Pixels();
+    data = decompressed.data();
+  }
+  if (compressed) {
+    // 圧縮したミップチェーンはそのまま送る（blit では作れない）
+    const auto &image = texture->compressed();
+    mipLevels = levelsInData = image.levelCount;
+    if (m_context.textureCompressionBC) {
+      data = image.data.data();
+      size = image.data.size();
+    } else {
+      textureFormat = TextureFormat::RGBA8;
+      decompressed = decompressMipChain(image);
+      data = decompressed.data();
+      size = decompressed.size();
+      ++m_stats.decompressedTextures;
+    }
+  } else if (mipGeneration == MipGeneration::None) {
+    mipLevels = levelsInData = 1;
+  } else if (mipGeneration == MipGeneration::GpuBlit &&
+             !texture->hasMipChain() &&
+             supportsLinearBlit(toVkFormat(textureFormat, texture->sRGB()))) {
+    levelsInData = 1;
+    ++m_stats.gpuMipTextures;
+  } else {
+    const auto start = std::chrono::high_resolution_clock::now();
+    const auto &chain = texture->mipChain();
+    m_stats.cpuMipMs += std::chrono::duration<double, std::milli>(
+                            std::chrono::high_resolution_clock::now() - start)
+                            .count();
+    ++m_stats.cpuMipTextures;
+    textureFormat = TextureFormat::RGBA8;
+    data = chain.data();
+    size = chain.size();
+  }
+  const VkFormat format = toVkFormat(textureFormat, texture->sRGB());
+  if (isBlockCompressed(textureFormat)) {
+    ++m_stats.compressedTextures;
+  } else if (textureFormat != TextureFormat::RGBA8) {
+    ++m_stats.narrowTextures;
+  }
+  // VRAM の使用量（blit で作るレベルを含む）と、RGBA8 だった場合の量
+  const auto layout = mipChainLayout(textureFormat, texture->width(),
+                                     texture->height(), mipLevels);
+  const auto rgbaLayout = mipChainLayout(
+      TextureFormat::RGBA8, texture->width(), texture->height(), mipLevels);
+  const uint64_t textureBytes = layout.back().offset + layout.back().size;
+  const uint64_t rgbaBytes = rgbaLayout.back().offset + rgbaLayout.back().size;
+  m_stats.textureBytes += textureBytes;
+  m_stats.textureRGBA8Bytes += rgbaBytes;
+  if (textureBytes < rgbaBytes) {
+    LOGI("texture {} '{}': {} {}x{}, {:.1f} KiB ({:.1f} KiB less than RGBA8)",
+         acquired.slot, texture->source().filename, toString(textureFormat),
+         texture->width(), texture->height(), textureBytes / 1024.0,
+         (rgbaBytes - textureBytes) / 1024.0);
+  }
+
+  VkImageCreateInfo imageInfo{
+      .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+      .imageType = VK_IMAGE_TYPE_2D,
+      .format = format,
+      .extent = {texture->width(), texture->height(), 1},
+      .mipLevels = mipLevels,
+      .arrayLayers = 1,
+      .samples = VK_SAMPLE_COUNT_1_BIT,
+      .tiling = VK_IMAGE_TILING_OPTIMAL,
+      // blit で作るレベルはレベル 0 から順に読み出す
+      .usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT |
+               (levelsInData < mipLevels ? VK_IMAGE_USAGE_TRANSFER_SRC_BIT
+                                         : VkImageUsageFlags{0}),
+      .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+      .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+  };
+  VmaAllocationCreateInfo allocationCreateInfo = {
+      .flags = 0,
+      .usage = VMA_MEMORY_USAGE_AUTO,
+      .requiredFlags = 0,
+  };
+  VkImage textureImage;
+  VmaAllocation allocation;
+  // イメージの作成
+  VK_CHECK(vmaCreateImage(m_context.vmaAllocator, &imageInfo,
+                          &allocationCreateInfo, &textureImage, &allocation,
+                          nullptr));
+
+  // 画像データをステージングのリング経由でコピーし、
+  // シェーダー読み込みに最適化する（submit はまとめて行う）
+  uint64_t uploadValue;
+  try {
+    if (streamed) {
+      uploadValue = m_context.uploader.uploadImage(
+          textureImage, textureFormat, texture->width(), texture->height(),
+          mipLevels, levelsInData, size,
+          [&](uint8_t *mapped) { texture->decodeInto(mapped); });
+      ++m_stats.streamedTextures;
+    } else {
+      uploadValue = m_context.uploader.uploadImage(
+          textureImage, textureFormat, texture->width(), texture->height(),
+          mipLevels, levelsInData, data, size);
+    }
+  } catch (...) {
+    vmaDestroyImage(m_context.vmaAllocator, textureImage, allocation);
+    throw;
+  }
+  // 送った内容はステージングにコピー済みなので、読み直せるなら手放してよい
+  if (!texture->keepPixels() && texture->hasSource() && texture->resident()) {
+    m_stats.releasedTextureBytes += texture->residentBytes();
+    texture->releasePixels();
+  }
+
+  // VkImageViewの作成
+  VkImageViewCreateInfo viewInfo{};
+  viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+  viewInfo.image = textureImage;
+  viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+  viewInfo.format = imageInfo.format;
+  // 1 / 2 チャンネルは輝度（とアルファ）として読めるように並べ替える。
+  // RGBA8 に広げたときと同じ値になるので、シェーダーは形式を区別しない。
+  if (channelCount(textureFormat) == 1) {
+    viewInfo.components = {VK_COMPONENT_SWIZZLE_R, VK_COMPONENT_SWIZZLE_R,
+                           VK_COMPONENT_SWIZZLE_R, VK_COMPONENT_SWIZZLE_ONE};
+  } else if (channelCount(textureFormat) == 2) {
+    viewInfo.components = {VK_COMPONENT_SWIZZLE_R, VK_COMPONENT_SWIZZLE_R,
+                           VK_COMPONENT_SWIZZLE_R, VK_COMPONENT_SWIZZLE_G};
+  }
+  viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  viewInfo.subresourceRange.baseMipLevel = 0;
+  viewInfo.subresourceRange.levelCount = mipLevels;
+  viewInfo.subresourceRange.baseArrayLayer = 0;
+  viewInfo.subresourceRange.layerCount = 1;
+  VkImageView imageView;
+  VK_CHECK(vkCreateImageView(m_context.device, &viewInfo, nullptr, &imageView));
+  assert(imageView != VK_NULL_HANDLE);
+
+  if (acquired.slot >= m_context.textures.size()) {
+    m_context.textures.resize(acquired.slot + 1);
+  }
+  m_context.textures[acquired.slot] = {.image = textureImage,
+                                       .allocation = allocation,
+                                       .imageView = imageView,
+                                       .uploadValue = uploadValue};
+  if (m_context.textureDescriptorSet != VK_NULL_HANDLE) {
+    // prepare() の後に追加したテクスチャ（空いていたスロットは描画中の
+    // フレームが使っていないので、そのまま書き換えてよい）
+    writeTextureDescriptor(acquired.slot, imageView);
+  }
+}
+
+void Engine::releaseTexture(const std::shared_ptr<Texture> &texture) {
+  const uint32_t slot = m_context.textureRegistry.release(texture);
+  if (slot == TextureRegistry::INVALID_SLOT) {
+    return;
+  }
+  const TextureData textureData = m_context.textures[slot];
+  m_context.textures[slot] = {};
+  // スロットは破棄と同時に空ける（それまでは描画中のフレームが使うかもしれない）
+  deferDeletion(textureData.uploadValue, [this, textureData, slot] {
+    vkDestroyImageView(m_context.device, textureData.imageView, nullptr);
+    vmaDestroyImage(m_context.vmaAllocator, textureData.image,
+                    textureData.allocation);
+    m_context.textureRegistry.freeSlot(slot);
+  });
+}
+
+void Engine::deferDeletion(uint64_t uploadValue,
+                           std::function<void()> destroy) {
+  m_pendingDeletions.push_back(
+      {.uploadValue = uploadValue, .destroy = std::move(destroy)});
+  ++m_stats.deferredDeletions;
+}
+
+void Engine::collectDeletions(PerFrame &per_frame) {
+  // 前回このフレームに積んだものは、フェンスを待ったのでどの描画からも
+  // 使われていない
+  for (auto &deletion : per_frame.deletions) {
+    deletion.destroy();
+    ++m_stats.executedDeletions;
+  }
+  per_frame.deletions.clear();
+
+  // アップロード中のイメージは、完了したフレームで取得のバリアを記録する。
+  // そのため、アップロードが終わったものだけをこのフレームに積む。
+  std::erase_if(m_pendingDeletions, [&](DeferredDeletion &deletion) {
+    if (deletion.uploadValue > m_uploadCompleted) {
+      return false;
+    }
+    per_frame.deletions.push_back(std::move(deletion));
+    return true;
+  });
+}
+
 /**
  * Uniform Buffer Objectの初期化
  */
@@ -265,23 +839,18 @@ void Engine::initUBO() {
   initDescriptorPool();
 
   initSceneDescriptorSetLayout();
-  initShadowDescriptorSetLayout();
 
   initSceneUB();
-  initShadowUB();
 
   initShadowSampler();
 
   allocateSceneDescriptorSet();
   bindSceneDescriptorSet();
 
-  allocateShadowDescriptorSet();
-  bindShadowDescriptorSet();
-
-  initModelDescriptorSetLayout();
-  initModelUB();
-  allocateModelDescriptorSet();
-  bindModelDescriptorSet();
+  initNodeDescriptorSetLayout();
+  initNodeBuffer();
+  allocateNodeDescriptorSet();
+  bindNodeDescriptorSet();
 
   initTextureDescriptorSetLayout();
   allocateTextureDescriptorSet();
@@ -298,8 +867,8 @@ void Engine::initDescriptorPool() {
           .descriptorCount = 2 * image_count,
       },
       {
-          .type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
-          .descriptorCount = (1 + 1) * image_count,
+          .type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+          .descriptorCount = 2 * image_count,
       },
       {
           .type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
@@ -314,7 +883,7 @@ void Engine::initDescriptorPool() {
       },
   };
   // 最大セット数
-  auto maxSets = (2 + 1) * image_count + 1;
+  auto maxSets = (1 + 1) * image_count + 1;
   VkDescriptorPoolCreateInfo poolInfo = {
       .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
       .flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT,
@@ -374,8 +943,15 @@ void Engine::initSceneDescriptorSetLayout() {
 // シーン向けのUniform Bufferの初期化
 void Engine::initSceneUB() {
   const auto image_count = m_context.swapchain.image_count;
+  // フラグメントシェーダー用の UBO は頂点シェーダー用の後ろに置くので、
+  // その位置をディスクリプタのオフセットのアラインメントに揃える
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(m_context.physicalDevice, &properties);
+  const VkDeviceSize alignment =
+      std::max<VkDeviceSize>(properties.limits.minUniformBufferOffsetAlignment,
+                             1);
   m_context.sceneUBOBufferSizeForVS =
-      minDynamicUBOAlignment(sizeof(SceneUBO_VS));
+      (sizeof(SceneUBO_VS) + alignment - 1) / alignment * alignment;
 
   for (size_t i = 0; i < image_count; ++i) {
     auto &per_frame = m_context.perFrame[i];
@@ -388,16 +964,20 @@ void Engine::initSceneUB() {
     };
 
     VmaAllocationCreateInfo allocationCreateInfo = {
-        .flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT,
+        .flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT |
+                 VMA_ALLOCATION_CREATE_MAPPED_BIT,
         .usage = VMA_MEMORY_USAGE_AUTO,
         .requiredFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
                          VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
     };
 
-    VK_CHECK(vmaCreateBuffer(m_context.vmaAllocator, &bufferCreateInfo,
-                             &allocationCreateInfo,
-                             &per_frame.sceneUniformBuffer,
-                             &per_frame.sceneUniformBufferAllocation, nullptr));
+    VmaAllocationInfo allocationInfo{};
+    VK_CHECK(vmaCreateBuffer(
+        m_context.vmaAllocator, &bufferCreateInfo, &allocationCreateInfo,
+        &per_frame.sceneUniformBuffer, &per_frame.sceneUniformBufferAllocation,
+        &allocationInfo));
+    per_frame.sceneUniformBufferMapped =
+        static_cast<uint8_t *>(allocationInfo.pMappedData);
   }
 }
 
@@ -519,17 +1099,24 @@ void Engine::bindSceneDescriptorSet() {
   } // image_count
 }
 
-// ***** モデル向けのディスクリプタセット *****
+// ***** ノード向けのディスクリプタセット *****
+// シーンとシャドウの両方のパスで、同じストレージバッファを参照する。
 
-void Engine::initModelDescriptorSetLayout() {
-  // シーンシェーダーが必要とするUniformを定義する。
-  std::vector<VkDescriptorSetLayoutBinding> uboLayoutBindings = {
+void Engine::initNodeDescriptorSetLayout() {
+  std::vector<VkDescriptorSetLayoutBinding> layoutBindings = {
       {
-          // UBO(MVPマトリックスなど)
-          .binding = 0, // バインディング位置 (`layout(binding = 0) uniform
-                        // ...`の0と一致)
-          .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
-          .descriptorCount = 1, // 配列の要素数（配列でなければ1）
+          // 全ノードの NodeData の配列
+          .binding = 0,
+          .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+          .descriptorCount = 1,
+          .stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
+          .pImmutableSamplers = nullptr,
+      },
+      {
+          // インスタンスごとのノードの index（gl_InstanceIndex で参照する）
+          .binding = 1,
+          .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+          .descriptorCount = 1,
           .stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
           .pImmutableSamplers = nullptr,
       },
@@ -537,49 +1124,66 @@ void Engine::initModelDescriptorSetLayout() {
 
   VkDescriptorSetLayoutCreateInfo layoutInfo = {
       .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
-      .bindingCount = static_cast<uint32_t>(uboLayoutBindings.size()),
-      .pBindings = uboLayoutBindings.data(),
+      .bindingCount = static_cast<uint32_t>(layoutBindings.size()),
+      .pBindings = layoutBindings.data(),
   };
   VK_CHECK(vkCreateDescriptorSetLayout(m_context.device, &layoutInfo, nullptr,
-                                       &m_context.modelDescriptorSetLayout));
+                                       &m_context.nodeDescriptorSetLayout));
 }
 
-void Engine::initModelUB() {
-  m_context.modelUBOBufferSizePerNode =
-      minDynamicUBOAlignment(sizeof(ModelUBO));
-  VkDeviceSize totalBufferSize =
-      MAX_NODES * m_context.modelUBOBufferSizePerNode;
-
+void Engine::initNodeBuffer() {
+  const auto capacity = growNodeCapacity(0, m_nodes.size());
   const auto image_count = m_context.swapchain.image_count;
   for (size_t i = 0; i < image_count; ++i) {
     auto &per_frame = m_context.perFrame[i];
+    createNodeBuffer(per_frame, capacity);
+    per_frame.nodeCapacity = capacity;
+  }
+}
 
-    VkBufferCreateInfo bufferCreateInfo = {
-        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
-        .size = totalBufferSize,
-        .usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
-    };
+void Engine::createNodeBuffer(PerFrame &per_frame, size_t capacity) {
+  // ストレージバッファなので、ノードごとのアラインメントは不要
+  VkBufferCreateInfo bufferCreateInfo = {
+      .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+      .size = capacity * sizeof(NodeData),
+      .usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+      .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+  };
 
-    VmaAllocationCreateInfo allocationCreateInfo = {
-        .flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT,
-        .usage = VMA_MEMORY_USAGE_AUTO,
-        .requiredFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-                         VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-    };
+  VmaAllocationCreateInfo allocationCreateInfo = {
+      .flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT |
+               VMA_ALLOCATION_CREATE_MAPPED_BIT,
+      .usage = VMA_MEMORY_USAGE_AUTO,
+      .requiredFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                       VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+  };
 
-    VK_CHECK(vmaCreateBuffer(m_context.vmaAllocator, &bufferCreateInfo,
-                             &allocationCreateInfo,
-                             &per_frame.modelUniformBuffer,
-                             &per_frame.modelUniformBufferAllocation, nullptr));
-  }
+  VmaAllocationInfo allocationInfo{};
+  VK_CHECK(vmaCreateBuffer(m_context.vmaAllocator, &bufferCreateInfo,
+                           &allocationCreateInfo, &per_frame.nodeBuffer,
+                           &per_frame.nodeBufferAllocation, &allocationInfo));
+  per_frame.nodeBufferMapped =
+      static_cast<NodeData *>(allocationInfo.pMappedData);
+
+  // シーンとシャドウのインスタンスは、それぞれ最大でノード数だけある
+  VkBufferCreateInfo instanceCreateInfo = {
+      .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+      .size = 2 * capacity * sizeof(uint32_t),
+      .usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+      .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+  };
+  VK_CHECK(vmaCreateBuffer(m_context.vmaAllocator, &instanceCreateInfo,
+                           &allocationCreateInfo, &per_frame.instanceBuffer,
+                           &per_frame.instanceBufferAllocation,
+                           &allocationInfo));
+  per_frame.instanceBufferMapped =
+      static_cast<uint32_t *>(allocationInfo.pMappedData);
 }
 
-void Engine::allocateModelDescriptorSet() {
-  // シーンのためのDescriptor Setを作成する
+void Engine::allocateNodeDescriptorSet() {
   const auto image_count = m_context.swapchain.image_count;
-  std::vector<VkDescriptorSetLayout> layouts(
-      image_count, m_context.modelDescriptorSetLayout);
+  std::vector<VkDescriptorSetLayout> layouts(image_count,
+                                             m_context.nodeDescriptorSetLayout);
 
   VkDescriptorSetAllocateInfo allocInfo = {
       .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
@@ -587,152 +1191,81 @@ void Engine::allocateModelDescriptorSet() {
       .descriptorSetCount = static_cast<uint32_t>(layouts.size()),
       .pSetLayouts = layouts.data(),
   };
-  std::vector<VkDescriptorSet> descriptorSets(m_context.swapchain.image_count,
-                                              VK_NULL_HANDLE);
+  std::vector<VkDescriptorSet> descriptorSets(image_count, VK_NULL_HANDLE);
   VK_CHECK(vkAllocateDescriptorSets(m_context.device, &allocInfo,
                                     descriptorSets.data()));
   for (size_t i = 0; i < image_count; ++i) {
-    m_context.perFrame[i].modelDescriptorSet = descriptorSets[i];
+    m_context.perFrame[i].nodeDescriptorSet = descriptorSets[i];
   }
 }
 
-void Engine::bindModelDescriptorSet() {
+void Engine::bindNodeDescriptorSet() {
   const auto image_count = m_context.swapchain.image_count;
   for (size_t i = 0; i < image_count; ++i) {
-    auto &per_frame = m_context.perFrame[i];
-
-    std::vector<VkDescriptorBufferInfo> bufferInfos = {
-        {
-            .buffer = per_frame.modelUniformBuffer,
-            .offset = 0,
-            .range = sizeof(ModelUBO),
-        },
-    };
-    std::vector<VkWriteDescriptorSet> descriptorWrites = {
-        {
-            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-            .dstSet = per_frame.modelDescriptorSet,
-            .dstBinding = 0,
-            .dstArrayElement = 0,
-            .descriptorCount = static_cast<uint32_t>(bufferInfos.size()),
-            .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
-            .pBufferInfo = bufferInfos.data(),
-        },
-    };
-
-    // シーンのディスクリプタセットの更新
-    vkUpdateDescriptorSets(m_context.device,
-                           static_cast<uint32_t>(descriptorWrites.size()),
-                           descriptorWrites.data(), 0, nullptr);
+    writeNodeDescriptorSet(m_context.perFrame[i]);
   } // image_count
 }
 
-// ***** シャドウ向けのディスクリプタセット *****
-
-void Engine::initShadowDescriptorSetLayout() {
-  // シャドウシェーダーが必要とするUniformを定義する。
-  std::vector<VkDescriptorSetLayoutBinding> shadowUBOLayoutBindings = {{
-      .binding =
-          0, // バインディング位置 (`layout(binding = 0) uniform ...`の0と一致)
-      .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
-      .descriptorCount = 1, // 配列の要素数（配列でなければ1）
-      .stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
-      .pImmutableSamplers = nullptr,
-  }};
-  VkDescriptorSetLayoutCreateInfo shadowLayoutInfo = {
-      .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
-      .bindingCount = static_cast<uint32_t>(shadowUBOLayoutBindings.size()),
-      .pBindings = shadowUBOLayoutBindings.data(),
+void Engine::writeNodeDescriptorSet(PerFrame &per_frame) {
+  std::vector<VkDescriptorBufferInfo> bufferInfos = {
+      {
+          .buffer = per_frame.nodeBuffer,
+          .offset = 0,
+          .range = VK_WHOLE_SIZE,
+      },
+      {
+          .buffer = per_frame.instanceBuffer,
+          .offset = 0,
+          .range = VK_WHOLE_SIZE,
+      },
+  };
+  std::vector<VkWriteDescriptorSet> descriptorWrites = {
+      {
+          .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+          .dstSet = per_frame.nodeDescriptorSet,
+          .dstBinding = 0,
+          .dstArrayElement = 0,
+          .descriptorCount = static_cast<uint32_t>(bufferInfos.size()),
+          .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+          .pBufferInfo = bufferInfos.data(),
+      },
   };
-  VK_CHECK(vkCreateDescriptorSetLayout(m_context.device, &shadowLayoutInfo,
-                                       nullptr,
-                                       &m_context.shadowDescriptorSetLayout));
-}
-
-void Engine::initShadowUB() {
-  m_context.shadowUBOBufferSizePerNode =
-      minDynamicUBOAlignment(sizeof(ShadowUniformBufferObject));
-  VkDeviceSize shadowTotalBufferSize =
-      MAX_NODES * m_context.shadowUBOBufferSizePerNode;
-
-  // シャドウ向けのUniform Bufferの作成
-  const auto image_count = m_context.swapchain.image_count;
-  for (size_t i = 0; i < image_count; ++i) {
-    auto &per_frame = m_context.perFrame[i];
-
-    VkBufferCreateInfo bufferCreateInfo = {
-        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
-        .size = shadowTotalBufferSize,
-        .usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
-    };
-
-    VmaAllocationCreateInfo allocationCreateInfo = {
-        .flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT,
-        .usage = VMA_MEMORY_USAGE_AUTO,
-        .requiredFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-                         VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-    };
 
-    VK_CHECK(
-        vmaCreateBuffer(m_context.vmaAllocator, &bufferCreateInfo,
-                        &allocationCreateInfo, &per_frame.shadowUniformBuffer,
-                        &per_frame.shadowUniformBufferAllocation, nullptr));
-  }
+  // ノードのディスクリプタセットの更新
+  vkUpdateDescriptorSets(m_context.device,
+                         static_cast<uint32_t>(descriptorWrites.size()),
+                         descriptorWrites.data(), 0, nullptr);
 }
 
-void Engine::allocateShadowDescriptorSet() {
-  // シャドウのためのDescriptor Setを作成する
-  const auto image_count = m_context.swapchain.image_count;
-  std::vector<VkDescriptorSetLayout> shadowLayouts(
-      image_count, m_context.shadowDescriptorSetLayout);
-  VkDescriptorSetAllocateInfo shadowAllocInfo = {
-      .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
-      .descriptorPool = m_context.descriptorPool,
-      .descriptorSetCount = static_cast<uint32_t>(shadowLayouts.size()),
-      .pSetLayouts = shadowLayouts.data(),
-  };
-  std::vector<VkDescriptorSet> shadowDescriptorSets(image_count,
-                                                    VK_NULL_HANDLE);
-  VK_CHECK(vkAllocateDescriptorSets(m_context.device, &shadowAllocInfo,
-                                    shadowDescriptorSets.data()));
-  for (size_t i = 0; i < image_count; ++i) {
-    auto &per_frame = m_context.perFrame[i];
-    per_frame.shadowDescriptorSet = shadowDescriptorSets[i];
+size_t Engine::growNodeCapacity(size_t capacity, size_t required) {
+  size_t newCapacity = std::max(capacity, INITIAL_NODE_CAPACITY);
+  while (newCapacity < required) {
+    newCapacity *= 2;
   }
+  return newCapacity;
 }
 
-void Engine::bindShadowDescriptorSet() {
-  // シャドウ
-  const auto image_count = m_context.swapchain.image_count;
-  for (size_t i = 0; i < image_count; ++i) {
-    auto &per_frame = m_context.perFrame[i];
+bool Engine::ensureNodeCapacity(PerFrame &per_frame, size_t nodeCount) {
+  if (nodeCount <= per_frame.nodeCapacity) {
+    return false;
+  }
+  const auto capacity = growNodeCapacity(per_frame.nodeCapacity, nodeCount);
+  LOGD("grow node buffers: {} -> {}", per_frame.nodeCapacity, capacity);
 
-    std::vector<VkDescriptorBufferInfo> bufferInfos = {
-        {
-            .buffer = per_frame.shadowUniformBuffer,
-            .offset = 0,
-            .range = sizeof(ShadowUniformBufferObject),
-        },
-    };
+  // このフレームのフェンスは待機済みなので、古いバッファは即座に破棄できる。
+  // 他のフレームは次に自分の番が来たときに同じように拡張される。
+  vmaDestroyBuffer(m_context.vmaAllocator, per_frame.nodeBuffer,
+                   per_frame.nodeBufferAllocation);
+  vmaDestroyBuffer(m_context.vmaAllocator, per_frame.instanceBuffer,
+                   per_frame.instanceBufferAllocation);
+  createNodeBuffer(per_frame, capacity);
 
-    std::vector<VkWriteDescriptorSet> descriptorWrites = {
-        {
-            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-            .dstSet = per_frame.shadowDescriptorSet,
-            .dstBinding = 0,
-            .dstArrayElement = 0,
-            .descriptorCount = static_cast<uint32_t>(bufferInfos.size()),
-            .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
-            .pBufferInfo = bufferInfos.data(),
-        },
-    };
+  // ディスクリプタセットも同じフレーム専用なので、そのまま書き換えて良い
+  writeNodeDescriptorSet(per_frame);
 
-    // シャドウのディスクリプタセットの更新
-    vkUpdateDescriptorSets(m_context.device,
-                           static_cast<uint32_t>(descriptorWrites.size()),
-                           descriptorWrites.data(), 0, nullptr);
-  } // image_count
+  per_frame.nodeCapacity = capacity;
+  ++m_stats.nodeBufferGrowths;
+  return true;
 }
 
 // ***** テクスチャのためのディスクリプタセット *****
@@ -832,27 +1365,27 @@ void Engine::bindTextureDescriptorSet() {
   descriptorWrites.push_back(write);
 
   // imageInfoがスコープを抜けると開放されてしまうので、ここに格納する
-  std::vector<VkDescriptorImageInfo> imageInfos(m_nodes.size());
-  for (size_t i = 0; i < m_nodes.size(); ++i) {
-    const auto &texture = m_nodes[i]->texture();
-    assert(texture != nullptr);
-    const auto &textureData = m_context.textureMap[texture];
-    assert(textureData.imageView != VK_NULL_HANDLE);
-
-    VkDescriptorImageInfo img{};
+  std::vector<VkDescriptorImageInfo> imageInfos;
+  imageInfos.reserve(m_context.textures.size());
+  for (uint32_t slot = 0; slot < m_context.textures.size(); ++slot) {
+    const auto &textureData = m_context.textures[slot];
+    if (textureData.imageView == VK_NULL_HANDLE) {
+      continue;
+    }
+
+    VkDescriptorImageInfo &img = imageInfos.emplace_back();
     img.sampler = VK_NULL_HANDLE;
     img.imageView = textureData.imageView;
     img.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-    imageInfos[i] = img;
 
     VkWriteDescriptorSet imgWrite{};
     imgWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
     imgWrite.dstSet = m_context.textureDescriptorSet;
     imgWrite.dstBinding = 1;
-    imgWrite.dstArrayElement = static_cast<uint32_t>(i);
+    imgWrite.dstArrayElement = slot;
     imgWrite.descriptorCount = 1;
     imgWrite.descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
-    imgWrite.pImageInfo = &imageInfos[i];
+    imgWrite.pImageInfo = &img;
 
     descriptorWrites.push_back(imgWrite);
   }
@@ -862,30 +1395,29 @@ void Engine::bindTextureDescriptorSet() {
                          descriptorWrites.data(), 0, nullptr);
 }
 
-size_t Engine::minDynamicUBOAlignment(size_t uboSize) {
-  VkPhysicalDeviceProperties properties;
-  vkGetPhysicalDeviceProperties(m_context.physicalDevice, &properties);
-
-  size_t min_ubo_alignment = properties.limits.minUniformBufferOffsetAlignment;
-  std::cout << "min_ubo_alignment = " << min_ubo_alignment << std::endl;
-
-  size_t uboBufferSizePerNode = uboSize;
-  if (min_ubo_alignment > 0) {
-    uboBufferSizePerNode = (uboBufferSizePerNode + min_ubo_alignment - 1) &
-                           ~(min_ubo_alignment - 1);
-  }
-  return uboBufferSizePerNode;
+void Engine::writeTextureDescriptor(uint32_t slot, VkImageView imageView) {
+  VkDescriptorImageInfo img{
+      .sampler = VK_NULL_HANDLE,
+      .imageView = imageView,
+      .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+  };
+  VkWriteDescriptorSet write{
+      .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+      .dstSet = m_context.textureDescriptorSet,
+      .dstBinding = 1,
+      .dstArrayElement = slot,
+      .descriptorCount = 1,
+      .descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,
+      .pImageInfo = &img,
+  };
+  vkUpdateDescriptorSets(m_context.device, 1, &write, 0, nullptr);
 }
 
-static const glm::mat4 bias(0.5, 0.0, 0.0, 0.0, 0.0, 0.5, 0.0, 0.0, 0.0, 0.0,
-                            1.0, 0.0, 0.5, 0.5, 0.0, 1.0);
-
 /**
  * UBOの更新
  */
 void Engine::updateUBO(PerFrame &per_frame) {
   // ***** シャドウ *****
-  ShadowUniformBufferObject shadowUBO{};
   glm::vec3 lightPos = m_lightPos;
   auto shadowView = glm::lookAt(lightPos, {0.f, 0.f, 0.f}, {0.f, 0.f, 1.f});
   auto shadowProj =
@@ -916,49 +1448,168 @@ void Engine::updateUBO(PerFrame &per_frame) {
   sceneUBOVS.view = view;
   sceneUBOVS.proj = proj;
   sceneUBOVS.lightPos = m_lightPos;
-  VK_CHECK(vmaCopyMemoryToAllocation(m_context.vmaAllocator, &sceneUBOVS,
-                                     per_frame.sceneUniformBufferAllocation, 0,
-                                     sizeof(SceneUBO_VS)));
+  std::memcpy(per_frame.sceneUniformBufferMapped, &sceneUBOVS,
+              sizeof(SceneUBO_VS));
 
   SceneUBO_FS sceneUBOFS{};
   sceneUBOFS.lightColor = m_lightColor;
   sceneUBOFS.intensity = m_intensity;
   sceneUBOFS.ambient = m_ambient;
-  VK_CHECK(vmaCopyMemoryToAllocation(m_context.vmaAllocator, &sceneUBOFS,
-                                     per_frame.sceneUniformBufferAllocation,
-                                     m_context.sceneUBOBufferSizeForVS,
-                                     sizeof(SceneUBO_FS)));
-
-  for (size_t i = 0; i < m_nodes.size(); ++i) {
-    auto model = m_nodes[i]->worldMatrix();
-
-    shadowUBO.depthMVP = shadowVP * model;
-
-    // シャドウUBOの更新
-    VkDeviceSize shadowOffset = i * m_context.shadowUBOBufferSizePerNode;
-    VK_CHECK(vmaCopyMemoryToAllocation(m_context.vmaAllocator, &shadowUBO,
-                                       per_frame.shadowUniformBufferAllocation,
-                                       shadowOffset, sizeof(shadowUBO)));
-    // frustum culling
-    auto shadowFrustum = extractFrustum(shadowVP);
-    m_shadowCastingNodes[i] =
-        sphereInFrustum(shadowFrustum, m_nodes[i]->boundingSphere());
-
-    ModelUBO modelUBO{};
-    modelUBO.shadowMatrix = bias * shadowUBO.depthMVP;
-    modelUBO.model = model;
-    modelUBO.texIndex = static_cast<uint32_t>(i);
-
-    // モデルUBOの更新
-    VkDeviceSize offset = i * m_context.modelUBOBufferSizePerNode;
-    VK_CHECK(vmaCopyMemoryToAllocation(m_context.vmaAllocator, &modelUBO,
-                                       per_frame.modelUniformBufferAllocation,
-                                       offset, sizeof(modelUBO)));
-    // frustum culling
-    auto sceneFrustum = extractFrustum(sceneVP);
-    m_visibleNodes[i] =
-        sphereInFrustum(sceneFrustum, m_nodes[i]->boundingSphere());
-  }
+  std::memcpy(per_frame.sceneUniformBufferMapped +
+                  m_context.sceneUBOBufferSizeForVS,
+              &sceneUBOFS, sizeof(SceneUBO_FS));
+
+  // 動いたノードとその子孫のワールド行列をまとめて更新する。
+  // TransformStore はスレッドセーフではないので、ここで済ませておき、
+  // 並列に書き込む間は update() 済みの値を読むだけにする。
+  TransformStore::shared().update();
+
+  const auto shadowPlanes = toPlanes(extractFrustum(shadowVP));
+  const auto scenePlanes = toPlanes(extractFrustum(sceneVP));
+  const bool linearCulling = m_cullingMode == CullingMode::Linear;
+
+  // バッファはマップしたままなので、直接書き込む。
+  // 書き込み結合メモリのことがあるので、読み出さずに構造体ごと書く。
+  NodeData *const nodeData = per_frame.nodeBufferMapped;
+  const auto fillStart = std::chrono::steady_clock::now();
+
+  // ノードを範囲に分けて、範囲ごとに並列に NodeData を書き込む。
+  // CullingMode::Linear なら、その範囲の frustum culling も一緒に行う。
+  const size_t nodeCount = m_nodes.size();
+  const size_t grain = m_jobs.grainFor(nodeCount);
+  const size_t chunkCount = (nodeCount + grain - 1) / grain;
+  m_nodeSpheres.resize(nodeCount);
+  m_nodeMeshIds.resize(nodeCount);
+  m_nodeLods.resize(nodeCount);
+  // 距離 1 で長さ 1 が画面の何ピクセルになるか（LOD の選択に使う）
+  const float pixelsPerUnitAtOne = std::abs(proj[1][1]) * 0.5f *
+                                   m_context.swapchain.extent.height;
+  const glm::vec3 cameraPos = m_camera.position();
+  if (linearCulling) {
+    m_chunkShadowCasters.resize(chunkCount);
+    m_chunkVisibleNodes.resize(chunkCount);
+  }
+  m_jobs.parallelFor(nodeCount, grain, [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      const auto &node = *m_nodes[i];
+      const auto &model = node.updatedWorldMatrix();
+
+      NodeData data{};
+      data.model = model;
+      data.depthMVP = shadowVP * model;
+      // メッシュとテクスチャのアップロードが終わったノードだけを描画する
+      const auto meshBuffer = m_context.meshBufferMap.find(node.mesh());
+      if (meshBuffer != m_context.meshBufferMap.end()) {
+        const auto &dq = meshBuffer->second.dequantization;
+        data.positionScale = glm::vec4(dq.positionScale, 0.f);
+        data.positionOffset = glm::vec4(dq.positionOffset, 0.f);
+        data.texCoordTransform = dq.texCoordTransform;
+      }
+      const auto textureSlot = m_context.textureRegistry.find(node.texture());
+      data.texIndex =
+          textureSlot != TextureRegistry::INVALID_SLOT ? textureSlot : 0;
+      std::memcpy(&nodeData[i], &data, sizeof(data));
+
+      const auto sphere = node.updatedBoundingSphere();
+      m_nodeSpheres.set(i, sphere);
+      const bool resident =
+          meshBuffer != m_context.meshBufferMap.end() &&
+          meshBuffer->second.uploadValue <= m_uploadCompleted &&
+          textureSlot != TextureRegistry::INVALID_SLOT &&
+          m_context.textures[textureSlot].uploadValue <= m_uploadCompleted;
+      if (!resident) {
+        m_nodeMeshIds[i] = DrawBatcher::NO_MESH;
+        continue;
+      }
+      // 球の手前側までの距離で、メッシュの誤差が画面上で何ピクセルに
+      // なるかを見積もって LOD を選ぶ（カメラが球の中なら元のメッシュ）
+      const auto &lodErrors = meshBuffer->second.lodErrors;
+      uint32_t lod = 0;
+      const float distance =
+          glm::length(sphere.center - cameraPos) - sphere.radius;
+      if (lodErrors.size() > 1 && distance > 0.f) {
+        const float scale = std::max({glm::length(glm::vec3(model[0])),
+                                      glm::length(glm::vec3(model[1])),
+                                      glm::length(glm::vec3(model[2]))});
+        lod = selectLod(lodErrors, pixelsPerUnitAtOne * scale / distance,
+                        m_nodeLods[i], m_lodPixelError);
+      }
+      m_nodeLods[i] = static_cast<uint8_t>(lod);
+      m_nodeMeshIds[i] = meshBuffer->second.id * MESH_LOD_LEVELS + lod;
+    }
+    if (linearCulling) {
+      const size_t chunk = begin / grain;
+      m_chunkShadowCasters[chunk].clear();
+      cullSphereRange(shadowPlanes, m_nodeSpheres, begin, end,
+                      m_chunkShadowCasters[chunk]);
+      m_chunkVisibleNodes[chunk].clear();
+      cullSphereRange(scenePlanes, m_nodeSpheres, begin, end,
+                      m_chunkVisibleNodes[chunk]);
+    }
+  });
+
+  const double fillMs = std::chrono::duration<double, std::milli>(
+                            std::chrono::steady_clock::now() - fillStart)
+                            .count();
+  m_stats.uboFillMs = fillMs;
+  m_stats.uboFillTotalMs += fillMs;
+  ++m_stats.uboFills;
+
+  // frustum culling
+  // 全ノードの Bounding Sphere から、描画するノードの index を得る
+  switch (m_cullingMode) {
+  case CullingMode::Linear:
+    // 範囲ごとの結果は昇順なので、範囲の順に繋げれば全体も昇順になる
+    m_shadowCasterIndices.clear();
+    m_visibleNodeIndices.clear();
+    for (size_t chunk = 0; chunk < chunkCount; ++chunk) {
+      m_shadowCasterIndices.insert(m_shadowCasterIndices.end(),
+                                   m_chunkShadowCasters[chunk].begin(),
+                                   m_chunkShadowCasters[chunk].end());
+      m_visibleNodeIndices.insert(m_visibleNodeIndices.end(),
+                                  m_chunkVisibleNodes[chunk].begin(),
+                                  m_chunkVisibleNodes[chunk].end());
+    }
+    break;
+  case CullingMode::Bvh:
+    // 動いたノードは refit、品質が落ちたら作り直す
+    m_bvh.update(m_nodeSpheres);
+    // 木は読むだけなので、シャドウとシーンの判定を並列に行う
+    m_jobs.parallelFor(2, 1, [&](size_t begin, size_t) {
+      if (begin == 0) {
+        m_bvh.cullFrustum(shadowPlanes, m_shadowCasterIndices);
+      } else {
+        m_bvh.cullFrustum(scenePlanes, m_visibleNodeIndices);
+      }
+    });
+    break;
+  case CullingMode::LooseOctree:
+    // 動いたノードだけ入るセルを付け替える
+    m_octree.update(m_nodeSpheres);
+    m_jobs.parallelFor(2, 1, [&](size_t begin, size_t) {
+      if (begin == 0) {
+        m_octree.cullFrustum(shadowPlanes, m_shadowCasterIndices);
+      } else {
+        m_octree.cullFrustum(scenePlanes, m_visibleNodeIndices);
+      }
+    });
+    break;
+  }
+
+  // 同じメッシュのノードを1回のインスタンス描画にまとめる。
+  // インスタンスのバッファにはシーン、シャドウの順に並べる。
+  const auto meshCount =
+      static_cast<uint32_t>(m_context.meshes.size()) * MESH_LOD_LEVELS;
+  m_sceneBatches.build(m_visibleNodeIndices, m_nodeMeshIds, meshCount);
+  m_shadowBatches.build(m_shadowCasterIndices, m_nodeMeshIds, meshCount,
+                        static_cast<uint32_t>(m_visibleNodeIndices.size()));
+  const auto &sceneInstances = m_sceneBatches.instanceNodes();
+  const auto &shadowInstances = m_shadowBatches.instanceNodes();
+  std::memcpy(per_frame.instanceBufferMapped, sceneInstances.data(),
+              sceneInstances.size() * sizeof(uint32_t));
+  std::memcpy(per_frame.instanceBufferMapped + sceneInstances.size(),
+              shadowInstances.data(),
+              shadowInstances.size() * sizeof(uint32_t));
 }
 
 void Engine::initPerFrame(PerFrame &per_frame) {
@@ -1025,20 +1676,23 @@ void Engine::teardownPerFrame(PerFrame &per_frame) {
                      per_frame.sceneUniformBufferAllocation);
     per_frame.sceneUniformBuffer = VK_NULL_HANDLE;
     per_frame.sceneUniformBufferAllocation = VK_NULL_HANDLE;
+    per_frame.sceneUniformBufferMapped = nullptr;
   }
 
-  if (per_frame.modelUniformBuffer != VK_NULL_HANDLE) {
-    vmaDestroyBuffer(m_context.vmaAllocator, per_frame.modelUniformBuffer,
-                     per_frame.modelUniformBufferAllocation);
-    per_frame.modelUniformBuffer = VK_NULL_HANDLE;
-    per_frame.modelUniformBufferAllocation = VK_NULL_HANDLE;
+  if (per_frame.nodeBuffer != VK_NULL_HANDLE) {
+    vmaDestroyBuffer(m_context.vmaAllocator, per_frame.nodeBuffer,
+                     per_frame.nodeBufferAllocation);
+    per_frame.nodeBuffer = VK_NULL_HANDLE;
+    per_frame.nodeBufferAllocation = VK_NULL_HANDLE;
+    per_frame.nodeBufferMapped = nullptr;
   }
 
-  if (per_frame.shadowUniformBuffer != VK_NULL_HANDLE) {
-    vmaDestroyBuffer(m_context.vmaAllocator, per_frame.shadowUniformBuffer,
-                     per_frame.shadowUniformBufferAllocation);
-    per_frame.shadowUniformBuffer = VK_NULL_HANDLE;
-    per_frame.shadowUniformBufferAllocation = VK_NULL_HANDLE;
+  if (per_frame.instanceBuffer != VK_NULL_HANDLE) {
+    vmaDestroyBuffer(m_context.vmaAllocator, per_frame.instanceBuffer,
+                     per_frame.instanceBufferAllocation);
+    per_frame.instanceBuffer = VK_NULL_HANDLE;
+    per_frame.instanceBufferAllocation = VK_NULL_HANDLE;
+    per_frame.instanceBufferMapped = nullptr;
   }
 }
 
@@ -1107,7 +1761,7 @@ VkShaderModule Engine::loadShaderModule(const char *path) {
 void Engine::initPipeline() {
   std::vector<VkDescriptorSetLayout> layouts = {
       m_context.sceneDescriptorSetLayout,
-      m_context.modelDescriptorSetLayout,
+      m_context.nodeDescriptorSetLayout,
       m_context.textureDescriptorSetLayout,
   };
   VkPipelineLayoutCreateInfo layout_info{
@@ -1117,30 +1771,40 @@ void Engine::initPipeline() {
   VK_CHECK(vkCreatePipelineLayout(m_context.device, &layout_info, nullptr,
                                   &m_context.pipelineLayout));
 
-  VkVertexInputBindingDescription binding_description{
-      .binding = 0,
-      .stride = sizeof(Vertex),
-      .inputRate = VK_VERTEX_INPUT_RATE_VERTEX};
+  // 位置（binding 0）と、法線と UV（binding 1）の 2 つのストリーム
+  const bool packed = m_vertexFormat == VertexFormat::Packed;
+  const auto streams = vertexStreamLayout(m_vertexFormat);
+  std::vector<VkVertexInputBindingDescription> binding_descriptions = {{
+      {.binding = 0,
+       .stride = streams.positionStride,
+       .inputRate = VK_VERTEX_INPUT_RATE_VERTEX},
+      {.binding = 1,
+       .stride = streams.attributeStride,
+       .inputRate = VK_VERTEX_INPUT_RATE_VERTEX},
+  }};
 
+  // Packed の戻す変換は NodeData から、法線の八面体の展開はシェーダーで行う
   std::vector<VkVertexInputAttributeDescription> attribute_descriptions = {{
       {.location = 0,
        .binding = 0,
-       .format = VK_FORMAT_R32G32B32_SFLOAT,
-       .offset = offsetof(Vertex, position)}, // position
+       .format = packed ? VK_FORMAT_R16G16B16A16_SNORM
+                        : VK_FORMAT_R32G32B32_SFLOAT,
+       .offset = 0}, // position
       {.location = 1,
-       .binding = 0,
-       .format = VK_FORMAT_R32G32B32_SFLOAT,
-       .offset = offsetof(Vertex, normal)}, // normal
+       .binding = 1,
+       .format = packed ? VK_FORMAT_R16G16_SNORM : VK_FORMAT_R32G32B32_SFLOAT,
+       .offset = streams.normalOffset}, // normal
       {.location = 2,
-       .binding = 0,
-       .format = VK_FORMAT_R32G32_SFLOAT,
-       .offset = offsetof(Vertex, texCoord)}, // texCoord
+       .binding = 1,
+       .format = packed ? VK_FORMAT_R16G16_UNORM : VK_FORMAT_R32G32_SFLOAT,
+       .offset = streams.texCoordOffset}, // texCoord
   }};
 
   VkPipelineVertexInputStateCreateInfo vertex_input{
       .sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
-      .vertexBindingDescriptionCount = 1,
-      .pVertexBindingDescriptions = &binding_description,
+      .vertexBindingDescriptionCount =
+          static_cast<uint32_t>(binding_descriptions.size()),
+      .pVertexBindingDescriptions = binding_descriptions.data(),
       .vertexAttributeDescriptionCount =
           static_cast<uint32_t>(attribute_descriptions.size()),
       .pVertexAttributeDescriptions = attribute_descriptions.data()};
@@ -1199,11 +1863,22 @@ void Engine::initPipeline() {
       .dynamicStateCount = static_cast<uint32_t>(dynamic_states.size()),
       .pDynamicStates = dynamic_states.data()};
 
+  // scene.vert の PACKED_VERTICES（constant_id = 0）
+  const VkBool32 packedVertices = packed ? VK_TRUE : VK_FALSE;
+  VkSpecializationMapEntry specialization_entry{
+      .constantID = 0, .offset = 0, .size = sizeof(VkBool32)};
+  VkSpecializationInfo specialization_info{
+      .mapEntryCount = 1,
+      .pMapEntries = &specialization_entry,
+      .dataSize = sizeof(packedVertices),
+      .pData = &packedVertices};
+
   std::vector<VkPipelineShaderStageCreateInfo> shader_stages = {
       {{.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
         .stage = VK_SHADER_STAGE_VERTEX_BIT,
         .module = loadShaderModule("shaders/scene.vert.spv"),
-        .pName = "main"},
+        .pName = "main",
+        .pSpecializationInfo = &specialization_info},
        {.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
         .stage = VK_SHADER_STAGE_FRAGMENT_BIT,
         .module = loadShaderModule("shaders/scene.frag.spv"),
@@ -1244,20 +1919,23 @@ void Engine::initShadowPipeline() {
   VkPipelineLayoutCreateInfo layout_info{};
   layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
   layout_info.setLayoutCount = 1;
-  layout_info.pSetLayouts = &m_context.shadowDescriptorSetLayout;
+  layout_info.pSetLayouts = &m_context.nodeDescriptorSetLayout;
   VK_CHECK(vkCreatePipelineLayout(m_context.device, &layout_info, nullptr,
                                   &m_context.shadowPipelineLayout));
 
+  // 位置のストリームだけを読む
+  const bool packed = m_vertexFormat == VertexFormat::Packed;
   VkVertexInputBindingDescription binding_description{
       .binding = 0,
-      .stride = sizeof(Vertex),
+      .stride = vertexStreamLayout(m_vertexFormat).positionStride,
       .inputRate = VK_VERTEX_INPUT_RATE_VERTEX};
 
   std::vector<VkVertexInputAttributeDescription> attribute_descriptions = {{
       {.location = 0,
        .binding = 0,
-       .format = VK_FORMAT_R32G32B32_SFLOAT,
-       .offset = offsetof(Vertex, position)}, // position
+       .format = packed ? VK_FORMAT_R16G16B16A16_SNORM
+                        : VK_FORMAT_R32G32B32_SFLOAT,
+       .offset = 0}, // position
   }};
 
   VkPipelineVertexInputStateCreateInfo vertex_input{
@@ -1409,6 +2087,43 @@ VkResult Engine::acquireNextSwapchainImage(uint32_t *image) {
   return VK_SUCCESS;
 }
 
+uint32_t Engine::drawBatches(VkCommandBuffer cmd, const DrawBatcher &batcher,
+                             bool positionsOnly, DrawCounts &counts) {
+  // 全メッシュが共有バッファにあるので、頂点バッファのバインドはパスごとに
+  // 1回でよい。インデックスバッファは幅（16/32 bit）が変わるときだけ替える。
+  // 深度だけのパスは位置のストリームだけを読む。
+  // 拡張のコピー中は、描画できるメッシュは古いバッファにある
+  const std::array<VkBuffer, 2> vertexBuffers = {
+      m_context.vertexArena.drawBuffer().buffer,
+      m_context.vertexArena.drawAttributeBuffer().buffer};
+  const std::array<VkDeviceSize, 2> offsets = {0, 0};
+  vkCmdBindVertexBuffers(cmd, 0, positionsOnly ? 1 : 2, vertexBuffers.data(),
+                         offsets.data());
+  VkIndexType boundIndexType = VK_INDEX_TYPE_MAX_ENUM;
+  for (const auto &batch : batcher.batches()) {
+    // バッチの id はメッシュと LOD のレベルの組
+    const auto &mesh = m_context.meshes[batch.meshId / MESH_LOD_LEVELS];
+    // バッチにはアップロード済みのメッシュしか入らない
+    const auto found = m_context.meshBufferMap.find(mesh);
+    assert(found != m_context.meshBufferMap.end());
+    const auto &meshBuffer = found->second;
+    const auto &lod = meshBuffer.lods[batch.meshId % MESH_LOD_LEVELS];
+    if (meshBuffer.indexType != boundIndexType) {
+      const auto &indexArena = meshBuffer.indexType == VK_INDEX_TYPE_UINT16
+                                   ? m_context.index16Arena
+                                   : m_context.indexArena;
+      vkCmdBindIndexBuffer(cmd, indexArena.drawBuffer().buffer, 0,
+                           meshBuffer.indexType);
+      boundIndexType = meshBuffer.indexType;
+    }
+    vkCmdDrawIndexed(cmd, lod.indexCount, batch.instanceCount, lod.firstIndex,
+                     meshBuffer.vertexOffset, batch.firstInstance);
+    counts.vertices += uint64_t(lod.vertexCount) * batch.instanceCount;
+    counts.triangles += uint64_t(lod.indexCount / 3) * batch.instanceCount;
+  }
+  return static_cast<uint32_t>(batcher.batches().size());
+}
+
 void Engine::renderShadow(uint32_t swapchain_index, VkCommandBuffer cmd) {
   VkClearValue shadowClearValue = {
       .depthStencil = {.depth = 1.0f, .stencil = 0}};
@@ -1456,34 +2171,28 @@ void Engine::renderShadow(uint32_t swapchain_index, VkCommandBuffer cmd) {
   vkCmdSetDepthBias(cmd, Engine::depthBiasConstant, 0.0f,
                     Engine::depthBiasSlope);
 
-  for (std::size_t i = 0; i < m_nodes.size(); ++i) {
-    if (!m_shadowCastingNodes[i]) {
-      continue;
-    }
-    const auto &node = m_nodes[i];
-    const auto &meshBuffer = m_context.meshBufferMap[node->mesh()];
-    const auto &vertexBuffer = meshBuffer.vertexBuffer;
-    VkDeviceSize offset = {0};
-    vkCmdBindVertexBuffers(cmd, 0, 1, &vertexBuffer.buffer, &offset);
-    const auto &indexBuffer = meshBuffer.indexBuffer;
-    vkCmdBindIndexBuffer(cmd, indexBuffer.buffer, 0, VK_INDEX_TYPE_UINT32);
-    uint32_t dynamic_offset =
-        static_cast<uint32_t>(i * m_context.shadowUBOBufferSizePerNode);
-    vkCmdBindDescriptorSets(
-        cmd,                             // commandBuffer
-        VK_PIPELINE_BIND_POINT_GRAPHICS, // pipelineBindPoint
-        m_context.shadowPipelineLayout,  // layout
-        0,                               // firstSet
-        1,                               // descriptorSetCount
-        &m_context.perFrame[swapchain_index]
-             .shadowDescriptorSet, // pDescriptorSets
-        1,                         // dynamicOffsetCount
-        &dynamic_offset            // pDynamicOffsets
-    );
-    vkCmdDrawIndexed(cmd,
-                     static_cast<uint32_t>(node->mesh()->numberOfIndices()), 1,
-                     0, 0, 0);
-  }
+  // ノードのデータはパスの最初に1回だけバインドし、インスタンスの位置は
+  // firstInstance（gl_InstanceIndex）で渡す
+  vkCmdBindDescriptorSets(
+      cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, m_context.shadowPipelineLayout,
+      0, // firstSet
+      1, // descriptorSetCount
+      &m_context.perFrame[swapchain_index].nodeDescriptorSet, 0, nullptr);
+
+  // 頂点の読み込み量は計測せず、各インスタンスが参照する頂点を 1 回ずつ
+  // 読むとみなして見積もる
+  DrawCounts shadowCounts;
+  m_stats.shadowDrawCalls =
+      drawBatches(cmd, m_shadowBatches, true, shadowCounts);
+  const auto streams = vertexStreamLayout(m_vertexFormat);
+  m_stats.estimatedShadowVertexBytes =
+      shadowCounts.vertices * streams.positionStride;
+  m_stats.estimatedShadowInterleavedVertexBytes =
+      shadowCounts.vertices *
+      (streams.positionStride + streams.attributeStride);
+  m_stats.shadowTriangles = shadowCounts.triangles;
+  m_stats.shadowInstances =
+      static_cast<uint32_t>(m_shadowBatches.instanceNodes().size());
   vkCmdEndRendering(cmd);
 }
 
@@ -1497,6 +2206,9 @@ void Engine::render(uint32_t swapchain_index) {
 
   VK_CHECK(vkBeginCommandBuffer(cmd, &begin_info));
 
+  // アップロードが終わったテクスチャの所有権を獲得する
+  m_context.uploader.recordAcquires(cmd, m_uploadCompleted);
+
   // MARK: Shadow Rendering
   {
     VkImageMemoryBarrier2 barrier = {
@@ -1656,30 +2368,18 @@ void Engine::render(uint32_t swapchain_index) {
                           1, // descriptorSetCount
                           &m_context.textureDescriptorSet, 0, nullptr);
 
-  for (std::size_t i = 0; i < m_nodes.size(); ++i) {
-    if (!m_visibleNodes[i]) {
-      continue;
-    }
-    const auto &node = m_nodes[i];
-    const auto &meshBuffer = m_context.meshBufferMap[node->mesh()];
-    const auto &vertexBuffer = meshBuffer.vertexBuffer;
-    VkDeviceSize offset = {0};
-    vkCmdBindVertexBuffers(cmd, 0, 1, &vertexBuffer.buffer, &offset);
-    const auto &indexBuffer = meshBuffer.indexBuffer;
-    vkCmdBindIndexBuffer(cmd, indexBuffer.buffer, 0, VK_INDEX_TYPE_UINT32);
-
-    uint32_t dynamic_offset =
-        static_cast<uint32_t>(i * m_context.modelUBOBufferSizePerNode);
-    vkCmdBindDescriptorSets(
-        cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, m_context.pipelineLayout,
-        1, // first set
-        1, // descriptorSetCount
-        &m_context.perFrame[swapchain_index].modelDescriptorSet, 1,
-        &dynamic_offset);
-    vkCmdDrawIndexed(cmd,
-                     static_cast<uint32_t>(node->mesh()->numberOfIndices()), 1,
-                     0, 0, 0);
-  }
+  vkCmdBindDescriptorSets(
+      cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, m_context.pipelineLayout,
+      1, // first set
+      1, // descriptorSetCount
+      &m_context.perFrame[swapchain_index].nodeDescriptorSet, 0, nullptr);
+
+  DrawCounts sceneCounts;
+  m_stats.sceneDrawCalls =
+      drawBatches(cmd, m_sceneBatches, false, sceneCounts);
+  m_stats.sceneTriangles = sceneCounts.triangles;
+  m_stats.sceneInstances =
+      static_cast<uint32_t>(m_sceneBatches.instanceNodes().size());
 
   vkCmdEndRendering(cmd);
 
@@ -1736,14 +2436,25 @@ void Engine::render(uint32_t swapchain_index) {
         &m_context.perFrame[swapchain_index].swapchain_release_semaphore));
   }
 
-  VkPipelineStageFlags wait_stage{VK_PIPELINE_STAGE_2_TOP_OF_PIPE_BIT};
+  // このフレームで使うアップロードの完了も待つ（既に完了している）
+  const VkSemaphore wait_semaphores[] = {
+      m_context.perFrame[swapchain_index].swapchain_acquire_semaphore,
+      m_context.uploader.timeline()};
+  const VkPipelineStageFlags wait_stages[] = {
+      VK_PIPELINE_STAGE_2_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT};
+  const uint64_t wait_values[] = {0, m_uploadCompleted};
+  VkTimelineSemaphoreSubmitInfo timeline_info{
+      .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+      .waitSemaphoreValueCount = 2,
+      .pWaitSemaphoreValues = wait_values,
+  };
 
   VkSubmitInfo info{
       .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-      .waitSemaphoreCount = 1,
-      .pWaitSemaphores =
-          &m_context.perFrame[swapchain_index].swapchain_acquire_semaphore,
-      .pWaitDstStageMask = &wait_stage,
+      .pNext = &timeline_info,
+      .waitSemaphoreCount = m_uploadCompleted > 0 ? 2u : 1u,
+      .pWaitSemaphores = wait_semaphores,
+      .pWaitDstStageMask = wait_stages,
       .commandBufferCount = 1,
       .pCommandBuffers = &cmd,
       .signalSemaphoreCount = 1,
@@ -1802,56 +2513,23 @@ void Engine::transitionImageLayout(VkCommandBuffer cmd, VkImage image,
   vkCmdPipelineBarrier2(cmd, &dependency_info);
 }
 
-void Engine::transitionImageLayout(VkImage image, VkFormat format,
-                                   VkImageLayout oldLayout,
-                                   VkImageLayout newLayout) {
-  VkCommandBuffer commandBuffer = beginSingleTimeCommands();
-
-  VkImageMemoryBarrier barrier{};
-  barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-  barrier.oldLayout = oldLayout;
-  barrier.newLayout = newLayout;
-  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-  barrier.image = image;
-  barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-  barrier.subresourceRange.baseMipLevel = 0;
-  barrier.subresourceRange.levelCount = 1;
-  barrier.subresourceRange.baseArrayLayer = 0;
-  barrier.subresourceRange.layerCount = 1;
-
-  VkPipelineStageFlags sourceStage;
-  VkPipelineStageFlags destinationStage;
-
-  if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED &&
-      newLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL) {
-    barrier.srcAccessMask = 0;
-    barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-
-    sourceStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
-    destinationStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
-  } else if (oldLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL &&
-             newLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL) {
-    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-
-    sourceStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
-    destinationStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
-  } else {
-    throw std::invalid_argument("unsupported layout transition!");
-  }
-
-  vkCmdPipelineBarrier(commandBuffer, sourceStage, destinationStage, 0, 0,
-                       nullptr, 0, nullptr, 1, &barrier);
-
-  endSingleTimeCommands(commandBuffer);
-}
-
 Engine::~Engine() {
   if (m_context.device != VK_NULL_HANDLE) {
     vkDeviceWaitIdle(m_context.device);
   }
 
+  // 破棄を遅らせていたリソース（GPU はもう使っていない）
+  for (auto &per_frame : m_context.perFrame) {
+    for (auto &deletion : per_frame.deletions) {
+      deletion.destroy();
+    }
+    per_frame.deletions.clear();
+  }
+  for (auto &deletion : m_pendingDeletions) {
+    deletion.destroy();
+  }
+  m_pendingDeletions.clear();
+
   for (auto &per_frame : m_context.perFrame) {
     teardownPerFrame(per_frame);
   }
@@ -1887,10 +2565,10 @@ Engine::~Engine() {
                                  m_context.sceneDescriptorSetLayout, nullptr);
     m_context.sceneDescriptorSetLayout = VK_NULL_HANDLE;
   }
-  if (m_context.modelDescriptorSetLayout != VK_NULL_HANDLE) {
+  if (m_context.nodeDescriptorSetLayout != VK_NULL_HANDLE) {
     vkDestroyDescriptorSetLayout(m_context.device,
-                                 m_context.modelDescriptorSetLayout, nullptr);
-    m_context.modelDescriptorSetLayout = VK_NULL_HANDLE;
+                                 m_context.nodeDescriptorSetLayout, nullptr);
+    m_context.nodeDescriptorSetLayout = VK_NULL_HANDLE;
   }
   if (m_context.textureDescriptorSetLayout != VK_NULL_HANDLE) {
     vkDestroyDescriptorSetLayout(m_context.device,
@@ -1920,29 +2598,37 @@ Engine::~Engine() {
   vkDestroyPipelineLayout(m_context.device, m_context.shadowPipelineLayout,
                           nullptr);
   vkDestroyPipeline(m_context.device, m_context.shadowPipeline, nullptr);
-  vkDestroyDescriptorSetLayout(m_context.device,
-                               m_context.shadowDescriptorSetLayout, nullptr);
 
-  for (auto &pair : m_context.meshBufferMap) {
-    vmaDestroyBuffer(m_context.vmaAllocator, pair.second.vertexBuffer.buffer,
-                     pair.second.vertexBuffer.allocation);
-    vmaDestroyBuffer(m_context.vmaAllocator, pair.second.indexBuffer.buffer,
-                     pair.second.indexBuffer.allocation);
-  }
-
-  for (auto &pair : m_context.textureMap) {
-    vkDestroyImageView(m_context.device, pair.second.imageView, nullptr);
-    vmaDestroyImage(m_context.vmaAllocator, pair.second.image,
-                    pair.second.allocation);
+  for (auto *arena : {&m_context.vertexArena, &m_context.indexArena,
+                      &m_context.index16Arena}) {
+    vmaDestroyBuffer(m_context.vmaAllocator, arena->buffer.buffer,
+                     arena->buffer.allocation);
+    arena->buffer = {};
+    vmaDestroyBuffer(m_context.vmaAllocator, arena->attributeBuffer.buffer,
+                     arena->attributeBuffer.allocation);
+    arena->attributeBuffer = {};
+    vmaDestroyBuffer(m_context.vmaAllocator, arena->retiredBuffer.buffer,
+                     arena->retiredBuffer.allocation);
+    arena->retiredBuffer = {};
+    vmaDestroyBuffer(m_context.vmaAllocator,
+                     arena->retiredAttributeBuffer.buffer,
+                     arena->retiredAttributeBuffer.allocation);
+    arena->retiredAttributeBuffer = {};
+    arena->allocator.reset();
+  }
+
+  for (auto &textureData : m_context.textures) {
+    if (textureData.image != VK_NULL_HANDLE) {
+      vkDestroyImageView(m_context.device, textureData.imageView, nullptr);
+      vmaDestroyImage(m_context.vmaAllocator, textureData.image,
+                      textureData.allocation);
+    }
   }
   vkDestroySampler(m_context.device, m_context.textureSampler, nullptr);
 
+  m_context.uploader.destroy();
   vmaDestroyAllocator(m_context.vmaAllocator);
 
-  if (m_context.commandPool != VK_NULL_HANDLE) {
-    vkDestroyCommandPool(m_context.device, m_context.commandPool, nullptr);
-  }
-
   if (m_context.device != VK_NULL_HANDLE) {
     vkb::destroy_device(m_context.device);
   }
@@ -1951,6 +2637,31 @@ Engine::~Engine() {
   SDL_Quit();
 }
 
+bool Engine::supportsSampledFormat(VkFormat format) {
+  VkFormatProperties props;
+  vkGetPhysicalDeviceFormatProperties(m_context.physicalDevice, format, &props);
+  constexpr VkFormatFeatureFlags features =
+      VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT |
+      VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT |
+      VK_FORMAT_FEATURE_TRANSFER_DST_BIT;
+  return (props.optimalTilingFeatures & features) == features;
+}
+
+bool Engine::supportsVertexFormat(VkFormat format) {
+  VkFormatProperties props;
+  vkGetPhysicalDeviceFormatProperties(m_context.physicalDevice, format, &props);
+  return (props.bufferFeatures & VK_FORMAT_FEATURE_VERTEX_BUFFER_BIT) != 0;
+}
+
+bool Engine::supportsLinearBlit(VkFormat format) {
+  VkFormatProperties props;
+  vkGetPhysicalDeviceFormatProperties(m_context.physicalDevice, format, &props);
+  constexpr VkFormatFeatureFlags features =
+      VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT |
+      VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+  return (props.optimalTilingFeatures & features) == features;
+}
+
 VkFormat Engine::findSupportedFormat(const std::vector<VkFormat> &candidates,
                                      VkImageTiling tiling,
                                      VkFormatFeatureFlags features) {
@@ -2112,6 +2823,7 @@ void Engine::initShadow() {
 }
 
 bool Engine::prepare() {
+  const auto prepareStart = std::chrono::steady_clock::now();
   if (volkInitialize() != VK_SUCCESS) {
     throw std::runtime_error("failed to initialize volk");
   }
@@ -2142,8 +2854,14 @@ bool Engine::prepare() {
 
   initDevice();
 
+  // アップロードは記録して submit し、完了を待たずに残りの初期化を行う。
+  // ノードはアップロードが終わったフレームから描画される。
+  const auto meshStart = std::chrono::steady_clock::now();
   initVertexBuffer();
+  const auto textureStart = std::chrono::steady_clock::now();
   initTexture();
+  const auto textureEnd = std::chrono::steady_clock::now();
+  m_context.uploader.flush();
 
   initSwapchain();
 
@@ -2156,6 +2874,19 @@ bool Engine::prepare() {
   initPipeline();
   initShadowPipeline();
 
+  const auto end = std::chrono::steady_clock::now();
+
+  using ms = std::chrono::duration<double, std::milli>;
+  m_stats.prepareMs = ms(end - prepareStart).count();
+  m_stats.meshUploadMs = ms(textureStart - meshStart).count();
+  m_stats.textureUploadMs = ms(textureEnd - textureStart).count();
+  const auto &upload = m_context.uploader.stats();
+  LOGI("prepare: {:.1f} ms (meshes {:.1f} ms, textures {:.1f} ms; "
+       "{} bytes in {} copies, {} submits, {} stalls)",
+       m_stats.prepareMs, m_stats.meshUploadMs, m_stats.textureUploadMs,
+       upload.bytes, upload.copies, upload.submits, upload.stalls);
+
+  m_prepared = true;
   return true;
 }
 
@@ -2200,12 +2931,20 @@ void Engine::update() {
 
   if (res != VK_SUCCESS) {
     vkQueueWaitIdle(m_context.queue);
+    ++m_stats.idleWaits;
     return;
   }
 
-  m_shadowCastingNodes.resize(m_nodes.size());
-  m_visibleNodes.resize(m_nodes.size());
-  updateUBO(m_context.perFrame[m_context.currentIndex]);
+  // 記録済みのアップロードを submit し、完了したものをこのフレームで使う
+  m_context.uploader.flush();
+  m_uploadCompleted = m_context.uploader.collect();
+  retireGrownArenas();
+
+  auto &per_frame = m_context.perFrame[m_context.currentIndex];
+  collectDeletions(per_frame);
+  ensureNodeCapacity(per_frame, m_nodes.size());
+
+  updateUBO(per_frame);
   render(m_context.currentIndex);
   res = presentImage(m_context.currentIndex);
 
@@ -2236,6 +2975,7 @@ bool Engine::resize(const uint32_t, const uint32_t) {
   }
 
   vkDeviceWaitIdle(m_context.device);
+  ++m_stats.idleWaits;
 
   initSwapchain();
   return true;
@@ -2266,43 +3006,6 @@ Engine::selectSurfaceFormat(VkPhysicalDevice gpu, VkSurfaceKHR surface,
                                                : supported_surface_formats[0];
 }
 
-VkCommandBuffer Engine::beginSingleTimeCommands() {
-  VkCommandBufferAllocateInfo allocInfo{};
-  allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-  allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-  allocInfo.commandPool = m_context.commandPool;
-  allocInfo.commandBufferCount = 1;
-
-  VkCommandBuffer commandBuffer;
-  VK_CHECK(
-      vkAllocateCommandBuffers(m_context.device, &allocInfo, &commandBuffer));
-  LOGD("beginSingleTimeCommands: commandBuffer = {:x}",
-       reinterpret_cast<uint64_t>(commandBuffer));
-
-  VkCommandBufferBeginInfo beginInfo{};
-  beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-  beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
-
-  vkBeginCommandBuffer(commandBuffer, &beginInfo);
-
-  return commandBuffer;
-}
-
-void Engine::endSingleTimeCommands(VkCommandBuffer commandBuffer) {
-  vkEndCommandBuffer(commandBuffer);
-
-  VkSubmitInfo submitInfo{};
-  submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-  submitInfo.commandBufferCount = 1;
-  submitInfo.pCommandBuffers = &commandBuffer;
-
-  vkQueueSubmit(m_context.queue, 1, &submitInfo, VK_NULL_HANDLE);
-  vkQueueWaitIdle(m_context.queue);
-
-  vkFreeCommandBuffers(m_context.device, m_context.commandPool, 1,
-                       &commandBuffer);
-}
-
 AllocatedBuffer Engine::createBuffer(VkDeviceSize size,
                                      VkBufferUsageFlags usage,
                                      VmaMemoryUsage memoryUsage) {
@@ -2323,28 +3026,10 @@ AllocatedBuffer Engine::createBuffer(VkDeviceSize size,
   return {buffer, allocation};
 }
 
-void Engine::copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer,
-                        VkDeviceSize size) {
-  VkCommandBuffer commandBuffer = beginSingleTimeCommands();
-
-  VkBufferCopy copyRegion{};
-  copyRegion.size = size;
-  vkCmdCopyBuffer(commandBuffer, srcBuffer, dstBuffer, 1, &copyRegion);
-
-  endSingleTimeCommands(commandBuffer);
-}
-
-AllocatedBuffer Engine::uploadBuffer(const void *srcData, VkDeviceSize size,
-                                     VkBufferUsageFlags usage) {
-  auto staging = createBuffer(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-                              VMA_MEMORY_USAGE_CPU_ONLY);
-  VK_CHECK(vmaCopyMemoryToAllocation(m_context.vmaAllocator, srcData,
-                                     staging.allocation, 0, size));
-  auto gpu = createBuffer(size, usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-                          VMA_MEMORY_USAGE_GPU_ONLY);
-  copyBuffer(staging.buffer, gpu.buffer, size);
-  vmaDestroyBuffer(m_context.vmaAllocator, staging.buffer, staging.allocation);
-  return gpu;
+uint64_t Engine::uploadToBuffer(VkBuffer buffer, VkDeviceSize offset,
+                                const void *srcData, VkDeviceSize size) {
+  // コピーは記録するだけで、submit はまとめて行う
+  return m_context.uploader.uploadBuffer(buffer, offset, srcData, size);
 }
 
 AllocatedImage Engine::createImage(uint32_t width, uint32_t height,
@@ -2377,35 +3062,42 @@ AllocatedImage Engine::createImage(uint32_t width, uint32_t height,
   return allocatedImage;
 }
 
-void Engine::copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width,
-                               uint32_t height) {
-  VkCommandBuffer commandBuffer = beginSingleTimeCommands();
-  VkImageSubresourceLayers subresource{
-      // 色、深度、ステンシルなどのどのアスペクトをコピーするか
-      .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-      // コピーするミップレベル
-      .mipLevel = 0,
-      // コピーする配列レイヤーの最初のレイヤー
-      .baseArrayLayer = 0,
-      // コピーする配列レイヤーのレイヤー数
-      .layerCount = 1,
-  };
-  VkBufferImageCopy region{.bufferOffset = 0,
-                           .bufferRowLength = 0,
-                           .bufferImageHeight = 0,
-
-                           .imageSubresource = subresource,
-
-                           .imageOffset = {0, 0, 0},
-                           .imageExtent = {width, height, 1}};
-
-  vkCmdCopyBufferToImage(commandBuffer, buffer, image,
-                         VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
-  endSingleTimeCommands(commandBuffer);
-}
-
 void Engine::addNode(const std::shared_ptr<Node> &node) {
+  [[maybe_unused]] const bool inserted =
+      m_nodeIndices.emplace(node.get(), m_nodes.size()).second;
+  assert(inserted && "node is already added");
   m_nodes.push_back(node);
+  if (m_prepared) {
+    acquireMesh(node->mesh());
+    acquireTexture(node->texture());
+  }
+}
+
+void Engine::removeNode(const std::shared_ptr<Node> &node) {
+  const auto found = m_nodeIndices.find(node.get());
+  if (found == m_nodeIndices.end()) {
+    return;
+  }
+  const size_t index = found->second;
+  m_nodeIndices.erase(found);
+  // LOD の履歴も同じように移す（まだ updateUBO() を通っていないノードの
+  // 分はないので 0 にする）
+  const size_t last = m_nodes.size() - 1;
+  if (index < m_nodeLods.size()) {
+    m_nodeLods[index] = last < m_nodeLods.size() ? m_nodeLods[last] : 0;
+  }
+  m_nodeLods.resize(std::min(m_nodeLods.size(), last));
+  // 最後のノードを空いた位置に移す（ノードの index はフレームごとに
+  // 振り直すので、順番は保たなくてよい）
+  if (index + 1 != m_nodes.size()) {
+    m_nodes[index] = std::move(m_nodes.back());
+    m_nodeIndices[m_nodes[index].get()] = index;
+  }
+  m_nodes.pop_back();
+  if (m_prepared) {
+    releaseMesh(node->mesh());
+    releaseTexture(node->texture());
+  }
 }
 
 // MARK: MSAA
@@ -8,9 +8,20 @@
 #include <SDL3/SDL.h>
 #include <SDL3/SDL_vulkan.h>
 
+#include "b3/bvh.hpp"
 #include "b3/camera.hpp"
+#include "b3/draw_batch.hpp"
+#include "b3/free_list_allocator.hpp"
+#include "b3/frustum_culling.hpp"
+#include "b3/job_system.hpp"
+#include "b3/loose_octree.hpp"
+#include "b3/mesh_simplifier.hpp"
+#include "b3/texture_registry.hpp"
 #include "b3/types.hpp"
+#include "b3/upload_batcher.hpp"
+#include "b3/vertex_quantization.hpp"
 
+#include <functional>
 #include <memory>
 #include <unordered_map>
 #include <unordered_set>
@@ -31,20 +42,87 @@ struct AllocatedImage {
   VmaAllocation allocation = VK_NULL_HANDLE;
 };
 
+// 1つの大きなバッファを FreeListAllocator で切り分けたもの
+struct GeometryArena {
+  AllocatedBuffer buffer;
+  // 頂点のアリーナだけが持つ、法線と UV のストリーム（buffer には位置だけを
+  // 置き、同じ要素の位置に置く）
+  AllocatedBuffer attributeBuffer;
+  // 要素（頂点やインデックス）の数を単位にする
+  FreeListAllocator allocator;
+  // 拡張したときのコピーが終わるアップロードのバッチ番号
+  uint64_t readyValue = 0;
+  // 拡張する前のバッファ。コピーが終わるまでは描画でこちらを使い、
+  // 終わったら描画中のフレームが使い終わってから破棄する
+  // （アップロードは常に buffer に書き込む）
+  AllocatedBuffer retiredBuffer;
+  AllocatedBuffer retiredAttributeBuffer;
+
+  // 描画でバインドするバッファ
+  const AllocatedBuffer &drawBuffer() const {
+    return retiredBuffer.buffer != VK_NULL_HANDLE ? retiredBuffer : buffer;
+  }
+  const AllocatedBuffer &drawAttributeBuffer() const {
+    return retiredBuffer.buffer != VK_NULL_HANDLE ? retiredAttributeBuffer
+                                                  : attributeBuffer;
+  }
+};
+
 struct MeshData {
-  AllocatedBuffer vertexBuffer;
-  AllocatedBuffer indexBuffer;
+  // 共有の頂点バッファ、インデックスバッファ上の位置（要素数単位）
+  int32_t vertexOffset = 0;
+  uint32_t vertexCount = 0;
+  // VertexFormat::Packed の頂点を元に戻す変換（NodeData に写してシェーダーへ）
+  VertexDequantization dequantization;
+  // 全 LOD のインデックスを置いた領域
+  uint32_t firstIndex = 0;
+  uint32_t indexCount = 0;
+  // 頂点が 65536 個以下のメッシュは 16 bit のインデックスを index16Arena に
+  // 置く（firstIndex はそのアリーナ上の位置）
+  VkIndexType indexType = VK_INDEX_TYPE_UINT32;
+  // LOD ごとのインデックスの範囲（細かい順。レベル 0 が元のメッシュ）と、
+  // 元のメッシュからの誤差（selectLod() に渡す）
+  struct Lod {
+    uint32_t firstIndex = 0;
+    uint32_t indexCount = 0;
+    // このレベルのインデックスが参照する頂点の数（統計用）
+    uint32_t vertexCount = 0;
+  };
+  std::vector<Lod> lods;
+  std::vector<float> lodErrors;
+  // メッシュの連番（インスタンス描画でノードをまとめるのに使う）
+  uint32_t id = 0;
+  // アップロードが終わるバッチ番号（UploadBatcher）
+  uint64_t uploadValue = 0;
+  // このメッシュを使っているノードの数
+  uint32_t users = 0;
 };
 
 struct TextureData {
   VkImage image = VK_NULL_HANDLE;
   VmaAllocation allocation = VK_NULL_HANDLE;
   VkImageView imageView = VK_NULL_HANDLE;
+  // アップロードが終わるバッチ番号（UploadBatcher）
+  uint64_t uploadValue = 0;
+};
+
+// 描画中のフレームが使い終わってから破棄するリソース
+struct DeferredDeletion {
+  // このアップロードのバッチが終わるまでは破棄しない
+  uint64_t uploadValue = 0;
+  std::function<void()> destroy;
 };
 
 class Engine {
-  static constexpr uint32_t MAX_NODES = 32;
+  // ノード用バッファの初期容量（足りなくなった時点でフレーム毎に拡張する）
+  static constexpr size_t INITIAL_NODE_CAPACITY = 64;
+  // 共有の頂点バッファ、インデックスバッファの初期容量（要素数）
+  static constexpr uint64_t INITIAL_VERTEX_CAPACITY = 1 << 16;
+  static constexpr uint64_t INITIAL_INDEX_CAPACITY = 1 << 18;
   static constexpr uint32_t MAX_TEXTURES = 4096;
+  // メッシュごとの LOD の最大レベル数（DrawBatcher の id は
+  // MeshData::id * MESH_LOD_LEVELS + レベル）
+  static constexpr uint32_t MESH_LOD_LEVELS = DEFAULT_LOD_LEVELS;
   static constexpr int SHADOWMAP_SIZE = 2048;
   static constexpr float lightFOV = 45.0f;
   static constexpr float zNear = 1.0f;
@@ -67,15 +145,20 @@ class Engine {
     float ambient = 0.1f;
   };
 
-  struct ModelUBO {
+  // ノードごとのデータ。フレームごとに1つのストレージバッファに並べ、
+  // シーン/シャドウの両方のパスから gl_InstanceIndex で参照する（std430）。
+  struct NodeData {
     glm::mat4 model;
-    glm::mat4 shadowMatrix;
-    glm::uint32_t texIndex;
-  };
-
-  struct ShadowUniformBufferObject {
+    // ライトから見た MVP（シーンのパスでは bias を掛けてシャドウマップを引く）
     glm::mat4 depthMVP;
+    // メッシュの VertexDequantization（xyz だけ使う）
+    glm::vec4 positionScale{1.f};
+    glm::vec4 positionOffset{0.f};
+    glm::vec4 texCoordTransform{1.f, 1.f, 0.f, 0.f};
+    glm::uint32_t texIndex;
+    glm::uint32_t padding[3];
   };
+  static_assert(sizeof(NodeData) == 192, "NodeData must match std430 layout");
 
   struct SwapchainDimensions {
     uint32_t width = 0;
@@ -90,18 +173,28 @@ class Engine {
     VkSemaphore swapchain_acquire_semaphore = VK_NULL_HANDLE;
     VkSemaphore swapchain_release_semaphore = VK_NULL_HANDLE;
 
+    // バッファは作成時から破棄するまでマップしたままにする（*Mapped）
     VkDescriptorSet sceneDescriptorSet = VK_NULL_HANDLE;
     VkBuffer sceneUniformBuffer = VK_NULL_HANDLE;
     VmaAllocation sceneUniformBufferAllocation = VK_NULL_HANDLE;
+    uint8_t *sceneUniformBufferMapped = nullptr;
 
-    VkDescriptorSet modelDescriptorSet = VK_NULL_HANDLE;
-    VkBuffer modelUniformBuffer = VK_NULL_HANDLE;
-    VmaAllocation modelUniformBufferAllocation = VK_NULL_HANDLE;
+    VkDescriptorSet nodeDescriptorSet = VK_NULL_HANDLE;
+    VkBuffer nodeBuffer = VK_NULL_HANDLE;
+    VmaAllocation nodeBufferAllocation = VK_NULL_HANDLE;
+    NodeData *nodeBufferMapped = nullptr;
+    // インスタンスごとのノードの index（シーン、シャドウの順に並べる）
+    VkBuffer instanceBuffer = VK_NULL_HANDLE;
+    VmaAllocation instanceBufferAllocation = VK_NULL_HANDLE;
+    uint32_t *instanceBufferMapped = nullptr;
 
     glm::mat4 depthMVP;
-    VkDescriptorSet shadowDescriptorSet = VK_NULL_HANDLE;
-    VkBuffer shadowUniformBuffer = VK_NULL_HANDLE;
-    VmaAllocation shadowUniformBufferAllocation = VK_NULL_HANDLE;
+
+    // ノード用バッファに格納できるノード数
+    size_t nodeCapacity = 0;
+
+    // このフレームのフェンスを待った後に破棄するリソース
+    std::vector<DeferredDeletion> deletions;
   };
 
   struct Context {
@@ -111,6 +204,9 @@ class Engine {
     vkb::PhysicalDevice physicalDevice;
     vkb::Device device;
     VkQueue queue = VK_NULL_HANDLE;
+    // アップロード用のキュー（転送専用のものがなければ queue と同じ）
+    VkQueue transferQueue = VK_NULL_HANDLE;
+    int32_t transferQueueIndex = -1;
     vkb::Swapchain swapchain;
     SwapchainDimensions swapchainDimensions;
     VkSurfaceKHR surface = VK_NULL_HANDLE;
@@ -123,18 +219,30 @@ class Engine {
     std::vector<PerFrame> perFrame;
     uint32_t currentIndex = 0;
 
-    // command pool for transfer
-    VkCommandPool commandPool = VK_NULL_HANDLE;
-
     // VMA
     VmaAllocator vmaAllocator = VK_NULL_HANDLE;
 
+    // 頂点、インデックス、テクスチャのアップロード
+    UploadBatcher uploader;
+
+    // 全メッシュの頂点とインデックスを置く共有バッファ
+    GeometryArena vertexArena;
+    GeometryArena indexArena;
+    GeometryArena index16Arena;
     // メッシュデータ
     std::unordered_map<std::shared_ptr<Mesh>, MeshData> meshBufferMap;
-
-    // テクスチャデータ
-    std::unordered_map<std::shared_ptr<Texture>, TextureData> textureMap;
+    // MeshData::id からメッシュ（削除したメッシュの id は nullptr）
+    std::vector<std::shared_ptr<Mesh>> meshes;
+    // 再利用できる MeshData::id
+    std::vector<uint32_t> freeMeshIds;
+
+    // テクスチャのスロット（bindless 配列上の位置で、シェーダーの texIndex）
+    TextureRegistry textureRegistry{MAX_TEXTURES};
+    // スロットごとのテクスチャデータ（空いているスロットは image が null）
+    std::vector<TextureData> textures;
     VkSampler textureSampler;
+    // BC 圧縮の形式をサンプリングできる（textureCompressionBC）
+    bool textureCompressionBC = false;
 
     // Descriptor Pool
     VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
@@ -143,9 +251,8 @@ class Engine {
     VkDescriptorSetLayout sceneDescriptorSetLayout = VK_NULL_HANDLE;
     size_t sceneUBOBufferSizeForVS = 0;
 
-    // UBO
-    VkDescriptorSetLayout modelDescriptorSetLayout = VK_NULL_HANDLE;
-    size_t modelUBOBufferSizePerNode = 0;
+    // ノードごとのデータ
+    VkDescriptorSetLayout nodeDescriptorSetLayout = VK_NULL_HANDLE;
 
     // Texture Resource Descriptor
     VkDescriptorSetLayout textureDescriptorSetLayout = VK_NULL_HANDLE;
@@ -169,8 +276,6 @@ class Engine {
     VkImageView shadowImageView = VK_NULL_HANDLE;
     VkPipeline shadowPipeline = VK_NULL_HANDLE;
     VkPipelineLayout shadowPipelineLayout = VK_NULL_HANDLE;
-    VkDescriptorSetLayout shadowDescriptorSetLayout = VK_NULL_HANDLE;
-    size_t shadowUBOBufferSizePerNode = 0;
     VkSampler shadowSampler = VK_NULL_HANDLE;
   };
 
@@ -197,6 +302,26 @@ public:
 
   void initVertexBuffer();
   void initTexture();
+  // インターリーブした count 個の頂点（m_vertexFormat）を、位置と、
+  // 法線と UV のストリームに分けて vertexArena に送る
+  uint64_t uploadVertexStreams(uint64_t vertexOffset, const void *vertices,
+                               size_t count);
+
+  // メッシュ/テクスチャを使うノードを1つ増やす（初めてなら GPU に送る）
+  void acquireMesh(const std::shared_ptr<Mesh> &mesh);
+  void acquireTexture(const std::shared_ptr<Texture> &texture);
+  // 使うノードを1つ減らす（いなくなれば、描画中のフレームが終わってから破棄する）
+  void releaseMesh(const std::shared_ptr<Mesh> &mesh);
+  void releaseTexture(const std::shared_ptr<Texture> &texture);
+
+  // 次にフェンスを待つフレームが終わった後に destroy を呼ぶ
+  // （uploadValue のアップロードが終わっていなければ、さらに後にする）
+  void deferDeletion(uint64_t uploadValue, std::function<void()> destroy);
+  // フェンス待ち済みのフレームについて、破棄を実行し、新しい破棄を積む
+  void collectDeletions(PerFrame &per_frame);
+  // 拡張のコピーが終わった共有バッファを新しいバッファで描画するようにし、
+  // 古いバッファの破棄を積む
+  void retireGrownArenas();
 
   void initUBO();
   void initDescriptorPool();
@@ -208,29 +333,37 @@ public:
   void allocateSceneDescriptorSet();
   void bindSceneDescriptorSet();
 
-  // モデル向けのディスクリプタセット
-  void initModelDescriptorSetLayout();
-  void initModelUB();
-  void allocateModelDescriptorSet();
-  void bindModelDescriptorSet();
+  // ノード向けのディスクリプタセット（シーンとシャドウで共有する）
+  void initNodeDescriptorSetLayout();
+  void initNodeBuffer();
+  void createNodeBuffer(PerFrame &per_frame, size_t capacity);
+  void allocateNodeDescriptorSet();
+  void bindNodeDescriptorSet();
+  void writeNodeDescriptorSet(PerFrame &per_frame);
 
-  // シャドウ向けのディスクリプタセット
-  void initShadowDescriptorSetLayout();
-  void initShadowUB();
-  void allocateShadowDescriptorSet();
-  void bindShadowDescriptorSet();
+  /**
+   * フレームのノード用バッファが全ノードを格納できるように拡張する。
+   * フェンス待ち済みのフレームに対してのみ呼び出すこと
+   * （そのフレームのバッファはGPUから参照されていないので、デバイスの待機は不要）。
+   * @param per_frame 対象のフレーム
+   * @param nodeCount 格納するノード数
+   * @return バッファを作り直した場合はtrue
+   */
+  bool ensureNodeCapacity(PerFrame &per_frame, size_t nodeCount);
+
+  /**
+   * 必要なノード数から新しいバッファ容量を求める（倍々で拡張する）
+   * @param capacity 現在の容量
+   * @param required 必要なノード数
+   * @return 新しい容量
+   */
+  static size_t growNodeCapacity(size_t capacity, size_t required);
 
   // テクスチャ向けのデスクリプタセット
   void initTextureDescriptorSetLayout();
   void allocateTextureDescriptorSet();
   void bindTextureDescriptorSet();
-
-  /**
-   * UBOサイズから最小のDynamic UBOアラインメントを計算する
-   * @param uboSize UBOのサイズ
-   * @return Dynamic UBOのアラインメント
-   */
-  size_t minDynamicUBOAlignment(size_t uboSize);
+  void writeTextureDescriptor(uint32_t slot, VkImageView imageView);
 
   void updateUBO(PerFrame &per_frame);
 
@@ -254,6 +387,15 @@ public:
 
   void render(uint32_t swapchainIndex);
   void renderShadow(uint32_t swapchainIndex, VkCommandBuffer cmd);
+  // drawBatches() が数える、インスタンスごとの頂点数と三角形数の合計
+  struct DrawCounts {
+    uint64_t vertices = 0;
+    uint64_t triangles = 0;
+  };
+  // まとめた描画を発行し、描画コマンドの数を返す。positionsOnly なら
+  // 位置のストリームだけをバインドする（深度だけのパス）
+  uint32_t drawBatches(VkCommandBuffer cmd, const DrawBatcher &batcher,
+                       bool positionsOnly, DrawCounts &counts);
 
   VkResult presentImage(uint32_t index);
 
@@ -265,36 +407,42 @@ public:
                              VkPipelineStageFlags2 srcStage,
                              VkPipelineStageFlags2 dstStage);
 
-  void transitionImageLayout(VkImage image, VkFormat format,
-                             VkImageLayout oldLayout, VkImageLayout newLayout);
-
   VkSurfaceFormatKHR
   selectSurfaceFormat(VkPhysicalDevice gpu, VkSurfaceKHR surface,
                       std::vector<VkFormat> const &preferred_formats = {
                           VK_FORMAT_R8G8B8A8_SRGB, VK_FORMAT_B8G8R8A8_SRGB,
                           VK_FORMAT_A8B8G8R8_SRGB_PACK32});
 
+  // 最適タイリングで線形フィルタの blit ができるか（ミップの生成に使う）
+  bool supportsLinearBlit(VkFormat format);
+  // 最適タイリングで線形フィルタでサンプリングでき、コピー先にできるか
+  bool supportsSampledFormat(VkFormat format);
+  // 頂点バッファの属性に使えるか
+  bool supportsVertexFormat(VkFormat format);
   VkFormat findSupportedFormat(const std::vector<VkFormat> &candidates,
                                VkImageTiling tiling,
                                VkFormatFeatureFlags features);
   VkFormat findDepthFormat();
 
-  // ワンショットコマンドバッファの開始
-  VkCommandBuffer beginSingleTimeCommands();
-
-  // ワンショットコマンドバッファの終了
-  void endSingleTimeCommands(VkCommandBuffer commandBuffer);
-
   // バッファの作成
   AllocatedBuffer createBuffer(VkDeviceSize size, VkBufferUsageFlags usage,
                                VmaMemoryUsage memoryUsage);
 
-  // バッファーのコピー
-  void copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size);
-
-  // バッファの作成と初期データの設定
-  AllocatedBuffer uploadBuffer(const void *data, VkDeviceSize size,
-                               VkBufferUsageFlags usage = 0);
+  // 既存のバッファの一部への書き込み
+  // （結果が使えるようになるアップロードのバッチ番号を返す）
+  uint64_t uploadToBuffer(VkBuffer buffer, VkDeviceSize offset,
+                          const void *data, VkDeviceSize size);
+
+  // 共有バッファから count 要素を割り当てる（足りなければ拡張する）。
+  // attributeSize が 0 でなければ attributeBuffer も同じ要素数で持つ
+  uint64_t allocateGeometry(GeometryArena &arena, uint64_t count,
+                            VkDeviceSize elementSize, VkBufferUsageFlags usage,
+                            VkDeviceSize attributeSize = 0);
+  // 共有バッファを capacity 要素に拡張し、今までの内容をコピーする。
+  // コピーが終わるまでは、描画は拡張する前のバッファを使い続ける
+  void growGeometryArena(GeometryArena &arena, uint64_t capacity,
+                         VkDeviceSize elementSize, VkBufferUsageFlags usage,
+                         VkDeviceSize attributeSize = 0);
 
   // イメージの作成
   AllocatedImage
@@ -302,9 +450,6 @@ public:
               VkSampleCountFlagBits numSamples, VkFormat format,
               VkImageTiling tiling, VkImageUsageFlags usage,
               VmaMemoryUsage memoryUsage = VMA_MEMORY_USAGE_AUTO);
-  // バッファのイメージへのコピー
-  void copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width,
-                         uint32_t height);
 
   // MSAAの最大サンプル数の取得
   VkSampleCountFlagBits getMaxUsableSampleCount();
@@ -315,7 +460,15 @@ public:
   // ***** シーングラフ *****
 
   // add a node to scene graph
+  // 描画対象として登録する。親子関係は変換行列の計算にだけ使われるので、
+  // 子ノードも描画する場合は個別に登録すること。
+  // prepare() の後に呼んだ場合は、メッシュとテクスチャをその場で GPU に送り、
+  // アップロードが終わったフレームから描画する。
   void addNode(const std::shared_ptr<Node> &node);
+  // 描画対象から外す。どのノードも使わなくなったメッシュとテクスチャは、
+  // 描画中のフレームが終わってから破棄する。
+  void removeNode(const std::shared_ptr<Node> &node);
+  size_t nodeCount() const { return m_nodes.size(); }
 
   void setWindowSize(uint32_t width, uint32_t height) {
     m_windowWidth = width;
@@ -328,17 +481,176 @@ public:
 
   void setLightPos(const glm::vec4 &lightPos) { m_lightPos = lightPos; }
 
+  // カリングの方法
+  enum class CullingMode {
+    // 全ノードを SIMD でまとめて判定する
+    Linear,
+    // Bvh で部分木ごとに判定する
+    Bvh,
+    // LooseOctree で判定する（ほとんどのノードが毎フレーム動く場合向け）
+    LooseOctree,
+  };
+  void setCullingMode(CullingMode mode) { m_cullingMode = mode; }
+  CullingMode cullingMode() const { return m_cullingMode; }
+
+  // GPU に送る前に、メッシュを頂点キャッシュとオーバードローに合わせて
+  // 並べ替えるか（optimizeMesh()）。並べ替えるのは GPU に送るコピーで、
+  // アプリの Mesh は書き換えない。
+  void setOptimizeMeshes(bool optimize) { m_optimizeMeshes = optimize; }
+  bool optimizeMeshes() const { return m_optimizeMeshes; }
+
+  // GPU に置く頂点の形式。prepare() の前に決める。
+  // Packed は 1 頂点 16 バイトに量子化する（GPU が形式に対応していなければ
+  // prepare() で Float に戻す）
+  void setVertexFormat(VertexFormat format) { m_vertexFormat = format; }
+  VertexFormat vertexFormat() const { return m_vertexFormat; }
+
+  // GPU に送るときにメッシュの LOD を作るか（buildLodChain()）。
+  // 作った場合は、ノードごとに画面上の誤差が lodPixelError ピクセル以下に
+  // なる最も粗いレベルで描画する
+  void setMeshLods(bool lods) { m_meshLods = lods; }
+  bool meshLods() const { return m_meshLods; }
+  void setLodPixelError(float pixels) { m_lodPixelError = pixels; }
+  float lodPixelError() const { return m_lodPixelError; }
+
+  // フレーム更新（ノードのデータの書き込みとカリング）に使うスレッドプール
+  JobSystem &jobSystem() { return m_jobs; }
+
+  // ***** 統計情報 *****
+
+  struct Stats {
+    // ノード用バッファを拡張した回数
+    uint64_t nodeBufferGrowths = 0;
+    // フレーム更新中にデバイス/キューの待機を行った回数
+    uint64_t idleWaits = 0;
+    // NodeData の書き込み（Linear のカリングを含む）にかかった CPU 時間
+    // 直近のフレームの値と、累計・回数
+    double uboFillMs = 0.0;
+    double uboFillTotalMs = 0.0;
+    uint64_t uboFills = 0;
+    // 直近のフレームの描画コマンド数と、描画したインスタンス数
+    uint32_t sceneDrawCalls = 0;
+    uint32_t sceneInstances = 0;
+    uint32_t shadowDrawCalls = 0;
+    uint32_t shadowInstances = 0;
+    // 直近のフレームで描画した三角形の数（選んだ LOD のもの）
+    uint64_t sceneTriangles = 0;
+    uint64_t shadowTriangles = 0;
+    // 直近のフレームのシャドウのパスが読む頂点のバイト数の見積もりと、
+    // 位置を分けずにインターリーブした頂点を読んだ場合の見積もり。
+    // GPU で計測した値ではなく、インスタンスごとに LOD が参照する頂点を
+    // 1 回ずつ読むとみなして、ストライドを掛けたもの。
+    uint64_t estimatedShadowVertexBytes = 0;
+    uint64_t estimatedShadowInterleavedVertexBytes = 0;
+    // prepare() にかかった時間と、アップロードの記録にかかった時間
+    // （アップロードの完了は待たない）
+    double prepareMs = 0.0;
+    double meshUploadMs = 0.0;
+    double textureUploadMs = 0.0;
+    // 並べ替えたメッシュの数と時間、並べ替えの前後に頂点シェーダーを
+    // 実行する回数（FIFO キャッシュで数えたもの）と三角形の数
+    uint64_t optimizedMeshes = 0;
+    double meshOptimizeMs = 0.0;
+    uint64_t meshTransformedBefore = 0;
+    uint64_t meshTransformedAfter = 0;
+    uint64_t meshTriangles = 0;
+    // 16 bit のインデックスで置いたメッシュの数と、それで減ったバイト数
+    uint64_t index16Meshes = 0;
+    uint64_t indexBytesSaved = 0;
+    // LOD を作ったメッシュの数と時間、LOD のために増えたインデックスの数
+    uint64_t lodMeshes = 0;
+    double lodMs = 0.0;
+    uint64_t lodIndices = 0;
+    // 量子化した頂点で置いたメッシュの数と、それで減ったバイト数、
+    // 全メッシュでの量子化の最大誤差
+    uint64_t packedMeshes = 0;
+    uint64_t vertexBytesSaved = 0;
+    QuantizationError quantizationError;
+    // 破棄を遅らせたリソースの数と、実際に破棄した数
+    uint64_t deferredDeletions = 0;
+    uint64_t executedDeletions = 0;
+    // ミップを GPU の blit と CPU で作ったテクスチャの数と、CPU の時間
+    uint64_t gpuMipTextures = 0;
+    uint64_t cpuMipTextures = 0;
+    double cpuMipMs = 0.0;
+    // BC 圧縮のまま置いたテクスチャの数と、GPU が対応していないため CPU で
+    // 展開したテクスチャの数
+    uint64_t compressedTextures = 0;
+    uint64_t decompressedTextures = 0;
+    // 1 / 2 チャンネルの形式（R8, RG8, R16, RG16）で置いたテクスチャの数
+    uint64_t narrowTextures = 0;
+    // テクスチャが使う VRAM と、すべて RGBA8 だった場合の量（バイト）
+    uint64_t textureBytes = 0;
+    uint64_t textureRGBA8Bytes = 0;
+    // ステージングに直接デコードしたテクスチャの数と、GPU に送った後に
+    // 手放した CPU 側の画素のバイト数
+    uint64_t streamedTextures = 0;
+    uint64_t releasedTextureBytes = 0;
+  };
+
+  const Stats &stats() const { return m_stats; }
+  const UploadBatcher::Stats &uploadStats() const {
+    return m_context.uploader.stats();
+  }
+
+  // フレームのノード用バッファの容量
+  size_t nodeCapacity(uint32_t frameIndex) const {
+    return m_context.perFrame[frameIndex].nodeCapacity;
+  }
+  size_t frameCount() const { return m_context.perFrame.size(); }
+  // GPU 上にあるメッシュとテクスチャの数
+  size_t meshCount() const { return m_context.meshBufferMap.size(); }
+  size_t textureCount() const {
+    return m_context.textureRegistry.textureCount();
+  }
+  const TextureRegistry::Stats &textureRegistryStats() const {
+    return m_context.textureRegistry.stats();
+  }
+
 private:
   Context m_context;
   VkSampleCountFlagBits m_msaaSamples = VK_SAMPLE_COUNT_1_BIT;
 
   // nodes
   std::vector<std::shared_ptr<Node>> m_nodes;
-
-  // 影を落とすノードかどうかのフラグ
-  std::vector<bool> m_shadowCastingNodes;
-  // カメラに写っているノードかどうかのフラグ
-  std::vector<bool> m_visibleNodes;
+  // m_nodes 上の位置（removeNode() は最後のノードを空いた位置に移す）
+  std::unordered_map<const Node *, size_t> m_nodeIndices;
+  // prepare() が終わったか（後から追加したノードはその場で GPU に送る）
+  bool m_prepared = false;
+  // 次にフェンスを待ったフレームに積む破棄
+  std::vector<DeferredDeletion> m_pendingDeletions;
+
+  // ノードのワールド座標系での Bounding Sphere（SoA）
+  BoundingSphereArray m_nodeSpheres;
+  // 影を落とすノードの index
+  std::vector<uint32_t> m_shadowCasterIndices;
+  // カメラに写っているノードの index
+  std::vector<uint32_t> m_visibleNodeIndices;
+  CullingMode m_cullingMode = CullingMode::Bvh;
+  bool m_optimizeMeshes = true;
+  VertexFormat m_vertexFormat = VertexFormat::Float;
+  bool m_meshLods = true;
+  float m_lodPixelError = 1.f;
+  // m_nodeSpheres に対する BVH（CullingMode::Bvh のとき使う）
+  Bvh m_bvh;
+  // m_nodeSpheres に対するルース八分木（CullingMode::LooseOctree のとき使う）
+  LooseOctree m_octree;
+  // ノードが使うメッシュの MeshData::id * MESH_LOD_LEVELS + LOD のレベル
+  // （メッシュかテクスチャのアップロードが終わっていなければ
+  // DrawBatcher::NO_MESH にして描画しない）
+  std::vector<uint32_t> m_nodeMeshIds;
+  // ノードが前のフレームで使った LOD のレベル（選び直すときの履歴）
+  std::vector<uint8_t> m_nodeLods;
+  // このフレームで使える、完了したアップロードのバッチ番号
+  uint64_t m_uploadCompleted = 0;
+  // 描画するノードをメッシュごとにまとめたインスタンス描画
+  DrawBatcher m_sceneBatches;
+  DrawBatcher m_shadowBatches;
+  // CullingMode::Linear で、範囲ごとに判定した結果（範囲の順に連結する）
+  std::vector<std::vector<uint32_t>> m_chunkShadowCasters;
+  std::vector<std::vector<uint32_t>> m_chunkVisibleNodes;
+
+  JobSystem m_jobs;
 
   // window size
   uint32_t m_windowWidth = 1024;
@@ -351,6 +663,8 @@ private:
   float m_ambient = 0.1f;
 
   Camera m_camera = Camera::lookAt({1.7f, 1.7f, 1.0f}, {0.0f, 0.0f, 0.0});
+
+  Stats m_stats;
 };
 
 } // namespace b3
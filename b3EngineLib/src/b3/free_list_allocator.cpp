@@ -0,0 +1,108 @@
+#include "free_list_allocator.hpp"
+
+#include <cassert>
+#include <iterator>
+
+namespace b3 {
+
+FreeListAllocator::FreeListAllocator(uint64_t capacity) { grow(capacity); }
+
+uint64_t FreeListAllocator::allocate(uint64_t size) {
+  if (size == 0) {
+    return INVALID_OFFSET;
+  }
+  // size 以上で最も小さい空き領域
+  const auto bySize = m_freeBySize.lower_bound(size);
+  if (bySize == m_freeBySize.end()) {
+    return INVALID_OFFSET;
+  }
+  const uint64_t offset = bySize->second;
+  const uint64_t blockSize = bySize->first;
+  eraseFreeBlock(m_freeByOffset.find(offset));
+  if (blockSize > size) {
+    insertFreeBlock(offset + size, blockSize - size);
+  }
+  m_allocations.emplace(offset, size);
+  m_used += size;
+  return offset;
+}
+
+void FreeListAllocator::free(uint64_t offset) {
+  const auto allocation = m_allocations.find(offset);
+  assert(allocation != m_allocations.end());
+  if (allocation == m_allocations.end()) {
+    return;
+  }
+  uint64_t size = allocation->second;
+  m_allocations.erase(allocation);
+  m_used -= size;
+
+  // 前後の空き領域と結合する
+  auto next = m_freeByOffset.lower_bound(offset);
+  if (next != m_freeByOffset.end() && next->first == offset + size) {
+    size += next->second;
+    next = std::next(next);
+    eraseFreeBlock(std::prev(next));
+  }
+  if (next != m_freeByOffset.begin()) {
+    const auto prev = std::prev(next);
+    if (prev->first + prev->second == offset) {
+      offset = prev->first;
+      size += prev->second;
+      eraseFreeBlock(prev);
+    }
+  }
+  insertFreeBlock(offset, size);
+}
+
+void FreeListAllocator::grow(uint64_t capacity) {
+  if (capacity <= m_capacity) {
+    return;
+  }
+  uint64_t offset = m_capacity;
+  uint64_t size = capacity - m_capacity;
+  // 末尾が空いていれば、その空き領域を伸ばす
+  if (!m_freeByOffset.empty()) {
+    const auto last = std::prev(m_freeByOffset.end());
+    if (last->first + last->second == m_capacity) {
+      offset = last->first;
+      size += last->second;
+      eraseFreeBlock(last);
+    }
+  }
+  insertFreeBlock(offset, size);
+  m_capacity = capacity;
+}
+
+void FreeListAllocator::reset() {
+  m_freeByOffset.clear();
+  m_freeBySize.clear();
+  m_allocations.clear();
+  m_used = 0;
+  if (m_capacity > 0) {
+    insertFreeBlock(0, m_capacity);
+  }
+}
+
+uint64_t FreeListAllocator::largestFreeBlock() const {
+  return m_freeBySize.empty() ? 0 : std::prev(m_freeBySize.end())->first;
+}
+
+void FreeListAllocator::insertFreeBlock(uint64_t offset, uint64_t size) {
+  m_freeByOffset.emplace(offset, size);
+  m_freeBySize.emplace(size, offset);
+}
+
+void FreeListAllocator::eraseFreeBlock(
+    std::map<uint64_t, uint64_t>::iterator it) {
+  auto [first, last] = m_freeBySize.equal_range(it->second);
+  for (; first != last; ++first) {
+    if (first->second == it->first) {
+      m_freeBySize.erase(first);
+      break;
+    }
+  }
+  m_freeByOffset.erase(it);
+}
+
+} // namespace b3
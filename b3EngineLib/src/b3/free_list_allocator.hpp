@@ -0,0 +1,52 @@
+#ifndef __FREE_LIST_ALLOCATOR_HPP__
+#define __FREE_LIST_ALLOCATOR_HPP__
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <unordered_map>
+
+namespace b3 {
+
+// 1つの大きなバッファを切り分けるための、オフセットだけを管理する割り当て器。
+//
+// 単位は呼び出し側が決める（頂点なら頂点数、インデックスならインデックス数）。
+// 空き領域は best-fit で選び、解放時には隣り合う空き領域と結合する。
+class FreeListAllocator {
+public:
+  static constexpr uint64_t INVALID_OFFSET = UINT64_MAX;
+
+  explicit FreeListAllocator(uint64_t capacity = 0);
+
+  // size 単位の領域を割り当てて先頭のオフセットを返す。
+  // 空きがなければ INVALID_OFFSET を返す（size == 0 も割り当てない）。
+  uint64_t allocate(uint64_t size);
+  // allocate() で得たオフセットの領域を解放する
+  void free(uint64_t offset);
+  // 末尾に領域を足して容量を広げる（縮めることはできない）
+  void grow(uint64_t capacity);
+  // すべての割り当てを捨てる
+  void reset();
+
+  uint64_t capacity() const { return m_capacity; }
+  uint64_t used() const { return m_used; }
+  uint64_t largestFreeBlock() const;
+  size_t freeBlockCount() const { return m_freeByOffset.size(); }
+  size_t allocationCount() const { return m_allocations.size(); }
+
+private:
+  void insertFreeBlock(uint64_t offset, uint64_t size);
+  void eraseFreeBlock(std::map<uint64_t, uint64_t>::iterator it);
+
+  uint64_t m_capacity = 0;
+  uint64_t m_used = 0;
+  // 空き領域（オフセット -> 大きさ）と、大きさで引くための索引
+  std::map<uint64_t, uint64_t> m_freeByOffset;
+  std::multimap<uint64_t, uint64_t> m_freeBySize;
+  // 割り当て済みの領域（オフセット -> 大きさ）
+  std::unordered_map<uint64_t, uint64_t> m_allocations;
+};
+
+} // namespace b3
+
+#endif
@@ -1,5 +1,6 @@
 #include "frustum_culling.hpp"
 
+#include <bit>
 #include <iostream>
 #include <format>
 
@@ -60,7 +61,8 @@ Frustum extractFrustum(const glm::mat4 &vp) {
 bool sphereInFrustum(const Frustum &f, const BoundingSphere &boundingSphere) {
   for (int i = 0; i < 6; i++) {
     float dist = f.planes[i].distance(boundingSphere.center);
-    if (dist < -boundingSphere.radius) {
+    // NaN の球は比較が偽になるので外側とする（SIMD の比較と同じ）
+    if (!(dist >= -boundingSphere.radius)) {
       // 完全に外側
       return false;
     }
@@ -68,6 +70,179 @@ bool sphereInFrustum(const Frustum &f, const BoundingSphere &boundingSphere) {
   return true; // 一部でも中にあれば描画する
 }
 
+FrustumPlanes toPlanes(const Frustum &f) {
+  FrustumPlanes planes;
+  for (int i = 0; i < 6; i++) {
+    planes.nx[i] = f.planes[i].normal.x;
+    planes.ny[i] = f.planes[i].normal.y;
+    planes.nz[i] = f.planes[i].normal.z;
+    planes.d[i] = f.planes[i].d;
+  }
+  return planes;
+}
+
+// 可視ビットが立っている要素の index を詰めて書き込む
+static size_t appendVisible(uint32_t mask, uint32_t base, uint32_t *out,
+                            size_t count) {
+  while (mask != 0) {
+    out[count++] = base + static_cast<uint32_t>(std::countr_zero(mask));
+    mask &= mask - 1;
+  }
+  return count;
+}
+
+static size_t cullScalar(const FrustumPlanes &planes,
+                         const BoundingSphereArray &spheres, size_t begin,
+                         size_t end, uint32_t *out, size_t count) {
+  for (size_t i = begin; i < end; ++i) {
+    bool inside = true;
+    for (int p = 0; p < 6 && inside; p++) {
+      const float dist = planes.nx[p] * spheres.cx[i] +
+                         planes.ny[p] * spheres.cy[i] +
+                         planes.nz[p] * spheres.cz[i] + planes.d[p];
+      inside = dist >= -spheres.radius[i];
+    }
+    if (inside) {
+      out[count++] = static_cast<uint32_t>(i);
+    }
+  }
+  return count;
+}
+
+#if defined(B3_SIMD_X86)
+
+static size_t cullSSE(const FrustumPlanes &planes,
+                      const BoundingSphereArray &spheres, size_t &i,
+                      size_t n, uint32_t *out) {
+  size_t count = 0;
+  const __m128 signBit = _mm_set1_ps(-0.0f);
+  for (; i + 4 <= n; i += 4) {
+    const __m128 cx = _mm_loadu_ps(&spheres.cx[i]);
+    const __m128 cy = _mm_loadu_ps(&spheres.cy[i]);
+    const __m128 cz = _mm_loadu_ps(&spheres.cz[i]);
+    const __m128 negR = _mm_xor_ps(_mm_loadu_ps(&spheres.radius[i]), signBit);
+    __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+    for (int p = 0; p < 6; p++) {
+      __m128 dist = _mm_mul_ps(_mm_set1_ps(planes.nx[p]), cx);
+      dist = _mm_add_ps(dist, _mm_mul_ps(_mm_set1_ps(planes.ny[p]), cy));
+      dist = _mm_add_ps(dist, _mm_mul_ps(_mm_set1_ps(planes.nz[p]), cz));
+      dist = _mm_add_ps(dist, _mm_set1_ps(planes.d[p]));
+      inside = _mm_and_ps(inside, _mm_cmpge_ps(dist, negR));
+    }
+    count = appendVisible(static_cast<uint32_t>(_mm_movemask_ps(inside)),
+                          static_cast<uint32_t>(i), out, count);
+  }
+  return count;
+}
+
+B3_TARGET_AVX2
+static size_t cullAVX2(const FrustumPlanes &planes,
+                       const BoundingSphereArray &spheres, size_t &i,
+                       size_t n, uint32_t *out) {
+  size_t count = 0;
+  const __m256 signBit = _mm256_set1_ps(-0.0f);
+  for (; i + 8 <= n; i += 8) {
+    const __m256 cx = _mm256_loadu_ps(&spheres.cx[i]);
+    const __m256 cy = _mm256_loadu_ps(&spheres.cy[i]);
+    const __m256 cz = _mm256_loadu_ps(&spheres.cz[i]);
+    const __m256 negR =
+        _mm256_xor_ps(_mm256_loadu_ps(&spheres.radius[i]), signBit);
+    __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+    for (int p = 0; p < 6; p++) {
+      // FMA は丸めが変わるので使わない（スカラー版と結果を揃える）
+      __m256 dist = _mm256_mul_ps(_mm256_set1_ps(planes.nx[p]), cx);
+      dist = _mm256_add_ps(dist,
+                           _mm256_mul_ps(_mm256_set1_ps(planes.ny[p]), cy));
+      dist = _mm256_add_ps(dist,
+                           _mm256_mul_ps(_mm256_set1_ps(planes.nz[p]), cz));
+      dist = _mm256_add_ps(dist, _mm256_set1_ps(planes.d[p]));
+      inside = _mm256_and_ps(inside, _mm256_cmp_ps(dist, negR, _CMP_GE_OQ));
+    }
+    count = appendVisible(static_cast<uint32_t>(_mm256_movemask_ps(inside)),
+                          static_cast<uint32_t>(i), out, count);
+  }
+  return count;
+}
+
+B3_TARGET_AVX512
+static size_t cullAVX512(const FrustumPlanes &planes,
+                         const BoundingSphereArray &spheres, size_t &i,
+                         size_t n, uint32_t *out) {
+  size_t count = 0;
+  const __m512i lane = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11,
+                                         12, 13, 14, 15);
+  for (; i + 16 <= n; i += 16) {
+    const __m512 cx = _mm512_loadu_ps(&spheres.cx[i]);
+    const __m512 cy = _mm512_loadu_ps(&spheres.cy[i]);
+    const __m512 cz = _mm512_loadu_ps(&spheres.cz[i]);
+    const __m512 negR = _mm512_sub_ps(_mm512_setzero_ps(),
+                                      _mm512_loadu_ps(&spheres.radius[i]));
+    __mmask16 inside = 0xffff;
+    for (int p = 0; p < 6; p++) {
+      __m512 dist = _mm512_mul_ps(_mm512_set1_ps(planes.nx[p]), cx);
+      dist = _mm512_add_ps(dist,
+                           _mm512_mul_ps(_mm512_set1_ps(planes.ny[p]), cy));
+      dist = _mm512_add_ps(dist,
+                           _mm512_mul_ps(_mm512_set1_ps(planes.nz[p]), cz));
+      dist = _mm512_add_ps(dist, _mm512_set1_ps(planes.d[p]));
+      inside = _mm512_mask_cmp_ps_mask(inside, dist, negR, _CMP_GE_OQ);
+    }
+    // 可視な index だけを詰めて書き込む
+    const __m512i index =
+        _mm512_add_epi32(_mm512_set1_epi32(static_cast<int>(i)), lane);
+    _mm512_mask_compressstoreu_epi32(out + count, inside, index);
+    count += static_cast<size_t>(std::popcount(static_cast<uint32_t>(inside)));
+  }
+  return count;
+}
+
+#endif
+
+void cullSpheres(const FrustumPlanes &planes,
+                 const BoundingSphereArray &spheres,
+                 std::vector<uint32_t> &visibleIndices) {
+  cullSpheres(planes, spheres, visibleIndices, detectSimdLevel());
+}
+
+void cullSpheres(const FrustumPlanes &planes,
+                 const BoundingSphereArray &spheres,
+                 std::vector<uint32_t> &visibleIndices, SimdLevel level) {
+  visibleIndices.clear();
+  cullSphereRange(planes, spheres, 0, spheres.size(), visibleIndices, level);
+}
+
+void cullSphereRange(const FrustumPlanes &planes,
+                     const BoundingSphereArray &spheres, size_t first,
+                     size_t last, std::vector<uint32_t> &visibleIndices) {
+  cullSphereRange(planes, spheres, first, last, visibleIndices,
+                  detectSimdLevel());
+}
+
+void cullSphereRange(const FrustumPlanes &planes,
+                     const BoundingSphereArray &spheres, size_t first,
+                     size_t last, std::vector<uint32_t> &visibleIndices,
+                     SimdLevel level) {
+  assert(first <= last && last <= spheres.size());
+  const size_t base = visibleIndices.size();
+  visibleIndices.resize(base + (last - first));
+  uint32_t *out = visibleIndices.data() + base;
+  size_t count = 0;
+  size_t i = first;
+#if defined(B3_SIMD_X86)
+  if (level == SimdLevel::AVX512) {
+    count += cullAVX512(planes, spheres, i, last, out + count);
+  }
+  if (level == SimdLevel::AVX2 || level == SimdLevel::AVX512) {
+    count += cullAVX2(planes, spheres, i, last, out + count);
+  }
+  if (level != SimdLevel::Scalar) {
+    count += cullSSE(planes, spheres, i, last, out + count);
+  }
+#endif
+  count = cullScalar(planes, spheres, i, last, out, count);
+  visibleIndices.resize(base + count);
+}
+
 // Bounding Sphereの計算（Ritter）
 // メッシュ頂点: std::vector<glm::vec3> vertices
 BoundingSphere computeBoundingSphere(const std::vector<glm::vec3> &v) {
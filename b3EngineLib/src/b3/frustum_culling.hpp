@@ -2,8 +2,10 @@
 #define __FRUSTUM_CULLING_HPP__
 
 #include "common.hpp"
+#include "simd.hpp"
 #include "types.hpp"
 #include <array>
+#include <limits>
 
 namespace b3 {
 
@@ -40,6 +42,87 @@ struct BoundingSphere {
 // 少しでも重なっていればtrueが返る。
 bool sphereInFrustum(const Frustum &f, const BoundingSphere &boundingSphere);
 
+// Frustum の平面を成分ごとの配列にしたもの（SIMD判定用）
+struct FrustumPlanes {
+  std::array<float, 6> nx;
+  std::array<float, 6> ny;
+  std::array<float, 6> nz;
+  std::array<float, 6> d;
+};
+
+FrustumPlanes toPlanes(const Frustum &f);
+
+// 軸平行境界ボックス
+struct Aabb {
+  glm::vec3 min = glm::vec3(std::numeric_limits<float>::max());
+  glm::vec3 max = glm::vec3(-std::numeric_limits<float>::max());
+
+  void expand(const Aabb &b) {
+    min = glm::min(min, b.min);
+    max = glm::max(max, b.max);
+  }
+  void expand(const glm::vec3 &p) {
+    min = glm::min(min, p);
+    max = glm::max(max, p);
+  }
+  glm::vec3 center() const { return (min + max) * 0.5f; }
+  glm::vec3 extent() const { return (max - min) * 0.5f; }
+  // 表面積（SAH 用）
+  float area() const {
+    const glm::vec3 d = glm::max(max - min, glm::vec3(0.0f));
+    return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+  }
+
+  static Aabb fromSphere(const BoundingSphere &s) {
+    return {s.center - glm::vec3(s.radius), s.center + glm::vec3(s.radius)};
+  }
+};
+
+// Bounding Sphere を成分ごとの配列（SoA）で保持する
+struct BoundingSphereArray {
+  std::vector<float> cx;
+  std::vector<float> cy;
+  std::vector<float> cz;
+  std::vector<float> radius;
+
+  size_t size() const { return radius.size(); }
+  void resize(size_t n) {
+    cx.resize(n);
+    cy.resize(n);
+    cz.resize(n);
+    radius.resize(n);
+  }
+  void set(size_t i, const BoundingSphere &s) {
+    cx[i] = s.center.x;
+    cy[i] = s.center.y;
+    cz[i] = s.center.z;
+    radius[i] = s.radius;
+  }
+  BoundingSphere get(size_t i) const {
+    return {{cx[i], cy[i], cz[i]}, radius[i]};
+  }
+};
+
+// Bounding Sphere の配列をまとめて判定し、Frustum と重なる要素の index を
+// 昇順に visibleIndices に書き込む（sphereInFrustum と同じ判定）。
+// 中心や半径が NaN の球はどの経路でも外側とする。
+// SSE/AVX2/AVX-512 で 4/8/16 個ずつ判定する。
+void cullSpheres(const FrustumPlanes &planes,
+                 const BoundingSphereArray &spheres,
+                 std::vector<uint32_t> &visibleIndices);
+void cullSpheres(const FrustumPlanes &planes,
+                 const BoundingSphereArray &spheres,
+                 std::vector<uint32_t> &visibleIndices, SimdLevel level);
+// [first, last) の要素だけを判定し、重なる要素の index を visibleIndices の
+// 末尾に昇順で追加する（範囲を分けて複数のスレッドで判定するため）。
+void cullSphereRange(const FrustumPlanes &planes,
+                     const BoundingSphereArray &spheres, size_t first,
+                     size_t last, std::vector<uint32_t> &visibleIndices);
+void cullSphereRange(const FrustumPlanes &planes,
+                     const BoundingSphereArray &spheres, size_t first,
+                     size_t last, std::vector<uint32_t> &visibleIndices,
+                     SimdLevel level);
+
 // 頂点の配列からBounding Sphereを計算する。
 BoundingSphere computeBoundingSphere(const std::vector<glm::vec3> &v);
 
@@ -0,0 +1,228 @@
+#include "job_system.hpp"
+
+#include "simd.hpp"
+
+#include <algorithm>
+
+namespace b3 {
+
+namespace {
+
+// ワーカースレッドが自分の JobSystem と index を覚えておく
+thread_local const JobSystem *t_jobSystem = nullptr;
+thread_local uint32_t t_workerIndex = 0;
+
+// 他のスレッドがジョブを終えるのを待つ間のスピン
+inline void cpuRelax() {
+#if defined(B3_SIMD_X86)
+  _mm_pause();
+#else
+  std::this_thread::yield();
+#endif
+}
+
+// 眠る前に、ジョブが積まれないかスピンして待つ回数
+constexpr int SPIN_COUNT = 256;
+
+} // namespace
+
+// ***** WorkQueue *****
+// "Correct and Efficient Work-Stealing for Weak Memory Models" (Lê et al.)
+// の C11 版に従う。容量は固定なので、バッファの拡張はしない。
+
+bool JobSystem::WorkQueue::push(Job *job) {
+  const int64_t b = m_bottom.load(std::memory_order_relaxed);
+  const int64_t t = m_top.load(std::memory_order_acquire);
+  if (b - t >= static_cast<int64_t>(QUEUE_CAPACITY)) {
+    return false;
+  }
+  m_jobs[b & (QUEUE_CAPACITY - 1)].store(job, std::memory_order_relaxed);
+  m_bottom.store(b + 1, std::memory_order_release);
+  return true;
+}
+
+JobSystem::Job *JobSystem::WorkQueue::pop() {
+  const int64_t b = m_bottom.load(std::memory_order_relaxed) - 1;
+  m_bottom.store(b, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  int64_t t = m_top.load(std::memory_order_relaxed);
+  if (t > b) {
+    // 空だった
+    m_bottom.store(b + 1, std::memory_order_relaxed);
+    return nullptr;
+  }
+  Job *job = m_jobs[b & (QUEUE_CAPACITY - 1)].load(std::memory_order_relaxed);
+  if (t == b) {
+    // 最後の1つは steal() と取り合いになる
+    if (!m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                       std::memory_order_relaxed)) {
+      job = nullptr;
+    }
+    m_bottom.store(b + 1, std::memory_order_relaxed);
+  }
+  return job;
+}
+
+JobSystem::Job *JobSystem::WorkQueue::steal() {
+  int64_t t = m_top.load(std::memory_order_acquire);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  const int64_t b = m_bottom.load(std::memory_order_acquire);
+  if (t >= b) {
+    return nullptr;
+  }
+  Job *job = m_jobs[t & (QUEUE_CAPACITY - 1)].load(std::memory_order_relaxed);
+  if (!m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                     std::memory_order_relaxed)) {
+    // 他のスレッドに取られた
+    return nullptr;
+  }
+  return job;
+}
+
+// ***** JobSystem *****
+
+JobSystem::JobSystem(uint32_t threadCount)
+    : m_ownerThread(std::this_thread::get_id()) {
+  static_assert((QUEUE_CAPACITY & (QUEUE_CAPACITY - 1)) == 0);
+  if (threadCount == 0) {
+    threadCount = std::max(1u, std::thread::hardware_concurrency());
+  }
+  m_queues.reserve(threadCount);
+  for (uint32_t i = 0; i < threadCount; ++i) {
+    m_queues.push_back(std::make_unique<WorkQueue>());
+  }
+  // index 0 は呼び出し元のスレッド
+  m_threads.reserve(threadCount - 1);
+  for (uint32_t i = 1; i < threadCount; ++i) {
+    m_threads.emplace_back([this, i] { workerLoop(i); });
+  }
+}
+
+JobSystem::~JobSystem() {
+  m_quit.store(true, std::memory_order_release);
+  m_signal.fetch_add(1, std::memory_order_release);
+  m_signal.notify_all();
+  for (auto &thread : m_threads) {
+    thread.join();
+  }
+}
+
+size_t JobSystem::grainFor(size_t count, size_t chunksPerThread) const {
+  const size_t chunks = std::max<size_t>(1, threadCount() * chunksPerThread);
+  return std::max<size_t>(1, (count + chunks - 1) / chunks);
+}
+
+JobSystem::Stats JobSystem::stats() const {
+  Stats stats;
+  for (const auto &queue : m_queues) {
+    stats.jobs += queue->executed.load(std::memory_order_relaxed);
+    stats.steals += queue->stolen.load(std::memory_order_relaxed);
+  }
+  return stats;
+}
+
+uint32_t JobSystem::currentWorker() const {
+  if (t_jobSystem == this) {
+    return t_workerIndex;
+  }
+  if (std::this_thread::get_id() == m_ownerThread) {
+    return 0;
+  }
+  return NO_WORKER;
+}
+
+void JobSystem::run(size_t count, size_t grain, RangeFunc func,
+                    const void *context) {
+  if (count == 0) {
+    return;
+  }
+  grain = std::max<size_t>(1, grain);
+  const size_t chunks = (count + grain - 1) / grain;
+  const uint32_t worker = currentWorker();
+  if (chunks == 1 || threadCount() == 1 || worker == NO_WORKER) {
+    // 範囲の分け方は並列に実行する場合と同じにする
+    for (size_t begin = 0; begin < count; begin += grain) {
+      func(context, begin, std::min(count, begin + grain));
+    }
+    return;
+  }
+
+  // 先頭の範囲は自分で実行し、残りを自分のキューに積んで他のワーカーに
+  // 盗ませる
+  std::vector<Job> jobs(chunks - 1);
+  std::atomic<size_t> pending{chunks - 1};
+  auto &queue = *m_queues[worker];
+  for (size_t c = 1; c < chunks; ++c) {
+    auto &job = jobs[c - 1];
+    job = {.func = func,
+           .context = context,
+           .begin = c * grain,
+           .end = std::min(count, (c + 1) * grain),
+           .pending = &pending};
+    if (!queue.push(&job)) {
+      execute(worker, &job);
+    }
+  }
+  m_signal.fetch_add(1, std::memory_order_release);
+  m_signal.notify_all();
+
+  func(context, 0, grain);
+
+  // 終わっていない範囲があれば、待つ間に他のジョブを手伝う
+  for (int spin = 0; pending.load(std::memory_order_acquire) != 0;) {
+    if (runOneJob(worker)) {
+      spin = 0;
+    } else if (++spin < SPIN_COUNT) {
+      cpuRelax();
+    } else {
+      // 実行中のスレッドに CPU を譲る
+      std::this_thread::yield();
+    }
+  }
+}
+
+void JobSystem::workerLoop(uint32_t index) {
+  t_jobSystem = this;
+  t_workerIndex = index;
+  while (!m_quit.load(std::memory_order_acquire)) {
+    const uint32_t signal = m_signal.load(std::memory_order_acquire);
+    bool found = false;
+    for (int spin = 0; spin < SPIN_COUNT && !found; ++spin) {
+      found = runOneJob(index);
+      if (!found) {
+        cpuRelax();
+      }
+    }
+    if (!found) {
+      // 眠っている間にジョブが積まれると m_signal が変わるので、
+      // 起こし損ねることはない
+      m_signal.wait(signal, std::memory_order_acquire);
+    }
+  }
+}
+
+bool JobSystem::runOneJob(uint32_t index) {
+  if (Job *job = m_queues[index]->pop()) {
+    execute(index, job);
+    return true;
+  }
+  const uint32_t n = threadCount();
+  for (uint32_t i = 1; i < n; ++i) {
+    const uint32_t victim = (index + i) % n;
+    if (Job *job = m_queues[victim]->steal()) {
+      m_queues[index]->stolen.fetch_add(1, std::memory_order_relaxed);
+      execute(index, job);
+      return true;
+    }
+  }
+  return false;
+}
+
+void JobSystem::execute(uint32_t index, Job *job) {
+  job->func(job->context, job->begin, job->end);
+  m_queues[index]->executed.fetch_add(1, std::memory_order_relaxed);
+  // これ以降 job は呼び出し元のスタックから消えているかもしれない
+  job->pending->fetch_sub(1, std::memory_order_release);
+}
+
+} // namespace b3
@@ -0,0 +1,115 @@
+#ifndef __JOB_SYSTEM_HPP__
+#define __JOB_SYSTEM_HPP__
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace b3 {
+
+// ワークスティーリング方式のスレッドプール。
+//
+// ワーカーごとに Chase-Lev の両端キュー（deque）を持ち、自分のキューには
+// 末尾から積んで末尾から取り出し、他のワーカーのキューからは先頭から盗む。
+// キューの操作はすべて lock-free で、全体で共有するロックはない。
+//
+// JobSystem を作ったスレッドは index 0 のワーカーとして扱い、
+// parallelFor() の中で自分でもジョブを実行する。
+// それ以外のスレッド（ワーカーを除く）から parallelFor() を呼ぶと、
+// その場で順番に実行する。
+class JobSystem {
+public:
+  // 1つのキューに積めるジョブの数（溢れた分は積んだスレッドが実行する）
+  static constexpr size_t QUEUE_CAPACITY = 4096;
+
+  // threadCount は呼び出し元のスレッドを含めた数。0 ならコア数にする。
+  explicit JobSystem(uint32_t threadCount = 0);
+  ~JobSystem();
+
+  JobSystem(const JobSystem &) = delete;
+  JobSystem &operator=(const JobSystem &) = delete;
+
+  // 呼び出し元のスレッドを含めたスレッド数
+  uint32_t threadCount() const {
+    return static_cast<uint32_t>(m_queues.size());
+  }
+
+  // [0, count) を grain 個ずつの範囲に分け、func(begin, end) を並列に呼ぶ。
+  // すべての範囲が終わるまで戻らない。ジョブの中から呼んでもよい。
+  template <typename Func>
+  void parallelFor(size_t count, size_t grain, const Func &func) {
+    run(count, grain,
+        [](const void *f, size_t begin, size_t end) {
+          (*static_cast<const Func *>(f))(begin, end);
+        },
+        &func);
+  }
+
+  // 範囲の数をスレッド数の chunksPerThread 倍程度にする grain を返す
+  size_t grainFor(size_t count, size_t chunksPerThread = 4) const;
+
+  struct Stats {
+    // 実行したジョブの数
+    uint64_t jobs = 0;
+    // 他のワーカーから盗んで実行したジョブの数
+    uint64_t steals = 0;
+  };
+  Stats stats() const;
+
+private:
+  using RangeFunc = void (*)(const void *, size_t, size_t);
+
+  struct Job {
+    RangeFunc func;
+    const void *context;
+    size_t begin;
+    size_t end;
+    // 終わっていないジョブの数（parallelFor() ごとに共有する）
+    std::atomic<size_t> *pending;
+  };
+
+  // Chase-Lev の work-stealing deque（容量固定）
+  class WorkQueue {
+  public:
+    // 持ち主のスレッドだけが呼ぶ
+    bool push(Job *job);
+    Job *pop();
+    // どのスレッドから呼んでもよい
+    Job *steal();
+
+    // このキューのワーカーが実行したジョブの数（統計用）
+    std::atomic<uint64_t> executed{0};
+    std::atomic<uint64_t> stolen{0};
+
+  private:
+    alignas(64) std::atomic<int64_t> m_top{0};
+    alignas(64) std::atomic<int64_t> m_bottom{0};
+    std::atomic<Job *> m_jobs[QUEUE_CAPACITY] = {};
+  };
+
+  std::vector<std::unique_ptr<WorkQueue>> m_queues;
+  std::vector<std::thread> m_threads;
+  std::thread::id m_ownerThread;
+
+  // ジョブを積むたびに増やす（眠っているワーカーを起こすため）
+  std::atomic<uint32_t> m_signal{0};
+  std::atomic<bool> m_quit{false};
+
+  void run(size_t count, size_t grain, RangeFunc func, const void *context);
+  void workerLoop(uint32_t index);
+  // 自分のキュー、なければ他のキューからジョブを1つ取り出して実行する。
+  // 実行するジョブがなければ false を返す。
+  bool runOneJob(uint32_t index);
+  void execute(uint32_t index, Job *job);
+  // 呼び出し元のスレッドのワーカー index（ワーカーでなければ NO_WORKER）
+  uint32_t currentWorker() const;
+
+  static constexpr uint32_t NO_WORKER = ~0u;
+};
+
+} // namespace b3
+
+#endif
@@ -0,0 +1,376 @@
+#include "loose_octree.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace b3 {
+
+namespace {
+
+enum class PlaneSide { Outside, Inside, Intersect };
+
+// planeMask の平面に対する AABB の位置。完全に内側になった平面は
+// planeMask から外す。
+PlaneSide testAabb(const FrustumPlanes &planes, const Aabb &box,
+                   uint32_t &planeMask) {
+  const glm::vec3 c = box.center();
+  const glm::vec3 e = box.extent();
+  for (int p = 0; p < 6; ++p) {
+    if ((planeMask & (1u << p)) == 0) {
+      continue;
+    }
+    const float dist = planes.nx[p] * c.x + planes.ny[p] * c.y +
+                       planes.nz[p] * c.z + planes.d[p];
+    const float r = std::abs(planes.nx[p]) * e.x +
+                    std::abs(planes.ny[p]) * e.y +
+                    std::abs(planes.nz[p]) * e.z;
+    if (dist < -r) {
+      return PlaneSide::Outside;
+    }
+    if (dist >= r) {
+      planeMask &= ~(1u << p);
+    }
+  }
+  return planeMask == 0 ? PlaneSide::Inside : PlaneSide::Intersect;
+}
+
+bool sphereInPlanes(const FrustumPlanes &planes, const BoundingSphere &s,
+                    uint32_t planeMask) {
+  for (int p = 0; p < 6; ++p) {
+    if ((planeMask & (1u << p)) == 0) {
+      continue;
+    }
+    const float dist = planes.nx[p] * s.center.x + planes.ny[p] * s.center.y +
+                       planes.nz[p] * s.center.z + planes.d[p];
+    if (!(dist >= -s.radius)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool sphereOverlapsAabb(const BoundingSphere &s, const Aabb &box) {
+  const glm::vec3 closest = glm::clamp(s.center, box.min, box.max);
+  return glm::distance2(closest, s.center) <= s.radius * s.radius;
+}
+
+// 半直線と AABB が [0, maxDistance] の範囲で交わるか（slab 法）
+bool rayOverlapsAabb(const glm::vec3 &origin, const glm::vec3 &invDirection,
+                     float maxDistance, const Aabb &box) {
+  float tmin = 0.0f;
+  float tmax = maxDistance;
+  for (int axis = 0; axis < 3; ++axis) {
+    float t0 = (box.min[axis] - origin[axis]) * invDirection[axis];
+    float t1 = (box.max[axis] - origin[axis]) * invDirection[axis];
+    if (t0 > t1) {
+      std::swap(t0, t1);
+    }
+    // 0 * inf の NaN は範囲を狭めない
+    tmin = t0 > tmin ? t0 : tmin;
+    tmax = t1 < tmax ? t1 : tmax;
+    if (tmin > tmax) {
+      return false;
+    }
+  }
+  return true;
+}
+
+constexpr uint32_t ALL_PLANES = (1u << 6) - 1;
+
+} // namespace
+
+LooseOctree::LooseOctree(uint32_t maxDepth) : m_maxDepth(maxDepth) {
+  assert(maxDepth <= MAX_DEPTH_LIMIT);
+  uint32_t offset = 0;
+  for (uint32_t level = 0; level <= m_maxDepth; ++level) {
+    m_levelOffset.push_back(offset);
+    offset += 1u << (3 * level);
+  }
+  m_head.assign(offset, NONE);
+  m_subtreeCount.assign(offset, 0);
+}
+
+void LooseOctree::reset(const glm::vec3 &center, float halfSize) {
+  assert(halfSize > 0.0f);
+  m_center = center;
+  m_halfSize = halfSize;
+  std::fill(m_head.begin(), m_head.end(), NONE);
+  std::fill(m_subtreeCount.begin(), m_subtreeCount.end(), 0);
+  m_outsideHead = NONE;
+  m_outsideCount = 0;
+  for (uint32_t i = 0; i < m_items.size(); ++i) {
+    m_items[i].key = keyFor(m_items[i].sphere);
+    link(i);
+  }
+  ++m_stats.resets;
+}
+
+LooseOctree::CellKey LooseOctree::keyFor(const BoundingSphere &sphere) const {
+  const glm::vec3 rel = sphere.center - (m_center - glm::vec3(m_halfSize));
+  const float size = 2.0f * m_halfSize;
+  if (!(rel.x >= 0.0f && rel.y >= 0.0f && rel.z >= 0.0f && rel.x < size &&
+        rel.y < size && rel.z < size && sphere.radius <= m_halfSize)) {
+    return {.outside = true};
+  }
+
+  // セルの半分の大きさ halfSize / 2^level が半径以上になる最も深い階層
+  uint32_t level = m_maxDepth;
+  if (sphere.radius > 0.0f) {
+    const int e = std::ilogb(m_halfSize / sphere.radius);
+    level = static_cast<uint32_t>(
+        std::clamp(e, 0, static_cast<int>(m_maxDepth)));
+  }
+  const uint32_t n = 1u << level;
+  const float scale = n / size;
+  auto coord = [&](float v) {
+    return static_cast<uint8_t>(
+        std::min(n - 1, static_cast<uint32_t>(v * scale)));
+  };
+  return {.level = static_cast<uint8_t>(level),
+          .x = coord(rel.x),
+          .y = coord(rel.y),
+          .z = coord(rel.z)};
+}
+
+void LooseOctree::addSubtreeCount(const CellKey &key, int32_t delta) {
+  uint32_t x = key.x, y = key.y, z = key.z;
+  for (int32_t level = key.level; level >= 0; --level) {
+    m_subtreeCount[cellIndex(level, x, y, z)] += delta;
+    x >>= 1;
+    y >>= 1;
+    z >>= 1;
+  }
+}
+
+void LooseOctree::link(uint32_t index) {
+  auto &item = m_items[index];
+  uint32_t *head = &m_outsideHead;
+  if (item.key.outside) {
+    item.cell = NONE;
+    ++m_outsideCount;
+  } else {
+    item.cell = cellIndex(item.key.level, item.key.x, item.key.y, item.key.z);
+    head = &m_head[item.cell];
+    addSubtreeCount(item.key, 1);
+  }
+  item.prev = NONE;
+  item.next = *head;
+  if (*head != NONE) {
+    m_items[*head].prev = index;
+  }
+  *head = index;
+}
+
+void LooseOctree::unlink(uint32_t index) {
+  auto &item = m_items[index];
+  uint32_t *head = &m_outsideHead;
+  if (item.key.outside) {
+    --m_outsideCount;
+  } else {
+    head = &m_head[item.cell];
+    addSubtreeCount(item.key, -1);
+  }
+  if (item.prev != NONE) {
+    m_items[item.prev].next = item.next;
+  } else {
+    *head = item.next;
+  }
+  if (item.next != NONE) {
+    m_items[item.next].prev = item.prev;
+  }
+  item.prev = item.next = NONE;
+}
+
+void LooseOctree::update(uint32_t index, const BoundingSphere &sphere) {
+  auto &item = m_items[index];
+  item.sphere = sphere;
+  const auto key = keyFor(sphere);
+  if (key == item.key) {
+    return;
+  }
+  unlink(index);
+  m_items[index].key = key;
+  link(index);
+  ++m_stats.reinsertions;
+}
+
+void LooseOctree::resize(size_t count) {
+  while (m_items.size() > count) {
+    unlink(static_cast<uint32_t>(m_items.size() - 1));
+    m_items.pop_back();
+  }
+  while (m_items.size() < count) {
+    const auto index = static_cast<uint32_t>(m_items.size());
+    Item item;
+    item.sphere = {m_center, 0.0f};
+    item.key = keyFor(item.sphere);
+    m_items.push_back(item);
+    link(index);
+  }
+}
+
+void LooseOctree::update(const BoundingSphereArray &spheres) {
+  resize(spheres.size());
+  for (uint32_t i = 0; i < spheres.size(); ++i) {
+    update(i, spheres.get(i));
+  }
+
+  // 初回、または範囲外の要素が増えたら、全体が収まるように範囲を取り直す
+  if (spheres.size() > 0 &&
+      (m_stats.resets == 0 || m_outsideCount * 4 > spheres.size())) {
+    Aabb bounds;
+    for (size_t i = 0; i < spheres.size(); ++i) {
+      bounds.expand(Aabb::fromSphere(spheres.get(i)));
+    }
+    const glm::vec3 e = bounds.extent();
+    // 少し余裕を持たせて、動いてもしばらくは範囲内に収まるようにする
+    const float halfSize = std::max({e.x, e.y, e.z, 0.5f}) * 1.25f;
+    LOGD("loose octree: reset bounds (half size {}, {} outside)", halfSize,
+         m_outsideCount);
+    reset(bounds.center(), halfSize);
+  }
+}
+
+Aabb LooseOctree::looseBounds(uint32_t level, uint32_t x, uint32_t y,
+                              uint32_t z) const {
+  const float cellSize = 2.0f * m_halfSize / static_cast<float>(1u << level);
+  const glm::vec3 center =
+      m_center - glm::vec3(m_halfSize) +
+      (glm::vec3(x, y, z) + glm::vec3(0.5f)) * cellSize;
+  // セルの2倍の大きさ（中心から cellSize）まで広げる
+  return {center - glm::vec3(cellSize), center + glm::vec3(cellSize)};
+}
+
+void LooseOctree::appendSubtree(uint32_t level, uint32_t x, uint32_t y,
+                                uint32_t z,
+                                std::vector<uint32_t> &indices) const {
+  const auto cell = cellIndex(level, x, y, z);
+  if (m_subtreeCount[cell] == 0) {
+    return;
+  }
+  for (auto i = m_head[cell]; i != NONE; i = m_items[i].next) {
+    indices.push_back(i);
+  }
+  if (level == m_maxDepth) {
+    return;
+  }
+  for (uint32_t c = 0; c < 8; ++c) {
+    appendSubtree(level + 1, 2 * x + (c & 1), 2 * y + ((c >> 1) & 1),
+                  2 * z + (c >> 2), indices);
+  }
+}
+
+void LooseOctree::cullCell(uint32_t level, uint32_t x, uint32_t y, uint32_t z,
+                           const FrustumPlanes &planes, uint32_t planeMask,
+                           std::vector<uint32_t> &visibleIndices) const {
+  const auto cell = cellIndex(level, x, y, z);
+  if (m_subtreeCount[cell] == 0) {
+    return;
+  }
+  switch (testAabb(planes, looseBounds(level, x, y, z), planeMask)) {
+  case PlaneSide::Outside:
+    return;
+  case PlaneSide::Inside:
+    // 完全に内側: 部分木の要素をすべて受け入れる
+    appendSubtree(level, x, y, z, visibleIndices);
+    return;
+  case PlaneSide::Intersect:
+    break;
+  }
+  for (auto i = m_head[cell]; i != NONE; i = m_items[i].next) {
+    if (sphereInPlanes(planes, m_items[i].sphere, planeMask)) {
+      visibleIndices.push_back(i);
+    }
+  }
+  if (level == m_maxDepth) {
+    return;
+  }
+  for (uint32_t c = 0; c < 8; ++c) {
+    cullCell(level + 1, 2 * x + (c & 1), 2 * y + ((c >> 1) & 1),
+             2 * z + (c >> 2), planes, planeMask, visibleIndices);
+  }
+}
+
+void LooseOctree::cullFrustum(const FrustumPlanes &planes,
+                              std::vector<uint32_t> &visibleIndices) const {
+  visibleIndices.clear();
+  cullCell(0, 0, 0, 0, planes, ALL_PLANES, visibleIndices);
+  for (auto i = m_outsideHead; i != NONE; i = m_items[i].next) {
+    if (sphereInPlanes(planes, m_items[i].sphere, ALL_PLANES)) {
+      visibleIndices.push_back(i);
+    }
+  }
+}
+
+template <typename CellTest, typename ItemVisitor>
+void LooseOctree::visitCells(uint32_t level, uint32_t x, uint32_t y,
+                             uint32_t z, const CellTest &cellTest,
+                             const ItemVisitor &itemVisitor) const {
+  const auto cell = cellIndex(level, x, y, z);
+  if (m_subtreeCount[cell] == 0 || !cellTest(looseBounds(level, x, y, z))) {
+    return;
+  }
+  for (auto i = m_head[cell]; i != NONE; i = m_items[i].next) {
+    itemVisitor(i, m_items[i].sphere);
+  }
+  if (level == m_maxDepth) {
+    return;
+  }
+  for (uint32_t c = 0; c < 8; ++c) {
+    visitCells(level + 1, 2 * x + (c & 1), 2 * y + ((c >> 1) & 1),
+               2 * z + (c >> 2), cellTest, itemVisitor);
+  }
+}
+
+void LooseOctree::querySphere(const BoundingSphere &sphere,
+                              std::vector<uint32_t> &indices) const {
+  indices.clear();
+  auto visit = [&](uint32_t i, const BoundingSphere &s) {
+    const float r = s.radius + sphere.radius;
+    if (glm::distance2(s.center, sphere.center) <= r * r) {
+      indices.push_back(i);
+    }
+  };
+  visitCells(
+      0, 0, 0, 0,
+      [&](const Aabb &box) { return sphereOverlapsAabb(sphere, box); }, visit);
+  for (auto i = m_outsideHead; i != NONE; i = m_items[i].next) {
+    visit(i, m_items[i].sphere);
+  }
+}
+
+void LooseOctree::raycast(const glm::vec3 &origin, const glm::vec3 &direction,
+                          float maxDistance,
+                          std::vector<RayHit> &hits) const {
+  hits.clear();
+  const glm::vec3 invDirection = 1.0f / direction;
+  auto visit = [&](uint32_t i, const BoundingSphere &s) {
+    const glm::vec3 oc = origin - s.center;
+    const float b = glm::dot(oc, direction);
+    const float c = glm::dot(oc, oc) - s.radius * s.radius;
+    if (c > 0.0f && b > 0.0f) {
+      // 始点が球の外にあり、球から遠ざかっている
+      return;
+    }
+    const float discriminant = b * b - c;
+    if (discriminant < 0.0f) {
+      return;
+    }
+    const float t = std::max(0.0f, -b - std::sqrt(discriminant));
+    if (t <= maxDistance) {
+      hits.push_back({i, t});
+    }
+  };
+  visitCells(
+      0, 0, 0, 0,
+      [&](const Aabb &box) {
+        return rayOverlapsAabb(origin, invDirection, maxDistance, box);
+      },
+      visit);
+  for (auto i = m_outsideHead; i != NONE; i = m_items[i].next) {
+    visit(i, m_items[i].sphere);
+  }
+  std::ranges::sort(hits, {}, &RayHit::t);
+}
+
+} // namespace b3
@@ -0,0 +1,134 @@
+#ifndef __LOOSE_OCTREE_HPP__
+#define __LOOSE_OCTREE_HPP__
+
+#include "common.hpp"
+#include "frustum_culling.hpp"
+
+#include <vector>
+
+namespace b3 {
+
+// Bounding Sphere の集合に対するルース八分木。
+//
+// 各セルの判定用の境界は、セルの大きさの2倍（ルース）にとる。
+// 半径 r の球は、セルの半分の大きさが r 以上になる最も深い階層の、中心を
+// 含むセルに必ず収まるので、挿入先は位置と半径から O(1) で決まる。
+// セルは階層ごとの密な配列で持ち、要素はセルごとの双方向リストに繋ぐので、
+// 動いた要素の付け替えも（深さで抑えられる）O(1) で済む。
+//
+// 全体の範囲から外れた要素は別のリストに入れ、問い合わせのたびに個別に
+// 判定する。外れた要素が増えたら update() が範囲を取り直す。
+class LooseOctree {
+public:
+  // 最も深い階層の既定値（セル数は 8^0 + ... + 8^depth）
+  static constexpr uint32_t DEFAULT_MAX_DEPTH = 6;
+  static constexpr uint32_t MAX_DEPTH_LIMIT = 7;
+
+  explicit LooseOctree(uint32_t maxDepth = DEFAULT_MAX_DEPTH);
+
+  // 範囲を設定して、登録済みの要素を入れ直す
+  void reset(const glm::vec3 &center, float halfSize);
+
+  // 要素 index の Bounding Sphere を設定する。
+  // 入るセルが変わらなければ値を書き換えるだけ。
+  void update(uint32_t index, const BoundingSphere &sphere);
+  // 配列全体を反映する。要素数が変わっていれば増減させ、
+  // 範囲外の要素が多くなったら範囲を取り直す。
+  void update(const BoundingSphereArray &spheres);
+  // 末尾の要素を削除して count 個にする
+  void resize(size_t count);
+
+  // Frustum と重なる要素の index（順不同）。判定は sphereInFrustum と同じ。
+  void cullFrustum(const FrustumPlanes &planes,
+                   std::vector<uint32_t> &visibleIndices) const;
+  // 球と重なる要素の index（順不同）
+  void querySphere(const BoundingSphere &sphere,
+                   std::vector<uint32_t> &indices) const;
+
+  struct RayHit {
+    uint32_t index;
+    // 球に入る位置までの距離（始点が球の中なら 0）
+    float t;
+  };
+  // 半直線と交わる要素を、近い順に返す。direction は正規化されていること。
+  void raycast(const glm::vec3 &origin, const glm::vec3 &direction,
+               float maxDistance, std::vector<RayHit> &hits) const;
+
+  size_t size() const { return m_items.size(); }
+  uint32_t maxDepth() const { return m_maxDepth; }
+  const glm::vec3 &center() const { return m_center; }
+  float halfSize() const { return m_halfSize; }
+  // 範囲から外れている要素の数
+  size_t outsideCount() const { return m_outsideCount; }
+
+  struct Stats {
+    // 別のセルに付け替えた回数
+    uint64_t reinsertions = 0;
+    // 範囲を取り直した回数
+    uint64_t resets = 0;
+  };
+  const Stats &stats() const { return m_stats; }
+
+private:
+  static constexpr uint32_t NONE = ~0u;
+
+  struct CellKey {
+    uint8_t level = 0;
+    uint8_t x = 0, y = 0, z = 0;
+    // 範囲外の要素
+    bool outside = false;
+
+    bool operator==(const CellKey &) const = default;
+  };
+
+  struct Item {
+    BoundingSphere sphere;
+    CellKey key;
+    uint32_t cell = NONE;
+    uint32_t prev = NONE;
+    uint32_t next = NONE;
+  };
+
+  uint32_t m_maxDepth;
+  glm::vec3 m_center{0.0f};
+  float m_halfSize = 1.0f;
+
+  // 階層ごとのセルの先頭位置
+  std::vector<uint32_t> m_levelOffset;
+  // セルに直接入っている要素のリストの先頭
+  std::vector<uint32_t> m_head;
+  // セルとその子孫に入っている要素の数（空の部分木を飛ばすため）
+  std::vector<uint32_t> m_subtreeCount;
+  // 範囲外の要素のリストの先頭
+  uint32_t m_outsideHead = NONE;
+  size_t m_outsideCount = 0;
+
+  std::vector<Item> m_items;
+  Stats m_stats;
+
+  CellKey keyFor(const BoundingSphere &sphere) const;
+  uint32_t cellIndex(uint32_t level, uint32_t x, uint32_t y, uint32_t z) const {
+    const uint32_t n = 1u << level;
+    return m_levelOffset[level] + (z * n + y) * n + x;
+  }
+  void link(uint32_t index);
+  void unlink(uint32_t index);
+  // セルと祖先の要素数を増減する
+  void addSubtreeCount(const CellKey &key, int32_t delta);
+  Aabb looseBounds(uint32_t level, uint32_t x, uint32_t y, uint32_t z) const;
+
+  void cullCell(uint32_t level, uint32_t x, uint32_t y, uint32_t z,
+                const FrustumPlanes &planes, uint32_t planeMask,
+                std::vector<uint32_t> &visibleIndices) const;
+  // 部分木の要素をすべて追加する
+  void appendSubtree(uint32_t level, uint32_t x, uint32_t y, uint32_t z,
+                     std::vector<uint32_t> &indices) const;
+  template <typename CellTest, typename ItemVisitor>
+  void visitCells(uint32_t level, uint32_t x, uint32_t y, uint32_t z,
+                  const CellTest &cellTest,
+                  const ItemVisitor &itemVisitor) const;
+};
+
+} // namespace b3
+
+#endif
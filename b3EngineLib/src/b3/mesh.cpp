@@ -11,4 +11,24 @@ void Mesh::addIndex(IndexType index) {
   m_indices.push_back(static_cast<IndexType>(index));
 }
 
+void Mesh::setGeometry(std::vector<Vertex> vertices,
+                       std::vector<IndexType> indices) {
+  m_vertices = std::move(vertices);
+  m_indices = std::move(indices);
+}
+
+std::vector<uint16_t> narrowIndices(const std::vector<IndexType> &indices) {
+  std::vector<uint16_t> narrowed(indices.size());
+  for (size_t i = 0; i < indices.size(); ++i) {
+    assert(indices[i] <= UINT16_MAX);
+    narrowed[i] = static_cast<uint16_t>(indices[i]);
+  }
+  return narrowed;
+}
+
+std::vector<uint16_t> Mesh::indices16() const {
+  assert(fitsIndex16());
+  return narrowIndices(m_indices);
+}
+
 }
\ No newline at end of file
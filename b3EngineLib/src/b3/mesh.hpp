@@ -6,6 +6,12 @@
 
 namespace b3 {
 
+// 頂点がこの数以下なら、インデックスを 16 bit で表せる
+constexpr size_t INDEX16_VERTEX_LIMIT = size_t(UINT16_MAX) + 1;
+
+// インデックスを 16 bit に詰める。どのインデックスも UINT16_MAX 以下のこと
+std::vector<uint16_t> narrowIndices(const std::vector<IndexType> &indices);
+
 class Mesh {
   std::vector<Vertex> m_vertices;
   std::vector<IndexType> m_indices;
@@ -13,6 +19,9 @@ class Mesh {
 public:
   IndexType addVertex(const Vertex &vertex);
   void addIndex(IndexType index);
+  // 頂点とインデックスをまとめて置き換える（並べ替えた結果を戻すときなど）
+  void setGeometry(std::vector<Vertex> vertices,
+                   std::vector<IndexType> indices);
 
   const std::vector<Vertex> vertices() const { return m_vertices; }
   const std::vector<IndexType> indices() const { return m_indices; }
@@ -20,6 +29,18 @@ public:
   IndexType index(size_t i) const { return m_indices[i]; }
   size_t numberOfVertices() const { return m_vertices.size(); }
   size_t numberOfIndices() const { return m_indices.size(); }
+
+  // インデックスは 32 bit で持ち、GPU に置くときに頂点数に応じて 16 bit に
+  // 詰める（プリミティブリスタートは使わないので 0xffff も普通の頂点）
+  bool fitsIndex16() const {
+    return m_vertices.size() <= INDEX16_VERTEX_LIMIT;
+  }
+  // GPU に置くときのインデックス 1 つの大きさ（2 か 4）
+  size_t indexSize() const {
+    return fitsIndex16() ? sizeof(uint16_t) : sizeof(IndexType);
+  }
+  // 16 bit に詰めたインデックス。fitsIndex16() のときだけ呼べる
+  std::vector<uint16_t> indices16() const;
 };
 
 } // namespace b3
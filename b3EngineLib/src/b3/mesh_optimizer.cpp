@@ -0,0 +1,315 @@
+#include "mesh_optimizer.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <numeric>
+
+namespace b3 {
+
+namespace {
+
+constexpr uint32_t NO_VERTEX = UINT32_MAX;
+
+// FIFO の頂点キャッシュ。頂点が入った時刻で、まだ残っているかを判定する
+// （時刻が cacheSize 以内なら残っている）
+class FifoCache {
+public:
+  FifoCache(size_t vertexCount, uint32_t cacheSize)
+      : m_insertedAt(vertexCount, 0), m_cacheSize(cacheSize) {}
+
+  // 頂点を参照し、キャッシュに当たらなければ true
+  bool miss(IndexType v) {
+    if (m_insertedAt[v] != 0 && m_time - m_insertedAt[v] < m_cacheSize) {
+      return false;
+    }
+    m_insertedAt[v] = ++m_time;
+    return true;
+  }
+  // 三角形の 3 頂点を参照し、当たらなかった数を返す
+  uint32_t misses(const IndexType *triangle) {
+    return miss(triangle[0]) + miss(triangle[1]) + miss(triangle[2]);
+  }
+  // 空にする（時刻を進めて、入っている頂点をすべて古くする）
+  void flush() { m_time += m_cacheSize; }
+
+private:
+  std::vector<uint32_t> m_insertedAt;
+  uint32_t m_time = 0;
+  uint32_t m_cacheSize;
+};
+
+// 頂点ごとの、その頂点を使う三角形の一覧（CSR 形式）
+struct Adjacency {
+  std::vector<uint32_t> offsets;
+  std::vector<uint32_t> triangles;
+
+  Adjacency(const std::vector<IndexType> &indices, size_t vertexCount)
+      : offsets(vertexCount + 1, 0), triangles(indices.size()) {
+    for (const auto v : indices) {
+      ++offsets[v + 1];
+    }
+    std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+    std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+    for (size_t i = 0; i < indices.size(); ++i) {
+      triangles[fill[indices[i]]++] = static_cast<uint32_t>(i / 3);
+    }
+  }
+
+  uint32_t count(IndexType v) const { return offsets[v + 1] - offsets[v]; }
+};
+
+} // namespace
+
+VertexCacheStats analyzeVertexCache(const std::vector<IndexType> &indices,
+                                    size_t vertexCount, uint32_t cacheSize) {
+  assert(indices.size() % 3 == 0);
+  VertexCacheStats stats;
+  stats.triangles = static_cast<uint32_t>(indices.size() / 3);
+  FifoCache cache(vertexCount, cacheSize);
+  std::vector<bool> used(vertexCount, false);
+  for (size_t i = 0; i < indices.size(); i += 3) {
+    stats.transformed += cache.misses(&indices[i]);
+  }
+  for (const auto v : indices) {
+    if (!used[v]) {
+      used[v] = true;
+      ++stats.vertices;
+    }
+  }
+  if (stats.triangles > 0) {
+    stats.acmr = double(stats.transformed) / stats.triangles;
+    stats.atvr = double(stats.transformed) / stats.vertices;
+  }
+  return stats;
+}
+
+std::vector<IndexType>
+optimizeVertexCache(const std::vector<IndexType> &indices, size_t vertexCount,
+                    uint32_t cacheSize) {
+  assert(indices.size() % 3 == 0);
+  const size_t triangleCount = indices.size() / 3;
+  const Adjacency adjacency(indices, vertexCount);
+
+  // まだ出力していない三角形の数と、キャッシュに入った時刻
+  std::vector<uint32_t> live(vertexCount);
+  for (size_t v = 0; v < vertexCount; ++v) {
+    live[v] = adjacency.count(static_cast<IndexType>(v));
+  }
+  std::vector<uint32_t> cacheTime(vertexCount, 0);
+  std::vector<bool> emitted(triangleCount, false);
+  // 行き止まりになったときに戻る候補（最近使った頂点）
+  std::vector<IndexType> deadEnd;
+  std::vector<IndexType> candidates;
+
+  std::vector<IndexType> result;
+  result.reserve(indices.size());
+  uint32_t time = cacheSize + 1;
+  // 行き止まりで候補もないときに、頭から順に探す位置
+  size_t cursor = 0;
+  uint32_t fan = indices.empty() ? NO_VERTEX : indices[0];
+
+  while (fan != NO_VERTEX) {
+    // fan を使う三角形をすべて出力する
+    candidates.clear();
+    for (uint32_t i = adjacency.offsets[fan]; i < adjacency.offsets[fan + 1];
+         ++i) {
+      const uint32_t t = adjacency.triangles[i];
+      if (emitted[t]) {
+        continue;
+      }
+      emitted[t] = true;
+      for (int k = 0; k < 3; ++k) {
+        const IndexType v = indices[t * 3 + k];
+        result.push_back(v);
+        deadEnd.push_back(v);
+        candidates.push_back(v);
+        --live[v];
+        if (time - cacheTime[v] > cacheSize) {
+          cacheTime[v] = time++;
+        }
+      }
+    }
+
+    // 次の fan: 出力後もキャッシュに残っていて、最も早く入った頂点
+    fan = NO_VERTEX;
+    uint32_t best = 0;
+    for (const auto v : candidates) {
+      if (live[v] == 0) {
+        continue;
+      }
+      // 残りの三角形を出力しても（1 つあたり最大 2 頂点）押し出されない
+      uint32_t priority = 0;
+      if (time - cacheTime[v] + 2 * live[v] <= cacheSize) {
+        priority = time - cacheTime[v];
+      }
+      if (priority > best || fan == NO_VERTEX) {
+        best = priority;
+        fan = v;
+      }
+    }
+    if (fan != NO_VERTEX) {
+      continue;
+    }
+    // 候補がなければ、最近使った頂点から、それもなければ頭から探す
+    while (!deadEnd.empty()) {
+      const IndexType v = deadEnd.back();
+      deadEnd.pop_back();
+      if (live[v] > 0) {
+        fan = v;
+        break;
+      }
+    }
+    while (fan == NO_VERTEX && cursor < vertexCount) {
+      if (live[cursor] > 0) {
+        fan = static_cast<uint32_t>(cursor);
+      }
+      ++cursor;
+    }
+  }
+  assert(result.size() == indices.size());
+  return result;
+}
+
+std::vector<IndexType> optimizeOverdraw(const std::vector<IndexType> &indices,
+                                        const std::vector<Vertex> &vertices,
+                                        uint32_t cacheSize, float threshold) {
+  assert(indices.size() % 3 == 0);
+  const size_t triangleCount = indices.size() / 3;
+  if (triangleCount == 0) {
+    return indices;
+  }
+
+  // 3 頂点ともキャッシュに当たらない三角形で区切る（キャッシュが途切れた所）
+  std::vector<uint32_t> hard = {0};
+  {
+    FifoCache cache(vertices.size(), cacheSize);
+    for (size_t t = 0; t < triangleCount; ++t) {
+      if (cache.misses(&indices[t * 3]) == 3 && t > 0) {
+        hard.push_back(static_cast<uint32_t>(t));
+      }
+    }
+  }
+  hard.push_back(static_cast<uint32_t>(triangleCount));
+
+  // さらに、塊の ACMR が元の塊の threshold 倍以内に収まる所で区切る
+  // （区切るとキャッシュは空から始まるので、ACMR が下がってから区切る）
+  std::vector<uint32_t> clusters;
+  FifoCache cache(vertices.size(), cacheSize);
+  for (size_t h = 0; h + 1 < hard.size(); ++h) {
+    const uint32_t begin = hard[h];
+    const uint32_t end = hard[h + 1];
+    cache.flush();
+    uint32_t wholeMisses = 0;
+    for (uint32_t t = begin; t < end; ++t) {
+      wholeMisses += cache.misses(&indices[t * 3]);
+    }
+    const double limit = threshold * double(wholeMisses) / (end - begin);
+
+    cache.flush();
+    clusters.push_back(begin);
+    uint32_t misses = 0;
+    uint32_t count = 0;
+    for (uint32_t t = begin; t < end; ++t) {
+      misses += cache.misses(&indices[t * 3]);
+      ++count;
+      if (t + 1 < end && double(misses) / count <= limit) {
+        clusters.push_back(t + 1);
+        cache.flush();
+        misses = 0;
+        count = 0;
+      }
+    }
+  }
+  clusters.push_back(static_cast<uint32_t>(triangleCount));
+
+  // 塊の中心と向き（面積で重み付け）。メッシュの中心から見て外側を向き、
+  // 遠くにある塊を先に描くと、奥の面が手前の面に隠される。
+  glm::vec3 meshCenter(0.f);
+  float meshArea = 0.f;
+  const size_t clusterCount = clusters.size() - 1;
+  std::vector<glm::vec3> centers(clusterCount, glm::vec3(0.f));
+  std::vector<glm::vec3> normals(clusterCount, glm::vec3(0.f));
+  std::vector<float> areas(clusterCount, 0.f);
+  for (size_t c = 0; c < clusterCount; ++c) {
+    for (uint32_t t = clusters[c]; t < clusters[c + 1]; ++t) {
+      const auto &p0 = vertices[indices[t * 3 + 0]].position;
+      const auto &p1 = vertices[indices[t * 3 + 1]].position;
+      const auto &p2 = vertices[indices[t * 3 + 2]].position;
+      const glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+      const float area = glm::length(normal);
+      centers[c] += (p0 + p1 + p2) * (area / 3.f);
+      normals[c] += normal;
+      areas[c] += area;
+    }
+    meshCenter += centers[c];
+    meshArea += areas[c];
+  }
+  if (meshArea > 0.f) {
+    meshCenter /= meshArea;
+  }
+  std::vector<float> keys(clusterCount, 0.f);
+  for (size_t c = 0; c < clusterCount; ++c) {
+    if (areas[c] <= 0.f) {
+      continue;
+    }
+    const glm::vec3 center = centers[c] / areas[c];
+    const float length = glm::length(normals[c]);
+    if (length > 0.f) {
+      keys[c] = glm::dot(center - meshCenter, normals[c] / length);
+    }
+  }
+
+  std::vector<uint32_t> order(clusterCount);
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(),
+                   [&](uint32_t a, uint32_t b) { return keys[a] > keys[b]; });
+
+  std::vector<IndexType> result;
+  result.reserve(indices.size());
+  for (const auto c : order) {
+    result.insert(result.end(), indices.begin() + clusters[c] * 3,
+                  indices.begin() + clusters[c + 1] * 3);
+  }
+  return result;
+}
+
+void optimizeVertexFetch(std::vector<Vertex> &vertices,
+                         std::vector<IndexType> &indices) {
+  std::vector<uint32_t> remap(vertices.size(), NO_VERTEX);
+  std::vector<Vertex> reordered;
+  reordered.reserve(vertices.size());
+  for (auto &index : indices) {
+    if (remap[index] == NO_VERTEX) {
+      remap[index] = static_cast<uint32_t>(reordered.size());
+      reordered.push_back(vertices[index]);
+    }
+    index = static_cast<IndexType>(remap[index]);
+  }
+  vertices = std::move(reordered);
+}
+
+MeshOptimizeReport optimizeMesh(std::vector<Vertex> &vertices,
+                                std::vector<IndexType> &indices,
+                                uint32_t cacheSize) {
+  const auto start = std::chrono::steady_clock::now();
+  MeshOptimizeReport report;
+  report.before = analyzeVertexCache(indices, vertices.size(), cacheSize);
+  indices = optimizeVertexCache(indices, vertices.size(), cacheSize);
+  indices = optimizeOverdraw(indices, vertices, cacheSize);
+  optimizeVertexFetch(vertices, indices);
+  report.after = analyzeVertexCache(indices, vertices.size(), cacheSize);
+  report.ms = std::chrono::duration<double, std::milli>(
+                  std::chrono::steady_clock::now() - start)
+                  .count();
+  return report;
+}
+
+MeshOptimizeReport optimizeMesh(Mesh &mesh, uint32_t cacheSize) {
+  std::vector<Vertex> vertices = mesh.vertices();
+  std::vector<IndexType> indices = mesh.indices();
+  const auto report = optimizeMesh(vertices, indices, cacheSize);
+  mesh.setGeometry(std::move(vertices), std::move(indices));
+  return report;
+}
+
+} // namespace b3
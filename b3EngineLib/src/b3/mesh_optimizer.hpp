@@ -0,0 +1,75 @@
+#ifndef __MESH_OPTIMIZER_HPP__
+#define __MESH_OPTIMIZER_HPP__
+
+#include "common.hpp"
+#include "mesh.hpp"
+#include "types.hpp"
+
+#include <vector>
+
+namespace b3 {
+
+// 頂点シェーダーの実行回数を減らすための、インデックスと頂点の並べ替え。
+//
+// 1. optimizeVertexCache(): 変換後の頂点キャッシュに当たるように三角形を
+//    並べ替える（Tipsify。Sander et al. 2007）
+// 2. optimizeOverdraw(): キャッシュの効率をほぼ保ったまま、三角形の塊を
+//    外向きのものから描くように並べ替え、オーバードローを減らす
+// 3. optimizeVertexFetch(): 頂点を最初に使われる順に並べ直し、頂点の
+//    読み込みを連続にする
+//
+// どれも三角形の頂点の順番（表裏）は変えない。
+
+// 変換後の頂点キャッシュを指定の大きさの FIFO とみなしたときの統計
+struct VertexCacheStats {
+  uint32_t triangles = 0;
+  // インデックスから参照されている頂点の数
+  uint32_t vertices = 0;
+  // キャッシュに当たらず頂点シェーダーを実行した回数
+  uint32_t transformed = 0;
+  // 三角形あたり（ACMR、0.5 から 3）と、頂点あたり（ATVR、1 以上）の実行回数
+  double acmr = 0.0;
+  double atvr = 0.0;
+};
+
+constexpr uint32_t DEFAULT_VERTEX_CACHE_SIZE = 16;
+
+VertexCacheStats
+analyzeVertexCache(const std::vector<IndexType> &indices, size_t vertexCount,
+                   uint32_t cacheSize = DEFAULT_VERTEX_CACHE_SIZE);
+
+// Tipsify で三角形を並べ替えたインデックスを返す
+std::vector<IndexType>
+optimizeVertexCache(const std::vector<IndexType> &indices, size_t vertexCount,
+                    uint32_t cacheSize = DEFAULT_VERTEX_CACHE_SIZE);
+
+// optimizeVertexCache() の結果を、キャッシュが途切れる位置と ACMR が
+// threshold 倍を超えない位置で塊に分け、塊の向きでソートする
+std::vector<IndexType>
+optimizeOverdraw(const std::vector<IndexType> &indices,
+                 const std::vector<Vertex> &vertices,
+                 uint32_t cacheSize = DEFAULT_VERTEX_CACHE_SIZE,
+                 float threshold = 1.05f);
+
+// 頂点を indices で最初に使われる順に並べ直し、indices を書き換える。
+// どこからも使われていない頂点は取り除く。
+void optimizeVertexFetch(std::vector<Vertex> &vertices,
+                         std::vector<IndexType> &indices);
+
+struct MeshOptimizeReport {
+  VertexCacheStats before;
+  VertexCacheStats after;
+  double ms = 0.0;
+};
+
+// 3 つをすべて行い、前後の統計を返す
+MeshOptimizeReport optimizeMesh(std::vector<Vertex> &vertices,
+                                std::vector<IndexType> &indices,
+                                uint32_t cacheSize = DEFAULT_VERTEX_CACHE_SIZE);
+// mesh の頂点とインデックスを書き換える版
+MeshOptimizeReport optimizeMesh(Mesh &mesh,
+                                uint32_t cacheSize = DEFAULT_VERTEX_CACHE_SIZE);
+
+} // namespace b3
+
+#endif
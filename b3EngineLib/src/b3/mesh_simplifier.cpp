@@ -0,0 +1,337 @@
+#include "mesh_simplifier.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <tuple>
+
+namespace b3 {
+
+namespace {
+
+// 平面からの距離の二乗の和を表す二次形式 p^T A p + 2 b^T p + c
+// （A は対称なので 6 成分）。weight は足した面積の合計。
+struct Quadric {
+  double a00 = 0, a01 = 0, a02 = 0, a11 = 0, a12 = 0, a22 = 0;
+  double b0 = 0, b1 = 0, b2 = 0;
+  double c = 0;
+  double weight = 0;
+
+  // 単位法線 n、n・p + d = 0 の平面を、重み w で足す
+  void addPlane(const glm::vec3 &n, double d, double w) {
+    a00 += w * n.x * n.x;
+    a01 += w * n.x * n.y;
+    a02 += w * n.x * n.z;
+    a11 += w * n.y * n.y;
+    a12 += w * n.y * n.z;
+    a22 += w * n.z * n.z;
+    b0 += w * n.x * d;
+    b1 += w * n.y * d;
+    b2 += w * n.z * d;
+    c += w * d * d;
+    weight += w;
+  }
+
+  void add(const Quadric &q) {
+    a00 += q.a00;
+    a01 += q.a01;
+    a02 += q.a02;
+    a11 += q.a11;
+    a12 += q.a12;
+    a22 += q.a22;
+    b0 += q.b0;
+    b1 += q.b1;
+    b2 += q.b2;
+    c += q.c;
+    weight += q.weight;
+  }
+
+  // p に動かしたときの、面積で重み付けした距離の二乗の平均
+  double error(const glm::vec3 &p) const {
+    if (weight <= 0) {
+      return 0;
+    }
+    const double x = p.x, y = p.y, z = p.z;
+    const double e = a00 * x * x + a11 * y * y + a22 * z * z +
+                     2 * (a01 * x * y + a02 * x * z + a12 * y * z) +
+                     2 * (b0 * x + b1 * y + b2 * z) + c;
+    return std::max(e, 0.0) / weight;
+  }
+};
+
+// 頂点ごとの、その頂点を使う三角形の一覧（CSR 形式）
+struct Adjacency {
+  std::vector<uint32_t> offsets;
+  std::vector<uint32_t> triangles;
+
+  Adjacency(const std::vector<IndexType> &indices, size_t vertexCount)
+      : offsets(vertexCount + 1, 0), triangles(indices.size()) {
+    for (const auto v : indices) {
+      ++offsets[v + 1];
+    }
+    std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+    std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+    for (size_t i = 0; i < indices.size(); ++i) {
+      triangles[fill[indices[i]]++] = static_cast<uint32_t>(i / 3);
+    }
+  }
+};
+
+// 取り除いてはいけない頂点（継ぎ目、開いた縁、多様体でない辺）
+std::vector<bool> findLockedVertices(const std::vector<Vertex> &vertices,
+                                     const std::vector<IndexType> &indices) {
+  const size_t vertexCount = vertices.size();
+  std::vector<bool> locked(vertexCount, false);
+
+  // 同じ位置に複数の頂点があれば、UV か法線の継ぎ目
+  std::vector<uint32_t> order(vertexCount);
+  std::iota(order.begin(), order.end(), 0);
+  const auto less = [&](uint32_t a, uint32_t b) {
+    const auto &p = vertices[a].position;
+    const auto &q = vertices[b].position;
+    return std::tie(p.x, p.y, p.z) < std::tie(q.x, q.y, q.z);
+  };
+  std::sort(order.begin(), order.end(), less);
+  for (size_t i = 1; i < vertexCount; ++i) {
+    if (vertices[order[i - 1]].position == vertices[order[i]].position) {
+      locked[order[i - 1]] = true;
+      locked[order[i]] = true;
+    }
+  }
+
+  // 向きを持った辺 (a, b) に逆向きの (b, a) がなければ縁。
+  // 同じ向きで 2 回以上使われる辺は多様体でない。
+  std::vector<uint64_t> edges;
+  edges.reserve(indices.size());
+  for (size_t i = 0; i < indices.size(); i += 3) {
+    for (int k = 0; k < 3; ++k) {
+      const uint64_t a = indices[i + k];
+      const uint64_t b = indices[i + (k + 1) % 3];
+      edges.push_back(a << 32 | b);
+    }
+  }
+  std::sort(edges.begin(), edges.end());
+  for (size_t i = 0; i < edges.size(); ++i) {
+    const uint64_t a = edges[i] >> 32;
+    const uint64_t b = edges[i] & UINT32_MAX;
+    const bool duplicated =
+        (i > 0 && edges[i - 1] == edges[i]) ||
+        (i + 1 < edges.size() && edges[i + 1] == edges[i]);
+    if (duplicated ||
+        !std::binary_search(edges.begin(), edges.end(), b << 32 | a)) {
+      locked[a] = true;
+      locked[b] = true;
+    }
+  }
+  return locked;
+}
+
+// v を t に潰したときに、残る三角形の向きが反転しないか
+bool keepsOrientation(const std::vector<Vertex> &vertices,
+                      const std::vector<IndexType> &indices,
+                      const Adjacency &adjacency, IndexType v, IndexType t) {
+  for (uint32_t i = adjacency.offsets[v]; i < adjacency.offsets[v + 1]; ++i) {
+    const IndexType *triangle = &indices[adjacency.triangles[i] * 3];
+    if (triangle[0] == t || triangle[1] == t || triangle[2] == t) {
+      // 潰れてなくなる三角形
+      continue;
+    }
+    glm::vec3 p[3];
+    glm::vec3 q[3];
+    for (int k = 0; k < 3; ++k) {
+      p[k] = vertices[triangle[k]].position;
+      q[k] = triangle[k] == v ? vertices[t].position : p[k];
+    }
+    const glm::vec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+    const glm::vec3 after = glm::cross(q[1] - q[0], q[2] - q[0]);
+    if (glm::dot(before, after) <
+        1e-2f * glm::length(before) * glm::length(after)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+struct Collapse {
+  double cost;
+  IndexType from;
+  IndexType to;
+};
+
+} // namespace
+
+SimplifyResult simplifyMesh(const std::vector<Vertex> &vertices,
+                            const std::vector<IndexType> &indices,
+                            size_t targetIndexCount, float maxError) {
+  assert(indices.size() % 3 == 0);
+  const size_t vertexCount = vertices.size();
+  SimplifyResult result;
+  result.indices = indices;
+  if (indices.size() <= targetIndexCount) {
+    return result;
+  }
+
+  const auto locked = findLockedVertices(vertices, indices);
+  // 頂点ごとに、周りの三角形の平面を面積で重み付けして足す
+  std::vector<Quadric> quadrics(vertexCount);
+  for (size_t i = 0; i < indices.size(); i += 3) {
+    const glm::vec3 &p0 = vertices[indices[i + 0]].position;
+    const glm::vec3 &p1 = vertices[indices[i + 1]].position;
+    const glm::vec3 &p2 = vertices[indices[i + 2]].position;
+    const glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+    const float length = glm::length(normal);
+    if (length <= 0.f) {
+      continue;
+    }
+    const glm::vec3 n = normal / length;
+    for (int k = 0; k < 3; ++k) {
+      quadrics[indices[i + k]].addPlane(n, -glm::dot(n, p0), length * 0.5);
+    }
+  }
+
+  const double maxCost = double(maxError) * maxError;
+  const size_t targetTriangles = targetIndexCount / 3;
+  size_t triangleCount = indices.size() / 3;
+  double worst = 0;
+  std::vector<Collapse> collapses;
+  std::vector<bool> touched(vertexCount);
+  std::vector<IndexType> remap(vertexCount);
+
+  // 1 回のパスでは、互いに隣り合わない辺だけを誤差の小さい順に潰す
+  // （潰した頂点の周りの二次誤差と隣接が古くなるので、次のパスで作り直す）
+  while (triangleCount > targetTriangles) {
+    const auto &current = result.indices;
+    const Adjacency adjacency(current, vertexCount);
+
+    collapses.clear();
+    for (size_t v = 0; v < vertexCount; ++v) {
+      const uint32_t begin = adjacency.offsets[v];
+      const uint32_t end = adjacency.offsets[v + 1];
+      if (locked[v] || begin == end) {
+        continue;
+      }
+      Collapse best{.cost = maxCost, .from = IndexType(v), .to = IndexType(v)};
+      for (uint32_t i = begin; i < end; ++i) {
+        const IndexType *triangle = &current[adjacency.triangles[i] * 3];
+        for (int k = 0; k < 3; ++k) {
+          const IndexType t = triangle[k];
+          if (t == v) {
+            continue;
+          }
+          const double cost = quadrics[v].error(vertices[t].position);
+          if (cost < best.cost ||
+              (cost == best.cost && best.to == IndexType(v))) {
+            if (keepsOrientation(vertices, current, adjacency, IndexType(v),
+                                 t)) {
+              best.cost = cost;
+              best.to = t;
+            }
+          }
+        }
+      }
+      if (best.to != IndexType(v)) {
+        collapses.push_back(best);
+      }
+    }
+    if (collapses.empty()) {
+      break;
+    }
+    std::stable_sort(
+        collapses.begin(), collapses.end(),
+        [](const Collapse &a, const Collapse &b) { return a.cost < b.cost; });
+
+    std::fill(touched.begin(), touched.end(), false);
+    std::iota(remap.begin(), remap.end(), 0);
+    size_t collapsed = 0;
+    for (const auto &collapse : collapses) {
+      if (triangleCount <= targetTriangles) {
+        break;
+      }
+      if (touched[collapse.from] || touched[collapse.to]) {
+        continue;
+      }
+      const IndexType v = collapse.from;
+      for (uint32_t i = adjacency.offsets[v]; i < adjacency.offsets[v + 1];
+           ++i) {
+        const IndexType *triangle = &current[adjacency.triangles[i] * 3];
+        const bool removed = triangle[0] == collapse.to ||
+                             triangle[1] == collapse.to ||
+                             triangle[2] == collapse.to;
+        triangleCount -= removed ? 1 : 0;
+        for (int k = 0; k < 3; ++k) {
+          touched[triangle[k]] = true;
+        }
+      }
+      remap[v] = collapse.to;
+      quadrics[collapse.to].add(quadrics[v]);
+      worst = std::max(worst, collapse.cost);
+      ++collapsed;
+    }
+    if (collapsed == 0) {
+      break;
+    }
+
+    // 潰した頂点を付け替え、面積がなくなった三角形を取り除く
+    std::vector<IndexType> next;
+    next.reserve(current.size());
+    for (size_t i = 0; i < current.size(); i += 3) {
+      const IndexType a = remap[current[i + 0]];
+      const IndexType b = remap[current[i + 1]];
+      const IndexType c = remap[current[i + 2]];
+      if (a != b && b != c && c != a) {
+        next.insert(next.end(), {a, b, c});
+      }
+    }
+    result.indices = std::move(next);
+    triangleCount = result.indices.size() / 3;
+  }
+  result.error = static_cast<float>(std::sqrt(worst));
+  return result;
+}
+
+std::vector<MeshLod> buildLodChain(const std::vector<Vertex> &vertices,
+                                   const std::vector<IndexType> &indices,
+                                   uint32_t levels, float ratio) {
+  std::vector<MeshLod> lods;
+  lods.push_back({.indices = indices, .error = 0.f});
+  // 誤差が元のメッシュからの値になるよう、毎回元のインデックスから減らす
+  size_t target = indices.size();
+  while (lods.size() < levels) {
+    target = static_cast<size_t>(target / 3 * ratio) * 3;
+    if (target == 0) {
+      break;
+    }
+    auto simplified = simplifyMesh(vertices, indices, target);
+    const auto &previous = lods.back();
+    // 1 割も減らなければ、これ以上のレベルは作らない
+    if (simplified.indices.size() * 10 > previous.indices.size() * 9) {
+      break;
+    }
+    const float error = std::max(simplified.error, previous.error);
+    lods.push_back({.indices = std::move(simplified.indices), .error = error});
+  }
+  return lods;
+}
+
+uint32_t selectLod(const std::vector<float> &errors, float pixelsPerUnit,
+                   uint32_t current, float threshold, float hysteresis) {
+  const auto coarsest = [&](float limit) {
+    uint32_t level = 0;
+    for (uint32_t i = 1; i < errors.size(); ++i) {
+      if (errors[i] * pixelsPerUnit <= limit) {
+        level = i;
+      }
+    }
+    return level;
+  };
+  const uint32_t level = coarsest(threshold);
+  if (level <= current) {
+    // 細かくするのはすぐに
+    return level;
+  }
+  // 粗くするのは余裕ができてから
+  return std::max(std::min(current, level),
+                  coarsest(threshold * (1.f - hysteresis)));
+}
+
+} // namespace b3
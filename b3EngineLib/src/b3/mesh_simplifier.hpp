@@ -0,0 +1,63 @@
+#ifndef __MESH_SIMPLIFIER_HPP__
+#define __MESH_SIMPLIFIER_HPP__
+
+#include "common.hpp"
+#include "types.hpp"
+
+#include <cfloat>
+#include <vector>
+
+namespace b3 {
+
+// 二次誤差（QEM。Garland & Heckbert 1997）による三角形の削減と、それを
+// 使った離散的な LOD。
+//
+// 辺を片方の頂点に潰す（half-edge collapse）ので、頂点は増えず、位置も
+// 動かない。どの LOD も元の頂点バッファをそのまま使い、インデックスだけが
+// 異なる。
+//
+// UV や法線の継ぎ目（同じ位置に別の頂点がある所）と、開いた縁の頂点は
+// 取り除かないので、継ぎ目と輪郭は崩れない。
+
+struct SimplifyResult {
+  std::vector<IndexType> indices;
+  // 取り除いた頂点を潰した先に動かしたときの、元の面からの距離の最大値
+  // （メッシュの座標系。面積で重み付けした二次誤差の平方根）
+  float error = 0.f;
+};
+
+// indices を targetIndexCount 個以下になるまで（継ぎ目と縁を残して
+// できる所まで）減らす。誤差が maxError を超える辺は潰さない。
+SimplifyResult simplifyMesh(const std::vector<Vertex> &vertices,
+                            const std::vector<IndexType> &indices,
+                            size_t targetIndexCount,
+                            float maxError = FLT_MAX);
+
+struct MeshLod {
+  std::vector<IndexType> indices;
+  // 元のメッシュからの誤差（simplifyMesh() の error。細かい順に増える）
+  float error = 0.f;
+};
+
+constexpr uint32_t DEFAULT_LOD_LEVELS = 4;
+
+// レベル 0 を元のインデックスとし、三角形を ratio 倍ずつ減らした LOD を
+// 最大 levels レベル作る。ほとんど減らなくなったらそこで止める。
+std::vector<MeshLod> buildLodChain(const std::vector<Vertex> &vertices,
+                                   const std::vector<IndexType> &indices,
+                                   uint32_t levels = DEFAULT_LOD_LEVELS,
+                                   float ratio = 0.4f);
+
+// 画面上の誤差で LOD を選ぶ。errors は各レベルの誤差（細かい順）、
+// pixelsPerUnit は距離 1 がその位置で何ピクセルになるか。
+//
+// 誤差が threshold ピクセル以下で最も粗いレベルを選ぶ。ただし current より
+// 粗くするのは threshold * (1 - hysteresis) 以下になってからにして、境目で
+// レベルが毎フレーム行き来しないようにする。
+uint32_t selectLod(const std::vector<float> &errors, float pixelsPerUnit,
+                   uint32_t current, float threshold = 1.f,
+                   float hysteresis = 0.25f);
+
+} // namespace b3
+
+#endif
@@ -0,0 +1,300 @@
+#include "mipmap.hpp"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cassert>
+#include <cmath>
+#include <numbers>
+
+namespace b3 {
+
+namespace {
+
+// 線形から sRGB への変換表の分解能（暗い側でも 8 bit の 1 段より十分細かい）
+constexpr int SRGB_ENCODE_STEPS = 16384;
+
+struct ColorTables {
+  // 8 bit の sRGB から線形
+  std::array<float, 256> srgbToLinear;
+  // 線形 [0, 1] を SRGB_ENCODE_STEPS 段に分けたものから 8 bit の sRGB
+  std::array<uint8_t, SRGB_ENCODE_STEPS + 1> linearToSrgb;
+
+  ColorTables() {
+    for (int i = 0; i < 256; ++i) {
+      const float c = i / 255.0f;
+      srgbToLinear[i] = c <= 0.04045f ? c / 12.92f
+                                      : std::pow((c + 0.055f) / 1.055f, 2.4f);
+    }
+    for (int i = 0; i <= SRGB_ENCODE_STEPS; ++i) {
+      const float l = static_cast<float>(i) / SRGB_ENCODE_STEPS;
+      const float c = l <= 0.0031308f
+                          ? l * 12.92f
+                          : 1.055f * std::pow(l, 1.0f / 2.4f) - 0.055f;
+      linearToSrgb[i] = static_cast<uint8_t>(
+          std::clamp(static_cast<int>(c * 255.0f + 0.5f), 0, 255));
+    }
+  }
+};
+
+const ColorTables &colorTables() {
+  static const ColorTables tables;
+  return tables;
+}
+
+// 0 次の第1種変形ベッセル関数（級数展開）
+double besselI0(double x) {
+  double sum = 1.0;
+  double term = 1.0;
+  for (int k = 1; k < 32; ++k) {
+    term *= (x / (2.0 * k)) * (x / (2.0 * k));
+    sum += term;
+  }
+  return sum;
+}
+
+// 1/2 に縮小する分離可能なフィルタ。出力 i は入力 2i + first から
+// taps.size() 個を重み付けして足す。
+struct DownsampleFilter {
+  int first;
+  std::vector<float> taps;
+};
+
+DownsampleFilter boxFilter() { return {.first = 0, .taps = {0.5f, 0.5f}}; }
+
+// 半径 4（入力の画素数）の Kaiser 窓付き sinc。alpha が大きいほどリンギングが
+// 減ってぼける。
+DownsampleFilter kaiserFilter() {
+  constexpr int radius = 4;
+  constexpr double alpha = 4.0;
+  DownsampleFilter filter{.first = 1 - radius, .taps = {}};
+  double sum = 0.0;
+  std::vector<double> weights;
+  for (int k = 1 - radius; k <= radius; ++k) {
+    // 出力の中心（入力の 2i と 2i + 1 の間）からの距離
+    const double d = k - 0.5;
+    const double x = std::numbers::pi * d / 2.0;
+    const double sinc = std::sin(x) / x;
+    const double t = d / radius;
+    const double window =
+        besselI0(alpha * std::sqrt(1.0 - t * t)) / besselI0(alpha);
+    weights.push_back(sinc * window);
+    sum += sinc * window;
+  }
+  for (const double w : weights) {
+    filter.taps.push_back(static_cast<float>(w / sum));
+  }
+  return filter;
+}
+
+// RGBA の float 画像
+struct LinearImage {
+  uint32_t width = 0;
+  uint32_t height = 0;
+  std::vector<float> pixels;
+};
+
+LinearImage decode(const uint8_t *rgba, uint32_t width, uint32_t height,
+                   bool sRGB) {
+  const auto &tables = colorTables();
+  LinearImage image{.width = width, .height = height, .pixels = {}};
+  const size_t count = size_t(width) * height * 4;
+  image.pixels.resize(count);
+  for (size_t i = 0; i < count; i += 4) {
+    for (size_t c = 0; c < 3; ++c) {
+      image.pixels[i + c] =
+          sRGB ? tables.srgbToLinear[rgba[i + c]] : rgba[i + c] / 255.0f;
+    }
+    image.pixels[i + 3] = rgba[i + 3] / 255.0f;
+  }
+  return image;
+}
+
+void encode(const LinearImage &image, bool sRGB, uint8_t *out) {
+  const auto &tables = colorTables();
+  const size_t count = image.pixels.size();
+  for (size_t i = 0; i < count; ++i) {
+    // Kaiser の負のローブで範囲を少しはみ出すことがある
+    const float v = std::clamp(image.pixels[i], 0.0f, 1.0f);
+    if (sRGB && (i & 3) != 3) {
+      out[i] = tables.linearToSrgb[static_cast<size_t>(
+          v * SRGB_ENCODE_STEPS + 0.5f)];
+    } else {
+      out[i] = static_cast<uint8_t>(v * 255.0f + 0.5f);
+    }
+  }
+}
+
+// 横方向に縮小する（幅が 1 ならそのまま）
+void downsampleRowsScalar(const LinearImage &src, const DownsampleFilter &f,
+                          LinearImage &dst) {
+  const int last = static_cast<int>(src.width) - 1;
+  for (uint32_t y = 0; y < src.height; ++y) {
+    const float *row = &src.pixels[size_t(y) * src.width * 4];
+    float *out = &dst.pixels[size_t(y) * dst.width * 4];
+    for (uint32_t x = 0; x < dst.width; ++x) {
+      float acc[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+      for (size_t k = 0; k < f.taps.size(); ++k) {
+        const int sx =
+            std::clamp(static_cast<int>(2 * x) + f.first + int(k), 0, last);
+        for (int c = 0; c < 4; ++c) {
+          acc[c] += f.taps[k] * row[sx * 4 + c];
+        }
+      }
+      for (int c = 0; c < 4; ++c) {
+        out[x * 4 + c] = acc[c];
+      }
+    }
+  }
+}
+
+// 縦方向に縮小する（行ごとに重みを掛けて足すので、連続したメモリを読む）
+void downsampleColumnsScalar(const LinearImage &src, const DownsampleFilter &f,
+                             LinearImage &dst) {
+  const int last = static_cast<int>(src.height) - 1;
+  const size_t rowFloats = size_t(src.width) * 4;
+  for (uint32_t y = 0; y < dst.height; ++y) {
+    float *out = &dst.pixels[y * rowFloats];
+    std::fill(out, out + rowFloats, 0.0f);
+    for (size_t k = 0; k < f.taps.size(); ++k) {
+      const int sy =
+          std::clamp(static_cast<int>(2 * y) + f.first + int(k), 0, last);
+      const float *row = &src.pixels[sy * rowFloats];
+      for (size_t i = 0; i < rowFloats; ++i) {
+        out[i] += f.taps[k] * row[i];
+      }
+    }
+  }
+}
+
+#if defined(B3_SIMD_X86)
+
+// 1 画素（RGBA）を 1 つの __m128 として扱う。足す順番はスカラー版と同じ。
+void downsampleRowsSSE(const LinearImage &src, const DownsampleFilter &f,
+                       LinearImage &dst) {
+  const int last = static_cast<int>(src.width) - 1;
+  for (uint32_t y = 0; y < src.height; ++y) {
+    const float *row = &src.pixels[size_t(y) * src.width * 4];
+    float *out = &dst.pixels[size_t(y) * dst.width * 4];
+    for (uint32_t x = 0; x < dst.width; ++x) {
+      __m128 acc = _mm_setzero_ps();
+      for (size_t k = 0; k < f.taps.size(); ++k) {
+        const int sx =
+            std::clamp(static_cast<int>(2 * x) + f.first + int(k), 0, last);
+        acc = _mm_add_ps(acc, _mm_mul_ps(_mm_set1_ps(f.taps[k]),
+                                         _mm_loadu_ps(&row[sx * 4])));
+      }
+      _mm_storeu_ps(&out[x * 4], acc);
+    }
+  }
+}
+
+void downsampleColumnsSSE(const LinearImage &src, const DownsampleFilter &f,
+                          LinearImage &dst) {
+  const int last = static_cast<int>(src.height) - 1;
+  const size_t rowFloats = size_t(src.width) * 4;
+  for (uint32_t y = 0; y < dst.height; ++y) {
+    float *out = &dst.pixels[y * rowFloats];
+    std::fill(out, out + rowFloats, 0.0f);
+    for (size_t k = 0; k < f.taps.size(); ++k) {
+      const int sy =
+          std::clamp(static_cast<int>(2 * y) + f.first + int(k), 0, last);
+      const float *row = &src.pixels[sy * rowFloats];
+      const __m128 w = _mm_set1_ps(f.taps[k]);
+      // 1 行は 4 の倍数の float
+      for (size_t i = 0; i < rowFloats; i += 4) {
+        _mm_storeu_ps(&out[i],
+                      _mm_add_ps(_mm_loadu_ps(&out[i]),
+                                 _mm_mul_ps(w, _mm_loadu_ps(&row[i]))));
+      }
+    }
+  }
+}
+
+#endif
+
+LinearImage downsample(const LinearImage &src, const DownsampleFilter &f,
+                       SimdLevel level) {
+  const uint32_t width = std::max(1u, src.width / 2);
+  const uint32_t height = std::max(1u, src.height / 2);
+
+  // 幅が 1 の方向には縮小しない
+  LinearImage rows;
+  const LinearImage *horizontal = &src;
+  if (src.width > 1) {
+    rows = {.width = width,
+            .height = src.height,
+            .pixels = std::vector<float>(size_t(width) * src.height * 4)};
+#if defined(B3_SIMD_X86)
+    if (level != SimdLevel::Scalar) {
+      downsampleRowsSSE(src, f, rows);
+    } else
+#endif
+    {
+      downsampleRowsScalar(src, f, rows);
+    }
+    horizontal = &rows;
+  }
+  if (src.height == 1) {
+    return *horizontal;
+  }
+  LinearImage dst{.width = width,
+                  .height = height,
+                  .pixels = std::vector<float>(size_t(width) * height * 4)};
+#if defined(B3_SIMD_X86)
+  if (level != SimdLevel::Scalar) {
+    downsampleColumnsSSE(*horizontal, f, dst);
+    return dst;
+  }
+#endif
+  downsampleColumnsScalar(*horizontal, f, dst);
+  return dst;
+}
+
+} // namespace
+
+uint32_t mipLevelCount(uint32_t width, uint32_t height) {
+  return static_cast<uint32_t>(std::bit_width(std::max({width, height, 1u})));
+}
+
+std::vector<MipLevel> mipChainLayout(uint32_t width, uint32_t height) {
+  std::vector<MipLevel> levels;
+  const uint32_t count = mipLevelCount(width, height);
+  size_t offset = 0;
+  for (uint32_t i = 0; i < count; ++i) {
+    const size_t size = size_t(width) * height * 4;
+    levels.push_back(
+        {.width = width, .height = height, .offset = offset, .size = size});
+    offset += size;
+    width = std::max(1u, width / 2);
+    height = std::max(1u, height / 2);
+  }
+  return levels;
+}
+
+std::vector<uint8_t> generateMipChain(const uint8_t *rgba, uint32_t width,
+                                      uint32_t height, MipFilter filter,
+                                      bool sRGB) {
+  return generateMipChain(rgba, width, height, filter, sRGB,
+                          detectSimdLevel());
+}
+
+std::vector<uint8_t> generateMipChain(const uint8_t *rgba, uint32_t width,
+                                      uint32_t height, MipFilter filter,
+                                      bool sRGB, SimdLevel level) {
+  const auto levels = mipChainLayout(width, height);
+  std::vector<uint8_t> chain(levels.back().offset + levels.back().size);
+  std::copy_n(rgba, levels[0].size, chain.begin());
+
+  const DownsampleFilter f =
+      filter == MipFilter::Kaiser ? kaiserFilter() : boxFilter();
+  LinearImage image = decode(rgba, width, height, sRGB);
+  for (size_t i = 1; i < levels.size(); ++i) {
+    image = downsample(image, f, level);
+    assert(image.width == levels[i].width && image.height == levels[i].height);
+    encode(image, sRGB, &chain[levels[i].offset]);
+  }
+  return chain;
+}
+
+} // namespace b3
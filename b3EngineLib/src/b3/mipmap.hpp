@@ -0,0 +1,57 @@
+#ifndef __MIPMAP_HPP__
+#define __MIPMAP_HPP__
+
+#include "b3/simd.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace b3 {
+
+// テクスチャのミップマップの作り方
+enum class MipGeneration {
+  // レベル 0 だけ
+  None,
+  // GPU で vkCmdBlitImage を繰り返す（線形フィルタ、sRGB はハードウェアが
+  // 線形に戻して補間する）
+  GpuBlit,
+  // CPU で 2x2 の平均
+  CpuBox,
+  // CPU で Kaiser 窓の sinc（8 タップ、分離可能）
+  CpuKaiser,
+};
+
+// CPU でミップを作るときのフィルタ
+enum class MipFilter { Box, Kaiser };
+
+// ミップチェーンの1レベル（RGBA8 を詰めて並べたときの位置、バイト単位）
+struct MipLevel {
+  uint32_t width;
+  uint32_t height;
+  size_t offset;
+  size_t size;
+};
+
+// 1x1 までのレベル数
+uint32_t mipLevelCount(uint32_t width, uint32_t height);
+
+// RGBA8 のレベル 0 から mipLevelCount() レベルを順に詰めて並べたときの配置
+std::vector<MipLevel> mipChainLayout(uint32_t width, uint32_t height);
+
+// RGBA8 のレベル 0 からミップチェーン全体（レベル 0 を含む）を作る。
+//
+// 各レベルは前のレベルを半分（切り捨て、最小 1）に縮小する。計算は線形の
+// float で行い、レベルごとに 8 bit に丸めるが、次のレベルは丸める前の値から
+// 作るので誤差は積み重ならない。sRGB のときは RGB を線形に戻してから
+// フィルタし、sRGB に戻す（アルファは常に線形）。
+std::vector<uint8_t> generateMipChain(const uint8_t *rgba, uint32_t width,
+                                      uint32_t height, MipFilter filter,
+                                      bool sRGB);
+std::vector<uint8_t> generateMipChain(const uint8_t *rgba, uint32_t width,
+                                      uint32_t height, MipFilter filter,
+                                      bool sRGB, SimdLevel level);
+
+} // namespace b3
+
+#endif
@@ -1,39 +1,76 @@
 #include "node.hpp"
 #include "mesh.hpp"
 
+#include <algorithm>
+
 namespace b3 {
 
+Node::Node() : m_transform(TransformStore::shared().create()) {}
+
 Node::Node(const std::shared_ptr<Mesh> &mesh,
            const std::shared_ptr<Texture> &texture)
-    : m_mesh(mesh), m_texture(texture) {
+    : m_mesh(mesh), m_texture(texture),
+      m_transform(TransformStore::shared().create()) {
   m_boundingSphere = computeBoundingSphere(m_mesh->vertices());
 }
 
+Node::~Node() {
+  auto &store = TransformStore::shared();
+  // 子ノードが生き残る場合に備えて、ストア上の親子関係を外しておく
+  for (const auto &child : m_children) {
+    child->m_parent.reset();
+    store.setParent(child->m_transform, TransformStore::INVALID_HANDLE);
+  }
+  store.destroy(m_transform);
+}
+
 void Node::setMesh(std::shared_ptr<Mesh> mesh) {
   m_mesh = mesh;
   m_boundingSphere = computeBoundingSphere(m_mesh->vertices());
 }
 
+void Node::addChild(const std::shared_ptr<Node> &child) {
+  assert(child != nullptr && child.get() != this);
+  for (auto p = parent(); p; p = p->parent()) {
+    // 循環参照になる親子関係は作れない
+    assert(p != child);
+  }
+  if (auto oldParent = child->parent()) {
+    oldParent->removeChild(child);
+  }
+  child->m_parent = weak_from_this();
+  m_children.push_back(child);
+  TransformStore::shared().setParent(child->m_transform, m_transform);
+}
+
+void Node::removeChild(const std::shared_ptr<Node> &child) {
+  auto it = std::ranges::find(m_children, child);
+  if (it == m_children.end()) {
+    return;
+  }
+  m_children.erase(it);
+  child->m_parent.reset();
+  TransformStore::shared().setParent(child->m_transform,
+                                     TransformStore::INVALID_HANDLE);
+}
+
 glm::mat4 Node::localMatrix() const {
-  glm::mat4 modelMatrix = glm::mat4_cast(m_quat);
-  modelMatrix[3][0] = m_pos.x;
-  modelMatrix[3][1] = m_pos.y;
-  modelMatrix[3][2] = m_pos.z;
-  modelMatrix[3][3] = 1.0f;
-  return modelMatrix;
+  return TransformStore::shared().localMatrix(m_transform);
 }
 
 glm::mat4 Node::worldMatrix() const {
-  if (std::shared_ptr<Node> r = m_parent.lock()) {
-    return r->worldMatrix() * localMatrix();
-  }
-  return localMatrix();
+  return TransformStore::shared().worldMatrix(m_transform);
 }
 
 BoundingSphere Node::boundingSphere() const {
-  auto boundingSphere = m_boundingSphere;
-  boundingSphere.center += m_pos;
-  return boundingSphere;
+  return worldSphere(TransformStore::shared().worldMatrix(m_transform));
+}
+
+BoundingSphere Node::worldSphere(const glm::mat4 &world) const {
+  return BoundingSphere{
+      .center = glm::vec3(world * glm::vec4(m_boundingSphere.center, 1.0f)),
+      .radius = m_boundingSphere.radius,
+  };
 }
 
-}
\ No newline at end of file
+}
@@ -3,8 +3,10 @@
 
 #include "common.hpp"
 #include "frustum_culling.hpp"
+#include "transform_store.hpp"
 
 #include <memory>
+#include <vector>
 
 namespace b3 {
 
@@ -13,28 +15,41 @@ class Texture;
 
 class Node : public std::enable_shared_from_this<Node> {
   std::weak_ptr<Node> m_parent;
-  glm::vec3 m_pos{0.0f, 0.0f, 0.0f};
-  glm::quat m_quat{glm::vec3{0.0f, 0.0f, 0.0f}};
+  std::vector<std::shared_ptr<Node>> m_children;
   std::shared_ptr<Mesh> m_mesh;
   std::shared_ptr<Texture> m_texture;
   BoundingSphere m_boundingSphere;
 
+  // 位置・回転・変換行列は TransformStore が SoA で保持する。
+  // ノードはその Handle を持つだけ。
+  TransformStore::Handle m_transform;
+
 public:
-  Node() = default;
+  Node();
   Node(const std::shared_ptr<Mesh> &mesh, const std::shared_ptr<Texture> &texture);
+  ~Node();
+  Node(const Node &) = delete;
+  Node &operator=(const Node &) = delete;
+
   // position
-  void setPosition(const glm::vec3 &pos) { m_pos = pos; }
-  const glm::vec3 &position() const { return m_pos; }
+  void setPosition(const glm::vec3 &pos) {
+    TransformStore::shared().setPosition(m_transform, pos);
+  }
+  glm::vec3 position() const {
+    return TransformStore::shared().position(m_transform);
+  }
 
   // quat
-  void setQuat(const glm::quat &quat) { m_quat = quat; }
-  const glm::quat &quat() const { return m_quat; }
+  void setQuat(const glm::quat &quat) {
+    TransformStore::shared().setQuat(m_transform, quat);
+  }
+  glm::quat quat() const { return TransformStore::shared().quat(m_transform); }
 
   // euler angle
   void setEulerAngle(const glm::vec3 &angle) {
-    m_quat = glm::quat(glm::vec3(angle.x, angle.y, angle.z));
+    setQuat(glm::quat(glm::vec3(angle.x, angle.y, angle.z)));
   }
-  glm::vec3 eulearAngle() const { return glm::eulerAngles(m_quat); }
+  glm::vec3 eulearAngle() const { return glm::eulerAngles(quat()); }
 
   // mesh
   void setMesh(std::shared_ptr<Mesh> mesh);
@@ -44,12 +59,37 @@ public:
   void setTexture(std::shared_ptr<Texture> texture) { m_texture = texture; }
   const std::shared_ptr<Texture> &texture() const { return m_texture; }
 
+  // hierarchy
+  // 子ノードを追加する。既に別の親を持っている場合は、その親から外される。
+  void addChild(const std::shared_ptr<Node> &child);
+  void removeChild(const std::shared_ptr<Node> &child);
+  std::shared_ptr<Node> parent() const { return m_parent.lock(); }
+  const std::vector<std::shared_ptr<Node>> &children() const {
+    return m_children;
+  }
+
+  TransformStore::Handle transformHandle() const { return m_transform; }
+
+  // 変更があれば TransformStore::update() してから返す
   glm::mat4 localMatrix() const;
   glm::mat4 worldMatrix() const;
 
+  // ワールド座標系でのBounding Sphere
   BoundingSphere boundingSphere() const;
+
+  // TransformStore::update() 済みの値を読むだけの版。
+  // 複数のスレッドから同時に呼べる。
+  const glm::mat4 &updatedWorldMatrix() const {
+    return TransformStore::shared().updatedWorldMatrix(m_transform);
+  }
+  BoundingSphere updatedBoundingSphere() const {
+    return worldSphere(updatedWorldMatrix());
+  }
+
+private:
+  BoundingSphere worldSphere(const glm::mat4 &world) const;
 };
 
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,93 @@
+#include "pixel_convert.hpp"
+
+#include <cstring>
+#include <stdexcept>
+
+namespace b3 {
+
+static void expandScalar(const uint8_t *rgb, uint8_t *rgba, size_t begin,
+                         size_t count) {
+  for (size_t i = begin; i < count; ++i) {
+    rgba[i * 4 + 0] = rgb[i * 3 + 0];
+    rgba[i * 4 + 1] = rgb[i * 3 + 1];
+    rgba[i * 4 + 2] = rgb[i * 3 + 2];
+    rgba[i * 4 + 3] = 255;
+  }
+}
+
+#if defined(B3_SIMD_X86)
+
+// 128 bit のレーンごとに 4 画素（12 バイト）を読んで 16 バイトに広げる。
+// 16 バイト読むので、最後の数画素はスカラーで変換する。
+B3_TARGET_AVX2
+static size_t expandAVX2(const uint8_t *rgb, uint8_t *rgba, size_t count) {
+  const __m256i shuffle = _mm256_setr_epi8(
+      0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1, //
+      0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+  const __m256i alpha = _mm256_set1_epi32(static_cast<int>(0xff000000u));
+  size_t i = 0;
+  // 後半は 12 バイト目から 16 バイト読むので、i * 3 + 28 バイトまで読む
+  for (; i + 10 <= count; i += 8) {
+    const uint8_t *src = rgb + i * 3;
+    const __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src));
+    const __m128i hi =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 12));
+    const __m256i v =
+        _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+    _mm256_storeu_si256(
+        reinterpret_cast<__m256i *>(rgba + i * 4),
+        _mm256_or_si256(_mm256_shuffle_epi8(v, shuffle), alpha));
+  }
+  return i;
+}
+
+#endif
+
+void expandRgbToRgba(const uint8_t *rgb, uint8_t *rgba, size_t count) {
+  expandRgbToRgba(rgb, rgba, count, detectSimdLevel());
+}
+
+void expandRgbToRgba(const uint8_t *rgb, uint8_t *rgba, size_t count,
+                     SimdLevel level) {
+  size_t done = 0;
+#if defined(B3_SIMD_X86)
+  if (level >= SimdLevel::AVX2) {
+    done = expandAVX2(rgb, rgba, count);
+  }
+#endif
+  expandScalar(rgb, rgba, done, count);
+}
+
+void expandToRgba(const uint8_t *src, TextureFormat format, uint8_t *rgba,
+                  size_t count) {
+  // 16 bit はリトルエンディアンなので、上位 8 bit は 2 バイト目
+  const auto gray = [&](uint32_t stride, uint32_t high, bool alpha) {
+    for (size_t i = 0; i < count; ++i) {
+      const uint8_t *p = src + i * stride;
+      rgba[i * 4 + 0] = rgba[i * 4 + 1] = rgba[i * 4 + 2] = p[high];
+      rgba[i * 4 + 3] = alpha ? p[stride / 2 + high] : 255;
+    }
+  };
+  switch (format) {
+  case TextureFormat::RGBA8:
+    std::memcpy(rgba, src, count * 4);
+    return;
+  case TextureFormat::R8:
+    gray(1, 0, false);
+    return;
+  case TextureFormat::RG8:
+    gray(2, 0, true);
+    return;
+  case TextureFormat::R16:
+    gray(2, 1, false);
+    return;
+  case TextureFormat::RG16:
+    gray(4, 1, true);
+    return;
+  default:
+    throw std::invalid_argument(std::string("cannot expand ") +
+                                toString(format));
+  }
+}
+
+} // namespace b3
@@ -0,0 +1,26 @@
+#ifndef __PIXEL_CONVERT_HPP__
+#define __PIXEL_CONVERT_HPP__
+
+#include "b3/simd.hpp"
+#include "b3/texture_format.hpp"
+
+#include <cstddef>
+#include <cstdint>
+
+namespace b3 {
+
+// count 画素の RGB8 を RGBA8（A = 255）に並べ替える。AVX2 が使えれば
+// バイトのシャッフルで 8 画素ずつ変換する。rgb と rgba は重ならないこと。
+void expandRgbToRgba(const uint8_t *rgb, uint8_t *rgba, size_t count);
+void expandRgbToRgba(const uint8_t *rgb, uint8_t *rgba, size_t count,
+                     SimdLevel level);
+
+// 圧縮しない形式の count 画素を RGBA8 に広げる。1 / 2 チャンネルは輝度と
+// アルファとして (L, L, L, 1) / (L, L, L, A) にし、16 bit は上位 8 bit を使う
+// （stb_image に 4 チャンネルで読ませたときと同じ）。
+void expandToRgba(const uint8_t *src, TextureFormat format, uint8_t *rgba,
+                  size_t count);
+
+} // namespace b3
+
+#endif
@@ -0,0 +1,69 @@
+#include "simd.hpp"
+
+#if defined(_MSC_VER) && defined(B3_SIMD_X86)
+#include <intrin.h>
+#endif
+
+namespace b3 {
+
+static SimdLevel queryCpu() {
+#if defined(B3_SIMD_X86)
+#if defined(__GNUC__) || defined(__clang__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) {
+    return SimdLevel::AVX512;
+  }
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+    return SimdLevel::AVX2;
+  }
+  return SimdLevel::SSE2;
+#elif defined(_MSC_VER)
+  int info[4];
+  __cpuid(info, 0);
+  const int maxLeaf = info[0];
+  __cpuid(info, 1);
+  const bool osxsave = (info[2] & (1 << 27)) != 0;
+  const bool fma = (info[2] & (1 << 12)) != 0;
+  if (!osxsave || maxLeaf < 7) {
+    return SimdLevel::SSE2;
+  }
+  // OSがYMM/ZMMレジスタを保存するかどうか
+  const unsigned long long xcr0 = _xgetbv(0);
+  const bool ymm = (xcr0 & 0x6) == 0x6;
+  const bool zmm = (xcr0 & 0xe6) == 0xe6;
+  __cpuidex(info, 7, 0);
+  if (zmm && (info[1] & (1 << 16)) != 0) {
+    return SimdLevel::AVX512;
+  }
+  if (ymm && fma && (info[1] & (1 << 5)) != 0) {
+    return SimdLevel::AVX2;
+  }
+  return SimdLevel::SSE2;
+#else
+  return SimdLevel::SSE2;
+#endif
+#else
+  return SimdLevel::Scalar;
+#endif
+}
+
+SimdLevel detectSimdLevel() {
+  static const SimdLevel level = queryCpu();
+  return level;
+}
+
+const char *toString(SimdLevel level) {
+  switch (level) {
+  case SimdLevel::Scalar:
+    return "Scalar";
+  case SimdLevel::SSE2:
+    return "SSE2";
+  case SimdLevel::AVX2:
+    return "AVX2";
+  case SimdLevel::AVX512:
+    return "AVX-512";
+  }
+  return "Unknown";
+}
+
+} // namespace b3
@@ -0,0 +1,30 @@
+#ifndef __SIMD_HPP__
+#define __SIMD_HPP__
+
+#include <cstdint>
+
+// x86-64 では SSE2 が常に使える。AVX2/AVX-512 は実行時に判定して切り替える。
+#if defined(__x86_64__) || defined(_M_X64)
+#define B3_SIMD_X86 1
+#include <immintrin.h>
+#if defined(__GNUC__) || defined(__clang__)
+#define B3_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#define B3_TARGET_AVX512 __attribute__((target("avx512f")))
+#else
+#define B3_TARGET_AVX2
+#define B3_TARGET_AVX512
+#endif
+#endif
+
+namespace b3 {
+
+enum class SimdLevel { Scalar, SSE2, AVX2, AVX512 };
+
+// CPUが対応している最も高いSIMDレベルを返す（結果はキャッシュされる）
+SimdLevel detectSimdLevel();
+
+const char *toString(SimdLevel level);
+
+} // namespace b3
+
+#endif
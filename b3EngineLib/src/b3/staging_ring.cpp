@@ -0,0 +1,43 @@
+#include "staging_ring.hpp"
+
+#include <cassert>
+
+namespace b3 {
+
+uint64_t StagingRing::allocate(uint64_t size, uint64_t alignment) {
+  assert((alignment & (alignment - 1)) == 0);
+  if (size == 0 || size > m_capacity) {
+    return INVALID_OFFSET;
+  }
+  if (m_head == m_tail && m_closed.empty()) {
+    // 空なら先頭から使う（折り返しで容量いっぱいの領域を取り損ねない）
+    m_head = m_tail = 0;
+  }
+  const uint64_t position = m_head % m_capacity;
+  uint64_t offset = (position + alignment - 1) & ~(alignment - 1);
+  if (offset + size > m_capacity) {
+    // 末尾に収まらなければ先頭に折り返す
+    offset = m_capacity;
+  }
+  const uint64_t start = m_head + (offset - position);
+  const uint64_t end = start + size;
+  if (end - m_tail > m_capacity) {
+    return INVALID_OFFSET;
+  }
+  m_head = end;
+  return start % m_capacity;
+}
+
+void StagingRing::close(uint64_t batch) {
+  assert(m_closed.empty() || m_closed.back().batch < batch);
+  m_closed.push_back({.batch = batch, .end = m_head});
+}
+
+void StagingRing::release(uint64_t completedBatch) {
+  while (!m_closed.empty() && m_closed.front().batch <= completedBatch) {
+    m_tail = m_closed.front().end;
+    m_closed.pop_front();
+  }
+}
+
+} // namespace b3
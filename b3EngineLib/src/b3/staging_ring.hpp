@@ -0,0 +1,48 @@
+#ifndef __STAGING_RING_HPP__
+#define __STAGING_RING_HPP__
+
+#include <cstdint>
+#include <deque>
+
+namespace b3 {
+
+// ステージングバッファをリングバッファとして切り出すための、オフセットだけを
+// 管理する割り当て器。
+//
+// allocate() した領域は close() でバッチ番号を付け、そのバッチの完了を
+// release() で知らせるまで再利用しない。バッチ番号は単調増加とする。
+class StagingRing {
+public:
+  static constexpr uint64_t INVALID_OFFSET = UINT64_MAX;
+
+  explicit StagingRing(uint64_t capacity = 0) : m_capacity(capacity) {}
+
+  // size バイトを alignment（2のべき乗）に揃えて割り当て、リング上の
+  // オフセットを返す。空きがなければ INVALID_OFFSET を返す。
+  // 領域はリングの末尾で折り返さない。
+  uint64_t allocate(uint64_t size, uint64_t alignment = 1);
+  // 前回の close() 以降に割り当てた領域を batch に属するものとする
+  void close(uint64_t batch);
+  // completedBatch 以前のバッチの領域を解放する
+  void release(uint64_t completedBatch);
+
+  uint64_t capacity() const { return m_capacity; }
+  // 使用中（まだ解放されていない）のバイト数。折り返しで飛ばした分を含む。
+  uint64_t used() const { return m_head - m_tail; }
+
+private:
+  struct Closed {
+    uint64_t batch;
+    uint64_t end;
+  };
+
+  uint64_t m_capacity = 0;
+  // 単調増加する書き込み位置と、使用中の先頭の位置
+  uint64_t m_head = 0;
+  uint64_t m_tail = 0;
+  std::deque<Closed> m_closed;
+};
+
+} // namespace b3
+
+#endif
@@ -1,47 +1,263 @@
 #include "texture.hpp"
 
+#include "b3/bcn.hpp"
+#include "b3/pixel_convert.hpp"
+
 #include <stb_image.h>
 
+#include <chrono>
+#include <cstring>
+
 namespace b3 {
 
-Texture::Texture(const std::string &filename, bool sRGB) : m_sRGB(sRGB) {
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double elapsedMs(Clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(Clock::now() - start)
+      .count();
+}
+
+// ファイルのヘッダから、展開したときの形式を決める。1 / 2 チャンネルは
+// そのまま R8 / RG8（16 bit のファイルは sRGB でなければ R16 / RG16）にし、
+// RGB と RGBA は RGBA8 にする。
+TextureFormat pixelFormatOf(const std::string &filename, bool sRGB,
+                            int &width, int &height) {
+  int nComponents;
+  if (!stbi_info(filename.c_str(), &width, &height, &nComponents)) {
+    SPDLOG_ERROR("Failed to load {}", filename);
+    throw std::runtime_error("texture creation error");
+  }
+  const bool wide = !sRGB && stbi_is_16_bit(filename.c_str());
+  switch (nComponents) {
+  case 1:
+    return wide ? TextureFormat::R16 : TextureFormat::R8;
+  case 2:
+    return wide ? TextureFormat::RG16 : TextureFormat::RG8;
+  case 3:
+  case 4:
+    return TextureFormat::RGBA8;
+  }
+  SPDLOG_ERROR("Unsupported number of channels {} in {}", nComponents,
+               filename);
+  throw std::runtime_error("texture creation error");
+}
+
+// ファイルのチャンネル数のまま展開し、RGB は自分で RGBA に並べ替える
+// （stb_image に変換させると1画素ずつのループになる）。
+// destination は画像の大きさと形式を受け取り、書き込み先を返す。
+template <class Destination>
+void decodePixels(const std::string &filename, bool sRGB, LoadTiming &timing,
+                  Destination destination) {
+  const auto start = Clock::now();
   int width, height, nComponents;
-  auto *data =
-      stbi_load(filename.c_str(), &width, &height, &nComponents, STBI_rgb_alpha);
+  const auto format = pixelFormatOf(filename, sRGB, width, height);
+  // 16 bit の形式だけ 16 bit のまま読む
+  const bool wide =
+      format == TextureFormat::R16 || format == TextureFormat::RG16;
+  void *data =
+      wide ? static_cast<void *>(stbi_load_16(filename.c_str(), &width,
+                                              &height, &nComponents, 0))
+           : static_cast<void *>(stbi_load(filename.c_str(), &width, &height,
+                                           &nComponents, 0));
   if (data == nullptr) {
     SPDLOG_ERROR("Failed to load {}", filename);
     throw std::runtime_error("texture creation error");
   }
+  timing.decodeMs = elapsedMs(start);
+
+  const auto convertStart = Clock::now();
+  try {
+    uint8_t *dst = destination(width, height, format);
+    const auto *src = static_cast<const uint8_t *>(data);
+    if (nComponents == 3) {
+      // PNGファイルにアルファがない場合はn=3になる
+      expandRgbToRgba(src, dst, size_t(width) * height);
+    } else {
+      std::memcpy(dst, src, levelSize(format, width, height));
+    }
+  } catch (...) {
+    stbi_image_free(data);
+    throw;
+  }
+  stbi_image_free(data);
+  timing.convertMs = elapsedMs(convertStart);
+}
+
+} // namespace
 
+Texture::Texture(const std::string &filename, bool sRGB)
+    : m_source{.filename = filename, .sRGB = sRGB}, m_sRGB(sRGB) {
+  if (isCompressedImageFile(filename)) {
+    loadCompressed();
+    return;
+  }
+  decodePixels(filename, sRGB, m_loadTiming,
+               [this](int width, int height, TextureFormat format) {
+                 m_width = width;
+                 m_height = height;
+                 m_pixelFormat = format;
+                 m_pixels.resize(levelSize(format, width, height));
+                 return m_pixels.data();
+               });
+}
+
+Texture::Texture(TextureSource source)
+    : m_source(std::move(source)), m_sRGB(m_source.sRGB), m_keepPixels(false) {
+  if (isCompressedImageFile(m_source.filename)) {
+    loadCompressed();
+    return;
+  }
+  // 大きさと形式だけを読む（registry や VkImage の作成に必要）
+  int width, height;
+  m_pixelFormat = pixelFormatOf(m_source.filename, m_sRGB, width, height);
   m_width = width;
   m_height = height;
+}
 
-  if (nComponents == 3) {
-    // PNGファイルにアルファがない場合はn=3になる
-    m_pixels.resize(width * height * 4);
-    for (int y = 0; y < height; ++y) {
-      for (int x = 0; x < width; ++x) {
-        size_t src = (x + y * width) * 3;
-        size_t dst = (x + y * width) * 4;
-        assert(dst < m_pixels.size());
-        m_pixels[dst + 0] = data[src + 0];
-        m_pixels[dst + 1] = data[src + 1];
-        m_pixels[dst + 2] = data[src + 2];
-        m_pixels[dst + 3] = 255;
-      }
-    }
-    stbi_image_free(data);
+void Texture::loadCompressed() {
+  // 色空間はファイルの形式によらず呼び出し側の指定に合わせる
+  // （古い DDS には情報がなく、BC5 には sRGB がない）
+  const auto start = Clock::now();
+  auto image = loadCompressedImage(m_source.filename);
+  image.sRGB = m_source.sRGB && image.format != TextureFormat::BC5;
+  adoptImage(std::move(image));
+  m_loadTiming.decodeMs = elapsedMs(start);
+}
+
+void Texture::adoptImage(CompressedImage image) {
+  m_width = image.width;
+  m_height = image.height;
+  m_sRGB = image.sRGB;
+  if (isBlockCompressed(image.format)) {
+    m_compressed = std::move(image);
     return;
-  } else if (nComponents == 4) {
-    const auto len = width * height * 4;
-    m_pixels.resize(len);
-    std::memcpy(m_pixels.data(), data, len);
-    stbi_image_free(data);
+  }
+  // 圧縮しない形式は画素として持つ（ミップは設定に従って作り直す）
+  m_pixelFormat = image.format;
+  image.data.resize(levelSize(image.format, image.width, image.height));
+  m_pixels = std::move(image.data);
+  m_compressed = {};
+}
+
+void Texture::releasePixels() {
+  if (!hasSource()) {
+    throw std::logic_error("texture has no source to reload from");
+  }
+  // 容量ごと手放す（形式とレベル数は読み直すときのために残す）
+  m_pixels = {};
+  m_mipChain = {};
+  m_compressed.data = {};
+}
+
+void Texture::reload(JobSystem *jobs) {
+  if (resident()) {
     return;
   }
+  if (!hasSource()) {
+    throw std::logic_error("texture has no source to reload from");
+  }
+  if (isCompressedImageFile(m_source.filename)) {
+    loadCompressed();
+    return;
+  }
+  decodePixels(m_source.filename, m_sRGB, m_loadTiming,
+               [this](int width, int height, TextureFormat format) {
+                 checkUnchanged(width, height, format);
+                 m_pixels.resize(levelSize(format, width, height));
+                 return m_pixels.data();
+               });
+  if (isCompressed()) {
+    compress(format(), jobs);
+  }
+}
 
-  SPDLOG_ERROR("Only support rgb or rgba format");
-  throw std::runtime_error("texture creation error");
+void Texture::decodeInto(uint8_t *dst) {
+  if (!m_pixels.empty()) {
+    std::memcpy(dst, m_pixels.data(), m_pixels.size());
+    return;
+  }
+  if (!hasSource() || isCompressedImageFile(m_source.filename)) {
+    throw std::logic_error("texture has no RGBA8 source to decode");
+  }
+  decodePixels(m_source.filename, m_sRGB, m_loadTiming,
+               [&](int width, int height, TextureFormat format) {
+                 checkUnchanged(width, height, format);
+                 return dst;
+               });
+}
+
+void Texture::checkUnchanged(int width, int height,
+                             TextureFormat format) const {
+  if (uint32_t(width) != m_width || uint32_t(height) != m_height ||
+      format != m_pixelFormat) {
+    throw std::runtime_error("texture file changed since it was loaded");
+  }
+}
+
+void Texture::setMipGeneration(MipGeneration mipGeneration) {
+  if (m_mipGeneration != mipGeneration) {
+    m_mipGeneration = mipGeneration;
+    m_mipChain.clear();
+  }
+}
+
+const std::vector<uint8_t> &Texture::mipChain() {
+  if (m_mipChain.empty()) {
+    if (m_pixels.empty()) {
+      throw std::logic_error("no pixels to generate mipmaps from");
+    }
+    const auto filter = m_mipGeneration == MipGeneration::CpuKaiser
+                            ? MipFilter::Kaiser
+                            : MipFilter::Box;
+    // ミップチェーンは RGBA8 で作る
+    std::vector<uint8_t> rgba;
+    const uint8_t *source = m_pixels.data();
+    if (m_pixelFormat != TextureFormat::RGBA8) {
+      rgba = rgba8Pixels();
+      source = rgba.data();
+    }
+    m_mipChain = generateMipChain(source, m_width, m_height, filter, m_sRGB);
+  }
+  return m_mipChain;
+}
+
+std::vector<uint8_t> Texture::rgba8Pixels() const {
+  if (m_pixelFormat == TextureFormat::RGBA8) {
+    return m_pixels;
+  }
+  std::vector<uint8_t> rgba(size_t(m_width) * m_height * 4);
+  expandToRgba(m_pixels.data(), m_pixelFormat, rgba.data(),
+               size_t(m_width) * m_height);
+  return rgba;
+}
+
+Texture::Texture(CompressedImage image) { adoptImage(std::move(image)); }
+
+void Texture::compress(TextureFormat format, JobSystem *jobs) {
+  const uint32_t levelCount = m_mipGeneration == MipGeneration::None
+                                  ? 1
+                                  : mipLevelCount(m_width, m_height);
+  std::vector<uint8_t> rgba;
+  const uint8_t *source;
+  if (levelCount > 1) {
+    source = mipChain().data();
+  } else {
+    rgba = rgba8Pixels();
+    source = rgba.data();
+  }
+  m_compressed = compressMipChain(source, m_width, m_height, levelCount,
+                                  format, m_sRGB, jobs);
+  m_sRGB = m_compressed.sRGB;
+}
+
+void Texture::setMipChain(std::vector<uint8_t> mipChain) {
+  const auto levels = mipChainLayout(m_width, m_height);
+  if (mipChain.size() != levels.back().offset + levels.back().size) {
+    throw std::invalid_argument("mip chain size mismatch");
+  }
+  m_mipChain = std::move(mipChain);
 }
 
 constexpr size_t COLOR_TEXTURE_WIDTH = 4;
@@ -5,26 +5,128 @@
 
 #include "b3/types.hpp"
 #include "b3/common.hpp"
+#include "b3/mipmap.hpp"
+#include "b3/texture_format.hpp"
 
 namespace b3 {
 
+class JobSystem;
+
+// ファイルからの読み込みにかかった時間
+struct LoadTiming {
+  // ファイルの読み込みと展開（PNG などのデコード、KTX2/DDS の読み込み）
+  double decodeMs = 0.0;
+  // RGBA8 への並べ替え
+  double convertMs = 0.0;
+};
+
+// 画素を手放したテクスチャを読み直すためのファイルの情報
+struct TextureSource {
+  std::string filename;
+  bool sRGB = false;
+
+  bool operator==(const TextureSource &) const = default;
+};
+
 class Texture {
+  TextureSource m_source;
   uint32_t m_width;
   uint32_t m_height;
   bool m_sRGB;
+  // レベル 0 の画素（形式は m_pixelFormat）
   std::vector<uint8_t> m_pixels;
+  TextureFormat m_pixelFormat = TextureFormat::RGBA8;
+  MipGeneration m_mipGeneration = MipGeneration::GpuBlit;
+  // CPU で作った、またはオフラインで作って設定したミップチェーン
+  std::vector<uint8_t> m_mipChain;
+  // 圧縮したテクスチャ（RGBA8 のままなら format が RGBA8 で data は空）
+  CompressedImage m_compressed;
+  LoadTiming m_loadTiming;
+  bool m_keepPixels = true;
   VkImage m_image = VK_NULL_HANDLE;
   VkImageView m_imageView = VK_NULL_HANDLE;
   VmaAllocation m_allocation = VK_NULL_HANDLE;
 
+  // source() の .ktx2 / .dds を読み込む
+  void loadCompressed();
+  // ブロック圧縮の形式はそのまま、それ以外はレベル 0 を画素として持つ
+  void adoptImage(CompressedImage image);
+  // 読み直したファイルが最初に読んだときと同じ大きさと形式か確かめる
+  void checkUnchanged(int width, int height, TextureFormat format) const;
+
 public:
+  // 画像はファイルのチャンネル数を保ち、1 / 2 チャンネルは R8 / RG8
+  // （sRGB でない 16 bit は R16 / RG16）、RGB と RGBA は RGBA8 で持つ。
+  // .ktx2 / .dds は圧縮したまま読み込む（pixels() は空になる）。
   Texture(const std::string &filename, bool sRGB);
   Texture(const RGBAColor &color);
+  // 圧縮済みのデータから作る（pixels() は空になる）
+  explicit Texture(CompressedImage image);
+  // ファイルのヘッダだけを読み、画素は GPU に送るときにステージングへ直接
+  // デコードする（resident() が false で始まり、keepPixels() も false）。
+  // .ktx2 / .dds はその場で読み込む。
+  explicit Texture(TextureSource source);
 
   uint32_t width() const { return m_width; }
   uint32_t height() const { return m_height; }
   bool sRGB() const { return m_sRGB; }
-  const uint8_t *pixels() { return m_pixels.data(); }
+  // レベル 0 の画素。形式は format()（isCompressed() でないとき）
+  const uint8_t *pixels() const { return m_pixels.data(); }
+  size_t pixelBytes() const { return m_pixels.size(); }
+  // pixels() を RGBA8 に広げたもの（1 / 2 チャンネルは輝度とアルファ）
+  std::vector<uint8_t> rgba8Pixels() const;
+
+  // ファイルから作ったときの読み込み元（それ以外は filename が空）
+  const TextureSource &source() const { return m_source; }
+  bool hasSource() const { return !m_source.filename.empty(); }
+  // 画素か圧縮したブロックを CPU 側に持っているか
+  bool resident() const {
+    return !m_pixels.empty() || !m_compressed.data.empty();
+  }
+  // CPU 側に持っている画素、ミップチェーン、圧縮したブロックのバイト数
+  size_t residentBytes() const {
+    return m_pixels.size() + m_mipChain.size() + m_compressed.data.size();
+  }
+  // 画素、ミップチェーン（setMipChain() したものも）、圧縮したブロックを
+  // 手放す。source() がなければ std::logic_error
+  void releasePixels();
+  // 手放した内容を source() から読み直す。compress() していたテクスチャは
+  // 同じ形式に圧縮し直す。
+  void reload(JobSystem *jobs = nullptr);
+  // レベル 0 の画素（format() の levelSize() バイト）を dst に書く。
+  // 画素を持っていなければ、ファイルから dst に直接デコードする。
+  void decodeInto(uint8_t *dst);
+  // GPU に送った後も画素を持ち続けるか。false なら、source() があれば
+  // 送った後に releasePixels() する。
+  void setKeepPixels(bool keepPixels) { m_keepPixels = keepPixels; }
+  bool keepPixels() const { return m_keepPixels; }
+
+  // ミップマップの作り方（既定は GpuBlit）
+  void setMipGeneration(MipGeneration mipGeneration);
+  MipGeneration mipGeneration() const { return m_mipGeneration; }
+  // レベル 0 を含む RGBA8 のミップチェーン全体（mipChainLayout() の順に
+  // 詰めたもの）。最初に呼んだときに CPU で作って保持する（CpuKaiser 以外は
+  // Box で作る）。
+  const std::vector<uint8_t> &mipChain();
+  bool hasMipChain() const { return !m_mipChain.empty(); }
+  // オフラインで作ったミップチェーンを設定する（大きさが合わなければ
+  // std::invalid_argument）。設定したものは作り方によらず使われる。
+  void setMipChain(std::vector<uint8_t> mipChain);
+
+  // ファイルから作ったときの読み込み時間（それ以外は 0）
+  const LoadTiming &loadTiming() const { return m_loadTiming; }
+
+  // GPU に置く形式
+  TextureFormat format() const {
+    return isCompressed() ? m_compressed.format : m_pixelFormat;
+  }
+  bool isCompressed() const { return isBlockCompressed(m_compressed.format); }
+  // 圧縮したミップチェーン（isCompressed() のときだけ使える）
+  const CompressedImage &compressed() const { return m_compressed; }
+  // pixels() を BC1/BC3/BC5/BC7 に圧縮して GPU に置く形式にする。ミップを作る
+  // 設定なら mipChain() の全レベルを、そうでなければレベル 0 を圧縮する。
+  // jobs を渡すとブロックを並列に圧縮する。
+  void compress(TextureFormat format, JobSystem *jobs = nullptr);
 
   VkImage getImage() const { return m_image; }
   VkImageView getImageView() const { return m_imageView; }
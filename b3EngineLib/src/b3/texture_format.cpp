@@ -0,0 +1,455 @@
+#include "texture_format.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+
+namespace b3 {
+
+namespace {
+
+// KTX2 の vkFormat（VkFormat の値）
+constexpr uint32_t VK_R8_UNORM = 9;
+constexpr uint32_t VK_R8_SRGB = 15;
+constexpr uint32_t VK_R8G8_UNORM = 16;
+constexpr uint32_t VK_R8G8_SRGB = 22;
+constexpr uint32_t VK_R8G8B8A8_UNORM = 37;
+constexpr uint32_t VK_R8G8B8A8_SRGB = 43;
+constexpr uint32_t VK_R16_UNORM = 70;
+constexpr uint32_t VK_R16G16_UNORM = 77;
+constexpr uint32_t VK_BC1_RGB_UNORM = 131;
+constexpr uint32_t VK_BC1_RGB_SRGB = 132;
+constexpr uint32_t VK_BC1_RGBA_UNORM = 133;
+constexpr uint32_t VK_BC1_RGBA_SRGB = 134;
+constexpr uint32_t VK_BC3_UNORM = 137;
+constexpr uint32_t VK_BC3_SRGB = 138;
+constexpr uint32_t VK_BC5_UNORM = 141;
+constexpr uint32_t VK_BC7_UNORM = 145;
+constexpr uint32_t VK_BC7_SRGB = 146;
+
+// DDS の DX10 拡張ヘッダの DXGI_FORMAT
+constexpr uint32_t DXGI_R8G8B8A8_UNORM = 28;
+constexpr uint32_t DXGI_R8G8B8A8_UNORM_SRGB = 29;
+constexpr uint32_t DXGI_R16G16_UNORM = 35;
+constexpr uint32_t DXGI_R8G8_UNORM = 49;
+constexpr uint32_t DXGI_R16_UNORM = 56;
+constexpr uint32_t DXGI_R8_UNORM = 61;
+constexpr uint32_t DXGI_BC1_UNORM = 71;
+constexpr uint32_t DXGI_BC1_UNORM_SRGB = 72;
+constexpr uint32_t DXGI_BC3_UNORM = 77;
+constexpr uint32_t DXGI_BC3_UNORM_SRGB = 78;
+constexpr uint32_t DXGI_BC5_UNORM = 83;
+constexpr uint32_t DXGI_BC7_UNORM = 98;
+constexpr uint32_t DXGI_BC7_UNORM_SRGB = 99;
+
+constexpr uint8_t KTX2_IDENTIFIER[12] = {0xab, 'K',  'T',  'X', ' ',  '2',
+                                         '0',  0xbb, '\r', '\n', 0x1a, '\n'};
+constexpr size_t KTX2_HEADER_SIZE = 80;
+constexpr size_t KTX2_LEVEL_INDEX_SIZE = 24;
+
+constexpr size_t DDS_HEADER_SIZE = 4 + 124;
+constexpr size_t DDS_DX10_HEADER_SIZE = 20;
+constexpr uint32_t DDPF_FOURCC = 0x4;
+constexpr uint32_t DDPF_RGB = 0x40;
+
+constexpr uint32_t fourCC(const char (&s)[5]) {
+  return uint32_t(uint8_t(s[0])) | uint32_t(uint8_t(s[1])) << 8 |
+         uint32_t(uint8_t(s[2])) << 16 | uint32_t(uint8_t(s[3])) << 24;
+}
+
+template <typename T>
+T read(const std::vector<uint8_t> &file, size_t offset) {
+  if (offset > file.size() || sizeof(T) > file.size() - offset) {
+    throw std::runtime_error("texture file is truncated");
+  }
+  T value;
+  std::memcpy(&value, file.data() + offset, sizeof(T));
+  return value;
+}
+
+template <typename T> void write(std::vector<uint8_t> &file, T value) {
+  const auto *bytes = reinterpret_cast<const uint8_t *>(&value);
+  file.insert(file.end(), bytes, bytes + sizeof(T));
+}
+
+struct FormatInfo {
+  TextureFormat format;
+  bool sRGB;
+};
+
+FormatInfo fromVkFormat(uint32_t vkFormat) {
+  switch (vkFormat) {
+  case VK_R8G8B8A8_UNORM:
+    return {TextureFormat::RGBA8, false};
+  case VK_R8G8B8A8_SRGB:
+    return {TextureFormat::RGBA8, true};
+  case VK_R8_UNORM:
+    return {TextureFormat::R8, false};
+  case VK_R8_SRGB:
+    return {TextureFormat::R8, true};
+  case VK_R8G8_UNORM:
+    return {TextureFormat::RG8, false};
+  case VK_R8G8_SRGB:
+    return {TextureFormat::RG8, true};
+  case VK_R16_UNORM:
+    return {TextureFormat::R16, false};
+  case VK_R16G16_UNORM:
+    return {TextureFormat::RG16, false};
+  case VK_BC1_RGB_UNORM:
+  case VK_BC1_RGBA_UNORM:
+    return {TextureFormat::BC1, false};
+  case VK_BC1_RGB_SRGB:
+  case VK_BC1_RGBA_SRGB:
+    return {TextureFormat::BC1, true};
+  case VK_BC3_UNORM:
+    return {TextureFormat::BC3, false};
+  case VK_BC3_SRGB:
+    return {TextureFormat::BC3, true};
+  case VK_BC5_UNORM:
+    return {TextureFormat::BC5, false};
+  case VK_BC7_UNORM:
+    return {TextureFormat::BC7, false};
+  case VK_BC7_SRGB:
+    return {TextureFormat::BC7, true};
+  }
+  throw std::runtime_error("unsupported KTX2 vkFormat " +
+                           std::to_string(vkFormat));
+}
+
+FormatInfo fromDxgiFormat(uint32_t dxgiFormat) {
+  switch (dxgiFormat) {
+  case DXGI_R8G8B8A8_UNORM:
+    return {TextureFormat::RGBA8, false};
+  case DXGI_R8G8B8A8_UNORM_SRGB:
+    return {TextureFormat::RGBA8, true};
+  case DXGI_R8_UNORM:
+    return {TextureFormat::R8, false};
+  case DXGI_R8G8_UNORM:
+    return {TextureFormat::RG8, false};
+  case DXGI_R16_UNORM:
+    return {TextureFormat::R16, false};
+  case DXGI_R16G16_UNORM:
+    return {TextureFormat::RG16, false};
+  case DXGI_BC1_UNORM:
+    return {TextureFormat::BC1, false};
+  case DXGI_BC1_UNORM_SRGB:
+    return {TextureFormat::BC1, true};
+  case DXGI_BC3_UNORM:
+    return {TextureFormat::BC3, false};
+  case DXGI_BC3_UNORM_SRGB:
+    return {TextureFormat::BC3, true};
+  case DXGI_BC5_UNORM:
+    return {TextureFormat::BC5, false};
+  case DXGI_BC7_UNORM:
+    return {TextureFormat::BC7, false};
+  case DXGI_BC7_UNORM_SRGB:
+    return {TextureFormat::BC7, true};
+  }
+  throw std::runtime_error("unsupported DDS DXGI format " +
+                           std::to_string(dxgiFormat));
+}
+
+uint32_t toDxgiFormat(TextureFormat format, bool sRGB) {
+  switch (format) {
+  case TextureFormat::RGBA8:
+    return sRGB ? DXGI_R8G8B8A8_UNORM_SRGB : DXGI_R8G8B8A8_UNORM;
+  // DXGI には 1 / 2 チャンネルの sRGB がない
+  case TextureFormat::R8:
+    return DXGI_R8_UNORM;
+  case TextureFormat::RG8:
+    return DXGI_R8G8_UNORM;
+  case TextureFormat::R16:
+    return DXGI_R16_UNORM;
+  case TextureFormat::RG16:
+    return DXGI_R16G16_UNORM;
+  case TextureFormat::BC1:
+    return sRGB ? DXGI_BC1_UNORM_SRGB : DXGI_BC1_UNORM;
+  case TextureFormat::BC3:
+    return sRGB ? DXGI_BC3_UNORM_SRGB : DXGI_BC3_UNORM;
+  case TextureFormat::BC5:
+    return DXGI_BC5_UNORM;
+  case TextureFormat::BC7:
+    return sRGB ? DXGI_BC7_UNORM_SRGB : DXGI_BC7_UNORM;
+  }
+  return 0;
+}
+
+// ファイルに書かれた大きさの上限（どの GPU の上限よりも大きい）
+constexpr uint32_t MAX_FILE_DIMENSION = 1u << 16;
+
+// 大きさとレベル数を確かめ、レベルを詰めて並べたときの配置を返す
+std::vector<MipLevel> checkedLayout(const CompressedImage &image) {
+  if (image.width == 0 || image.height == 0) {
+    throw std::runtime_error("texture file has no pixels");
+  }
+  // 大きさの積があふれないようにする
+  if (image.width > MAX_FILE_DIMENSION || image.height > MAX_FILE_DIMENSION) {
+    throw std::runtime_error("texture file is too large");
+  }
+  if (image.levelCount > mipLevelCount(image.width, image.height)) {
+    throw std::runtime_error("texture file has too many mip levels");
+  }
+  return mipChainLayout(image.format, image.width, image.height,
+                        image.levelCount);
+}
+
+} // namespace
+
+const char *toString(TextureFormat format) {
+  switch (format) {
+  case TextureFormat::RGBA8:
+    return "RGBA8";
+  case TextureFormat::R8:
+    return "R8";
+  case TextureFormat::RG8:
+    return "RG8";
+  case TextureFormat::R16:
+    return "R16";
+  case TextureFormat::RG16:
+    return "RG16";
+  case TextureFormat::BC1:
+    return "BC1";
+  case TextureFormat::BC3:
+    return "BC3";
+  case TextureFormat::BC5:
+    return "BC5";
+  case TextureFormat::BC7:
+    return "BC7";
+  }
+  return "unknown";
+}
+
+bool isBlockCompressed(TextureFormat format) {
+  return channelCount(format) == 0;
+}
+
+uint32_t blockBytes(TextureFormat format) {
+  switch (format) {
+  case TextureFormat::RGBA8:
+    return 4;
+  case TextureFormat::R8:
+    return 1;
+  case TextureFormat::RG8:
+  case TextureFormat::R16:
+    return 2;
+  case TextureFormat::RG16:
+    return 4;
+  case TextureFormat::BC1:
+    return 8;
+  case TextureFormat::BC3:
+  case TextureFormat::BC5:
+  case TextureFormat::BC7:
+    return 16;
+  }
+  return 0;
+}
+
+uint32_t channelCount(TextureFormat format) {
+  switch (format) {
+  case TextureFormat::RGBA8:
+    return 4;
+  case TextureFormat::R8:
+  case TextureFormat::R16:
+    return 1;
+  case TextureFormat::RG8:
+  case TextureFormat::RG16:
+    return 2;
+  case TextureFormat::BC1:
+  case TextureFormat::BC3:
+  case TextureFormat::BC5:
+  case TextureFormat::BC7:
+    return 0;
+  }
+  return 0;
+}
+
+size_t levelSize(TextureFormat format, uint32_t width, uint32_t height) {
+  if (!isBlockCompressed(format)) {
+    return size_t(width) * height * blockBytes(format);
+  }
+  return size_t((width + 3) / 4) * ((height + 3) / 4) * blockBytes(format);
+}
+
+std::vector<MipLevel> mipChainLayout(TextureFormat format, uint32_t width,
+                                     uint32_t height, uint32_t levelCount) {
+  std::vector<MipLevel> levels;
+  size_t offset = 0;
+  for (uint32_t i = 0; i < levelCount; ++i) {
+    const size_t size = levelSize(format, width, height);
+    levels.push_back(
+        {.width = width, .height = height, .offset = offset, .size = size});
+    offset += size;
+    width = std::max(1u, width / 2);
+    height = std::max(1u, height / 2);
+  }
+  return levels;
+}
+
+CompressedImage loadKtx2(const std::vector<uint8_t> &file) {
+  if (file.size() < KTX2_HEADER_SIZE ||
+      std::memcmp(file.data(), KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER)) !=
+          0) {
+    throw std::runtime_error("not a KTX2 file");
+  }
+  const auto info = fromVkFormat(read<uint32_t>(file, 12));
+  CompressedImage image{.format = info.format,
+                        .sRGB = info.sRGB,
+                        .width = read<uint32_t>(file, 20),
+                        .height = read<uint32_t>(file, 24),
+                        .levelCount = 0,
+                        .data = {}};
+  const uint32_t depth = read<uint32_t>(file, 28);
+  const uint32_t layers = read<uint32_t>(file, 32);
+  const uint32_t faces = read<uint32_t>(file, 36);
+  if (depth > 1 || layers > 1 || faces != 1) {
+    throw std::runtime_error("only 2D KTX2 textures are supported");
+  }
+  if (read<uint32_t>(file, 44) != 0) {
+    throw std::runtime_error("supercompressed KTX2 is not supported");
+  }
+  // 0 は「読み込む側で作る」という意味なので、レベル 0 だけにする
+  image.levelCount = std::max(1u, read<uint32_t>(file, 40));
+
+  const auto levels = checkedLayout(image);
+  const size_t size = levels.back().offset + levels.back().size;
+  if (size > file.size()) {
+    throw std::runtime_error("texture file is truncated");
+  }
+  image.data.resize(size);
+  for (uint32_t i = 0; i < image.levelCount; ++i) {
+    const size_t index = KTX2_HEADER_SIZE + i * KTX2_LEVEL_INDEX_SIZE;
+    const auto offset = read<uint64_t>(file, index);
+    const auto length = read<uint64_t>(file, index + 8);
+    // ファイルの値を足すとあふれることがあるので、引き算で比べる
+    if (length != levels[i].size || offset > file.size() ||
+        length > file.size() - offset) {
+      throw std::runtime_error("KTX2 level size mismatch");
+    }
+    std::memcpy(&image.data[levels[i].offset], file.data() + offset, length);
+  }
+  return image;
+}
+
+CompressedImage loadDds(const std::vector<uint8_t> &file) {
+  if (file.size() < DDS_HEADER_SIZE ||
+      read<uint32_t>(file, 0) != fourCC("DDS ")) {
+    throw std::runtime_error("not a DDS file");
+  }
+  CompressedImage image{.format = TextureFormat::RGBA8,
+                        .sRGB = false,
+                        .width = read<uint32_t>(file, 16),
+                        .height = read<uint32_t>(file, 12),
+                        .levelCount = std::max(1u, read<uint32_t>(file, 28)),
+                        .data = {}};
+  const uint32_t pixelFlags = read<uint32_t>(file, 80);
+  const uint32_t code = read<uint32_t>(file, 84);
+  size_t dataOffset = DDS_HEADER_SIZE;
+  if ((pixelFlags & DDPF_FOURCC) && code == fourCC("DX10")) {
+    const auto info = fromDxgiFormat(read<uint32_t>(file, 128));
+    // D3D10_RESOURCE_DIMENSION_TEXTURE2D で1枚だけ
+    if (read<uint32_t>(file, 132) != 3 || read<uint32_t>(file, 140) > 1) {
+      throw std::runtime_error("only 2D DDS textures are supported");
+    }
+    image.format = info.format;
+    image.sRGB = info.sRGB;
+    dataOffset += DDS_DX10_HEADER_SIZE;
+  } else if (pixelFlags & DDPF_FOURCC) {
+    // 古い形式には色空間の情報がない（呼び出し側で決める）
+    if (code == fourCC("DXT1")) {
+      image.format = TextureFormat::BC1;
+    } else if (code == fourCC("DXT5")) {
+      image.format = TextureFormat::BC3;
+    } else if (code == fourCC("ATI2") || code == fourCC("BC5U")) {
+      image.format = TextureFormat::BC5;
+    } else {
+      throw std::runtime_error("unsupported DDS FourCC");
+    }
+  } else if ((pixelFlags & DDPF_RGB) && read<uint32_t>(file, 88) == 32 &&
+             read<uint32_t>(file, 92) == 0x000000ff) {
+    image.format = TextureFormat::RGBA8;
+  } else {
+    throw std::runtime_error("unsupported DDS pixel format");
+  }
+
+  const auto levels = checkedLayout(image);
+  const size_t size = levels.back().offset + levels.back().size;
+  if (dataOffset > file.size() || size > file.size() - dataOffset) {
+    throw std::runtime_error("texture file is truncated");
+  }
+  image.data.assign(file.begin() + dataOffset,
+                    file.begin() + dataOffset + size);
+  return image;
+}
+
+bool isCompressedImageFile(const std::string &filename) {
+  auto extension = std::filesystem::path(filename).extension().string();
+  std::transform(extension.begin(), extension.end(), extension.begin(),
+                 [](unsigned char c) { return std::tolower(c); });
+  return extension == ".ktx2" || extension == ".dds";
+}
+
+CompressedImage loadCompressedImage(const std::string &filename) {
+  std::ifstream stream(filename, std::ios::binary);
+  if (!stream) {
+    throw std::runtime_error("failed to open " + filename);
+  }
+  const std::vector<uint8_t> file{std::istreambuf_iterator<char>(stream),
+                                  std::istreambuf_iterator<char>()};
+  if (file.size() >= sizeof(KTX2_IDENTIFIER) &&
+      std::memcmp(file.data(), KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER)) ==
+          0) {
+    return loadKtx2(file);
+  }
+  return loadDds(file);
+}
+
+std::vector<uint8_t> saveDds(const CompressedImage &image) {
+  const auto levels = checkedLayout(image);
+  if (image.data.size() != levels.back().offset + levels.back().size) {
+    throw std::invalid_argument("compressed image size mismatch");
+  }
+  // DDSD_CAPS | DDSD_HEIGHT | DDSD_WIDTH | DDSD_PIXELFORMAT | DDSD_MIPMAPCOUNT
+  // | DDSD_LINEARSIZE
+  constexpr uint32_t flags = 0x1 | 0x2 | 0x4 | 0x1000 | 0x20000 | 0x80000;
+  // DDSCAPS_TEXTURE | DDSCAPS_COMPLEX | DDSCAPS_MIPMAP
+  const uint32_t caps = 0x1000 | (image.levelCount > 1 ? 0x8 | 0x400000 : 0);
+
+  std::vector<uint8_t> file;
+  file.reserve(DDS_HEADER_SIZE + DDS_DX10_HEADER_SIZE + image.data.size());
+  write(file, fourCC("DDS "));
+  write<uint32_t>(file, 124);
+  write(file, flags);
+  write(file, image.height);
+  write(file, image.width);
+  write(file, static_cast<uint32_t>(levels[0].size));
+  write<uint32_t>(file, 0);
+  write(file, image.levelCount);
+  for (int i = 0; i < 11; ++i) {
+    write<uint32_t>(file, 0);
+  }
+  // DDS_PIXELFORMAT
+  write<uint32_t>(file, 32);
+  write(file, DDPF_FOURCC);
+  write(file, fourCC("DX10"));
+  for (int i = 0; i < 5; ++i) {
+    write<uint32_t>(file, 0);
+  }
+  write(file, caps);
+  for (int i = 0; i < 4; ++i) {
+    write<uint32_t>(file, 0);
+  }
+  // DDS_HEADER_DXT10
+  write(file, toDxgiFormat(image.format, image.sRGB));
+  write<uint32_t>(file, 3);
+  write<uint32_t>(file, 0);
+  write<uint32_t>(file, 1);
+  write<uint32_t>(file, 0);
+  file.insert(file.end(), image.data.begin(), image.data.end());
+  return file;
+}
+
+} // namespace b3
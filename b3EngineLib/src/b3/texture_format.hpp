@@ -0,0 +1,74 @@
+#ifndef __TEXTURE_FORMAT_HPP__
+#define __TEXTURE_FORMAT_HPP__
+
+#include "b3/mipmap.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace b3 {
+
+// GPU に置くテクスチャの形式
+enum class TextureFormat {
+  // 1 画素 4 バイト
+  RGBA8,
+  // 1 画素 1 / 2 バイト（グレースケール、グレースケールとアルファ）
+  R8,
+  RG8,
+  // 1 画素 2 / 4 バイト（16 bit のグレースケールなど。sRGB はない）
+  R16,
+  RG16,
+  // 4x4 画素を 8 バイト（RGB、アルファは使わない）
+  BC1,
+  // 4x4 画素を 16 バイト（BC1 の色と 8 bit 相当のアルファ）
+  BC3,
+  // 4x4 画素を 16 バイト（R と G の 2 チャンネル、法線マップ向け）
+  BC5,
+  // 4x4 画素を 16 バイト（RGBA、高品質。読み込みのみでエンコードはしない）
+  BC7,
+};
+
+const char *toString(TextureFormat format);
+
+// 4x4 画素のブロック単位で圧縮する形式か
+bool isBlockCompressed(TextureFormat format);
+// 1 ブロックのバイト数（圧縮しない形式は 1 画素を 1 ブロックとみなす）
+uint32_t blockBytes(TextureFormat format);
+// 圧縮しない形式のチャンネル数（ブロック圧縮の形式は 0）
+uint32_t channelCount(TextureFormat format);
+// width x height の1レベルのバイト数
+size_t levelSize(TextureFormat format, uint32_t width, uint32_t height);
+
+// levelCount レベルを順に詰めて並べたときの配置。RGBA8 で levelCount が
+// mipLevelCount() なら mipChainLayout(width, height) と同じ。
+std::vector<MipLevel> mipChainLayout(TextureFormat format, uint32_t width,
+                                     uint32_t height, uint32_t levelCount);
+
+// ファイルから読み込んだ、またはエンコードした圧縮テクスチャ
+struct CompressedImage {
+  TextureFormat format = TextureFormat::RGBA8;
+  bool sRGB = false;
+  uint32_t width = 0;
+  uint32_t height = 0;
+  uint32_t levelCount = 0;
+  // レベル 0 から levelCount レベルを mipChainLayout() の順に詰めたもの
+  std::vector<uint8_t> data;
+};
+
+// KTX2 / DDS のファイルの内容を読む。2D の1枚のテクスチャで、形式が
+// TextureFormat にあるもの（KTX2 は supercompression なし）だけに対応し、
+// それ以外は std::runtime_error。
+CompressedImage loadKtx2(const std::vector<uint8_t> &file);
+CompressedImage loadDds(const std::vector<uint8_t> &file);
+// ファイルの先頭のマジックナンバーで KTX2 か DDS かを判定して読む
+CompressedImage loadCompressedImage(const std::string &filename);
+bool isCompressedImageFile(const std::string &filename);
+
+// DX10 拡張ヘッダ付きの DDS にする（オフラインでエンコードした結果の保存用）
+std::vector<uint8_t> saveDds(const CompressedImage &image);
+
+} // namespace b3
+
+#endif
@@ -0,0 +1,84 @@
+#include "texture_loader.hpp"
+
+#include <algorithm>
+
+namespace b3 {
+
+TextureLoader::TextureLoader(uint32_t threadCount) {
+  if (threadCount == 0) {
+    threadCount = std::max(1u, std::thread::hardware_concurrency());
+  }
+  for (uint32_t i = 0; i < threadCount; ++i) {
+    m_threads.emplace_back([this] { workerLoop(); });
+  }
+}
+
+TextureLoader::~TextureLoader() {
+  {
+    std::lock_guard lock(m_mutex);
+    m_quit = true;
+  }
+  m_condition.notify_all();
+  for (auto &thread : m_threads) {
+    thread.join();
+  }
+}
+
+std::future<std::shared_ptr<Texture>>
+TextureLoader::load(const std::string &filename, bool sRGB) {
+  std::packaged_task<std::shared_ptr<Texture>()> task([this, filename, sRGB] {
+    try {
+      auto texture = std::make_shared<Texture>(filename, sRGB);
+      std::lock_guard lock(m_mutex);
+      ++m_stats.loaded;
+      m_stats.decodeMs += texture->loadTiming().decodeMs;
+      m_stats.convertMs += texture->loadTiming().convertMs;
+      return texture;
+    } catch (...) {
+      std::lock_guard lock(m_mutex);
+      ++m_stats.failed;
+      throw;
+    }
+  });
+  auto future = task.get_future();
+  {
+    std::lock_guard lock(m_mutex);
+    m_tasks.push_back(std::move(task));
+  }
+  m_condition.notify_one();
+  return future;
+}
+
+std::vector<std::future<std::shared_ptr<Texture>>>
+TextureLoader::loadAll(const std::vector<Request> &requests) {
+  std::vector<std::future<std::shared_ptr<Texture>>> futures;
+  futures.reserve(requests.size());
+  for (const auto &request : requests) {
+    futures.push_back(load(request.filename, request.sRGB));
+  }
+  return futures;
+}
+
+TextureLoader::Stats TextureLoader::stats() const {
+  std::lock_guard lock(m_mutex);
+  return m_stats;
+}
+
+void TextureLoader::workerLoop() {
+  while (true) {
+    std::packaged_task<std::shared_ptr<Texture>()> task;
+    {
+      std::unique_lock lock(m_mutex);
+      m_condition.wait(lock, [this] { return m_quit || !m_tasks.empty(); });
+      if (m_tasks.empty()) {
+        return;
+      }
+      task = std::move(m_tasks.front());
+      m_tasks.pop_front();
+    }
+    // 例外は future に入る
+    task();
+  }
+}
+
+} // namespace b3
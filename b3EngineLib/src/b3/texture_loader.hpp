@@ -0,0 +1,75 @@
+#ifndef __TEXTURE_LOADER_HPP__
+#define __TEXTURE_LOADER_HPP__
+
+#include "b3/texture.hpp"
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace b3 {
+
+// 画像ファイルから Texture を作る処理（デコードと RGBA への並べ替え）を
+// 専用のスレッドで並列に行う。
+//
+// JobSystem の parallelFor() は終わるまで戻らないので、読み込みには使わない。
+// load() はすぐに future を返し、呼び出し側は他の初期化と並行して待てる。
+// デコードの失敗は future の get() で例外として受け取る。
+//
+// 1ファイルごとの時間は Texture::loadTiming() で、全体の合計は stats() で
+// 見られる。
+class TextureLoader {
+public:
+  // 0 ならコア数にする
+  explicit TextureLoader(uint32_t threadCount = 0);
+  // 積まれている読み込みをすべて終えてからスレッドを止める
+  ~TextureLoader();
+
+  TextureLoader(const TextureLoader &) = delete;
+  TextureLoader &operator=(const TextureLoader &) = delete;
+
+  uint32_t threadCount() const {
+    return static_cast<uint32_t>(m_threads.size());
+  }
+
+  std::future<std::shared_ptr<Texture>> load(const std::string &filename,
+                                             bool sRGB);
+
+  struct Request {
+    std::string filename;
+    bool sRGB;
+  };
+  // まとめて積む。future は requests と同じ順番
+  std::vector<std::future<std::shared_ptr<Texture>>>
+  loadAll(const std::vector<Request> &requests);
+
+  struct Stats {
+    // 読み込んだファイルの数と、失敗した数
+    uint64_t loaded = 0;
+    uint64_t failed = 0;
+    // 全ファイルのデコードと並べ替えの時間の合計（スレッドをまたいだ合計）
+    double decodeMs = 0.0;
+    double convertMs = 0.0;
+  };
+  Stats stats() const;
+
+private:
+  void workerLoop();
+
+  std::vector<std::thread> m_threads;
+  mutable std::mutex m_mutex;
+  std::condition_variable m_condition;
+  std::deque<std::packaged_task<std::shared_ptr<Texture>()>> m_tasks;
+  bool m_quit = false;
+  Stats m_stats;
+};
+
+} // namespace b3
+
+#endif
@@ -0,0 +1,168 @@
+#include "texture_registry.hpp"
+
+#include "texture.hpp"
+
+#include <cassert>
+#include <cstring>
+#include <span>
+#include <stdexcept>
+
+namespace b3 {
+
+namespace {
+
+constexpr uint64_t HASH_MULTIPLIER = 0x9e3779b97f4a7c15ull;
+
+// 64 bit を攪拌する（splitmix64 の最後の段）
+inline uint64_t mix64(uint64_t x) {
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ull;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebull;
+  x ^= x >> 31;
+  return x;
+}
+
+// GPU に送る内容（圧縮したテクスチャはブロック、それ以外は画素）。
+// 画素を持っていないテクスチャは読み込み元のファイル名で代える。
+std::span<const uint8_t> content(const Texture &texture) {
+  if (!texture.resident()) {
+    const auto &filename = texture.source().filename;
+    return {reinterpret_cast<const uint8_t *>(filename.data()),
+            filename.size()};
+  }
+  if (texture.isCompressed()) {
+    return texture.compressed().data;
+  }
+  return {texture.pixels(), texture.pixelBytes()};
+}
+
+} // namespace
+
+TextureRegistry::TextureRegistry(uint32_t maxSlots) : m_maxSlots(maxSlots) {}
+
+uint64_t TextureRegistry::contentHash(const Texture &texture) {
+  uint64_t h = mix64((uint64_t(texture.width()) << 32) | texture.height());
+  h = mix64(h ^ (texture.sRGB() ? HASH_MULTIPLIER : 0) ^
+            static_cast<uint64_t>(texture.mipGeneration()) ^
+            static_cast<uint64_t>(texture.format()) << 8);
+
+  // 8 バイトずつ 4 本の列で混ぜる（列ごとの依存だけになるので速い）
+  const auto bytes = content(texture);
+  const uint8_t *p = bytes.data();
+  const size_t size = bytes.size();
+  uint64_t lanes[4] = {h, h + 1, h + 2, h + 3};
+  size_t i = 0;
+  for (; i + 32 <= size; i += 32) {
+    for (int lane = 0; lane < 4; ++lane) {
+      uint64_t word;
+      std::memcpy(&word, p + i + lane * 8, sizeof(word));
+      lanes[lane] = (lanes[lane] ^ word) * HASH_MULTIPLIER;
+      lanes[lane] ^= lanes[lane] >> 29;
+    }
+  }
+  for (; i < size; ++i) {
+    lanes[0] = (lanes[0] ^ p[i]) * HASH_MULTIPLIER;
+  }
+  h = mix64(lanes[0]) ^ mix64(lanes[1] + 1) ^ mix64(lanes[2] + 2) ^
+      mix64(lanes[3] + 3);
+  return mix64(h ^ size);
+}
+
+bool TextureRegistry::sameContent(const Texture &a, const Texture &b) {
+  if (a.width() != b.width() || a.height() != b.height() ||
+      a.sRGB() != b.sRGB() || a.mipGeneration() != b.mipGeneration() ||
+      a.format() != b.format()) {
+    return false;
+  }
+  if (!a.resident() || !b.resident()) {
+    // どちらかが画素を手放していれば、読み込み元が同じかで比べる
+    return a.hasSource() && a.source() == b.source();
+  }
+  const auto x = content(a);
+  const auto y = content(b);
+  return x.size() == y.size() &&
+         std::memcmp(x.data(), y.data(), x.size()) == 0;
+}
+
+TextureRegistry::Acquired
+TextureRegistry::acquire(const std::shared_ptr<Texture> &texture) {
+  assert(texture != nullptr);
+  if (const auto found = m_aliases.find(texture); found != m_aliases.end()) {
+    ++found->second.users;
+    ++m_slots[found->second.slot].users;
+    return {.slot = found->second.slot, .created = false};
+  }
+
+  // 初めてのポインタは、内容が同じテクスチャを探す
+  const uint64_t hash = contentHash(*texture);
+  ++m_stats.hashed;
+  const auto [begin, end] = m_byHash.equal_range(hash);
+  for (auto it = begin; it != end; ++it) {
+    auto &slot = m_slots[it->second];
+    if (sameContent(*slot.source, *texture)) {
+      ++slot.users;
+      m_aliases.emplace(texture, Alias{.slot = it->second, .users = 1});
+      ++m_stats.deduplicated;
+      return {.slot = it->second, .created = false};
+    }
+  }
+
+  const uint32_t index = allocateSlot();
+  m_slots[index] = {.source = texture, .hash = hash, .users = 1};
+  m_byHash.emplace(hash, index);
+  m_aliases.emplace(texture, Alias{.slot = index, .users = 1});
+  return {.slot = index, .created = true};
+}
+
+uint32_t TextureRegistry::release(const std::shared_ptr<Texture> &texture) {
+  const auto found = m_aliases.find(texture);
+  assert(found != m_aliases.end());
+  const uint32_t index = found->second.slot;
+  if (--found->second.users == 0) {
+    m_aliases.erase(found);
+  }
+  auto &slot = m_slots[index];
+  assert(slot.users > 0);
+  if (--slot.users > 0) {
+    return INVALID_SLOT;
+  }
+
+  // もう内容で引かれないようにする（スロットは freeSlot() まで空けない）
+  const auto [begin, end] = m_byHash.equal_range(slot.hash);
+  for (auto it = begin; it != end; ++it) {
+    if (it->second == index) {
+      m_byHash.erase(it);
+      break;
+    }
+  }
+  slot.source = nullptr;
+  return index;
+}
+
+void TextureRegistry::freeSlot(uint32_t slot) {
+  assert(slot < m_slots.size());
+  assert(m_slots[slot].users == 0 && m_slots[slot].source == nullptr);
+  m_freeSlots.push_back(slot);
+}
+
+uint32_t
+TextureRegistry::find(const std::shared_ptr<Texture> &texture) const {
+  const auto found = m_aliases.find(texture);
+  return found != m_aliases.end() ? found->second.slot : INVALID_SLOT;
+}
+
+uint32_t TextureRegistry::allocateSlot() {
+  if (!m_freeSlots.empty()) {
+    const uint32_t slot = m_freeSlots.back();
+    m_freeSlots.pop_back();
+    return slot;
+  }
+  if (m_slots.size() >= m_maxSlots) {
+    throw std::runtime_error("too many textures");
+  }
+  m_slots.emplace_back();
+  return static_cast<uint32_t>(m_slots.size() - 1);
+}
+
+} // namespace b3
@@ -0,0 +1,96 @@
+#ifndef __TEXTURE_REGISTRY_HPP__
+#define __TEXTURE_REGISTRY_HPP__
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+namespace b3 {
+
+class Texture;
+
+// テクスチャを bindless 配列のスロットに割り当て、使っているノードの数を数える。
+//
+// 同じ shared_ptr はもちろん、別のポインタでも内容（大きさ、sRGB、ミップの
+// 作り方、形式、画素または圧縮したブロック）が同じテクスチャは同じスロットに
+// まとめる。内容はハッシュで引き、一致したら中身を比較して確かめる。
+// 画素を持っていない（resident() でない）テクスチャは、内容の代わりに
+// 読み込み元のファイルからハッシュを求め、読み込み元で比べる。スロットの
+// 代表が登録後に画素を手放した場合も、読み込み元で比べる。
+// スロットは 0 から maxSlots - 1 までで、空いたスロットを再利用するので、
+// テクスチャが生きている間は変わらない。
+//
+// GPU のリソースは持たない。スロットが使われなくなったら呼び出し側が破棄し、
+// 描画中のフレームが終わってから freeSlot() でスロットを返す。
+class TextureRegistry {
+public:
+  static constexpr uint32_t INVALID_SLOT = UINT32_MAX;
+
+  explicit TextureRegistry(uint32_t maxSlots);
+
+  struct Acquired {
+    uint32_t slot;
+    // 新しいスロットを割り当てた（GPU に送る必要がある）
+    bool created;
+  };
+  // 使うノードを1つ増やす。スロットが足りなければ std::runtime_error
+  Acquired acquire(const std::shared_ptr<Texture> &texture);
+  // 使うノードを1つ減らす。スロットを使うテクスチャがなくなれば、その
+  // スロットを返す（freeSlot() を呼ぶまで他のテクスチャには割り当てない）。
+  // まだ使われていれば INVALID_SLOT を返す。
+  uint32_t release(const std::shared_ptr<Texture> &texture);
+  // release() で返されたスロットを空きに戻す
+  void freeSlot(uint32_t slot);
+
+  // テクスチャのスロット（登録されていなければ INVALID_SLOT）
+  uint32_t find(const std::shared_ptr<Texture> &texture) const;
+
+  // 大きさ、sRGB、ミップの作り方、形式、GPU に送る内容から求めたハッシュ
+  static uint64_t contentHash(const Texture &texture);
+
+  // 使っているスロットの数（内容の異なるテクスチャの数）
+  size_t textureCount() const { return m_byHash.size(); }
+  // 登録されているポインタの数
+  size_t aliasCount() const { return m_aliases.size(); }
+  // 一度でも使ったスロットの数（bindless 配列の使っている範囲）
+  uint32_t slotCount() const { return static_cast<uint32_t>(m_slots.size()); }
+  uint32_t maxSlots() const { return m_maxSlots; }
+
+  struct Stats {
+    // 内容のハッシュを求めたテクスチャの数と、既存のスロットにまとめた数
+    uint64_t hashed = 0;
+    uint64_t deduplicated = 0;
+  };
+  const Stats &stats() const { return m_stats; }
+
+private:
+  struct Slot {
+    // 内容を比較するための代表（最初に登録したテクスチャ）
+    std::shared_ptr<Texture> source;
+    uint64_t hash = 0;
+    // このスロットを使っているノードの数（全ポインタの合計）
+    uint32_t users = 0;
+  };
+  struct Alias {
+    uint32_t slot;
+    uint32_t users;
+  };
+
+  static bool sameContent(const Texture &a, const Texture &b);
+  uint32_t allocateSlot();
+
+  uint32_t m_maxSlots;
+  std::vector<Slot> m_slots;
+  std::vector<uint32_t> m_freeSlots;
+  // ポインタからスロット
+  std::unordered_map<std::shared_ptr<Texture>, Alias> m_aliases;
+  // 内容のハッシュから、使っているスロット
+  std::unordered_multimap<uint64_t, uint32_t> m_byHash;
+  Stats m_stats;
+};
+
+} // namespace b3
+
+#endif
@@ -0,0 +1,478 @@
+#include "transform_store.hpp"
+
+#include <algorithm>
+
+namespace b3 {
+
+// ***** カーネル *****
+
+static glm::mat4 composeLocal(float px, float py, float pz, float qx, float qy,
+                              float qz, float qw) {
+  glm::mat4 m = glm::mat4_cast(glm::quat(qw, qx, qy, qz));
+  m[3][0] = px;
+  m[3][1] = py;
+  m[3][2] = pz;
+  m[3][3] = 1.0f;
+  return m;
+}
+
+static bool anyDirty(const uint8_t *flags, size_t count) {
+  for (size_t i = 0; i < count; ++i) {
+    if (flags[i]) {
+      return true;
+    }
+  }
+  return false;
+}
+
+#if defined(B3_SIMD_X86)
+
+// 4ノード分の行（r0..r3 の各レーンがノード）を転置して、
+// 各ノードの列 col に書き込む
+static inline void storeColumn4(glm::mat4 *out, int col, __m128 r0, __m128 r1,
+                                __m128 r2, __m128 r3) {
+  _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+  _mm_storeu_ps(&out[0][col][0], r0);
+  _mm_storeu_ps(&out[1][col][0], r1);
+  _mm_storeu_ps(&out[2][col][0], r2);
+  _mm_storeu_ps(&out[3][col][0], r3);
+}
+
+// 四元数→回転行列 + 平行移動を4ノード同時に計算する
+static void composeLocal4(const float *px, const float *py, const float *pz,
+                          const float *qx, const float *qy, const float *qz,
+                          const float *qw, glm::mat4 *out) {
+  const __m128 one = _mm_set1_ps(1.0f);
+  const __m128 two = _mm_set1_ps(2.0f);
+  const __m128 zero = _mm_setzero_ps();
+
+  const __m128 x = _mm_loadu_ps(qx);
+  const __m128 y = _mm_loadu_ps(qy);
+  const __m128 z = _mm_loadu_ps(qz);
+  const __m128 w = _mm_loadu_ps(qw);
+
+  const __m128 xx = _mm_mul_ps(x, x), yy = _mm_mul_ps(y, y),
+               zz = _mm_mul_ps(z, z);
+  const __m128 xy = _mm_mul_ps(x, y), xz = _mm_mul_ps(x, z),
+               yz = _mm_mul_ps(y, z);
+  const __m128 wx = _mm_mul_ps(w, x), wy = _mm_mul_ps(w, y),
+               wz = _mm_mul_ps(w, z);
+
+  const __m128 m00 = _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(yy, zz)));
+  const __m128 m01 = _mm_mul_ps(two, _mm_add_ps(xy, wz));
+  const __m128 m02 = _mm_mul_ps(two, _mm_sub_ps(xz, wy));
+  const __m128 m10 = _mm_mul_ps(two, _mm_sub_ps(xy, wz));
+  const __m128 m11 = _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, zz)));
+  const __m128 m12 = _mm_mul_ps(two, _mm_add_ps(yz, wx));
+  const __m128 m20 = _mm_mul_ps(two, _mm_add_ps(xz, wy));
+  const __m128 m21 = _mm_mul_ps(two, _mm_sub_ps(yz, wx));
+  const __m128 m22 = _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, yy)));
+
+  storeColumn4(out, 0, m00, m01, m02, zero);
+  storeColumn4(out, 1, m10, m11, m12, zero);
+  storeColumn4(out, 2, m20, m21, m22, zero);
+  storeColumn4(out, 3, _mm_loadu_ps(px), _mm_loadu_ps(py), _mm_loadu_ps(pz),
+               one);
+}
+
+// 8ノード同時版
+B3_TARGET_AVX2
+static void composeLocal8(const float *px, const float *py, const float *pz,
+                          const float *qx, const float *qy, const float *qz,
+                          const float *qw, glm::mat4 *out) {
+  const __m256 one = _mm256_set1_ps(1.0f);
+  const __m256 two = _mm256_set1_ps(2.0f);
+
+  const __m256 x = _mm256_loadu_ps(qx);
+  const __m256 y = _mm256_loadu_ps(qy);
+  const __m256 z = _mm256_loadu_ps(qz);
+  const __m256 w = _mm256_loadu_ps(qw);
+
+  const __m256 xx = _mm256_mul_ps(x, x), yy = _mm256_mul_ps(y, y),
+               zz = _mm256_mul_ps(z, z);
+  const __m256 xy = _mm256_mul_ps(x, y), xz = _mm256_mul_ps(x, z),
+               yz = _mm256_mul_ps(y, z);
+  const __m256 wx = _mm256_mul_ps(w, x), wy = _mm256_mul_ps(w, y),
+               wz = _mm256_mul_ps(w, z);
+
+  const __m256 rows[4][4] = {
+      {_mm256_fnmadd_ps(two, _mm256_add_ps(yy, zz), one),
+       _mm256_mul_ps(two, _mm256_add_ps(xy, wz)),
+       _mm256_mul_ps(two, _mm256_sub_ps(xz, wy)), _mm256_setzero_ps()},
+      {_mm256_mul_ps(two, _mm256_sub_ps(xy, wz)),
+       _mm256_fnmadd_ps(two, _mm256_add_ps(xx, zz), one),
+       _mm256_mul_ps(two, _mm256_add_ps(yz, wx)), _mm256_setzero_ps()},
+      {_mm256_mul_ps(two, _mm256_add_ps(xz, wy)),
+       _mm256_mul_ps(two, _mm256_sub_ps(yz, wx)),
+       _mm256_fnmadd_ps(two, _mm256_add_ps(xx, yy), one), _mm256_setzero_ps()},
+      {_mm256_loadu_ps(px), _mm256_loadu_ps(py), _mm256_loadu_ps(pz), one},
+  };
+
+  // 下位4ノード / 上位4ノードに分けて転置する
+  for (int col = 0; col < 4; ++col) {
+    storeColumn4(out, col, _mm256_castps256_ps128(rows[col][0]),
+                 _mm256_castps256_ps128(rows[col][1]),
+                 _mm256_castps256_ps128(rows[col][2]),
+                 _mm256_castps256_ps128(rows[col][3]));
+    storeColumn4(out + 4, col, _mm256_extractf128_ps(rows[col][0], 1),
+                 _mm256_extractf128_ps(rows[col][1], 1),
+                 _mm256_extractf128_ps(rows[col][2], 1),
+                 _mm256_extractf128_ps(rows[col][3], 1));
+  }
+}
+
+// out = a * b（列ごとに4レーン）
+static inline void mulMat4SSE(const glm::mat4 &a, const glm::mat4 &b,
+                              glm::mat4 &out) {
+  const __m128 a0 = _mm_loadu_ps(&a[0][0]);
+  const __m128 a1 = _mm_loadu_ps(&a[1][0]);
+  const __m128 a2 = _mm_loadu_ps(&a[2][0]);
+  const __m128 a3 = _mm_loadu_ps(&a[3][0]);
+  for (int j = 0; j < 4; ++j) {
+    __m128 r = _mm_mul_ps(a0, _mm_set1_ps(b[j][0]));
+    r = _mm_add_ps(r, _mm_mul_ps(a1, _mm_set1_ps(b[j][1])));
+    r = _mm_add_ps(r, _mm_mul_ps(a2, _mm_set1_ps(b[j][2])));
+    r = _mm_add_ps(r, _mm_mul_ps(a3, _mm_set1_ps(b[j][3])));
+    _mm_storeu_ps(&out[j][0], r);
+  }
+}
+
+// out = a * b（2列ずつ8レーン）
+B3_TARGET_AVX2
+static inline void mulMat4AVX2(const glm::mat4 &a, const glm::mat4 &b,
+                               glm::mat4 &out) {
+  const __m256 a0 =
+      _mm256_broadcast_ps(reinterpret_cast<const __m128 *>(&a[0][0]));
+  const __m256 a1 =
+      _mm256_broadcast_ps(reinterpret_cast<const __m128 *>(&a[1][0]));
+  const __m256 a2 =
+      _mm256_broadcast_ps(reinterpret_cast<const __m128 *>(&a[2][0]));
+  const __m256 a3 =
+      _mm256_broadcast_ps(reinterpret_cast<const __m128 *>(&a[3][0]));
+  for (int j = 0; j < 4; j += 2) {
+    const __m256 bj = _mm256_loadu_ps(&b[j][0]);
+    __m256 r = _mm256_mul_ps(a0, _mm256_shuffle_ps(bj, bj, 0x00));
+    r = _mm256_fmadd_ps(a1, _mm256_shuffle_ps(bj, bj, 0x55), r);
+    r = _mm256_fmadd_ps(a2, _mm256_shuffle_ps(bj, bj, 0xaa), r);
+    r = _mm256_fmadd_ps(a3, _mm256_shuffle_ps(bj, bj, 0xff), r);
+    _mm256_storeu_ps(&out[j][0], r);
+  }
+}
+
+B3_TARGET_AVX2
+static size_t updateWorldAVX2(size_t n, const uint32_t *parentIndex,
+                              const uint8_t *localDirty, uint8_t *worldChanged,
+                              const glm::mat4 *local, glm::mat4 *world) {
+  size_t count = 0;
+  for (size_t i = 0; i < n; ++i) {
+    const uint32_t p = parentIndex[i];
+    const bool parentChanged = p != ~0u && worldChanged[p];
+    worldChanged[i] = localDirty[i] || parentChanged;
+    if (!worldChanged[i]) {
+      continue;
+    }
+    if (p == ~0u) {
+      world[i] = local[i];
+    } else {
+      mulMat4AVX2(world[p], local[i], world[i]);
+    }
+    ++count;
+  }
+  return count;
+}
+
+#endif
+
+// ***** TransformStore *****
+
+TransformStore &TransformStore::shared() {
+  static TransformStore store;
+  return store;
+}
+
+TransformStore::Handle TransformStore::create() {
+  Handle handle;
+  if (!m_freeHandles.empty()) {
+    handle = m_freeHandles.back();
+    m_freeHandles.pop_back();
+  } else {
+    handle = static_cast<Handle>(m_handleToIndex.size());
+    m_handleToIndex.push_back(0);
+    m_parentHandle.push_back(INVALID_HANDLE);
+  }
+
+  // ルートとして末尾に追加する（親より後ろなので並び順は崩れない）
+  const auto index = static_cast<uint32_t>(m_indexToHandle.size());
+  m_px.push_back(0.0f);
+  m_py.push_back(0.0f);
+  m_pz.push_back(0.0f);
+  m_qx.push_back(0.0f);
+  m_qy.push_back(0.0f);
+  m_qz.push_back(0.0f);
+  m_qw.push_back(1.0f);
+  m_parentIndex.push_back(NO_PARENT);
+  m_local.emplace_back(1.0f);
+  m_world.emplace_back(1.0f);
+  m_localDirty.push_back(1);
+  m_worldChanged.push_back(0);
+  m_alive.push_back(1);
+  m_indexToHandle.push_back(handle);
+
+  m_handleToIndex[handle] = index;
+  m_parentHandle[handle] = INVALID_HANDLE;
+  m_anyDirty = true;
+  return handle;
+}
+
+void TransformStore::destroy(Handle handle) {
+  const auto index = indexOf(handle);
+  m_alive[index] = 0;
+  m_localDirty[index] = 0;
+  m_parentHandle[handle] = INVALID_HANDLE;
+  m_handleToIndex[handle] = NO_PARENT;
+  // 子の親は呼び出し側で外しておくこと。
+  // Handle は並べ替えで詰めるまで再利用しない。
+  m_orderDirty = true;
+}
+
+void TransformStore::setPosition(Handle handle, const glm::vec3 &pos) {
+  const auto index = indexOf(handle);
+  m_px[index] = pos.x;
+  m_py[index] = pos.y;
+  m_pz[index] = pos.z;
+  m_localDirty[index] = 1;
+  m_anyDirty = true;
+}
+
+glm::vec3 TransformStore::position(Handle handle) const {
+  const auto index = indexOf(handle);
+  return {m_px[index], m_py[index], m_pz[index]};
+}
+
+void TransformStore::setQuat(Handle handle, const glm::quat &quat) {
+  const auto index = indexOf(handle);
+  m_qx[index] = quat.x;
+  m_qy[index] = quat.y;
+  m_qz[index] = quat.z;
+  m_qw[index] = quat.w;
+  m_localDirty[index] = 1;
+  m_anyDirty = true;
+}
+
+glm::quat TransformStore::quat(Handle handle) const {
+  const auto index = indexOf(handle);
+  return glm::quat(m_qw[index], m_qx[index], m_qy[index], m_qz[index]);
+}
+
+void TransformStore::setParent(Handle handle, Handle parent) {
+  const auto index = indexOf(handle);
+  m_parentHandle[handle] = parent;
+  if (parent == INVALID_HANDLE) {
+    m_parentIndex[index] = NO_PARENT;
+  } else {
+    const auto parentIndex = indexOf(parent);
+    m_parentIndex[index] = parentIndex;
+    // 親が子より後ろにある場合は並べ替えが必要
+    if (parentIndex > index) {
+      m_orderDirty = true;
+    }
+  }
+  // ワールド行列を作り直させる
+  m_localDirty[index] = 1;
+  m_anyDirty = true;
+}
+
+TransformStore::Handle TransformStore::parent(Handle handle) const {
+  return m_parentHandle[handle];
+}
+
+const glm::mat4 &TransformStore::localMatrix(Handle handle) {
+  if (dirty()) {
+    update();
+  }
+  return m_local[indexOf(handle)];
+}
+
+const glm::mat4 &TransformStore::worldMatrix(Handle handle) {
+  if (dirty()) {
+    update();
+  }
+  return m_world[indexOf(handle)];
+}
+
+void TransformStore::rebuildOrder() {
+  const size_t handleCount = m_handleToIndex.size();
+
+  // 深さを求める（親を辿ってメモ化）
+  std::vector<int32_t> depth(handleCount, -1);
+  std::vector<Handle> stack;
+  uint32_t maxDepth = 0;
+  for (size_t i = 0; i < m_indexToHandle.size(); ++i) {
+    if (!m_alive[i]) {
+      continue;
+    }
+    Handle h = m_indexToHandle[i];
+    while (depth[h] < 0) {
+      const Handle p = m_parentHandle[h];
+      if (p == INVALID_HANDLE) {
+        depth[h] = 0;
+        break;
+      }
+      if (depth[p] >= 0) {
+        depth[h] = depth[p] + 1;
+        break;
+      }
+      stack.push_back(h);
+      h = p;
+    }
+    while (!stack.empty()) {
+      const Handle c = stack.back();
+      stack.pop_back();
+      depth[c] = depth[m_parentHandle[c]] + 1;
+    }
+    maxDepth = std::max(maxDepth, static_cast<uint32_t>(
+                                      depth[m_indexToHandle[i]]));
+  }
+
+  // 深さごとの計数ソート（安定）
+  std::vector<uint32_t> levelStart(maxDepth + 2, 0);
+  for (size_t i = 0; i < m_indexToHandle.size(); ++i) {
+    if (m_alive[i]) {
+      ++levelStart[depth[m_indexToHandle[i]] + 1];
+    }
+  }
+  for (size_t d = 1; d < levelStart.size(); ++d) {
+    levelStart[d] += levelStart[d - 1];
+  }
+  const size_t liveCount = levelStart.back();
+  std::vector<uint32_t> order(liveCount);
+  for (size_t i = 0; i < m_indexToHandle.size(); ++i) {
+    if (m_alive[i]) {
+      order[levelStart[depth[m_indexToHandle[i]]]++] =
+          static_cast<uint32_t>(i);
+    }
+  }
+
+  auto gather = [&order](auto &v) {
+    std::remove_reference_t<decltype(v)> out;
+    out.reserve(order.size());
+    for (auto i : order) {
+      out.push_back(v[i]);
+    }
+    v.swap(out);
+  };
+  gather(m_px);
+  gather(m_py);
+  gather(m_pz);
+  gather(m_qx);
+  gather(m_qy);
+  gather(m_qz);
+  gather(m_qw);
+  gather(m_local);
+  gather(m_world);
+  gather(m_localDirty);
+  gather(m_indexToHandle);
+  m_alive.assign(liveCount, 1);
+  m_worldChanged.assign(liveCount, 0);
+
+  for (uint32_t i = 0; i < liveCount; ++i) {
+    m_handleToIndex[m_indexToHandle[i]] = i;
+  }
+  m_parentIndex.resize(liveCount);
+  for (uint32_t i = 0; i < liveCount; ++i) {
+    const Handle p = m_parentHandle[m_indexToHandle[i]];
+    m_parentIndex[i] = p == INVALID_HANDLE ? NO_PARENT : m_handleToIndex[p];
+    assert(m_parentIndex[i] == NO_PARENT || m_parentIndex[i] < i);
+  }
+
+  // 詰め終わったので、削除済みの Handle を再利用できる
+  m_freeHandles.clear();
+  for (size_t h = 0; h < handleCount; ++h) {
+    if (m_handleToIndex[h] == NO_PARENT) {
+      m_freeHandles.push_back(static_cast<Handle>(h));
+    }
+  }
+  m_orderDirty = false;
+}
+
+void TransformStore::updateLocal(SimdLevel level) {
+  const size_t n = m_indexToHandle.size();
+  size_t i = 0;
+#if defined(B3_SIMD_X86)
+  if (level == SimdLevel::AVX2 || level == SimdLevel::AVX512) {
+    for (; i + 8 <= n; i += 8) {
+      if (anyDirty(&m_localDirty[i], 8)) {
+        composeLocal8(&m_px[i], &m_py[i], &m_pz[i], &m_qx[i], &m_qy[i],
+                      &m_qz[i], &m_qw[i], &m_local[i]);
+      }
+    }
+  }
+  if (level != SimdLevel::Scalar) {
+    for (; i + 4 <= n; i += 4) {
+      if (anyDirty(&m_localDirty[i], 4)) {
+        composeLocal4(&m_px[i], &m_py[i], &m_pz[i], &m_qx[i], &m_qy[i],
+                      &m_qz[i], &m_qw[i], &m_local[i]);
+      }
+    }
+  }
+#endif
+  for (; i < n; ++i) {
+    if (m_localDirty[i]) {
+      m_local[i] = composeLocal(m_px[i], m_py[i], m_pz[i], m_qx[i], m_qy[i],
+                                m_qz[i], m_qw[i]);
+    }
+  }
+}
+
+void TransformStore::updateWorld(SimdLevel level) {
+  const size_t n = m_indexToHandle.size();
+#if defined(B3_SIMD_X86)
+  if (level == SimdLevel::AVX2 || level == SimdLevel::AVX512) {
+    m_lastUpdatedCount =
+        updateWorldAVX2(n, m_parentIndex.data(), m_localDirty.data(),
+                        m_worldChanged.data(), m_local.data(), m_world.data());
+    return;
+  }
+#endif
+  size_t count = 0;
+  for (size_t i = 0; i < n; ++i) {
+    // 親は必ず前にあるので、既に今回の結果が入っている
+    const uint32_t p = m_parentIndex[i];
+    const bool parentChanged = p != NO_PARENT && m_worldChanged[p];
+    m_worldChanged[i] = m_localDirty[i] || parentChanged;
+    if (!m_worldChanged[i]) {
+      continue;
+    }
+    if (p == NO_PARENT) {
+      m_world[i] = m_local[i];
+    } else {
+#if defined(B3_SIMD_X86)
+      if (level != SimdLevel::Scalar) {
+        mulMat4SSE(m_world[p], m_local[i], m_world[i]);
+      } else {
+        m_world[i] = m_world[p] * m_local[i];
+      }
+#else
+      m_world[i] = m_world[p] * m_local[i];
+#endif
+    }
+    ++count;
+  }
+  m_lastUpdatedCount = count;
+}
+
+void TransformStore::update(SimdLevel level) {
+  if (m_orderDirty) {
+    rebuildOrder();
+  }
+  if (!m_anyDirty) {
+    m_lastUpdatedCount = 0;
+    return;
+  }
+  updateLocal(level);
+  updateWorld(level);
+  std::fill(m_localDirty.begin(), m_localDirty.end(), 0);
+  m_anyDirty = false;
+}
+
+} // namespace b3
@@ -0,0 +1,105 @@
+#ifndef __TRANSFORM_STORE_HPP__
+#define __TRANSFORM_STORE_HPP__
+
+#include "common.hpp"
+#include "simd.hpp"
+
+#include <vector>
+
+namespace b3 {
+
+// ノードの位置・回転・親子関係・ワールド行列を Structure of Arrays で保持する。
+//
+// 要素は深さ順（親は必ず子より前）に並べ替えて格納するので、
+// update() は先頭から順に処理するだけで親のワールド行列が確定している。
+// ローカル行列は連続した 4/8 要素をまとめて SIMD で計算し、
+// ワールド行列の乗算も SIMD で行う。
+//
+// 外部からは安定した Handle で参照し、内部の並び順（index）は
+// 親子関係が変わったときに作り直される。
+// スレッドセーフではない。
+class TransformStore {
+public:
+  using Handle = uint32_t;
+  static constexpr Handle INVALID_HANDLE = ~0u;
+
+  TransformStore() = default;
+  TransformStore(const TransformStore &) = delete;
+  TransformStore &operator=(const TransformStore &) = delete;
+
+  // Node が既定で使うストア
+  static TransformStore &shared();
+
+  Handle create();
+  void destroy(Handle handle);
+
+  void setPosition(Handle handle, const glm::vec3 &pos);
+  glm::vec3 position(Handle handle) const;
+
+  void setQuat(Handle handle, const glm::quat &quat);
+  glm::quat quat(Handle handle) const;
+
+  // 親を設定する。INVALID_HANDLE で親なし。
+  void setParent(Handle handle, Handle parent);
+  Handle parent(Handle handle) const;
+
+  // 必要であれば update() してから返す。
+  // 返した参照は次に create()/update() するまで有効。
+  const glm::mat4 &localMatrix(Handle handle);
+  const glm::mat4 &worldMatrix(Handle handle);
+  // update() 済みのワールド行列を返す。何も変更しないので、複数のスレッド
+  // から同時に呼べる。dirty() の間は呼ばないこと。
+  const glm::mat4 &updatedWorldMatrix(Handle handle) const {
+    assert(!dirty());
+    return m_world[indexOf(handle)];
+  }
+
+  // 変更されたノードとその子孫のローカル/ワールド行列を再計算する。
+  // 何も変更されていなければ行列計算は一切行わない。
+  void update() { update(detectSimdLevel()); }
+  void update(SimdLevel level);
+
+  bool dirty() const { return m_anyDirty || m_orderDirty; }
+  size_t size() const { return m_indexToHandle.size(); }
+
+  // 最後の update() で再計算したワールド行列の数
+  size_t lastUpdatedCount() const { return m_lastUpdatedCount; }
+
+private:
+  static constexpr uint32_t NO_PARENT = ~0u;
+
+  // 並び順（index）ごとの SoA
+  std::vector<float> m_px, m_py, m_pz;
+  std::vector<float> m_qx, m_qy, m_qz, m_qw;
+  std::vector<uint32_t> m_parentIndex;
+  std::vector<glm::mat4> m_local;
+  std::vector<glm::mat4> m_world;
+  std::vector<uint8_t> m_localDirty;
+  // 今回の update() でワールド行列が変わったかどうか（子への伝搬用）
+  std::vector<uint8_t> m_worldChanged;
+  std::vector<uint8_t> m_alive;
+  std::vector<Handle> m_indexToHandle;
+
+  // Handle ごとの情報
+  std::vector<uint32_t> m_handleToIndex;
+  std::vector<Handle> m_parentHandle;
+  std::vector<Handle> m_freeHandles;
+
+  bool m_anyDirty = false;
+  bool m_orderDirty = false;
+  size_t m_lastUpdatedCount = 0;
+
+  uint32_t indexOf(Handle handle) const {
+    assert(handle < m_handleToIndex.size());
+    return m_handleToIndex[handle];
+  }
+
+  // 親子関係から深さ順に並べ替え、削除済みの要素を詰める
+  void rebuildOrder();
+  void updateLocal(SimdLevel level);
+  void updateWorld(SimdLevel level);
+};
+
+} // namespace b3
+
+#endif
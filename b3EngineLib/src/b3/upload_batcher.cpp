@@ -0,0 +1,573 @@
+#include "upload_batcher.hpp"
+
+#include <cassert>
+#include <cstring>
+
+namespace b3 {
+
+namespace {
+
+// バッファのコピー元オフセットの揃え（イメージのテクセルサイズも満たす）
+constexpr VkDeviceSize STAGING_ALIGNMENT = 16;
+
+} // namespace
+
+void UploadBatcher::init(VkDevice device, VmaAllocator allocator,
+                         VkQueue queue, uint32_t queueFamilyIndex,
+                         uint32_t graphicsQueueFamilyIndex,
+                         VkDeviceSize ringSize) {
+  m_device = device;
+  m_allocator = allocator;
+  m_queue = queue;
+  m_queueFamilies[0] = queueFamilyIndex;
+  m_queueFamilies[1] = graphicsQueueFamilyIndex;
+
+  VkCommandPoolCreateInfo poolInfo{
+      .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+      .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT |
+               VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+      .queueFamilyIndex = queueFamilyIndex,
+  };
+  VK_CHECK(vkCreateCommandPool(m_device, &poolInfo, nullptr, &m_commandPool));
+
+  VkSemaphoreTypeCreateInfo timelineInfo{
+      .sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO,
+      .semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE,
+      .initialValue = 0,
+  };
+  VkSemaphoreCreateInfo semaphoreInfo{
+      .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+      .pNext = &timelineInfo,
+  };
+  VK_CHECK(vkCreateSemaphore(m_device, &semaphoreInfo, nullptr, &m_timeline));
+
+  VkBufferCreateInfo bufferInfo{
+      .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+      .size = ringSize,
+      .usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+      .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+  };
+  VmaAllocationCreateInfo allocationCreateInfo = {
+      .flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT |
+               VMA_ALLOCATION_CREATE_MAPPED_BIT,
+      .usage = VMA_MEMORY_USAGE_AUTO,
+      .requiredFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                       VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+  };
+  VmaAllocationInfo allocationInfo{};
+  VK_CHECK(vmaCreateBuffer(m_allocator, &bufferInfo, &allocationCreateInfo,
+                           &m_ringBuffer, &m_ringAllocation, &allocationInfo));
+  m_ringMapped = static_cast<uint8_t *>(allocationInfo.pMappedData);
+  m_ring = StagingRing(ringSize);
+}
+
+void UploadBatcher::destroy() {
+  if (m_device == VK_NULL_HANDLE) {
+    return;
+  }
+  wait();
+  m_idle.clear();
+  m_acquires.clear();
+  // コマンドバッファはプールと一緒に破棄される
+  vkDestroyCommandPool(m_device, m_commandPool, nullptr);
+  vkDestroySemaphore(m_device, m_timeline, nullptr);
+  m_timeline = VK_NULL_HANDLE;
+  vmaDestroyBuffer(m_allocator, m_ringBuffer, m_ringAllocation);
+  m_commandPool = VK_NULL_HANDLE;
+  m_ringBuffer = VK_NULL_HANDLE;
+  m_ringAllocation = VK_NULL_HANDLE;
+  m_ringMapped = nullptr;
+  m_device = VK_NULL_HANDLE;
+}
+
+void UploadBatcher::shareBuffer(VkBufferCreateInfo &info) const {
+  if (transfersOwnership()) {
+    info.sharingMode = VK_SHARING_MODE_CONCURRENT;
+    info.queueFamilyIndexCount = 2;
+    info.pQueueFamilyIndices = m_queueFamilies;
+  } else {
+    info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  }
+}
+
+uint64_t UploadBatcher::uploadBuffer(VkBuffer dst, VkDeviceSize dstOffset,
+                                     const void *data, VkDeviceSize size) {
+  return uploadBuffer(dst, dstOffset, size, [data, size](uint8_t *mapped) {
+    std::memcpy(mapped, data, size);
+  });
+}
+
+uint64_t
+UploadBatcher::uploadBuffer(VkBuffer dst, VkDeviceSize dstOffset,
+                            VkDeviceSize size,
+                            const std::function<void(uint8_t *)> &write) {
+  if (size == 0) {
+    // 何も書き込まないので、すぐに使える
+    return 0;
+  }
+  VkBuffer staging;
+  VkDeviceSize stagingOffset;
+  uint8_t *mapped = reserve(size, STAGING_ALIGNMENT, staging, stagingOffset);
+  write(mapped);
+
+  VkBufferCopy region{
+      .srcOffset = stagingOffset,
+      .dstOffset = dstOffset,
+      .size = size,
+  };
+  vkCmdCopyBuffer(recording(), staging, dst, 1, &region);
+  m_stats.bytes += size;
+  ++m_stats.copies;
+  return m_current.batch;
+}
+
+uint64_t UploadBatcher::uploadImage(VkImage image, TextureFormat format,
+                                    uint32_t width, uint32_t height,
+                                    uint32_t mipLevels, uint32_t levelsInData,
+                                    const void *data, VkDeviceSize size) {
+  return uploadImage(image, format, width, height, mipLevels, levelsInData,
+                     size, [data, size](uint8_t *mapped) {
+                       std::memcpy(mapped, data, size);
+                     });
+}
+
+uint64_t
+UploadBatcher::uploadImage(VkImage image, TextureFormat format, uint32_t width,
+                           uint32_t height, uint32_t mipLevels,
+                           uint32_t levelsInData, VkDeviceSize size,
+                           const std::function<void(uint8_t *)> &write) {
+  assert(levelsInData >= 1 && levelsInData <= mipLevels);
+  assert(levelsInData == mipLevels || !isBlockCompressed(format));
+  VkBuffer staging;
+  VkDeviceSize stagingOffset;
+  // 書き込みに失敗しても、確保した領域は次に submit するバッチと一緒に
+  // 解放される
+  uint8_t *mapped = reserve(size, STAGING_ALIGNMENT, staging, stagingOffset);
+  write(mapped);
+
+  const VkCommandBuffer cmd = recording();
+  VkImageMemoryBarrier2 barrier{
+      .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+      .srcStageMask = VK_PIPELINE_STAGE_2_NONE,
+      .srcAccessMask = VK_ACCESS_2_NONE,
+      .dstStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT,
+      .dstAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT,
+      .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+      .newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+      .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+      .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+      .image = image,
+      .subresourceRange = {.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                           .baseMipLevel = 0,
+                           .levelCount = levelsInData,
+                           .baseArrayLayer = 0,
+                           .layerCount = 1},
+  };
+  VkDependencyInfo dependencyInfo{
+      .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+      .imageMemoryBarrierCount = 1,
+      .pImageMemoryBarriers = &barrier,
+  };
+  vkCmdPipelineBarrier2(cmd, &dependencyInfo);
+
+  // data にあるレベルを、詰めて並べた位置からそれぞれコピーする
+  // （圧縮形式の 4x4 に満たないレベルも、大きさはレベルの画素数で指定する）
+  const auto levels = mipChainLayout(format, width, height, levelsInData);
+  std::vector<VkBufferImageCopy> regions;
+  for (uint32_t level = 0; level < levelsInData; ++level) {
+    assert(levels[level].offset + levels[level].size <= size);
+    regions.push_back({
+        .bufferOffset = stagingOffset + levels[level].offset,
+        .bufferRowLength = 0,
+        .bufferImageHeight = 0,
+        .imageSubresource = {.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                             .mipLevel = level,
+                             .baseArrayLayer = 0,
+                             .layerCount = 1},
+        .imageOffset = {0, 0, 0},
+        .imageExtent = {levels[level].width, levels[level].height, 1},
+    });
+  }
+  vkCmdCopyBufferToImage(cmd, staging, image,
+                         VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                         static_cast<uint32_t>(regions.size()),
+                         regions.data());
+
+  // 残りのレベルを描画側で作る場合は、コピー元にする。
+  // そうでなければシェーダー読み込みに最適化する。
+  const bool blit = levelsInData < mipLevels;
+  barrier.srcStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT;
+  barrier.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+  barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+  barrier.newLayout = blit ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL
+                           : VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+  if (transfersOwnership()) {
+    // 所有権を解放する。レイアウトの変更は獲得側と同じものを指定し、
+    // 獲得側の barrier がシェーダーの読み込みを待たせる。
+    barrier.dstStageMask = VK_PIPELINE_STAGE_2_NONE;
+    barrier.dstAccessMask = VK_ACCESS_2_NONE;
+    barrier.srcQueueFamilyIndex = m_queueFamilies[0];
+    barrier.dstQueueFamilyIndex = m_queueFamilies[1];
+  } else if (blit) {
+    // 描画側の blit はタイムラインセマフォの待機で順序が付く
+    barrier.dstStageMask = VK_PIPELINE_STAGE_2_NONE;
+    barrier.dstAccessMask = VK_ACCESS_2_NONE;
+  } else {
+    barrier.dstStageMask = VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT;
+    barrier.dstAccessMask = VK_ACCESS_2_SHADER_SAMPLED_READ_BIT;
+  }
+  vkCmdPipelineBarrier2(cmd, &dependencyInfo);
+  if (transfersOwnership() || blit) {
+    m_acquires.push_back({.batch = m_current.batch,
+                          .image = image,
+                          .width = width,
+                          .height = height,
+                          .mipLevels = mipLevels,
+                          .levelsInData = levelsInData});
+  }
+
+  m_stats.bytes += size;
+  ++m_stats.copies;
+  return m_current.batch;
+}
+
+uint64_t UploadBatcher::copyBuffer(VkBuffer src, VkBuffer dst,
+                                   VkDeviceSize size) {
+  const VkCommandBuffer cmd = recording();
+  // 記録済みのコピーが src に書き込んでいるかもしれない
+  transferBarrier(cmd,
+                  VK_ACCESS_2_TRANSFER_READ_BIT |
+                      VK_ACCESS_2_TRANSFER_WRITE_BIT,
+                  VK_PIPELINE_STAGE_2_TRANSFER_BIT);
+  VkBufferCopy region{.srcOffset = 0, .dstOffset = 0, .size = size};
+  vkCmdCopyBuffer(cmd, src, dst, 1, &region);
+  // この後のコピーが dst の同じ範囲に書き込むかもしれない
+  transferBarrier(cmd, VK_ACCESS_2_TRANSFER_WRITE_BIT,
+                  VK_PIPELINE_STAGE_2_TRANSFER_BIT);
+  return m_current.batch;
+}
+
+void UploadBatcher::destroyAfterUpload(VkBuffer buffer,
+                                       VmaAllocation allocation) {
+  recording();
+  m_current.garbage.push_back({buffer, allocation});
+}
+
+void UploadBatcher::flush() {
+  if (m_current.cmd == VK_NULL_HANDLE) {
+    return;
+  }
+  // 書き込みは、描画側がタイムラインセマフォを待つことで見えるようになる
+  VK_CHECK(vkEndCommandBuffer(m_current.cmd));
+
+  VkTimelineSemaphoreSubmitInfo timelineInfo{
+      .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+      .signalSemaphoreValueCount = 1,
+      .pSignalSemaphoreValues = &m_current.batch,
+  };
+  VkSubmitInfo submitInfo{
+      .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+      .pNext = &timelineInfo,
+      .commandBufferCount = 1,
+      .pCommandBuffers = &m_current.cmd,
+      .signalSemaphoreCount = 1,
+      .pSignalSemaphores = &m_timeline,
+  };
+  VK_CHECK(vkQueueSubmit(m_queue, 1, &submitInfo, VK_NULL_HANDLE));
+  ++m_stats.submits;
+
+  ++m_nextBatch;
+  m_ring.close(m_current.batch);
+  m_inFlight.push_back(std::move(m_current));
+  m_current = {};
+}
+
+void UploadBatcher::wait() {
+  flush();
+  while (!m_inFlight.empty()) {
+    waitOldest();
+  }
+}
+
+uint64_t UploadBatcher::collect() {
+  const uint64_t completed = completedValue();
+  while (!m_inFlight.empty() && m_inFlight.front().batch <= completed) {
+    retire(m_inFlight.front());
+    m_inFlight.pop_front();
+  }
+  return completed;
+}
+
+uint64_t UploadBatcher::completedValue() const {
+  uint64_t value = 0;
+  VK_CHECK(vkGetSemaphoreCounterValue(m_device, m_timeline, &value));
+  return value;
+}
+
+void UploadBatcher::recordAcquires(VkCommandBuffer cmd,
+                                   uint64_t completedValue) {
+  std::vector<Acquire> acquires;
+  while (!m_acquires.empty() && m_acquires.front().batch <= completedValue) {
+    acquires.push_back(m_acquires.front());
+    m_acquires.pop_front();
+  }
+  if (acquires.empty()) {
+    return;
+  }
+
+  // 所有権の獲得と、blit で作るレベルの準備をまとめて1回の barrier にする
+  std::vector<VkImageMemoryBarrier2> barriers;
+  for (const auto &acquire : acquires) {
+    const bool blit = acquire.levelsInData < acquire.mipLevels;
+    if (transfersOwnership()) {
+      const VkImageLayout layout =
+          blit ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL
+               : VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+      barriers.push_back({
+          .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+          .srcStageMask = VK_PIPELINE_STAGE_2_NONE,
+          .srcAccessMask = VK_ACCESS_2_NONE,
+          .dstStageMask = blit ? VK_PIPELINE_STAGE_2_BLIT_BIT
+                               : VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT,
+          .dstAccessMask = blit ? VK_ACCESS_2_TRANSFER_READ_BIT
+                                : VK_ACCESS_2_SHADER_SAMPLED_READ_BIT,
+          .oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+          .newLayout = layout,
+          .srcQueueFamilyIndex = m_queueFamilies[0],
+          .dstQueueFamilyIndex = m_queueFamilies[1],
+          .image = acquire.image,
+          .subresourceRange = {.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                               .baseMipLevel = 0,
+                               .levelCount = acquire.levelsInData,
+                               .baseArrayLayer = 0,
+                               .layerCount = 1},
+      });
+    }
+    if (blit) {
+      // まだ何も書いていないレベルなので、所有権の移動はいらない
+      barriers.push_back({
+          .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+          .srcStageMask = VK_PIPELINE_STAGE_2_NONE,
+          .srcAccessMask = VK_ACCESS_2_NONE,
+          .dstStageMask = VK_PIPELINE_STAGE_2_BLIT_BIT,
+          .dstAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT,
+          .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+          .newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+          .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+          .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+          .image = acquire.image,
+          .subresourceRange = {.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                               .baseMipLevel = acquire.levelsInData,
+                               .levelCount =
+                                   acquire.mipLevels - acquire.levelsInData,
+                               .baseArrayLayer = 0,
+                               .layerCount = 1},
+      });
+    }
+  }
+  VkDependencyInfo dependencyInfo{
+      .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+      .imageMemoryBarrierCount = static_cast<uint32_t>(barriers.size()),
+      .pImageMemoryBarriers = barriers.data(),
+  };
+  if (!barriers.empty()) {
+    vkCmdPipelineBarrier2(cmd, &dependencyInfo);
+  }
+  if (transfersOwnership()) {
+    m_stats.acquires += acquires.size();
+  }
+
+  // 1つ上のレベルから線形フィルタで縮小していく。sRGB のフォーマットは
+  // 線形に戻してから補間される。
+  barriers.clear();
+  for (const auto &acquire : acquires) {
+    if (acquire.levelsInData == acquire.mipLevels) {
+      continue;
+    }
+    const auto levels = mipChainLayout(acquire.width, acquire.height);
+    VkImageMemoryBarrier2 barrier{
+        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+        .srcStageMask = VK_PIPELINE_STAGE_2_BLIT_BIT,
+        .srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT,
+        .dstStageMask = VK_PIPELINE_STAGE_2_BLIT_BIT,
+        .dstAccessMask = VK_ACCESS_2_TRANSFER_READ_BIT,
+        .oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        .newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .image = acquire.image,
+        .subresourceRange = {.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                             .baseMipLevel = 0,
+                             .levelCount = 1,
+                             .baseArrayLayer = 0,
+                             .layerCount = 1},
+    };
+    VkDependencyInfo levelDependency{
+        .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+        .imageMemoryBarrierCount = 1,
+        .pImageMemoryBarriers = &barrier,
+    };
+    for (uint32_t level = acquire.levelsInData; level < acquire.mipLevels;
+         ++level) {
+      const auto &src = levels[level - 1];
+      const auto &dst = levels[level];
+      VkImageBlit region{
+          .srcSubresource = {.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                             .mipLevel = level - 1,
+                             .baseArrayLayer = 0,
+                             .layerCount = 1},
+          .srcOffsets = {{0, 0, 0},
+                         {static_cast<int32_t>(src.width),
+                          static_cast<int32_t>(src.height), 1}},
+          .dstSubresource = {.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                             .mipLevel = level,
+                             .baseArrayLayer = 0,
+                             .layerCount = 1},
+          .dstOffsets = {{0, 0, 0},
+                         {static_cast<int32_t>(dst.width),
+                          static_cast<int32_t>(dst.height), 1}},
+      };
+      vkCmdBlitImage(cmd, acquire.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                     acquire.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1,
+                     &region, VK_FILTER_LINEAR);
+      // 書いたレベルを次の blit のコピー元にする
+      barrier.subresourceRange.baseMipLevel = level;
+      vkCmdPipelineBarrier2(cmd, &levelDependency);
+    }
+    m_stats.blitLevels += acquire.mipLevels - acquire.levelsInData;
+
+    barriers.push_back({
+        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+        .srcStageMask = VK_PIPELINE_STAGE_2_BLIT_BIT,
+        .srcAccessMask = VK_ACCESS_2_TRANSFER_READ_BIT,
+        .dstStageMask = VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT,
+        .dstAccessMask = VK_ACCESS_2_SHADER_SAMPLED_READ_BIT,
+        .oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+        .newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .image = acquire.image,
+        .subresourceRange = {.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                             .baseMipLevel = 0,
+                             .levelCount = acquire.mipLevels,
+                             .baseArrayLayer = 0,
+                             .layerCount = 1},
+    });
+  }
+  if (!barriers.empty()) {
+    dependencyInfo.imageMemoryBarrierCount =
+        static_cast<uint32_t>(barriers.size());
+    dependencyInfo.pImageMemoryBarriers = barriers.data();
+    vkCmdPipelineBarrier2(cmd, &dependencyInfo);
+  }
+}
+
+VkCommandBuffer UploadBatcher::recording() {
+  if (m_current.cmd != VK_NULL_HANDLE) {
+    return m_current.cmd;
+  }
+  if (!m_idle.empty()) {
+    m_current = std::move(m_idle.back());
+    m_idle.pop_back();
+  } else {
+    VkCommandBufferAllocateInfo allocInfo{
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+        .commandPool = m_commandPool,
+        .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+        .commandBufferCount = 1,
+    };
+    VK_CHECK(vkAllocateCommandBuffers(m_device, &allocInfo, &m_current.cmd));
+  }
+  // flush() でこの番号を signal する
+  m_current.batch = m_nextBatch;
+  VkCommandBufferBeginInfo beginInfo{
+      .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+      .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+  };
+  VK_CHECK(vkBeginCommandBuffer(m_current.cmd, &beginInfo));
+  return m_current.cmd;
+}
+
+uint8_t *UploadBatcher::reserve(VkDeviceSize size, VkDeviceSize alignment,
+                                VkBuffer &buffer, VkDeviceSize &offset) {
+  if (size > m_ring.capacity()) {
+    // リングに収まらないものは専用のステージングバッファを使う
+    VkBufferCreateInfo bufferInfo{
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .size = size,
+        .usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+    };
+    VmaAllocationCreateInfo allocationCreateInfo = {
+        .flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT |
+                 VMA_ALLOCATION_CREATE_MAPPED_BIT,
+        .usage = VMA_MEMORY_USAGE_AUTO,
+        .requiredFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                         VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+    };
+    VmaAllocation allocation;
+    VmaAllocationInfo allocationInfo{};
+    VK_CHECK(vmaCreateBuffer(m_allocator, &bufferInfo, &allocationCreateInfo,
+                             &buffer, &allocation, &allocationInfo));
+    destroyAfterUpload(buffer, allocation);
+    ++m_stats.dedicatedStagings;
+    offset = 0;
+    return static_cast<uint8_t *>(allocationInfo.pMappedData);
+  }
+
+  uint64_t ringOffset = m_ring.allocate(size, alignment);
+  while (ringOffset == StagingRing::INVALID_OFFSET) {
+    // 記録中のコピーも含めて submit し、古いバッチから空くのを待つ。
+    // 使用中のバッチがなくなればリングは空なので必ず確保できる。
+    flush();
+    waitOldest();
+    ++m_stats.stalls;
+    ringOffset = m_ring.allocate(size, alignment);
+  }
+  buffer = m_ringBuffer;
+  offset = ringOffset;
+  return m_ringMapped + ringOffset;
+}
+
+void UploadBatcher::waitOldest() {
+  auto &oldest = m_inFlight.front();
+  VkSemaphoreWaitInfo waitInfo{
+      .sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
+      .semaphoreCount = 1,
+      .pSemaphores = &m_timeline,
+      .pValues = &oldest.batch,
+  };
+  VK_CHECK(vkWaitSemaphores(m_device, &waitInfo, UINT64_MAX));
+  retire(oldest);
+  m_inFlight.pop_front();
+}
+
+void UploadBatcher::retire(Submission &submission) {
+  for (const auto &garbage : submission.garbage) {
+    vmaDestroyBuffer(m_allocator, garbage.buffer, garbage.allocation);
+  }
+  submission.garbage.clear();
+  m_ring.release(submission.batch);
+  VK_CHECK(vkResetCommandBuffer(submission.cmd, 0));
+  m_idle.push_back(std::move(submission));
+}
+
+void UploadBatcher::transferBarrier(VkCommandBuffer cmd,
+                                    VkAccessFlags2 dstAccessMask,
+                                    VkPipelineStageFlags2 dstStage) {
+  VkMemoryBarrier2 barrier{
+      .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2,
+      .srcStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT,
+      .srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT,
+      .dstStageMask = dstStage,
+      .dstAccessMask = dstAccessMask,
+  };
+  VkDependencyInfo dependencyInfo{
+      .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+      .memoryBarrierCount = 1,
+      .pMemoryBarriers = &barrier,
+  };
+  vkCmdPipelineBarrier2(cmd, &dependencyInfo);
+}
+
+} // namespace b3
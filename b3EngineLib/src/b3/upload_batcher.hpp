@@ -0,0 +1,175 @@
+#ifndef __UPLOAD_BATCHER_HPP__
+#define __UPLOAD_BATCHER_HPP__
+
+#include "b3/common.hpp"
+#include "b3/staging_ring.hpp"
+#include "b3/texture_format.hpp"
+
+#include <deque>
+#include <functional>
+#include <vector>
+
+namespace b3 {
+
+// GPU へのアップロードをまとめて1つのコマンドバッファに記録し、
+// アップロード用のキューに非同期に submit する。
+//
+// submit したバッチはタイムラインセマフォにバッチ番号を signal する。
+// アップロード関数はそのデータが使えるようになるバッチ番号を返すので、
+// completedValue() がそれ以上になったフレームから使ってよい。
+//
+// データは永続的にマップしたステージングバッファ（リング）に書き込み、
+// その領域はバッチの完了後に再利用する。リングに収まらない大きさのデータ
+// だけは専用のステージングバッファを作る。
+//
+// アップロード用のキューが描画と別のキューファミリーの場合:
+// - バッファは両方のファミリーから使うので CONCURRENT で作る
+//   （shareBuffer()）。範囲ごとの書き込みや拡張時のコピーが多いため。
+// - イメージは EXCLUSIVE のままで、アップロード側で解放し、描画側で
+//   recordAcquires() が獲得する（キューファミリーの所有権の移動）。
+//
+// ミップレベルを blit で作るイメージは、レベル 0 だけをコピーし、残りは
+// 描画側の recordAcquires() で作る。
+class UploadBatcher {
+public:
+  static constexpr VkDeviceSize DEFAULT_RING_SIZE = 64 * 1024 * 1024;
+
+  struct Stats {
+    // ステージングを経由してコピーしたバイト数と回数
+    uint64_t bytes = 0;
+    uint64_t copies = 0;
+    // submit した回数
+    uint64_t submits = 0;
+    // リングが一杯でバッチの完了を待った回数
+    uint64_t stalls = 0;
+    // リングに収まらず専用のステージングバッファを作った回数
+    uint64_t dedicatedStagings = 0;
+    // 描画側で所有権を獲得したイメージの数
+    uint64_t acquires = 0;
+    // 描画側で blit して作ったミップレベルの数
+    uint64_t blitLevels = 0;
+  };
+
+  UploadBatcher() = default;
+  UploadBatcher(const UploadBatcher &) = delete;
+  UploadBatcher &operator=(const UploadBatcher &) = delete;
+
+  // queue はアップロードに使うキュー（queueFamilyIndex のもの）で、
+  // graphicsQueueFamilyIndex はアップロードしたものを使うキューファミリー
+  void init(VkDevice device, VmaAllocator allocator, VkQueue queue,
+            uint32_t queueFamilyIndex, uint32_t graphicsQueueFamilyIndex,
+            VkDeviceSize ringSize = DEFAULT_RING_SIZE);
+  // 完了を待ってからすべてを破棄する
+  void destroy();
+
+  // アップロード用のキューが描画と別のファミリーか
+  bool transfersOwnership() const {
+    return m_queueFamilies[0] != m_queueFamilies[1];
+  }
+  // 両方のキューから使うバッファの共有モードを設定する
+  void shareBuffer(VkBufferCreateInfo &info) const;
+
+  // 以下のアップロード関数は、結果が使えるようになるバッチ番号を返す
+
+  // dst の dstOffset から size バイトを書き込む
+  uint64_t uploadBuffer(VkBuffer dst, VkDeviceSize dstOffset, const void *data,
+                        VkDeviceSize size);
+  // data をコピーする代わりに、マップしたステージングの size バイトに
+  // write で直接書き込む（インターリーブした頂点をストリームに分けるなど）
+  uint64_t uploadBuffer(VkBuffer dst, VkDeviceSize dstOffset, VkDeviceSize size,
+                        const std::function<void(uint8_t *)> &write);
+  // mipLevels レベル、1 レイヤーのカラーイメージ全体を書き込み、
+  // SHADER_READ_ONLY_OPTIMAL にする（イメージは UNDEFINED から始める）。
+  // data はレベル 0 から levelsInData レベルを mipChainLayout() の順に
+  // 詰めたもの。levelsInData < mipLevels なら、残りのレベルは描画側の
+  // recordAcquires() で blit して作る（ブロック圧縮しない形式のみで、
+  // イメージに TRANSFER_SRC が必要）。
+  uint64_t uploadImage(VkImage image, TextureFormat format, uint32_t width,
+                       uint32_t height, uint32_t mipLevels,
+                       uint32_t levelsInData, const void *data,
+                       VkDeviceSize size);
+  // data をコピーする代わりに、マップしたステージングの size バイトに
+  // write で直接書き込む（デコードした画像を中間のバッファなしで送る）。
+  // write が例外を投げたら何も記録せずにそのまま投げる。
+  uint64_t uploadImage(VkImage image, TextureFormat format, uint32_t width,
+                       uint32_t height, uint32_t mipLevels,
+                       uint32_t levelsInData, VkDeviceSize size,
+                       const std::function<void(uint8_t *)> &write);
+  // 記録済みのコピーの後に、バッファ間のコピーを記録する
+  uint64_t copyBuffer(VkBuffer src, VkBuffer dst, VkDeviceSize size);
+  // 記録済みのコピーが終わってからバッファを破棄する
+  void destroyAfterUpload(VkBuffer buffer, VmaAllocation allocation);
+
+  // 記録したコピーを submit する（完了は待たない）
+  void flush();
+  // flush() してから、すべての完了を待つ
+  void wait();
+  // 完了したバッチのステージングを解放し、完了したバッチ番号を返す
+  uint64_t collect();
+  // 完了したバッチ番号（GPU に問い合わせる）
+  uint64_t completedValue() const;
+
+  // completedValue までにアップロードしたイメージの所有権を、描画側の
+  // コマンドバッファで獲得し、blit で作るミップレベルを作る（blit は
+  // グラフィックスのキューでしか使えない）。そのコマンドバッファの submit は
+  // timeline() を completedValue まで待つこと。
+  void recordAcquires(VkCommandBuffer cmd, uint64_t completedValue);
+  VkSemaphore timeline() const { return m_timeline; }
+
+  const Stats &stats() const { return m_stats; }
+
+private:
+  struct Garbage {
+    VkBuffer buffer;
+    VmaAllocation allocation;
+  };
+  struct Submission {
+    VkCommandBuffer cmd = VK_NULL_HANDLE;
+    uint64_t batch = 0;
+    std::vector<Garbage> garbage;
+  };
+  // 描画側で所有権を獲得するか、ミップレベルを作るイメージ
+  struct Acquire {
+    uint64_t batch;
+    VkImage image;
+    uint32_t width;
+    uint32_t height;
+    uint32_t mipLevels;
+    uint32_t levelsInData;
+  };
+
+  // 記録中のコマンドバッファ（なければ開始する）
+  VkCommandBuffer recording();
+  // ステージングに size バイトを確保し、書き込み先を返す
+  uint8_t *reserve(VkDeviceSize size, VkDeviceSize alignment,
+                   VkBuffer &buffer, VkDeviceSize &offset);
+  // 最も古いバッチの完了を待つ
+  void waitOldest();
+  void retire(Submission &submission);
+  void transferBarrier(VkCommandBuffer cmd, VkAccessFlags2 dstAccessMask,
+                       VkPipelineStageFlags2 dstStage);
+
+  VkDevice m_device = VK_NULL_HANDLE;
+  VmaAllocator m_allocator = VK_NULL_HANDLE;
+  VkQueue m_queue = VK_NULL_HANDLE;
+  // アップロード用と描画用のキューファミリー
+  uint32_t m_queueFamilies[2] = {0, 0};
+  VkCommandPool m_commandPool = VK_NULL_HANDLE;
+  VkSemaphore m_timeline = VK_NULL_HANDLE;
+
+  VkBuffer m_ringBuffer = VK_NULL_HANDLE;
+  VmaAllocation m_ringAllocation = VK_NULL_HANDLE;
+  uint8_t *m_ringMapped = nullptr;
+  StagingRing m_ring;
+
+  Submission m_current;
+  std::deque<Submission> m_inFlight;
+  std::vector<Submission> m_idle;
+  std::deque<Acquire> m_acquires;
+  uint64_t m_nextBatch = 1;
+  Stats m_stats;
+};
+
+} // namespace b3
+
+#endif
@@ -0,0 +1,198 @@
+#include "vertex_quantization.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace b3 {
+
+namespace {
+
+constexpr float SNORM16_MAX = 32767.f;
+constexpr float UNORM16_MAX = 65535.f;
+
+int16_t toSnorm16(float v) {
+  return static_cast<int16_t>(
+      std::lround(std::clamp(v, -1.f, 1.f) * SNORM16_MAX));
+}
+float fromSnorm16(int16_t q) { return std::max(q / SNORM16_MAX, -1.f); }
+
+uint16_t toUnorm16(float v) {
+  return static_cast<uint16_t>(
+      std::lround(std::clamp(v, 0.f, 1.f) * UNORM16_MAX));
+}
+float fromUnorm16(uint16_t q) { return q / UNORM16_MAX; }
+
+float signNotZero(float v) { return v >= 0.f ? 1.f : -1.f; }
+
+// 量子化した八面体の座標のうち、丸めの上下 4 通りから元の法線に最も
+// 近いものを選ぶ（単純に丸めるより角度の誤差が小さい）
+void encodeNormal(const glm::vec3 &normal, int16_t out[2]) {
+  const glm::vec2 e = encodeOctahedral(normal) * SNORM16_MAX;
+  float best = -2.f;
+  for (int i = 0; i < 4; ++i) {
+    const glm::vec2 q((i & 1) ? std::ceil(e.x) : std::floor(e.x),
+                      (i & 2) ? std::ceil(e.y) : std::floor(e.y));
+    const glm::vec2 clamped = glm::clamp(q, -SNORM16_MAX, SNORM16_MAX);
+    const float d = glm::dot(decodeOctahedral(clamped / SNORM16_MAX), normal);
+    if (d > best) {
+      best = d;
+      out[0] = static_cast<int16_t>(clamped.x);
+      out[1] = static_cast<int16_t>(clamped.y);
+    }
+  }
+}
+
+} // namespace
+
+const char *toString(VertexFormat format) {
+  switch (format) {
+  case VertexFormat::Float:
+    return "Float";
+  case VertexFormat::Packed:
+    return "Packed";
+  }
+  return "Unknown";
+}
+
+VertexStreamLayout vertexStreamLayout(VertexFormat format) {
+  switch (format) {
+  case VertexFormat::Float:
+    return {
+        .positionStride = offsetof(Vertex, normal),
+        .attributeStride = sizeof(Vertex) - offsetof(Vertex, normal),
+        .normalOffset = 0,
+        .texCoordOffset = offsetof(Vertex, texCoord) - offsetof(Vertex, normal),
+    };
+  case VertexFormat::Packed:
+    return {
+        .positionStride = offsetof(PackedVertex, normal),
+        .attributeStride =
+            sizeof(PackedVertex) - offsetof(PackedVertex, normal),
+        .normalOffset = 0,
+        .texCoordOffset =
+            offsetof(PackedVertex, texCoord) - offsetof(PackedVertex, normal),
+    };
+  }
+  assert(false);
+  return {};
+}
+
+void copyVertexStream(const void *vertices, size_t count, size_t stride,
+                      size_t offset, size_t size, uint8_t *dst) {
+  const auto *src = static_cast<const uint8_t *>(vertices) + offset;
+  for (size_t i = 0; i < count; ++i) {
+    std::memcpy(dst + i * size, src + i * stride, size);
+  }
+}
+
+glm::vec2 encodeOctahedral(const glm::vec3 &normal) {
+  const float sum =
+      std::abs(normal.x) + std::abs(normal.y) + std::abs(normal.z);
+  if (sum == 0.f) {
+    // 長さ 0 の法線は +Z にしておく
+    return glm::vec2(0.f);
+  }
+  const glm::vec3 n = normal / sum;
+  if (n.z >= 0.f) {
+    return glm::vec2(n.x, n.y);
+  }
+  // 下半分は折り返して外側の三角形に置く
+  return glm::vec2((1.f - std::abs(n.y)) * signNotZero(n.x),
+                   (1.f - std::abs(n.x)) * signNotZero(n.y));
+}
+
+glm::vec3 decodeOctahedral(const glm::vec2 &encoded) {
+  glm::vec3 n(encoded.x, encoded.y,
+              1.f - std::abs(encoded.x) - std::abs(encoded.y));
+  const float t = std::max(-n.z, 0.f);
+  n.x += n.x >= 0.f ? -t : t;
+  n.y += n.y >= 0.f ? -t : t;
+  return glm::normalize(n);
+}
+
+QuantizedVertices quantizeVertices(const std::vector<Vertex> &vertices) {
+  QuantizedVertices result;
+  if (vertices.empty()) {
+    return result;
+  }
+
+  glm::vec3 minPosition = vertices[0].position;
+  glm::vec3 maxPosition = vertices[0].position;
+  glm::vec2 minTexCoord = vertices[0].texCoord;
+  glm::vec2 maxTexCoord = vertices[0].texCoord;
+  for (const auto &v : vertices) {
+    minPosition = glm::min(minPosition, v.position);
+    maxPosition = glm::max(maxPosition, v.position);
+    minTexCoord = glm::min(minTexCoord, v.texCoord);
+    maxTexCoord = glm::max(maxTexCoord, v.texCoord);
+  }
+  auto &dq = result.dequantization;
+  dq.positionScale = (maxPosition - minPosition) * 0.5f;
+  dq.positionOffset = (maxPosition + minPosition) * 0.5f;
+  const glm::vec2 texCoordRange = maxTexCoord - minTexCoord;
+  dq.texCoordTransform =
+      glm::vec4(texCoordRange.x, texCoordRange.y, minTexCoord.x, minTexCoord.y);
+
+  // 大きさ 0 の軸（平面の厚みなど）は、どの値も 0 にする
+  const auto inverse = [](float scale) {
+    return scale > 0.f ? 1.f / scale : 0.f;
+  };
+  const glm::vec3 positionInverse(inverse(dq.positionScale.x),
+                                  inverse(dq.positionScale.y),
+                                  inverse(dq.positionScale.z));
+  const glm::vec2 texCoordInverse(inverse(texCoordRange.x),
+                                  inverse(texCoordRange.y));
+
+  result.vertices.resize(vertices.size());
+  auto &error = result.error;
+  for (size_t i = 0; i < vertices.size(); ++i) {
+    const auto &v = vertices[i];
+    auto &packed = result.vertices[i];
+    const glm::vec3 p = (v.position - dq.positionOffset) * positionInverse;
+    packed.position[0] = toSnorm16(p.x);
+    packed.position[1] = toSnorm16(p.y);
+    packed.position[2] = toSnorm16(p.z);
+    packed.position[3] = 0;
+    encodeNormal(v.normal, packed.normal);
+    const glm::vec2 t = (v.texCoord - minTexCoord) * texCoordInverse;
+    packed.texCoord[0] = toUnorm16(t.x);
+    packed.texCoord[1] = toUnorm16(t.y);
+
+    const Vertex decoded = dequantizeVertex(packed, dq);
+    error.position = std::max(error.position,
+                              glm::length(decoded.position - v.position));
+    // 小さな角度は acos より atan2 のほうが float で正確
+    const float angle =
+        std::atan2(glm::length(glm::cross(decoded.normal, v.normal)),
+                   glm::dot(decoded.normal, v.normal));
+    if (glm::length(v.normal) > 0.f) {
+      error.normalDegrees = std::max(error.normalDegrees, glm::degrees(angle));
+    }
+    const glm::vec2 texCoordError = glm::abs(decoded.texCoord - v.texCoord);
+    error.texCoord = std::max(
+        {error.texCoord, texCoordError.x, texCoordError.y});
+  }
+  return result;
+}
+
+Vertex dequantizeVertex(const PackedVertex &vertex,
+                        const VertexDequantization &dequantization) {
+  const glm::vec3 p(fromSnorm16(vertex.position[0]),
+                    fromSnorm16(vertex.position[1]),
+                    fromSnorm16(vertex.position[2]));
+  const glm::vec2 n(fromSnorm16(vertex.normal[0]),
+                    fromSnorm16(vertex.normal[1]));
+  const glm::vec2 t(fromUnorm16(vertex.texCoord[0]),
+                    fromUnorm16(vertex.texCoord[1]));
+  const auto &transform = dequantization.texCoordTransform;
+  return {
+      .position =
+          p * dequantization.positionScale + dequantization.positionOffset,
+      .normal = decodeOctahedral(n),
+      .texCoord = t * glm::vec2(transform.x, transform.y) +
+                  glm::vec2(transform.z, transform.w),
+  };
+}
+
+} // namespace b3
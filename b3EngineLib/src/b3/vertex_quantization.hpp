@@ -0,0 +1,94 @@
+#ifndef __VERTEX_QUANTIZATION_HPP__
+#define __VERTEX_QUANTIZATION_HPP__
+
+#include "common.hpp"
+#include "types.hpp"
+
+#include <vector>
+
+namespace b3 {
+
+// GPU に置く頂点の形式
+enum class VertexFormat {
+  // Vertex そのまま（float32、1 頂点 32 バイト）
+  Float,
+  // PackedVertex（16 bit に量子化、1 頂点 16 バイト）
+  Packed,
+};
+
+const char *toString(VertexFormat format);
+
+// 量子化した頂点。
+//
+// - position: メッシュの AABB の中心と半分の大きさで [-1, 1] にした snorm16。
+//   4 成分目は 8 バイトに揃えるための詰め物（0）
+// - normal: 八面体（octahedral）で 2 成分にした snorm16
+// - texCoord: メッシュの UV の範囲で [0, 1] にした unorm16
+//
+// 位置と UV は VertexDequantization で元の値に戻す。
+struct PackedVertex {
+  int16_t position[4];
+  int16_t normal[2];
+  uint16_t texCoord[2];
+};
+static_assert(sizeof(PackedVertex) == 16, "PackedVertex must be 16 bytes");
+
+// 量子化した値から元の値に戻す変換（メッシュごと）。
+// Float の頂点では何もしない変換になる。
+struct VertexDequantization {
+  // position = q * positionScale + positionOffset
+  glm::vec3 positionScale{1.f};
+  glm::vec3 positionOffset{0.f};
+  // texCoord = q * texCoordTransform.xy + texCoordTransform.zw
+  glm::vec4 texCoordTransform{1.f, 1.f, 0.f, 0.f};
+};
+
+// 量子化の誤差（全頂点での最大値）
+struct QuantizationError {
+  // 位置の距離（メッシュの座標系）
+  float position = 0.f;
+  // 法線の角度（度）
+  float normalDegrees = 0.f;
+  // UV の成分ごとの差
+  float texCoord = 0.f;
+};
+
+struct QuantizedVertices {
+  std::vector<PackedVertex> vertices;
+  VertexDequantization dequantization;
+  QuantizationError error;
+};
+
+// GPU では頂点を、位置だけのストリームと法線と UV のストリームに分けて
+// 置く（影のパスは位置のストリームだけを読む）。どちらの形式も、
+// インターリーブした頂点の先頭が位置で、残りが法線と UV になっている。
+struct VertexStreamLayout {
+  // 位置のストリームの 1 頂点のバイト数
+  uint32_t positionStride;
+  // 法線と UV のストリームの 1 頂点のバイト数と、その中での位置
+  uint32_t attributeStride;
+  uint32_t normalOffset;
+  uint32_t texCoordOffset;
+};
+
+VertexStreamLayout vertexStreamLayout(VertexFormat format);
+
+// インターリーブした count 個の頂点（1 頂点 stride バイト）から、それぞれ
+// offset から size バイトを取り出して dst に詰める
+void copyVertexStream(const void *vertices, size_t count, size_t stride,
+                      size_t offset, size_t size, uint8_t *dst);
+
+// 単位ベクトルを八面体に投影して [-1, 1]^2 に写す（と、その逆）
+glm::vec2 encodeOctahedral(const glm::vec3 &normal);
+glm::vec3 decodeOctahedral(const glm::vec2 &encoded);
+
+// 頂点を PackedVertex にし、戻す変換と誤差を返す
+QuantizedVertices quantizeVertices(const std::vector<Vertex> &vertices);
+
+// quantizeVertices() の逆（scene.vert と同じ計算。誤差の確認用）
+Vertex dequantizeVertex(const PackedVertex &vertex,
+                        const VertexDequantization &dequantization);
+
+} // namespace b3
+
+#endif
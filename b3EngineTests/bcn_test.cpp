@@ -0,0 +1,464 @@
+#include "doctest.h"
+
+#include "b3/bcn.hpp"
+#include "b3/job_system.hpp"
+#include "b3/texture_format.hpp"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <random>
+#include <string>
+
+using namespace b3;
+
+namespace {
+
+// なめらかなグラデーションに少しノイズを乗せた画像
+std::vector<uint8_t> makeImage(uint32_t width, uint32_t height) {
+  std::mt19937 rng(7);
+  std::uniform_int_distribution<int> noise(-6, 6);
+  std::vector<uint8_t> pixels(size_t(width) * height * 4);
+  for (uint32_t y = 0; y < height; ++y) {
+    for (uint32_t x = 0; x < width; ++x) {
+      uint8_t *p = &pixels[(size_t(y) * width + x) * 4];
+      const int r = int(255.0 * x / width);
+      const int g = int(127.5 + 127.0 * std::sin(y * 0.05));
+      const int b = int(255.0 * (x + y) / (width + height));
+      p[0] = static_cast<uint8_t>(std::clamp(r + noise(rng), 0, 255));
+      p[1] = static_cast<uint8_t>(std::clamp(g + noise(rng), 0, 255));
+      p[2] = static_cast<uint8_t>(std::clamp(b + noise(rng), 0, 255));
+      p[3] = static_cast<uint8_t>((x * 7 + y * 3) & 0xff);
+    }
+  }
+  return pixels;
+}
+
+// チャンネルごとの二乗平均平方根誤差
+double rmse(const std::vector<uint8_t> &a, const std::vector<uint8_t> &b,
+            int channel) {
+  double sum = 0.0;
+  for (size_t i = channel; i < a.size(); i += 4) {
+    const double d = double(a[i]) - double(b[i]);
+    sum += d * d;
+  }
+  return std::sqrt(sum / (a.size() / 4));
+}
+
+
+// BC7 のモードごとの欄の幅（仕様の表をそのまま書いたもの）
+struct Bc7Layout {
+  uint32_t subsets, partition, rotation, selection, color, alpha, endpointP,
+      sharedP, index, index2;
+};
+constexpr Bc7Layout BC7_LAYOUTS[8] = {
+    {3, 4, 0, 0, 4, 0, 1, 0, 3, 0}, {2, 6, 0, 0, 6, 0, 0, 1, 3, 0},
+    {3, 6, 0, 0, 5, 0, 0, 0, 2, 0}, {2, 6, 0, 0, 7, 0, 1, 0, 2, 0},
+    {1, 0, 2, 1, 5, 6, 0, 0, 2, 3}, {1, 0, 2, 0, 7, 8, 0, 0, 2, 2},
+    {1, 0, 0, 0, 7, 7, 1, 0, 4, 0}, {2, 6, 0, 0, 5, 5, 1, 0, 2, 0},
+};
+
+// ブロックに下位から順にビットを詰める
+struct BitPacker {
+  std::vector<uint8_t> block = std::vector<uint8_t>(16, 0);
+  uint32_t bit = 0;
+  void put(uint32_t value, uint32_t count) {
+    for (uint32_t i = 0; i < count; ++i, ++bit) {
+      block[bit / 8] |= static_cast<uint8_t>(((value >> i) & 1) << (bit % 8));
+    }
+  }
+};
+
+// bits ビットの端点を 8 bit に広げる
+int expandBc7(uint32_t value, uint32_t bits) {
+  value <<= 8 - bits;
+  return static_cast<int>(value | (value >> bits));
+}
+
+// モード、分け方、回転、インデックス選択と、端点（サブセット s の
+// 端点 e の値を endpoint(s, e, channel) で決める）、P ビットを書く
+template <typename Endpoint>
+BitPacker packBc7Header(uint32_t modeIndex, uint32_t partition,
+                        uint32_t rotation, Endpoint endpoint,
+                        uint32_t pbit0, uint32_t pbit1) {
+  const auto &mode = BC7_LAYOUTS[modeIndex];
+  BitPacker packer;
+  packer.put(1u << modeIndex, modeIndex + 1);
+  packer.put(partition, mode.partition);
+  packer.put(rotation, mode.rotation);
+  packer.put(0, mode.selection);
+  for (uint32_t c = 0; c < (mode.alpha != 0 ? 4u : 3u); ++c) {
+    for (uint32_t s = 0; s < mode.subsets; ++s) {
+      for (uint32_t e = 0; e < 2; ++e) {
+        packer.put(endpoint(s, e, c), c < 3 ? mode.color : mode.alpha);
+      }
+    }
+  }
+  for (uint32_t s = 0; s < mode.subsets; ++s) {
+    if (mode.endpointP != 0) {
+      packer.put(pbit0, 1);
+      packer.put(pbit1, 1);
+    } else if (mode.sharedP != 0) {
+      packer.put(pbit0, 1);
+    }
+  }
+  return packer;
+}
+
+// P ビットを含めて 8 bit に広げた端点の値
+int bc7Endpoint(const Bc7Layout &mode, uint32_t value, uint32_t pbit,
+                uint32_t bits) {
+  if (mode.endpointP != 0 || mode.sharedP != 0) {
+    return expandBc7(value << 1 | pbit, bits + 1);
+  }
+  return expandBc7(value, bits);
+}
+} // namespace
+
+TEST_CASE("block compressed sizes") {
+  CHECK(levelSize(TextureFormat::RGBA8, 5, 3) == 5 * 3 * 4);
+  CHECK(levelSize(TextureFormat::BC1, 4, 4) == 8);
+  CHECK(levelSize(TextureFormat::BC1, 5, 3) == 2 * 1 * 8);
+  CHECK(levelSize(TextureFormat::BC3, 1, 1) == 16);
+  CHECK(levelSize(TextureFormat::BC7, 256, 256) == 64 * 64 * 16);
+  CHECK(levelSize(TextureFormat::R8, 5, 3) == 5 * 3);
+  CHECK(levelSize(TextureFormat::RG8, 5, 3) == 5 * 3 * 2);
+  CHECK(levelSize(TextureFormat::R16, 5, 3) == 5 * 3 * 2);
+  CHECK(levelSize(TextureFormat::RG16, 5, 3) == 5 * 3 * 4);
+  CHECK(channelCount(TextureFormat::RG16) == 2);
+  CHECK(channelCount(TextureFormat::BC5) == 0);
+  CHECK_FALSE(isBlockCompressed(TextureFormat::R8));
+
+  const auto levels = mipChainLayout(TextureFormat::BC1, 16, 8, 5);
+  REQUIRE(levels.size() == 5);
+  CHECK(levels[1].offset == 4 * 2 * 8);
+  CHECK(levels[4].width == 1);
+  CHECK(levels[4].size == 8);
+  // RGBA8 の全レベルは mipmap.hpp の配置と同じ
+  const auto rgba = mipChainLayout(TextureFormat::RGBA8, 13, 6,
+                                   mipLevelCount(13, 6));
+  const auto expected = mipChainLayout(13, 6);
+  REQUIRE(rgba.size() == expected.size());
+  CHECK(rgba.back().offset == expected.back().offset);
+}
+
+TEST_CASE("BCn round trips within a small error") {
+  const uint32_t width = 66;
+  const uint32_t height = 35;
+  const auto pixels = makeImage(width, height);
+
+  const auto bc1 = decompressBlocks(
+      compressBlocks(pixels.data(), width, height, TextureFormat::BC1).data(),
+      width, height, TextureFormat::BC1);
+  for (int c = 0; c < 3; ++c) {
+    CHECK(rmse(pixels, bc1, c) < 6.0);
+  }
+
+  const auto bc3 = decompressBlocks(
+      compressBlocks(pixels.data(), width, height, TextureFormat::BC3).data(),
+      width, height, TextureFormat::BC3);
+  CHECK(rmse(pixels, bc3, 0) < 6.0);
+  CHECK(rmse(pixels, bc3, 3) < 3.0);
+
+  const auto bc5 = decompressBlocks(
+      compressBlocks(pixels.data(), width, height, TextureFormat::BC5).data(),
+      width, height, TextureFormat::BC5);
+  CHECK(rmse(pixels, bc5, 0) < 2.0);
+  CHECK(rmse(pixels, bc5, 1) < 2.0);
+  CHECK(bc5[2] == 0);
+  CHECK(bc5[3] == 255);
+
+  // 単色のブロックは正確に戻る（565 で表せる色）
+  std::vector<uint8_t> flat(4 * 4 * 4);
+  for (size_t i = 0; i < flat.size(); i += 4) {
+    flat[i + 0] = 255;
+    flat[i + 1] = 0;
+    flat[i + 2] = 132;
+    flat[i + 3] = 77;
+  }
+  const auto flatBc3 = decompressBlocks(
+      compressBlocks(flat.data(), 4, 4, TextureFormat::BC3).data(), 4, 4,
+      TextureFormat::BC3);
+  CHECK(flatBc3 == flat);
+
+  const auto bc7 = decompressBlocks(
+      compressBlocks(pixels.data(), width, height, TextureFormat::BC7).data(),
+      width, height, TextureFormat::BC7);
+  for (int c = 0; c < 3; ++c) {
+    CHECK(rmse(pixels, bc7, c) < 6.0);
+  }
+  CHECK(rmse(pixels, bc7, 3) < 3.0);
+  // 単色は P ビットで偶数・奇数を選べるので、ほぼそのまま戻る
+  const auto flatBc7 = decompressBlocks(
+      compressBlocks(flat.data(), 4, 4, TextureFormat::BC7).data(), 4, 4,
+      TextureFormat::BC7);
+  for (size_t i = 0; i < flat.size(); ++i) {
+    REQUIRE(std::abs(flatBc7[i] - flat[i]) <= 1);
+  }
+
+  CHECK_THROWS_AS(compressBlocks(pixels.data(), width, height,
+                                 TextureFormat::RGBA8),
+                  std::invalid_argument);
+}
+
+TEST_CASE("BC7 decodes the partitions of every mode") {
+  // 仕様の表から抜き出した分け方（2 サブセットの 0, 13、3 サブセットの 0, 8）
+  const std::vector<std::pair<uint32_t, std::array<uint8_t, 16>>> two = {
+      {0, {0, 0, 1, 1, 0, 0, 1, 1, 0, 0, 1, 1, 0, 0, 1, 1}},
+      {13, {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1}}};
+  const std::vector<std::pair<uint32_t, std::array<uint8_t, 16>>> three = {
+      {0, {0, 0, 1, 1, 0, 0, 1, 1, 0, 2, 2, 1, 2, 2, 2, 2}},
+      {8, {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2}}};
+  const std::vector<std::pair<uint32_t, std::array<uint8_t, 16>>> one = {
+      {0, {}}};
+  std::mt19937 rng(5);
+  for (uint32_t modeIndex = 0; modeIndex < 8; ++modeIndex) {
+    CAPTURE(modeIndex);
+    const auto &mode = BC7_LAYOUTS[modeIndex];
+    const auto &partitions =
+        mode.subsets == 3 ? three : mode.subsets == 2 ? two : one;
+    for (const auto &[partition, subsets] : partitions) {
+      CAPTURE(partition);
+      // サブセットごとに違う単色（2 端点が同じ値なのでインデックスに
+      // よらない）
+      const auto value = [&](uint32_t s, uint32_t c) {
+        const uint32_t bits = c < 3 ? mode.color : mode.alpha;
+        return (s + c) % 3 == 0 ? (1u << bits) - 1 : (s + 1) * 3 + c;
+      };
+      auto packer = packBc7Header(
+          modeIndex, partition, 0,
+          [&](uint32_t s, uint32_t, uint32_t c) { return value(s, c); }, 1,
+          1);
+      // インデックスは何でもよい
+      while (packer.bit < 128) {
+        packer.put(rng() & 1, 1);
+      }
+      const auto rgba =
+          decompressBlocks(packer.block.data(), 4, 4, TextureFormat::BC7);
+      for (uint32_t i = 0; i < 16; ++i) {
+        CAPTURE(i);
+        for (uint32_t c = 0; c < 4; ++c) {
+          const int expected =
+              c == 3 && mode.alpha == 0
+                  ? 255
+                  : bc7Endpoint(mode, value(subsets[i], c), 1,
+                                c < 3 ? mode.color : mode.alpha);
+          REQUIRE(rgba[i * 4 + c] == expected);
+        }
+      }
+    }
+  }
+}
+
+TEST_CASE("BC7 anchor pixels drop the top index bit") {
+  constexpr int weights2[] = {0, 21, 43, 64};
+  constexpr int weights3[] = {0, 9, 18, 27, 37, 46, 55, 64};
+  constexpr int weights4[] = {0,  4,  9,  13, 17, 21, 26, 30,
+                              34, 38, 43, 47, 51, 55, 60, 64};
+  const auto weight = [&](uint32_t bits, uint32_t index) {
+    return bits == 2 ? weights2[index]
+                     : bits == 3 ? weights3[index] : weights4[index];
+  };
+  for (uint32_t modeIndex = 0; modeIndex < 8; ++modeIndex) {
+    CAPTURE(modeIndex);
+    const auto &mode = BC7_LAYOUTS[modeIndex];
+    // 分け方 0 のアンカー画素
+    const std::vector<uint32_t> anchors =
+        mode.subsets == 3   ? std::vector<uint32_t>{0, 3, 15}
+        : mode.subsets == 2 ? std::vector<uint32_t>{0, 15}
+                            : std::vector<uint32_t>{0};
+    // 端点 0 は 0、端点 1 は最大値。アンカー画素は省略できる中で最大の、
+    // それ以外は最大のインデックスにする。
+    auto packer = packBc7Header(
+        modeIndex, 0, 0,
+        [&](uint32_t, uint32_t e, uint32_t c) {
+          return e == 0 ? 0u
+                        : (1u << (c < 3 ? mode.color : mode.alpha)) - 1;
+        },
+        0, 1);
+    const auto isAnchor = [&](uint32_t i) {
+      return std::ranges::find(anchors, i) != anchors.end();
+    };
+    for (uint32_t i = 0; i < 16; ++i) {
+      const uint32_t bits = mode.index - (isAnchor(i) ? 1 : 0);
+      packer.put((1u << bits) - 1, bits);
+    }
+    for (uint32_t i = 0; mode.index2 != 0 && i < 16; ++i) {
+      const uint32_t bits = mode.index2 - (i == 0 ? 1 : 0);
+      packer.put((1u << bits) - 1, bits);
+    }
+    REQUIRE(packer.bit == 128);
+
+    const auto rgba =
+        decompressBlocks(packer.block.data(), 4, 4, TextureFormat::BC7);
+    for (uint32_t i = 0; i < 16; ++i) {
+      CAPTURE(i);
+      for (uint32_t c = 0; c < 4; ++c) {
+        if (c == 3 && mode.alpha == 0) {
+          REQUIRE(rgba[i * 4 + c] == 255);
+          continue;
+        }
+        const uint32_t channelBits = c < 3 ? mode.color : mode.alpha;
+        const int e0 = bc7Endpoint(mode, 0, 0, channelBits);
+        const int e1 = bc7Endpoint(mode, (1u << channelBits) - 1,
+                                   mode.sharedP != 0 ? 0 : 1, channelBits);
+        // モード 4, 5 のアルファは 2 つ目のインデックスを使う
+        const uint32_t indexBits =
+            c == 3 && mode.index2 != 0 ? mode.index2 : mode.index;
+        const bool anchor = c == 3 && mode.index2 != 0 ? i == 0 : isAnchor(i);
+        const uint32_t index =
+            anchor ? (1u << (indexBits - 1)) - 1 : (1u << indexBits) - 1;
+        const int w = weight(indexBits, index);
+        REQUIRE(rgba[i * 4 + c] == ((64 - w) * e0 + w * e1 + 32) >> 6);
+      }
+    }
+  }
+}
+
+TEST_CASE("BC7 rotation swaps alpha back and reserved blocks are black") {
+  // モード 5、回転 1（R とアルファを入れ替えて符号化したもの）
+  auto packer = packBc7Header(
+      5, 0, 1,
+      [](uint32_t, uint32_t, uint32_t c) { return c == 3 ? 255u : 0u; }, 0,
+      0);
+  while (packer.bit < 128) {
+    packer.put(0, 1);
+  }
+  const auto rgba =
+      decompressBlocks(packer.block.data(), 4, 4, TextureFormat::BC7);
+  CHECK(rgba[0] == 255);
+  CHECK(rgba[1] == 0);
+  CHECK(rgba[3] == 0);
+
+  const std::vector<uint8_t> reserved(16, 0);
+  const auto black =
+      decompressBlocks(reserved.data(), 4, 4, TextureFormat::BC7);
+  CHECK(std::ranges::all_of(black, [](uint8_t v) { return v == 0; }));
+}
+
+TEST_CASE("BCn encoder gives the same blocks with SIMD and threads") {
+  const uint32_t width = 128;
+  const uint32_t height = 100;
+  const auto pixels = makeImage(width, height);
+  JobSystem jobs(4);
+  for (const auto format :
+       {TextureFormat::BC1, TextureFormat::BC3, TextureFormat::BC5,
+        TextureFormat::BC7}) {
+    CAPTURE(std::string(toString(format)));
+    const auto scalar = compressBlocks(pixels.data(), width, height, format,
+                                       nullptr, SimdLevel::Scalar);
+    CHECK(compressBlocks(pixels.data(), width, height, format, nullptr,
+                         detectSimdLevel()) == scalar);
+    CHECK(compressBlocks(pixels.data(), width, height, format, &jobs,
+                         detectSimdLevel()) == scalar);
+  }
+}
+
+TEST_CASE("DDS and KTX2 containers") {
+  const uint32_t width = 12;
+  const uint32_t height = 8;
+  const auto pixels = makeImage(width, height);
+  const auto chain = generateMipChain(pixels.data(), width, height,
+                                      MipFilter::Box, true);
+  const auto image = compressMipChain(chain.data(), width, height,
+                                      mipLevelCount(width, height),
+                                      TextureFormat::BC1, true);
+  CHECK(image.levelCount == 4);
+  CHECK(image.data.size() == 3 * 2 * 8 + 2 * 1 * 8 + 8 + 8);
+
+  const auto dds = loadDds(saveDds(image));
+  CHECK(std::string(toString(dds.format)) == "BC1");
+  CHECK(dds.sRGB);
+  CHECK(dds.width == width);
+  CHECK(dds.height == height);
+  CHECK(dds.levelCount == image.levelCount);
+  CHECK(dds.data == image.data);
+
+  // レベルを小さい方から並べた KTX2（BC1_RGB_SRGB、DFD は空）
+  const auto levels =
+      mipChainLayout(TextureFormat::BC1, width, height, image.levelCount);
+  std::vector<uint8_t> ktx2 = {0xab, 'K',  'T',  'X', ' ',  '2',
+                               '0',  0xbb, '\r', '\n', 0x1a, '\n'};
+  const auto put32 = [&](uint32_t v) {
+    for (int i = 0; i < 4; ++i) {
+      ktx2.push_back(static_cast<uint8_t>(v >> (i * 8)));
+    }
+  };
+  const auto put64 = [&](uint64_t v) {
+    put32(static_cast<uint32_t>(v));
+    put32(static_cast<uint32_t>(v >> 32));
+  };
+  for (uint32_t v : {132u, 1u, width, height, 0u, 0u, 1u, image.levelCount,
+                     0u, 0u, 0u, 0u, 0u}) {
+    put32(v);
+  }
+  put64(0);
+  put64(0);
+  const size_t dataStart = ktx2.size() + levels.size() * 24;
+  size_t offset = dataStart + image.data.size();
+  for (const auto &level : levels) {
+    offset -= level.size;
+    put64(offset);
+    put64(level.size);
+    put64(level.size);
+  }
+  for (size_t i = levels.size(); i-- > 0;) {
+    ktx2.insert(ktx2.end(), image.data.begin() + levels[i].offset,
+                image.data.begin() + levels[i].offset + levels[i].size);
+  }
+  const auto loaded = loadKtx2(ktx2);
+  CHECK(std::string(toString(loaded.format)) == "BC1");
+  CHECK(loaded.sRGB);
+  CHECK(loaded.levelCount == image.levelCount);
+  CHECK(loaded.data == image.data);
+
+  // オフセットと長さを足すとあふれるレベルは、範囲外として弾く
+  auto wrapped = ktx2;
+  const uint64_t wrappedOffset = UINT64_MAX - 7;
+  std::memcpy(&wrapped[80], &wrappedOffset, sizeof(wrappedOffset));
+  CHECK_THROWS_AS(loadKtx2(wrapped), std::runtime_error);
+  auto truncated = saveDds(image);
+  truncated.pop_back();
+  CHECK_THROWS_AS(loadDds(truncated), std::runtime_error);
+
+  ktx2[12] = 200;
+  CHECK_THROWS_AS(loadKtx2(ktx2), std::runtime_error);
+  CHECK_THROWS_AS(loadDds(ktx2), std::runtime_error);
+}
+
+TEST_CASE("benchmark BCn encoder" * doctest::skip()) {
+  const uint32_t size = 2048;
+  const auto pixels = makeImage(size, size);
+  const double megaPixels = double(size) * size / 1e6;
+  JobSystem jobs;
+  for (const auto format :
+       {TextureFormat::BC1, TextureFormat::BC3, TextureFormat::BC5,
+        TextureFormat::BC7}) {
+    const auto run = [&](JobSystem *j, SimdLevel level) {
+      const auto start = std::chrono::high_resolution_clock::now();
+      const auto blocks =
+          compressBlocks(pixels.data(), size, size, format, j, level);
+      const double ms = std::chrono::duration<double, std::milli>(
+                            std::chrono::high_resolution_clock::now() - start)
+                            .count();
+      const auto decoded =
+          decompressBlocks(blocks.data(), size, size, format);
+      const uint32_t threads = j ? j->threadCount() : 1;
+      MESSAGE(std::string(toString(format))
+              << " " << std::string(toString(level)) << " x" << threads
+              << ": " << ms << " ms (" << megaPixels / (ms / 1000.0)
+              << " MPix/s), RMSE R " << rmse(pixels, decoded, 0));
+    };
+    run(nullptr, SimdLevel::Scalar);
+    run(nullptr, detectSimdLevel());
+    run(&jobs, detectSimdLevel());
+    const double rgbaMiB = levelSize(TextureFormat::RGBA8, size, size) /
+                           (1024.0 * 1024.0);
+    const double blockMiB = levelSize(format, size, size) / (1024.0 * 1024.0);
+    MESSAGE(std::string(toString(format))
+            << " memory: " << blockMiB << " MiB vs RGBA8 " << rgbaMiB
+            << " MiB (" << rgbaMiB / blockMiB << "x)");
+  }
+}
@@ -0,0 +1,203 @@
+#include "doctest.h"
+
+#include "b3/bvh.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+
+using namespace b3;
+
+static FrustumPlanes testPlanes(float fovDegrees = 60.0f) {
+  auto proj =
+      glm::perspective(glm::radians(fovDegrees), 4.0f / 3.0f, 0.1f, 50.0f);
+  auto view = glm::lookAt(glm::vec3(0.f, 2.f, 10.f), glm::vec3(0.f),
+                          glm::vec3(0.f, 1.f, 0.f));
+  return toPlanes(extractFrustum(proj * view));
+}
+
+static BoundingSphereArray randomSpheres(size_t count, uint32_t seed,
+                                         float range = 60.f) {
+  std::mt19937 rng(seed);
+  std::uniform_real_distribution<float> pos(-range, range);
+  std::uniform_real_distribution<float> radius(0.f, 1.f);
+  BoundingSphereArray spheres;
+  spheres.resize(count);
+  for (size_t i = 0; i < count; ++i) {
+    spheres.set(i, {{pos(rng), pos(rng), pos(rng)}, radius(rng)});
+  }
+  return spheres;
+}
+
+static std::vector<uint32_t> cullSorted(const Bvh &bvh,
+                                        const FrustumPlanes &planes) {
+  std::vector<uint32_t> visible;
+  bvh.cullFrustum(planes, visible);
+  std::ranges::sort(visible);
+  return visible;
+}
+
+TEST_CASE("bvh culling matches linear culling") {
+  const auto planes = testPlanes();
+  const auto spheres = randomSpheres(5000, 3);
+
+  Bvh bvh;
+  bvh.build(spheres);
+  CHECK(bvh.size() == spheres.size());
+
+  std::vector<uint32_t> expected;
+  cullSpheres(planes, spheres, expected, SimdLevel::Scalar);
+  REQUIRE_FALSE(expected.empty());
+  CHECK(cullSorted(bvh, planes) == expected);
+}
+
+TEST_CASE("bvh refit follows moving spheres") {
+  const auto planes = testPlanes();
+  auto spheres = randomSpheres(2000, 5);
+  Bvh bvh;
+  bvh.build(spheres);
+
+  // 全体を少しずつ動かして refit する
+  for (int frame = 0; frame < 10; ++frame) {
+    for (size_t i = 0; i < spheres.size(); ++i) {
+      spheres.cx[i] += (i % 3 == 0 ? 0.5f : -0.25f);
+      spheres.cz[i] += (i % 5 == 0 ? -1.0f : 0.1f);
+    }
+    bvh.refit(spheres);
+    std::vector<uint32_t> expected;
+    cullSpheres(planes, spheres, expected, SimdLevel::Scalar);
+    CHECK(cullSorted(bvh, planes) == expected);
+  }
+  CHECK(bvh.stats().builds == 1);
+  CHECK(bvh.stats().refits == 10);
+}
+
+TEST_CASE("bvh update refits only moved spheres") {
+  const auto planes = testPlanes();
+  auto spheres = randomSpheres(3000, 7);
+  Bvh bvh;
+  bvh.update(spheres);
+  CHECK(bvh.stats().builds == 1);
+
+  // 何も動いていなければ何もしない
+  bvh.update(spheres);
+  CHECK(bvh.lastMovedCount() == 0);
+  CHECK(bvh.stats().refits == 0);
+
+  // 一部だけ動かす
+  for (size_t i = 0; i < spheres.size(); i += 100) {
+    spheres.cx[i] = -spheres.cx[i];
+    spheres.radius[i] += 0.5f;
+  }
+  bvh.update(spheres);
+  CHECK(bvh.lastMovedCount() == 30);
+  CHECK(bvh.stats().refits == 1);
+  std::vector<uint32_t> expected;
+  cullSpheres(planes, spheres, expected, SimdLevel::Scalar);
+  CHECK(cullSorted(bvh, planes) == expected);
+}
+
+TEST_CASE("bvh update rebuilds when quality degrades or size changes") {
+  auto spheres = randomSpheres(1000, 9, 10.f);
+  Bvh bvh;
+  bvh.update(spheres);
+  CHECK(bvh.stats().builds == 1);
+
+  // 要素を入れ替えるように大きく動かすと木の品質が落ちる
+  bvh.update(randomSpheres(1000, 10, 10.f));
+  CHECK(bvh.stats().builds == 2);
+
+  // 要素数が変われば作り直す
+  spheres = randomSpheres(1001, 11, 10.f);
+  bvh.update(spheres);
+  CHECK(bvh.stats().builds == 3);
+  CHECK(bvh.size() == 1001);
+
+  // refit が一定回数続いても作り直す
+  bvh.setRebuildInterval(3);
+  for (int i = 0; i < 3; ++i) {
+    spheres.cy[0] += 0.01f;
+    bvh.update(spheres);
+  }
+  CHECK(bvh.stats().builds == 4);
+}
+
+TEST_CASE("bvh handles empty and degenerate input") {
+  Bvh bvh;
+  bvh.build(BoundingSphereArray{});
+  std::vector<uint32_t> visible{1};
+  CHECK(bvh.cullFrustum(testPlanes(), visible) == 0);
+  CHECK(visible.empty());
+
+  // すべて同じ位置にある場合も分割できる
+  BoundingSphereArray spheres;
+  spheres.resize(100);
+  for (size_t i = 0; i < spheres.size(); ++i) {
+    spheres.set(i, {{0.f, 0.f, 0.f}, 0.5f});
+  }
+  bvh.build(spheres);
+  CHECK(cullSorted(bvh, testPlanes()).size() == 100);
+}
+
+TEST_CASE("bvh visits few nodes for a narrow frustum") {
+  const auto spheres = randomSpheres(100000, 13, 200.f);
+  Bvh bvh;
+  bvh.build(spheres);
+  std::vector<uint32_t> visible;
+  const auto visited = bvh.cullFrustum(testPlanes(5.0f), visible);
+  // 訪れるノード数は全ノード数よりずっと少ない
+  CHECK(visited * 10 < bvh.nodeCount());
+}
+
+// 時間がかかるので既定ではスキップする（--no-skip で実行）
+TEST_CASE("benchmark bvh culling" * doctest::skip()) {
+  using clock = std::chrono::steady_clock;
+  using us = std::chrono::duration<double, std::micro>;
+  constexpr int iterations = 50;
+  for (size_t count : {10000, 100000}) {
+    const auto spheres = randomSpheres(count, 17, 200.f);
+    for (float fov : {10.0f, 60.0f}) {
+      const auto planes = testPlanes(fov);
+      std::vector<uint32_t> visible;
+
+      auto start = clock::now();
+      for (int n = 0; n < iterations; ++n) {
+        cullSpheres(planes, spheres, visible);
+      }
+      const auto linearUs = us(clock::now() - start).count() / iterations;
+
+      Bvh bvh;
+      start = clock::now();
+      bvh.build(spheres);
+      const auto buildUs = us(clock::now() - start).count();
+      start = clock::now();
+      for (int n = 0; n < iterations; ++n) {
+        bvh.refit(spheres);
+      }
+      const auto refitUs = us(clock::now() - start).count() / iterations;
+      // 1% の要素だけが動いた場合の update()
+      auto moving = spheres;
+      start = clock::now();
+      for (int n = 0; n < iterations; ++n) {
+        for (size_t i = 0; i < count; i += 100) {
+          moving.cx[i] += 0.01f;
+        }
+        bvh.update(moving);
+      }
+      const auto updateUs = us(clock::now() - start).count() / iterations;
+      start = clock::now();
+      size_t visited = 0;
+      for (int n = 0; n < iterations; ++n) {
+        visited = bvh.cullFrustum(planes, visible);
+      }
+      const auto bvhUs = us(clock::now() - start).count() / iterations;
+
+      MESSAGE(count << " spheres, fov " << fov << ": visible "
+                    << visible.size() << ", linear " << linearUs
+                    << " us, bvh cull " << bvhUs << " us (" << visited
+                    << " nodes), build " << buildUs << " us, refit "
+                    << refitUs << " us, update(1% moved) " << updateUs
+                    << " us");
+    }
+  }
+}
@@ -0,0 +1,82 @@
+#include "doctest.h"
+
+#include "b3/draw_batch.hpp"
+
+#include <chrono>
+#include <random>
+
+using namespace b3;
+
+TEST_CASE("DrawBatcher groups nodes by mesh and keeps their order") {
+  // ノード 0..7 のメッシュ
+  const std::vector<uint32_t> meshIds = {2, 0, 2, 1, 0, 2, 3, 0};
+  const std::vector<uint32_t> nodes = {0, 1, 2, 4, 5, 7};
+
+  DrawBatcher batcher;
+  batcher.build(nodes, meshIds, 4);
+
+  // 使われていないメッシュ 1, 3 の描画は作らない
+  const auto &batches = batcher.batches();
+  REQUIRE(batches.size() == 2);
+  CHECK(batches[0].meshId == 0);
+  CHECK(batches[0].firstInstance == 0);
+  CHECK(batches[0].instanceCount == 3);
+  CHECK(batches[1].meshId == 2);
+  CHECK(batches[1].firstInstance == 3);
+  CHECK(batches[1].instanceCount == 3);
+  CHECK(batcher.instanceNodes() == std::vector<uint32_t>{1, 4, 7, 0, 2, 5});
+
+  // firstInstance はインスタンスのバッファ上の位置だけずらす
+  batcher.build(nodes, meshIds, 4, 100);
+  CHECK(batcher.batches()[0].firstInstance == 100);
+  CHECK(batcher.batches()[1].firstInstance == 103);
+  CHECK(batcher.instanceNodes() == std::vector<uint32_t>{1, 4, 7, 0, 2, 5});
+
+  // NO_MESH のノードは描画しない
+  auto pending = meshIds;
+  pending[4] = DrawBatcher::NO_MESH;
+  pending[0] = DrawBatcher::NO_MESH;
+  batcher.build(nodes, pending, 4);
+  REQUIRE(batcher.batches().size() == 2);
+  CHECK(batcher.batches()[0].instanceCount == 2);
+  CHECK(batcher.batches()[1].firstInstance == 2);
+  CHECK(batcher.instanceNodes() == std::vector<uint32_t>{1, 7, 2, 5});
+
+  batcher.build({}, meshIds, 4);
+  CHECK(batcher.batches().empty());
+  CHECK(batcher.instanceNodes().empty());
+}
+
+// 10k インスタンスのシーンで、ノードごとの描画とインスタンス描画の
+// 描画コマンド数を比べる（--no-skip で実行）
+TEST_CASE("benchmark draw batching of 10k instances" * doctest::skip()) {
+  using clock = std::chrono::steady_clock;
+  using ms = std::chrono::duration<double, std::milli>;
+  constexpr uint32_t nodeCount = 10000;
+  constexpr int iterations = 100;
+
+  std::mt19937 rng(11);
+  std::bernoulli_distribution visible(0.6);
+  for (const uint32_t meshCount : {1u, 3u, 16u, 256u}) {
+    std::uniform_int_distribution<uint32_t> mesh(0, meshCount - 1);
+    std::vector<uint32_t> meshIds(nodeCount);
+    std::vector<uint32_t> nodes;
+    for (uint32_t i = 0; i < nodeCount; ++i) {
+      meshIds[i] = mesh(rng);
+      if (visible(rng)) {
+        nodes.push_back(i);
+      }
+    }
+
+    DrawBatcher batcher;
+    const auto start = clock::now();
+    for (int n = 0; n < iterations; ++n) {
+      batcher.build(nodes, meshIds, meshCount);
+    }
+    const auto elapsedMs = ms(clock::now() - start).count() / iterations;
+    CHECK(batcher.instanceNodes().size() == nodes.size());
+    MESSAGE(meshCount << " meshes: draw calls " << nodes.size() << " -> "
+                      << batcher.batches().size() << ", build " << elapsedMs
+                      << " ms");
+  }
+}
@@ -0,0 +1,234 @@
+#include "doctest.h"
+
+#include "b3/b3.hpp"
+
+#include <chrono>
+
+using namespace b3;
+
+TEST_CASE("node buffer capacity grows geometrically") {
+  CHECK(Engine::growNodeCapacity(0, 0) == 64);
+  CHECK(Engine::growNodeCapacity(0, 64) == 64);
+  CHECK(Engine::growNodeCapacity(0, 65) == 128);
+  CHECK(Engine::growNodeCapacity(64, 1000) == 1024);
+  CHECK(Engine::growNodeCapacity(1024, 100000) == 131072);
+  // 既に十分な容量があれば縮めない
+  CHECK(Engine::growNodeCapacity(4096, 10) == 4096);
+}
+
+// GPUとウィンドウが必要なので、既定ではスキップする（--no-skip で実行）
+TEST_CASE("node buffers grow after prepare without idle wait" *
+          doctest::skip()) {
+  Engine engine;
+  auto mesh = mesh::CubeMesh::generate(0.1f, 0.1f, 0.1f, 1, 1);
+  auto texture = std::make_shared<Texture>(
+      RGBAColor{.r = 1.f, .g = 1.f, .b = 1.f, .a = 1.f});
+  engine.addNode(std::make_shared<Node>(mesh, texture));
+  engine.prepare();
+
+  size_t nodeCount = 1;
+  for (size_t target : {1000, 10000, 100000}) {
+    for (; nodeCount < target; ++nodeCount) {
+      auto node = std::make_shared<Node>(mesh, texture);
+      node->setPosition(glm::vec3(0.01f * (nodeCount % 100),
+                                  0.01f * (nodeCount / 100 % 100),
+                                  0.01f * (nodeCount / 10000)));
+      engine.addNode(node);
+    }
+    // 全フレームが一巡すれば、すべてのフレームのバッファが拡張されている
+    for (size_t i = 0; i < engine.frameCount() * 2; ++i) {
+      engine.update();
+    }
+    for (uint32_t i = 0; i < engine.frameCount(); ++i) {
+      CHECK(engine.nodeCapacity(i) >= nodeCount);
+    }
+    MESSAGE(nodeCount << " nodes: UBO fill " << engine.stats().uboFillMs
+                      << " ms, draw calls " << engine.stats().sceneDrawCalls
+                      << " for " << engine.stats().sceneInstances
+                      << " instances");
+  }
+
+  CHECK(engine.stats().nodeBufferGrowths > 0);
+  CHECK(engine.stats().idleWaits == 0);
+  CHECK(engine.stats().uboFills > 0);
+}
+
+// 2,000 メッシュのシーンの prepare() の時間（--no-skip で実行）
+TEST_CASE("prepare uploads many meshes in few submits" * doctest::skip()) {
+  Engine engine;
+  auto texture = std::make_shared<Texture>(
+      RGBAColor{.r = 1.f, .g = 1.f, .b = 1.f, .a = 1.f});
+  constexpr size_t meshCount = 2000;
+  for (size_t i = 0; i < meshCount; ++i) {
+    auto mesh = mesh::SphereMesh::generate(0.1f, 16, 16);
+    auto node = std::make_shared<Node>(mesh, texture);
+    node->setPosition(glm::vec3(0.3f * (i % 50), 0.3f * (i / 50), 0.f));
+    engine.addNode(node);
+  }
+  engine.prepare();
+
+  const auto &stats = engine.stats();
+  const auto &upload = engine.uploadStats();
+  MESSAGE("prepare " << stats.prepareMs << " ms (meshes " << stats.meshUploadMs
+                     << " ms, textures " << stats.textureUploadMs << " ms), "
+                     << upload.copies << " copies in " << upload.submits
+                     << " submits");
+  // 1 メッシュあたり位置、法線と UV、インデックスの 3 回
+  CHECK(upload.copies >= meshCount * 3);
+  CHECK(upload.submits < meshCount);
+
+  // アップロードは待たないので、完了したフレームから描画される
+  size_t frames = 0;
+  for (; frames < 1000 && engine.stats().sceneInstances == 0; ++frames) {
+    engine.update();
+  }
+  MESSAGE("first instances drawn after " << frames << " frames ("
+                                         << engine.uploadStats().acquires
+                                         << " image acquires)");
+  CHECK(engine.stats().idleWaits == 0);
+}
+
+TEST_CASE("nodes can be added and removed after prepare" * doctest::skip()) {
+  Engine engine;
+  auto sharedMesh = mesh::SphereMesh::generate(0.1f, 16, 16);
+  auto sharedTexture = std::make_shared<Texture>(
+      RGBAColor{.r = 1.f, .g = 1.f, .b = 1.f, .a = 1.f});
+  engine.addNode(std::make_shared<Node>(sharedMesh, sharedTexture));
+  engine.prepare();
+  CHECK(engine.meshCount() == 1);
+  CHECK(engine.textureCount() == 1);
+
+  // 毎フレーム、それぞれ別のメッシュとテクスチャを持つノードを入れ替える
+  // （テクスチャは内容が同じなので、1つのスロットにまとまる）
+  std::vector<std::shared_ptr<Node>> streamed;
+  for (int frame = 0; frame < 200; ++frame) {
+    if (streamed.size() >= 16) {
+      engine.removeNode(streamed.front());
+      streamed.erase(streamed.begin());
+    }
+    auto node = std::make_shared<Node>(
+        mesh::SphereMesh::generate(0.1f, 8, 8),
+        std::make_shared<Texture>(
+            RGBAColor{.r = 1.f, .g = 0.f, .b = 0.f, .a = 1.f}));
+    node->setPosition(glm::vec3(0.3f * (frame % 16), 0.f, 0.f));
+    engine.addNode(node);
+    streamed.push_back(node);
+    engine.update();
+  }
+  CHECK(engine.nodeCount() == 17);
+  CHECK(engine.meshCount() == 17);
+  CHECK(engine.textureCount() == 2);
+  CHECK(engine.textureRegistryStats().deduplicated > 0);
+
+  for (const auto &node : streamed) {
+    engine.removeNode(node);
+  }
+  CHECK(engine.nodeCount() == 1);
+  CHECK(engine.meshCount() == 1);
+  CHECK(engine.textureCount() == 1);
+  // 描画中のフレームが終わるまでは破棄しない
+  const auto deferred = engine.stats().deferredDeletions;
+  CHECK(engine.stats().executedDeletions < deferred);
+  for (int frame = 0; frame < 100; ++frame) {
+    engine.update();
+  }
+  MESSAGE(deferred << " deferred deletions, "
+                   << engine.stats().executedDeletions << " executed");
+  CHECK(engine.stats().executedDeletions == deferred);
+  CHECK(engine.stats().idleWaits == 0);
+}
+
+// 共有バッファを拡張している間も、今までのメッシュは描画し続ける
+// （--no-skip で実行）
+TEST_CASE("growing geometry arenas keeps drawing" * doctest::skip()) {
+  Engine engine;
+  auto texture = std::make_shared<Texture>(
+      RGBAColor{.r = 1.f, .g = 1.f, .b = 1.f, .a = 1.f});
+  engine.addNode(std::make_shared<Node>(
+      mesh::SphereMesh::generate(0.1f, 16, 16), texture));
+  engine.prepare();
+  for (int frame = 0; frame < 100 && engine.stats().sceneInstances == 0;
+       ++frame) {
+    engine.update();
+  }
+  REQUIRE(engine.stats().sceneInstances > 0);
+
+  // 初期容量（65536 頂点）を超えるまで、毎フレーム別のメッシュを足す
+  for (int frame = 0; frame < 64; ++frame) {
+    engine.addNode(std::make_shared<Node>(
+        mesh::SphereMesh::generate(0.1f, 64, 32), texture));
+    engine.update();
+    REQUIRE(engine.stats().sceneInstances > 0);
+  }
+  CHECK(engine.stats().idleWaits == 0);
+}
+
+// シャドウのパスが読む頂点のバイト数の見積もり（--no-skip で実行）
+TEST_CASE("shadow pass reads only the position stream" * doctest::skip()) {
+  for (const auto format : {VertexFormat::Float, VertexFormat::Packed}) {
+    Engine engine;
+    engine.setVertexFormat(format);
+    auto mesh = mesh::SphereMesh::generate(0.1f, 32, 32);
+    auto texture = std::make_shared<Texture>(
+        RGBAColor{.r = 1.f, .g = 1.f, .b = 1.f, .a = 1.f});
+    for (size_t i = 0; i < 1000; ++i) {
+      auto node = std::make_shared<Node>(mesh, texture);
+      node->setPosition(glm::vec3(0.3f * (i % 32), 0.3f * (i / 32), 0.f));
+      engine.addNode(node);
+    }
+    engine.prepare();
+    for (int frame = 0; frame < 100 && engine.stats().shadowInstances == 0;
+         ++frame) {
+      engine.update();
+    }
+    const auto &stats = engine.stats();
+    MESSAGE(toString(format)
+            << ": shadow pass reads an estimated "
+            << stats.estimatedShadowVertexBytes / 1024.0 << " KiB ("
+            << stats.estimatedShadowInterleavedVertexBytes / 1024.0
+            << " KiB interleaved)");
+    REQUIRE(stats.shadowInstances > 0);
+    CHECK(stats.estimatedShadowVertexBytes * 2 <=
+          stats.estimatedShadowInterleavedVertexBytes);
+  }
+}
+
+// 遠くに多数の球があるシーンで、LOD の有無による三角形の数とフレーム時間
+// （--no-skip で実行）
+TEST_CASE("mesh lods draw fewer triangles at distance" * doctest::skip()) {
+  uint64_t triangles[2] = {};
+  for (const bool lods : {false, true}) {
+    Engine engine;
+    engine.setMeshLods(lods);
+    auto mesh = mesh::SphereMesh::generate(0.1f, 32, 32);
+    auto texture = std::make_shared<Texture>(
+        RGBAColor{.r = 1.f, .g = 1.f, .b = 1.f, .a = 1.f});
+    for (size_t i = 0; i < 4096; ++i) {
+      auto node = std::make_shared<Node>(mesh, texture);
+      node->setPosition(
+          glm::vec3(-0.15f * (i % 64), -0.15f * (i / 64), 0.f));
+      engine.addNode(node);
+    }
+    engine.prepare();
+    for (int frame = 0; frame < 100 && engine.stats().sceneInstances == 0;
+         ++frame) {
+      engine.update();
+    }
+    constexpr int frames = 200;
+    const auto start = std::chrono::steady_clock::now();
+    for (int frame = 0; frame < frames; ++frame) {
+      engine.update();
+    }
+    const double ms = std::chrono::duration<double, std::milli>(
+                          std::chrono::steady_clock::now() - start)
+                          .count();
+    const auto &stats = engine.stats();
+    MESSAGE((lods ? "lods" : "no lods")
+            << ": " << stats.sceneTriangles << " scene triangles, "
+            << stats.shadowTriangles << " shadow triangles, "
+            << ms / frames << " ms/frame");
+    REQUIRE(stats.sceneInstances > 0);
+    triangles[lods ? 1 : 0] = stats.sceneTriangles;
+  }
+  CHECK(triangles[1] < triangles[0]);
+}
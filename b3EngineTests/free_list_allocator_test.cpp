@@ -0,0 +1,101 @@
+#include "doctest.h"
+
+#include "b3/free_list_allocator.hpp"
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+using namespace b3;
+
+TEST_CASE("FreeListAllocator allocates, frees and coalesces") {
+  FreeListAllocator allocator(100);
+  const auto a = allocator.allocate(10);
+  const auto b = allocator.allocate(20);
+  const auto c = allocator.allocate(30);
+  CHECK(a == 0);
+  CHECK(b == 10);
+  CHECK(c == 30);
+  CHECK(allocator.used() == 60);
+  CHECK(allocator.allocate(41) == FreeListAllocator::INVALID_OFFSET);
+  CHECK(allocator.allocate(0) == FreeListAllocator::INVALID_OFFSET);
+
+  // 間の領域を解放しても、末尾の空きとは結合しない
+  allocator.free(b);
+  CHECK(allocator.freeBlockCount() == 2);
+  CHECK(allocator.largestFreeBlock() == 40);
+
+  // best-fit なので、ちょうど収まる穴を使う
+  CHECK(allocator.allocate(15) == 10);
+  allocator.free(10);
+
+  // 全部解放すれば1つの空き領域に戻る
+  allocator.free(a);
+  allocator.free(c);
+  CHECK(allocator.used() == 0);
+  CHECK(allocator.freeBlockCount() == 1);
+  CHECK(allocator.largestFreeBlock() == 100);
+}
+
+TEST_CASE("FreeListAllocator grows into the free tail") {
+  FreeListAllocator allocator(16);
+  CHECK(allocator.allocate(12) == 0);
+  CHECK(allocator.allocate(8) == FreeListAllocator::INVALID_OFFSET);
+  allocator.grow(32);
+  CHECK(allocator.capacity() == 32);
+  CHECK(allocator.freeBlockCount() == 1);
+  CHECK(allocator.allocate(8) == 12);
+
+  // 末尾が埋まっていれば新しい空き領域になる
+  CHECK(allocator.allocate(12) == 20);
+  allocator.grow(40);
+  CHECK(allocator.allocate(8) == 32);
+
+  allocator.reset();
+  CHECK(allocator.used() == 0);
+  CHECK(allocator.largestFreeBlock() == 40);
+}
+
+TEST_CASE("FreeListAllocator never hands out overlapping ranges") {
+  constexpr uint64_t capacity = 1 << 16;
+  FreeListAllocator allocator(capacity);
+  std::mt19937 rng(17);
+  std::uniform_int_distribution<uint64_t> size(1, 700);
+  struct Range {
+    uint64_t offset;
+    uint64_t size;
+  };
+  std::vector<Range> live;
+  for (int i = 0; i < 20000; ++i) {
+    if (!live.empty() && (rng() % 3 == 0 || live.size() > 150)) {
+      const auto n = rng() % live.size();
+      allocator.free(live[n].offset);
+      live[n] = live.back();
+      live.pop_back();
+    } else {
+      const auto s = size(rng);
+      const auto offset = allocator.allocate(s);
+      if (offset != FreeListAllocator::INVALID_OFFSET) {
+        live.push_back({offset, s});
+      }
+    }
+  }
+
+  std::ranges::sort(live, {}, &Range::offset);
+  uint64_t used = 0;
+  for (size_t i = 0; i < live.size(); ++i) {
+    CHECK(live[i].offset + live[i].size <= capacity);
+    if (i > 0) {
+      CHECK(live[i - 1].offset + live[i - 1].size <= live[i].offset);
+    }
+    used += live[i].size;
+  }
+  CHECK(allocator.used() == used);
+  CHECK(allocator.allocationCount() == live.size());
+
+  for (const auto &range : live) {
+    allocator.free(range.offset);
+  }
+  CHECK(allocator.freeBlockCount() == 1);
+  CHECK(allocator.largestFreeBlock() == capacity);
+}
@@ -0,0 +1,164 @@
+#include "doctest.h"
+
+#include "b3/frustum_culling.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <random>
+#include <string>
+
+using namespace b3;
+
+static Frustum testFrustum() {
+  auto proj = glm::perspective(glm::radians(60.0f), 4.0f / 3.0f, 0.1f, 50.0f);
+  auto view = glm::lookAt(glm::vec3(0.f, 2.f, 10.f), glm::vec3(0.f),
+                          glm::vec3(0.f, 1.f, 0.f));
+  return extractFrustum(proj * view);
+}
+
+static BoundingSphereArray randomSpheres(size_t count, uint32_t seed) {
+  std::mt19937 rng(seed);
+  std::uniform_real_distribution<float> pos(-60.f, 60.f);
+  std::uniform_real_distribution<float> radius(0.f, 3.f);
+  BoundingSphereArray spheres;
+  spheres.resize(count);
+  for (size_t i = 0; i < count; ++i) {
+    spheres.set(i, {{pos(rng), pos(rng), pos(rng)}, radius(rng)});
+  }
+  return spheres;
+}
+
+static std::vector<SimdLevel> supportedLevels() {
+  std::vector<SimdLevel> levels{SimdLevel::Scalar};
+  for (auto level : {SimdLevel::SSE2, SimdLevel::AVX2, SimdLevel::AVX512}) {
+    if (level <= detectSimdLevel()) {
+      levels.push_back(level);
+    }
+  }
+  return levels;
+}
+
+TEST_CASE("batch sphere culling matches sphereInFrustum") {
+  const auto frustum = testFrustum();
+  const auto planes = toPlanes(frustum);
+  // SIMD 幅で割り切れない数にして端数の処理も確認する
+  const auto spheres = randomSpheres(1000 + 13, 7);
+
+  std::vector<uint32_t> expected;
+  for (size_t i = 0; i < spheres.size(); ++i) {
+    if (sphereInFrustum(frustum, spheres.get(i))) {
+      expected.push_back(static_cast<uint32_t>(i));
+    }
+  }
+  REQUIRE_FALSE(expected.empty());
+
+  for (auto level : supportedLevels()) {
+    const std::string levelName = toString(level);
+    CAPTURE(levelName);
+    std::vector<uint32_t> visible;
+    cullSpheres(planes, spheres, visible, level);
+    CHECK(visible == expected);
+  }
+}
+
+TEST_CASE("batch sphere culling handles empty input") {
+  std::vector<uint32_t> visible{1, 2, 3};
+  cullSpheres(toPlanes(testFrustum()), BoundingSphereArray{}, visible);
+  CHECK(visible.empty());
+}
+
+TEST_CASE("spheres with NaN are culled on every path") {
+  const auto frustum = testFrustum();
+  const auto planes = toPlanes(frustum);
+  const float nan = std::numeric_limits<float>::quiet_NaN();
+  // 原点の球（見える）と、中心か半径のどれかが NaN の球を交互に並べる。
+  // SIMD の各レーンと端数の両方に NaN が入る数にする。
+  BoundingSphereArray spheres;
+  spheres.resize(37);
+  std::vector<uint32_t> expected;
+  for (size_t i = 0; i < spheres.size(); ++i) {
+    BoundingSphere sphere{{0.f, 0.f, 0.f}, 1.f};
+    if (i % 2 == 1) {
+      switch (i / 2 % 4) {
+      case 0:
+        sphere.center.x = nan;
+        break;
+      case 1:
+        sphere.center.y = nan;
+        break;
+      case 2:
+        sphere.center.z = nan;
+        break;
+      default:
+        sphere.radius = nan;
+        break;
+      }
+    } else {
+      expected.push_back(static_cast<uint32_t>(i));
+    }
+    spheres.set(i, sphere);
+    CHECK(sphereInFrustum(frustum, sphere) == (i % 2 == 0));
+  }
+
+  for (auto level : supportedLevels()) {
+    const std::string levelName = toString(level);
+    CAPTURE(levelName);
+    std::vector<uint32_t> visible;
+    cullSpheres(planes, spheres, visible, level);
+    CHECK(visible == expected);
+  }
+}
+
+TEST_CASE("range culling concatenates to whole-array culling") {
+  const auto planes = toPlanes(testFrustum());
+  const auto spheres = randomSpheres(10007, 9);
+  std::vector<uint32_t> expected;
+  cullSpheres(planes, spheres, expected);
+
+  // SIMD 幅に揃わない範囲に分けて、順に連結する
+  std::vector<uint32_t> visible;
+  for (size_t begin = 0; begin < spheres.size(); begin += 333) {
+    cullSphereRange(planes, spheres, begin,
+                    std::min(spheres.size(), begin + 333), visible);
+  }
+  CHECK(visible == expected);
+}
+
+// 時間がかかるので既定ではスキップする（--no-skip で実行）
+TEST_CASE("benchmark sphere culling" * doctest::skip()) {
+  using clock = std::chrono::steady_clock;
+  constexpr size_t count = 50000;
+  constexpr int iterations = 200;
+  const auto frustum = testFrustum();
+  const auto planes = toPlanes(frustum);
+  const auto spheres = randomSpheres(count, 11);
+
+  // 以前の方法: 1つずつ sphereInFrustum で判定して vector<bool> に書く
+  std::vector<bool> flags(count);
+  auto start = clock::now();
+  for (int n = 0; n < iterations; ++n) {
+    for (size_t i = 0; i < count; ++i) {
+      flags[i] = sphereInFrustum(frustum, spheres.get(i));
+    }
+  }
+  auto legacyUs =
+      std::chrono::duration<double, std::micro>(clock::now() - start).count() /
+      iterations;
+  MESSAGE("sphereInFrustum: " << legacyUs << " us");
+
+  std::vector<uint32_t> visible;
+  for (auto level : supportedLevels()) {
+    start = clock::now();
+    for (int n = 0; n < iterations; ++n) {
+      cullSpheres(planes, spheres, visible, level);
+    }
+    auto us = std::chrono::duration<double, std::micro>(clock::now() - start)
+                  .count() /
+              iterations;
+    MESSAGE("cullSpheres (" << std::string(toString(level)) << "): " << us
+                            << " us, x" << legacyUs / us);
+  }
+  CHECK(visible.size() ==
+        static_cast<size_t>(std::count(flags.begin(), flags.end(), true)));
+}
@@ -0,0 +1,132 @@
+#include "doctest.h"
+
+#include "b3/frustum_culling.hpp"
+#include "b3/job_system.hpp"
+#include "b3/transform_store.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <random>
+
+using namespace b3;
+
+TEST_CASE("parallelFor visits every index exactly once") {
+  for (uint32_t threads : {1u, 2u, 4u}) {
+    CAPTURE(threads);
+    JobSystem jobs(threads);
+    CHECK(jobs.threadCount() == threads);
+    for (size_t count : {0, 1, 7, 1000, 100003}) {
+      std::vector<std::atomic<uint32_t>> visits(count);
+      jobs.parallelFor(count, 13, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+          visits[i].fetch_add(1, std::memory_order_relaxed);
+        }
+      });
+      CHECK(std::ranges::all_of(visits, [](const auto &v) { return v == 1; }));
+    }
+  }
+}
+
+TEST_CASE("parallelFor can be nested and called from other threads") {
+  JobSystem jobs(4);
+  std::atomic<size_t> sum{0};
+  jobs.parallelFor(16, 1, [&](size_t, size_t) {
+    // ジョブの中から parallelFor を呼んでも終わる
+    jobs.parallelFor(100, 10, [&](size_t begin, size_t end) {
+      sum.fetch_add(end - begin, std::memory_order_relaxed);
+    });
+  });
+  CHECK(sum == 1600);
+
+  // ワーカーでないスレッドからはその場で順番に実行する
+  std::vector<size_t> order;
+  std::thread([&] {
+    jobs.parallelFor(5, 1, [&](size_t begin, size_t) { order.push_back(begin); });
+  }).join();
+  CHECK(order == std::vector<size_t>{0, 1, 2, 3, 4});
+}
+
+TEST_CASE("parallelFor handles more jobs than the queue capacity") {
+  JobSystem jobs(3);
+  const size_t count = JobSystem::QUEUE_CAPACITY * 2 + 5;
+  std::atomic<size_t> sum{0};
+  jobs.parallelFor(count, 1, [&](size_t begin, size_t end) {
+    sum.fetch_add(end - begin, std::memory_order_relaxed);
+  });
+  CHECK(sum == count);
+}
+
+// Engine::updateUBO() と同じ処理を、GPU なしで 100k ノードに対して行う
+// 時間がかかるので既定ではスキップする（--no-skip で実行）
+TEST_CASE("benchmark parallel UBO fill and culling" * doctest::skip()) {
+  using clock = std::chrono::steady_clock;
+  using ms = std::chrono::duration<double, std::milli>;
+  constexpr size_t nodeCount = 100000;
+  constexpr size_t stride = 256; // minUniformBufferOffsetAlignment 相当
+  constexpr int iterations = 20;
+
+  TransformStore store;
+  std::vector<TransformStore::Handle> handles;
+  std::mt19937 rng(7);
+  std::uniform_real_distribution<float> pos(-50.f, 50.f);
+  for (size_t i = 0; i < nodeCount; ++i) {
+    const auto handle = store.create();
+    store.setPosition(handle, {pos(rng), pos(rng), pos(rng)});
+    handles.push_back(handle);
+  }
+  store.update();
+
+  const auto vp = glm::perspective(glm::radians(60.0f), 4.0f / 3.0f, 0.1f,
+                                   50.0f) *
+                  glm::lookAt(glm::vec3(0.f, 2.f, 10.f), glm::vec3(0.f),
+                              glm::vec3(0.f, 1.f, 0.f));
+  const auto planes = toPlanes(extractFrustum(vp));
+  std::vector<uint8_t> modelData(nodeCount * stride);
+  std::vector<uint8_t> shadowData(nodeCount * stride);
+  BoundingSphereArray spheres;
+  spheres.resize(nodeCount);
+
+  const uint32_t maxThreads = std::max(1u, std::thread::hardware_concurrency());
+  std::vector<uint32_t> threadCounts;
+  for (uint32_t threads = 1; threads < maxThreads; threads *= 2) {
+    threadCounts.push_back(threads);
+  }
+  threadCounts.push_back(maxThreads);
+  double singleMs = 0.0;
+  for (const uint32_t threads : threadCounts) {
+    JobSystem jobs(threads);
+    const size_t grain = jobs.grainFor(nodeCount);
+    const size_t chunkCount = (nodeCount + grain - 1) / grain;
+    std::vector<std::vector<uint32_t>> chunkVisible(chunkCount);
+    std::vector<uint32_t> visible;
+
+    const auto start = clock::now();
+    for (int n = 0; n < iterations; ++n) {
+      jobs.parallelFor(nodeCount, grain, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+          const auto &model = store.updatedWorldMatrix(handles[i]);
+          const glm::mat4 depthMVP = vp * model;
+          std::memcpy(&shadowData[i * stride], &depthMVP, sizeof(depthMVP));
+          const glm::mat4 ubo[2] = {model, depthMVP};
+          std::memcpy(&modelData[i * stride], ubo, sizeof(ubo));
+          spheres.set(i, {glm::vec3(model[3]), 1.0f});
+        }
+        auto &out = chunkVisible[begin / grain];
+        out.clear();
+        cullSphereRange(planes, spheres, begin, end, out);
+      });
+      visible.clear();
+      for (const auto &chunk : chunkVisible) {
+        visible.insert(visible.end(), chunk.begin(), chunk.end());
+      }
+    }
+    const auto elapsedMs = ms(clock::now() - start).count() / iterations;
+    if (threads == 1) {
+      singleMs = elapsedMs;
+    }
+    MESSAGE(threads << " threads: " << elapsedMs << " ms, x"
+                    << singleMs / elapsedMs << " (visible " << visible.size()
+                    << ", steals " << jobs.stats().steals << ")");
+  }
+}
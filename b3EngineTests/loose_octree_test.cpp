@@ -0,0 +1,184 @@
+#include "doctest.h"
+
+#include "b3/loose_octree.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+
+using namespace b3;
+
+static FrustumPlanes testPlanes() {
+  auto proj = glm::perspective(glm::radians(60.0f), 4.0f / 3.0f, 0.1f, 50.0f);
+  auto view = glm::lookAt(glm::vec3(0.f, 2.f, 10.f), glm::vec3(0.f),
+                          glm::vec3(0.f, 1.f, 0.f));
+  return toPlanes(extractFrustum(proj * view));
+}
+
+static BoundingSphereArray randomSpheres(size_t count, uint32_t seed,
+                                         float range = 60.f) {
+  std::mt19937 rng(seed);
+  std::uniform_real_distribution<float> pos(-range, range);
+  std::uniform_real_distribution<float> radius(0.f, 2.f);
+  BoundingSphereArray spheres;
+  spheres.resize(count);
+  for (size_t i = 0; i < count; ++i) {
+    spheres.set(i, {{pos(rng), pos(rng), pos(rng)}, radius(rng)});
+  }
+  return spheres;
+}
+
+static void moveSpheres(BoundingSphereArray &spheres, float t) {
+  for (size_t i = 0; i < spheres.size(); ++i) {
+    spheres.cx[i] += std::sin(t + i) * 0.5f;
+    spheres.cy[i] += std::cos(t * 1.3f + i) * 0.5f;
+  }
+}
+
+static std::vector<uint32_t> sorted(std::vector<uint32_t> v) {
+  std::ranges::sort(v);
+  return v;
+}
+
+TEST_CASE("loose octree frustum culling matches linear culling") {
+  const auto planes = testPlanes();
+  auto spheres = randomSpheres(5000, 21);
+  LooseOctree octree;
+  octree.update(spheres);
+  CHECK(octree.size() == spheres.size());
+  CHECK(octree.outsideCount() == 0);
+
+  for (int frame = 0; frame < 5; ++frame) {
+    std::vector<uint32_t> expected;
+    cullSpheres(planes, spheres, expected, SimdLevel::Scalar);
+    std::vector<uint32_t> visible;
+    octree.cullFrustum(planes, visible);
+    CHECK(sorted(visible) == expected);
+
+    moveSpheres(spheres, static_cast<float>(frame));
+    octree.update(spheres);
+  }
+  CHECK(octree.stats().reinsertions > 0);
+}
+
+TEST_CASE("loose octree sphere and ray queries") {
+  const auto spheres = randomSpheres(3000, 23);
+  LooseOctree octree;
+  octree.update(spheres);
+
+  const BoundingSphere query{{5.f, -3.f, 2.f}, 12.f};
+  std::vector<uint32_t> expected;
+  for (uint32_t i = 0; i < spheres.size(); ++i) {
+    const auto s = spheres.get(i);
+    const float r = s.radius + query.radius;
+    if (glm::distance2(s.center, query.center) <= r * r) {
+      expected.push_back(i);
+    }
+  }
+  std::vector<uint32_t> found;
+  octree.querySphere(query, found);
+  REQUIRE_FALSE(expected.empty());
+  CHECK(sorted(found) == expected);
+
+  // 原点を通る半直線。近い順に並んでいること
+  const glm::vec3 origin(-70.f, 0.5f, 0.2f);
+  const glm::vec3 direction = glm::normalize(glm::vec3(1.f, 0.02f, 0.01f));
+  std::vector<LooseOctree::RayHit> hits;
+  octree.raycast(origin, direction, 200.f, hits);
+  size_t expectedHits = 0;
+  for (uint32_t i = 0; i < spheres.size(); ++i) {
+    const auto s = spheres.get(i);
+    const glm::vec3 oc = s.center - origin;
+    const float t = glm::dot(oc, direction);
+    const float d2 = glm::dot(oc, oc) - t * t;
+    if (t >= -s.radius && d2 <= s.radius * s.radius) {
+      ++expectedHits;
+    }
+  }
+  CHECK(hits.size() == expectedHits);
+  CHECK(std::ranges::is_sorted(hits, {}, &LooseOctree::RayHit::t));
+}
+
+TEST_CASE("loose octree handles spheres leaving the bounds") {
+  LooseOctree octree;
+  octree.reset(glm::vec3(0.f), 10.f);
+  BoundingSphereArray spheres;
+  spheres.resize(2);
+  spheres.set(0, {{0.f, 0.f, 0.f}, 1.f});
+  spheres.set(1, {{0.f, 0.f, 0.f}, 1.f});
+  octree.update(spheres);
+  CHECK(octree.outsideCount() == 0);
+
+  // 範囲外に出た要素も問い合わせで見つかる
+  octree.update(1, {{100.f, 0.f, 0.f}, 1.f});
+  CHECK(octree.outsideCount() == 1);
+  std::vector<uint32_t> found;
+  octree.querySphere({{100.f, 0.f, 0.f}, 0.5f}, found);
+  CHECK(found == std::vector<uint32_t>{1});
+
+  // 範囲外が多くなると範囲を取り直す
+  spheres.set(1, {{100.f, 0.f, 0.f}, 1.f});
+  const auto resets = octree.stats().resets;
+  octree.update(spheres);
+  CHECK(octree.stats().resets == resets + 1);
+  CHECK(octree.outsideCount() == 0);
+
+  // 要素数を減らす
+  spheres.resize(1);
+  octree.update(spheres);
+  CHECK(octree.size() == 1);
+  octree.querySphere({{100.f, 0.f, 0.f}, 0.5f}, found);
+  CHECK(found.empty());
+}
+
+// 時間がかかるので既定ではスキップする（--no-skip で実行）
+TEST_CASE("benchmark loose octree with moving spheres" * doctest::skip()) {
+  using clock = std::chrono::steady_clock;
+  using ms = std::chrono::duration<double, std::milli>;
+  const auto planes = testPlanes();
+  constexpr int frames = 10;
+  for (size_t count : {10000, 100000, 1000000}) {
+    // 数が増えても密度が変わらないように範囲を広げる
+    const float range = 60.f * std::cbrt(count / 10000.f);
+    auto spheres = randomSpheres(count, 29, range);
+    LooseOctree octree;
+    octree.update(spheres);
+
+    double updateMs = 0.0;
+    double cullMs = 0.0;
+    double linearMs = 0.0;
+    double queryMs = 0.0;
+    size_t visible = 0;
+    std::vector<uint32_t> indices;
+    std::vector<LooseOctree::RayHit> hits;
+    for (int frame = 0; frame < frames; ++frame) {
+      moveSpheres(spheres, static_cast<float>(frame));
+      auto start = clock::now();
+      octree.update(spheres);
+      updateMs += ms(clock::now() - start).count();
+
+      start = clock::now();
+      octree.cullFrustum(planes, indices);
+      cullMs += ms(clock::now() - start).count();
+      visible = indices.size();
+
+      start = clock::now();
+      cullSpheres(planes, spheres, indices);
+      linearMs += ms(clock::now() - start).count();
+
+      start = clock::now();
+      for (int q = 0; q < 100; ++q) {
+        const glm::vec3 p(q - 50.f, 0.f, 50.f - q);
+        octree.querySphere({p, 5.f}, indices);
+        octree.raycast(p, glm::vec3(0.f, 0.f, -1.f), 100.f, hits);
+      }
+      queryMs += ms(clock::now() - start).count();
+    }
+    MESSAGE(count << " moving spheres: update " << updateMs / frames
+                  << " ms (" << count / (updateMs / frames) / 1000.0
+                  << " M/s), frustum " << cullMs / frames << " ms ("
+                  << visible << " visible, linear " << linearMs / frames
+                  << " ms), 100 sphere+ray queries " << queryMs / frames
+                  << " ms, reinsertions " << octree.stats().reinsertions);
+  }
+}
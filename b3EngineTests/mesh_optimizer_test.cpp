@@ -0,0 +1,150 @@
+#include "doctest.h"
+
+#include "b3/mesh_optimizer.hpp"
+#include "b3/primitives/PlaneMesh.hpp"
+#include "b3/primitives/SphereMesh.hpp"
+
+#include <algorithm>
+#include <array>
+#include <tuple>
+
+using namespace b3;
+
+namespace {
+
+// 三角形を頂点の位置で表し、向きを保ったまま最小の頂点から始まるように
+// 回してソートする（並べ替えの前後で同じ三角形の集合か比べるため）
+std::vector<std::array<float, 9>> triangleSet(const Mesh &mesh) {
+  std::vector<std::array<float, 9>> triangles;
+  for (size_t i = 0; i < mesh.numberOfIndices(); i += 3) {
+    std::array<glm::vec3, 3> p;
+    for (int k = 0; k < 3; ++k) {
+      p[k] = mesh.vertex(mesh.index(i + k)).position;
+    }
+    const auto less = [](const glm::vec3 &a, const glm::vec3 &b) {
+      return std::tie(a.x, a.y, a.z) < std::tie(b.x, b.y, b.z);
+    };
+    const auto first = std::min_element(p.begin(), p.end(), less);
+    std::rotate(p.begin(), first, p.end());
+    triangles.push_back({p[0].x, p[0].y, p[0].z, p[1].x, p[1].y, p[1].z,
+                         p[2].x, p[2].y, p[2].z});
+  }
+  std::sort(triangles.begin(), triangles.end());
+  return triangles;
+}
+
+} // namespace
+
+TEST_CASE("vertex cache statistics of simple index buffers") {
+  const auto single = analyzeVertexCache({0, 1, 2}, 3);
+  CHECK(single.triangles == 1);
+  CHECK(single.acmr == doctest::Approx(3.0));
+  CHECK(single.atvr == doctest::Approx(1.0));
+
+  // 2 つ目の三角形は 1 頂点だけ新しい
+  const auto quad = analyzeVertexCache({0, 1, 2, 2, 1, 3}, 4);
+  CHECK(quad.transformed == 4);
+  CHECK(quad.acmr == doctest::Approx(2.0));
+
+  // キャッシュより遠くで再利用すると、もう一度変換する
+  std::vector<IndexType> far = {0, 1, 2};
+  for (IndexType v = 3; v < 3 + 3 * 8; v += 3) {
+    far.insert(far.end(), {v, IndexType(v + 1), IndexType(v + 2)});
+  }
+  far.insert(far.end(), {0, 1, 2});
+  const auto stats = analyzeVertexCache(far, 27, 16);
+  CHECK(stats.transformed == 30);
+  CHECK(stats.vertices == 27);
+}
+
+TEST_CASE("optimizeMesh keeps the triangles and lowers ACMR") {
+  auto plane = mesh::PlaneMesh::generate(1.f, 1.f, UpAxis::Z, 64, 64);
+  auto sphere = mesh::SphereMesh::generate(1.f, 48, 32);
+  for (const auto &mesh : {plane, sphere}) {
+    const auto before = triangleSet(*mesh);
+    const auto report = optimizeMesh(*mesh);
+    MESSAGE("ACMR " << report.before.acmr << " -> " << report.after.acmr
+                    << ", ATVR " << report.before.atvr << " -> "
+                    << report.after.atvr);
+    CHECK(report.after.triangles == report.before.triangles);
+    CHECK(report.after.acmr < report.before.acmr);
+    CHECK(report.after.atvr >= 1.0);
+    CHECK(triangleSet(*mesh) == before);
+
+    // 頂点は最初に使われる順に並ぶ
+    IndexType next = 0;
+    for (size_t i = 0; i < mesh->numberOfIndices(); ++i) {
+      REQUIRE(mesh->index(i) <= next);
+      if (mesh->index(i) == next) {
+        ++next;
+      }
+    }
+    CHECK(next == mesh->numberOfVertices());
+  }
+}
+
+TEST_CASE("optimizeMesh on copies leaves the mesh untouched") {
+  auto mesh = mesh::SphereMesh::generate(1.f, 24, 16);
+  const auto indices = mesh->indices();
+  auto optimizedVertices = mesh->vertices();
+  auto optimizedIndices = indices;
+  optimizeMesh(optimizedVertices, optimizedIndices);
+  CHECK(mesh->indices() == indices);
+  CHECK(optimizedIndices != indices);
+
+  // Mesh を書き換える版と同じ結果になる
+  optimizeMesh(*mesh);
+  CHECK(mesh->indices() == optimizedIndices);
+  CHECK(mesh->numberOfVertices() == optimizedVertices.size());
+}
+
+TEST_CASE("optimizeVertexFetch drops unused vertices") {
+  std::vector<Vertex> vertices(5);
+  for (size_t i = 0; i < vertices.size(); ++i) {
+    vertices[i].position = glm::vec3(float(i), 0.f, 0.f);
+  }
+  std::vector<IndexType> indices = {4, 2, 0, 0, 2, 3};
+  optimizeVertexFetch(vertices, indices);
+  CHECK(indices == std::vector<IndexType>{0, 1, 2, 2, 1, 3});
+  REQUIRE(vertices.size() == 4);
+  CHECK(vertices[0].position.x == 4.f);
+  CHECK(vertices[3].position.x == 3.f);
+}
+
+TEST_CASE("optimizeOverdraw draws outward facing clusters first") {
+  // 上下に重なった、どちらも +Z を向いた 2 枚の平面。上から見ると上の
+  // 平面が下の平面を隠すので、上の平面を先に描くとよい。
+  auto plane = mesh::PlaneMesh::generate(2.f, 2.f, UpAxis::Z, 32, 32);
+  std::vector<Vertex> vertices = plane->vertices();
+  std::vector<IndexType> indices;
+  const IndexType base = static_cast<IndexType>(vertices.size());
+  for (size_t i = 0; i < plane->numberOfVertices(); ++i) {
+    auto v = plane->vertex(i);
+    v.position.z -= 1.f;
+    vertices.push_back(v);
+  }
+  // 下の平面を先に並べる
+  for (size_t i = 0; i < plane->numberOfIndices(); ++i) {
+    indices.push_back(plane->index(i) + base);
+  }
+  for (size_t i = 0; i < plane->numberOfIndices(); ++i) {
+    indices.push_back(plane->index(i));
+  }
+  const auto sorted = optimizeOverdraw(
+      optimizeVertexCache(indices, vertices.size()), vertices);
+  REQUIRE(sorted.size() == indices.size());
+  // 上の平面（中心より +Z 側）が先
+  CHECK(sorted[0] < base);
+  CHECK(sorted.back() >= base);
+  CHECK(analyzeVertexCache(sorted, vertices.size()).acmr <
+        analyzeVertexCache(indices, vertices.size()).acmr * 1.1);
+}
+
+TEST_CASE("benchmark mesh optimization" * doctest::skip()) {
+  auto mesh = mesh::PlaneMesh::generate(1.f, 1.f, UpAxis::Z, 512, 512);
+  const auto report = optimizeMesh(*mesh);
+  MESSAGE(report.before.triangles
+          << " triangles: ACMR " << report.before.acmr << " -> "
+          << report.after.acmr << ", ATVR " << report.before.atvr << " -> "
+          << report.after.atvr << " in " << report.ms << " ms");
+}
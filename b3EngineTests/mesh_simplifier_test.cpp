@@ -0,0 +1,103 @@
+#include "doctest.h"
+
+#include "b3/mesh_simplifier.hpp"
+#include "b3/primitives/PlaneMesh.hpp"
+#include "b3/primitives/SphereMesh.hpp"
+
+#include <set>
+
+using namespace b3;
+
+namespace {
+
+std::set<IndexType> usedVertices(const std::vector<IndexType> &indices) {
+  return {indices.begin(), indices.end()};
+}
+
+} // namespace
+
+TEST_CASE("simplifyMesh reduces a sphere and keeps its seams") {
+  auto sphere = mesh::SphereMesh::generate(1.f, 32, 32);
+  const auto &vertices = sphere->vertices();
+  const auto &indices = sphere->indices();
+  const auto result = simplifyMesh(vertices, indices, indices.size() / 4);
+  MESSAGE((indices.size() / 3) << " -> " << (result.indices.size() / 3)
+                               << " triangles, error " << result.error);
+  CHECK(result.indices.size() % 3 == 0);
+  CHECK(result.indices.size() < indices.size() / 2);
+  CHECK(result.error > 0.f);
+  CHECK(result.error < 0.2f);
+
+  // 頂点は増えず、UV の継ぎ目（経度 0 と 1 の列）は残る
+  const auto used = usedVertices(result.indices);
+  CHECK(*used.rbegin() < vertices.size());
+  for (size_t lat = 1; lat < 32; ++lat) {
+    CHECK(used.count(IndexType(lat * 33)) == 1);
+    CHECK(used.count(IndexType(lat * 33 + 32)) == 1);
+  }
+}
+
+TEST_CASE("simplifyMesh collapses a flat plane without error") {
+  auto plane = mesh::PlaneMesh::generate(2.f, 2.f, UpAxis::Z, 16, 16);
+  const auto &indices = plane->indices();
+  const auto result = simplifyMesh(plane->vertices(), indices, 0);
+  CHECK(result.indices.size() < indices.size() / 4);
+  CHECK(result.error == doctest::Approx(0.f));
+
+  // 縁の頂点は動かさない
+  const auto used = usedVertices(result.indices);
+  for (int i = 0; i <= 16; ++i) {
+    CHECK(used.count(IndexType(i)) == 1);
+    CHECK(used.count(IndexType(16 * 17 + i)) == 1);
+    CHECK(used.count(IndexType(i * 17)) == 1);
+    CHECK(used.count(IndexType(i * 17 + 16)) == 1);
+  }
+  // 向きは変わらない
+  for (size_t i = 0; i < result.indices.size(); i += 3) {
+    const auto &p0 = plane->vertex(result.indices[i + 0]).position;
+    const auto &p1 = plane->vertex(result.indices[i + 1]).position;
+    const auto &p2 = plane->vertex(result.indices[i + 2]).position;
+    REQUIRE(glm::cross(p1 - p0, p2 - p0).z > 0.f);
+  }
+}
+
+TEST_CASE("simplifyMesh stops at maxError") {
+  auto sphere = mesh::SphereMesh::generate(1.f, 32, 32);
+  const auto &indices = sphere->indices();
+  const auto result =
+      simplifyMesh(sphere->vertices(), indices, 0, 0.01f);
+  CHECK(result.error <= 0.01f);
+  CHECK(result.indices.size() < indices.size());
+}
+
+TEST_CASE("buildLodChain makes coarser levels with growing error") {
+  auto sphere = mesh::SphereMesh::generate(1.f, 32, 32);
+  const auto lods = buildLodChain(sphere->vertices(), sphere->indices());
+  REQUIRE(lods.size() >= 3);
+  CHECK(lods.size() <= DEFAULT_LOD_LEVELS);
+  CHECK(lods[0].indices == sphere->indices());
+  CHECK(lods[0].error == 0.f);
+  for (size_t i = 1; i < lods.size(); ++i) {
+    MESSAGE("LOD " << i << ": " << (lods[i].indices.size() / 3)
+                   << " triangles, error " << lods[i].error);
+    CHECK(lods[i].indices.size() < lods[i - 1].indices.size());
+    CHECK(lods[i].error >= lods[i - 1].error);
+  }
+}
+
+TEST_CASE("selectLod uses screen-space error with hysteresis") {
+  const std::vector<float> errors = {0.f, 0.01f, 0.1f};
+  // 近く（1 単位 1000 ピクセル）では元のメッシュ
+  CHECK(selectLod(errors, 1000.f, 0) == 0);
+  // 遠く（1 単位 5 ピクセル）では最も粗いレベル
+  CHECK(selectLod(errors, 5.f, 0) == 2);
+  // レベル 1 の誤差がちょうど 0.9 ピクセル: 今が 0 なら 0 のまま、
+  // 今が 1 ならそのまま
+  CHECK(selectLod(errors, 90.f, 0) == 0);
+  CHECK(selectLod(errors, 90.f, 1) == 1);
+  // 余裕ができたら粗くする
+  CHECK(selectLod(errors, 70.f, 0) == 1);
+  // 誤差が閾値を超えたらすぐに細かくする
+  CHECK(selectLod(errors, 110.f, 1) == 0);
+  CHECK(selectLod(errors, 50.f, 2) == 1);
+}
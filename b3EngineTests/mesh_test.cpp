@@ -0,0 +1,34 @@
+#include "doctest.h"
+
+#include "b3/mesh.hpp"
+#include "b3/primitives/PlaneMesh.hpp"
+
+using namespace b3;
+
+TEST_CASE("small meshes narrow their indices to 16 bit") {
+  auto plane = mesh::PlaneMesh::generate(1.f, 1.f, UpAxis::Z, 32, 32);
+  REQUIRE(plane->fitsIndex16());
+  CHECK(plane->indexSize() == sizeof(uint16_t));
+  const auto narrowed = plane->indices16();
+  REQUIRE(narrowed.size() == plane->numberOfIndices());
+  for (size_t i = 0; i < narrowed.size(); ++i) {
+    REQUIRE(narrowed[i] == plane->index(i));
+  }
+}
+
+TEST_CASE("16-bit indices cover exactly 65536 vertices") {
+  Mesh mesh;
+  for (size_t i = 0; i < INDEX16_VERTEX_LIMIT; ++i) {
+    mesh.addVertex(Vertex{});
+  }
+  mesh.addIndex(0);
+  mesh.addIndex(UINT16_MAX);
+  mesh.addIndex(1);
+  REQUIRE(mesh.fitsIndex16());
+  CHECK(mesh.indices16() == std::vector<uint16_t>{0, UINT16_MAX, 1});
+
+  // もう 1 頂点増えると 32 bit のまま
+  mesh.addVertex(Vertex{});
+  CHECK_FALSE(mesh.fitsIndex16());
+  CHECK(mesh.indexSize() == sizeof(IndexType));
+}
@@ -0,0 +1,103 @@
+#include "doctest.h"
+
+#include "b3/mipmap.hpp"
+
+#include <chrono>
+#include <cstdlib>
+#include <random>
+#include <string>
+
+using namespace b3;
+
+TEST_CASE("mip chain layout goes down to 1x1") {
+  CHECK(mipLevelCount(1, 1) == 1);
+  CHECK(mipLevelCount(256, 256) == 9);
+  CHECK(mipLevelCount(300, 20) == 9);
+  CHECK(mipLevelCount(1, 5) == 3);
+
+  const auto levels = mipChainLayout(5, 2);
+  REQUIRE(levels.size() == 3);
+  CHECK(levels[1].width == 2);
+  CHECK(levels[1].height == 1);
+  CHECK(levels[2].width == 1);
+  CHECK(levels[2].height == 1);
+  CHECK(levels[1].offset == 5 * 2 * 4);
+  CHECK(levels[2].offset == levels[1].offset + 2 * 1 * 4);
+}
+
+TEST_CASE("box mips average in linear space for sRGB") {
+  // 黒と白を1画素ずつ
+  const uint8_t pixels[] = {0, 0, 0, 255, 255, 255, 255, 255};
+  const auto unorm = generateMipChain(pixels, 2, 1, MipFilter::Box, false);
+  const auto srgb = generateMipChain(pixels, 2, 1, MipFilter::Box, true);
+  REQUIRE(unorm.size() == 12);
+  CHECK(unorm[8] == 128);
+  // 線形で 0.5 は sRGB で約 188
+  CHECK(srgb[8] == 188);
+  // アルファは色空間によらない
+  CHECK(unorm[11] == 255);
+  CHECK(srgb[11] == 255);
+}
+
+TEST_CASE("mip filters keep a flat image flat") {
+  const uint32_t width = 37;
+  const uint32_t height = 16;
+  std::vector<uint8_t> pixels(width * height * 4);
+  for (size_t i = 0; i < pixels.size(); i += 4) {
+    pixels[i + 0] = 200;
+    pixels[i + 1] = 100;
+    pixels[i + 2] = 3;
+    pixels[i + 3] = 77;
+  }
+  for (const auto filter : {MipFilter::Box, MipFilter::Kaiser}) {
+    for (const bool sRGB : {false, true}) {
+      CAPTURE(static_cast<int>(filter));
+      CAPTURE(sRGB);
+      const auto chain = generateMipChain(pixels.data(), width, height, filter,
+                                          sRGB);
+      for (size_t i = 0; i < chain.size(); ++i) {
+        REQUIRE(std::abs(chain[i] - pixels[i % 4]) <= 1);
+      }
+    }
+  }
+}
+
+TEST_CASE("SIMD mips match the scalar mips") {
+  const uint32_t width = 64;
+  const uint32_t height = 33;
+  std::mt19937 rng(3);
+  std::vector<uint8_t> pixels(width * height * 4);
+  for (auto &p : pixels) {
+    p = static_cast<uint8_t>(rng());
+  }
+  for (const auto filter : {MipFilter::Box, MipFilter::Kaiser}) {
+    const auto scalar = generateMipChain(pixels.data(), width, height, filter,
+                                         true, SimdLevel::Scalar);
+    const auto simd = generateMipChain(pixels.data(), width, height, filter,
+                                       true, detectSimdLevel());
+    CHECK(scalar == simd);
+  }
+}
+
+// 時間がかかるので既定ではスキップする（--no-skip で実行）
+TEST_CASE("benchmark CPU mip generation" * doctest::skip()) {
+  using ms = std::chrono::duration<double, std::milli>;
+  const uint32_t size = 2048;
+  std::mt19937 rng(5);
+  std::vector<uint8_t> pixels(size * size * 4);
+  for (auto &p : pixels) {
+    p = static_cast<uint8_t>(rng());
+  }
+  for (const auto filter : {MipFilter::Box, MipFilter::Kaiser}) {
+    for (const auto level : {SimdLevel::Scalar, detectSimdLevel()}) {
+      const auto start = std::chrono::steady_clock::now();
+      const auto chain = generateMipChain(pixels.data(), size, size, filter,
+                                          true, level);
+      const auto elapsed =
+          ms(std::chrono::steady_clock::now() - start).count();
+      const std::string name = filter == MipFilter::Box ? "box" : "kaiser";
+      MESSAGE(name << " " << std::string(toString(level)) << ": " << elapsed
+                   << " ms (" << chain.size() << " bytes)");
+    }
+  }
+}
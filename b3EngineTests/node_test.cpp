@@ -0,0 +1,110 @@
+#include "doctest.h"
+
+#include "b3/mesh.hpp"
+#include "b3/node.hpp"
+#include "b3/primitives/CubeMesh.hpp"
+
+using namespace b3;
+
+static bool nearlyEqual(const glm::mat4 &a, const glm::mat4 &b) {
+  for (int c = 0; c < 4; ++c) {
+    for (int r = 0; r < 4; ++r) {
+      if (std::abs(a[c][r] - b[c][r]) > 1e-5f) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+TEST_CASE("world matrix composes parent transforms") {
+  auto root = std::make_shared<Node>();
+  auto child = std::make_shared<Node>();
+  auto grandChild = std::make_shared<Node>();
+  root->addChild(child);
+  child->addChild(grandChild);
+
+  root->setPosition({1.f, 0.f, 0.f});
+  root->setEulerAngle({0.f, 0.f, glm::radians(90.f)});
+  child->setPosition({0.f, 2.f, 0.f});
+  grandChild->setPosition({0.f, 0.f, 3.f});
+
+  CHECK(grandChild->parent() == child);
+  CHECK(root->children().size() == 1);
+  CHECK(nearlyEqual(grandChild->worldMatrix(), root->localMatrix() *
+                                                   child->localMatrix() *
+                                                   grandChild->localMatrix()));
+
+  auto p = grandChild->worldMatrix() * glm::vec4(0.f, 0.f, 0.f, 1.f);
+  CHECK(p.x == doctest::Approx(-1.f));
+  CHECK(p.y == doctest::Approx(0.f));
+  CHECK(p.z == doctest::Approx(3.f));
+}
+
+TEST_CASE("moving a parent invalidates cached descendants") {
+  auto root = std::make_shared<Node>();
+  auto child = std::make_shared<Node>();
+  root->addChild(child);
+  child->setPosition({0.f, 1.f, 0.f});
+
+  // キャッシュを作る
+  CHECK(child->worldMatrix()[3][1] == doctest::Approx(1.f));
+
+  root->setPosition({0.f, 0.f, 5.f});
+  CHECK(child->worldMatrix()[3][2] == doctest::Approx(5.f));
+
+  // 親から外すとローカル行列だけになる
+  root->removeChild(child);
+  CHECK(child->parent() == nullptr);
+  CHECK(child->worldMatrix()[3][2] == doctest::Approx(0.f));
+}
+
+TEST_CASE("re-parenting moves the child") {
+  auto a = std::make_shared<Node>();
+  auto b = std::make_shared<Node>();
+  auto child = std::make_shared<Node>();
+  a->setPosition({1.f, 0.f, 0.f});
+  b->setPosition({2.f, 0.f, 0.f});
+
+  a->addChild(child);
+  CHECK(child->worldMatrix()[3][0] == doctest::Approx(1.f));
+  b->addChild(child);
+  CHECK(a->children().empty());
+  CHECK(child->worldMatrix()[3][0] == doctest::Approx(2.f));
+}
+
+TEST_CASE("bounding sphere follows the world transform") {
+  auto mesh = mesh::CubeMesh::generate(1.f, 1.f, 1.f, 1, 1);
+  auto root = std::make_shared<Node>();
+  auto node = std::make_shared<Node>(mesh, nullptr);
+  root->addChild(node);
+  root->setPosition({0.f, 0.f, 2.f});
+  node->setPosition({1.f, 0.f, 0.f});
+
+  auto sphere = node->boundingSphere();
+  CHECK(sphere.center.x == doctest::Approx(1.f));
+  CHECK(sphere.center.z == doctest::Approx(2.f));
+  CHECK(sphere.radius > 0.8f);
+
+  // update() の後は読むだけの版でも同じ値になる
+  root->setPosition({0.f, 3.f, 0.f});
+  TransformStore::shared().update();
+  CHECK(nearlyEqual(node->updatedWorldMatrix(), node->worldMatrix()));
+  sphere = node->updatedBoundingSphere();
+  CHECK(sphere.center.y == doctest::Approx(3.f));
+  CHECK(sphere.center.z == doctest::Approx(0.f));
+}
+
+TEST_CASE("destroying a parent detaches its children") {
+  auto child = std::make_shared<Node>();
+  child->setPosition({0.f, 1.f, 0.f});
+  {
+    auto root = std::make_shared<Node>();
+    root->setPosition({3.f, 0.f, 0.f});
+    root->addChild(child);
+    CHECK(child->worldMatrix()[3][0] == doctest::Approx(3.f));
+  }
+  CHECK(child->parent() == nullptr);
+  CHECK(child->worldMatrix()[3][0] == doctest::Approx(0.f));
+  CHECK(child->worldMatrix()[3][1] == doctest::Approx(1.f));
+}
@@ -0,0 +1,79 @@
+#include "doctest.h"
+
+#include "b3/staging_ring.hpp"
+
+#include <vector>
+
+using namespace b3;
+
+TEST_CASE("StagingRing reuses regions only after their batch completes") {
+  StagingRing ring(256);
+  CHECK(ring.allocate(100, 16) == 0);
+  // 100 は 16 に揃えて 112 から
+  CHECK(ring.allocate(100, 16) == 112);
+  ring.close(1);
+  CHECK(ring.used() == 212);
+
+  // 末尾に収まらないので先頭に折り返したいが、バッチ 1 が使っている
+  CHECK(ring.allocate(64) == StagingRing::INVALID_OFFSET);
+  CHECK(ring.allocate(44) == 212);
+  ring.close(2);
+
+  ring.release(1);
+  CHECK(ring.used() == 44);
+  CHECK(ring.allocate(64) == 0);
+  ring.close(3);
+
+  ring.release(3);
+  CHECK(ring.used() == 0);
+}
+
+TEST_CASE("StagingRing allocates its whole capacity when empty") {
+  StagingRing ring(256);
+  CHECK(ring.allocate(0) == StagingRing::INVALID_OFFSET);
+  CHECK(ring.allocate(257) == StagingRing::INVALID_OFFSET);
+
+  CHECK(ring.allocate(200) == 0);
+  ring.close(1);
+  ring.release(1);
+  // 途中の位置から折り返すと入らないが、空なので先頭から使える
+  CHECK(ring.allocate(256) == 0);
+  CHECK(ring.allocate(1) == StagingRing::INVALID_OFFSET);
+  ring.close(2);
+  ring.release(2);
+  CHECK(ring.used() == 0);
+}
+
+TEST_CASE("StagingRing keeps live regions disjoint across wraps") {
+  constexpr uint64_t capacity = 1000;
+  StagingRing ring(capacity);
+  struct Region {
+    uint64_t batch;
+    uint64_t offset;
+    uint64_t size;
+  };
+  std::vector<Region> live;
+  uint64_t batch = 1;
+  uint64_t completed = 0;
+  for (int i = 0; i < 5000; ++i) {
+    const uint64_t size = 1 + (i * 37) % 300;
+    const uint64_t offset = ring.allocate(size, 8);
+    if (offset == StagingRing::INVALID_OFFSET) {
+      // 最も古いバッチの完了を待つ
+      ring.close(batch++);
+      ++completed;
+      ring.release(completed);
+      std::erase_if(live, [&](const Region &r) { return r.batch <= completed; });
+      continue;
+    }
+    CHECK(offset % 8 == 0);
+    CHECK(offset + size <= capacity);
+    for (const auto &r : live) {
+      CHECK((offset + size <= r.offset || r.offset + r.size <= offset));
+    }
+    live.push_back({batch, offset, size});
+    if (i % 3 == 0) {
+      ring.close(batch++);
+    }
+  }
+}
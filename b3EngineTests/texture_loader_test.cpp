@@ -0,0 +1,183 @@
+#include "doctest.h"
+
+#include "b3/bcn.hpp"
+#include "b3/pixel_convert.hpp"
+#include "b3/texture_loader.hpp"
+
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <string>
+
+using namespace b3;
+
+namespace {
+
+// 1色の BC1 の DDS を書き出す
+void writeDds(const std::string &path, uint32_t size, uint8_t value) {
+  std::vector<uint8_t> pixels(size * size * 4, value);
+  const auto image = compressMipChain(pixels.data(), size, size, 1,
+                                      TextureFormat::BC1, false);
+  const auto file = saveDds(image);
+  std::ofstream(path, std::ios::binary)
+      .write(reinterpret_cast<const char *>(file.data()),
+             static_cast<std::streamsize>(file.size()));
+}
+
+} // namespace
+
+TEST_CASE("RGB to RGBA expansion matches the scalar loop") {
+  std::mt19937 rng(3);
+  std::uniform_int_distribution<int> byte(0, 255);
+  for (const size_t count : {0, 1, 7, 9, 10, 17, 64, 1001}) {
+    CAPTURE(count);
+    std::vector<uint8_t> rgb(count * 3);
+    for (auto &v : rgb) {
+      v = static_cast<uint8_t>(byte(rng));
+    }
+    std::vector<uint8_t> scalar(count * 4);
+    std::vector<uint8_t> simd(count * 4);
+    expandRgbToRgba(rgb.data(), scalar.data(), count, SimdLevel::Scalar);
+    expandRgbToRgba(rgb.data(), simd.data(), count, detectSimdLevel());
+    CHECK(simd == scalar);
+    for (size_t i = 0; i < count; ++i) {
+      REQUIRE(scalar[i * 4 + 1] == rgb[i * 3 + 1]);
+      REQUIRE(scalar[i * 4 + 3] == 255);
+    }
+  }
+}
+
+TEST_CASE("single and dual channel pixels expand as luminance and alpha") {
+  const uint8_t r8[] = {10, 200};
+  const uint8_t rg8[] = {10, 20, 200, 255};
+  // 16 bit はリトルエンディアン
+  const uint8_t r16[] = {0xff, 0x12, 0x00, 0xab};
+  const uint8_t rg16[] = {0x00, 0x40, 0xff, 0x80};
+  std::vector<uint8_t> rgba(8);
+  expandToRgba(r8, TextureFormat::R8, rgba.data(), 2);
+  CHECK(rgba == std::vector<uint8_t>{10, 10, 10, 255, 200, 200, 200, 255});
+  expandToRgba(rg8, TextureFormat::RG8, rgba.data(), 2);
+  CHECK(rgba == std::vector<uint8_t>{10, 10, 10, 20, 200, 200, 200, 255});
+  expandToRgba(r16, TextureFormat::R16, rgba.data(), 2);
+  CHECK(rgba ==
+        std::vector<uint8_t>{0x12, 0x12, 0x12, 255, 0xab, 0xab, 0xab, 255});
+  expandToRgba(rg16, TextureFormat::RG16, rgba.data(), 1);
+  CHECK(rgba[0] == 0x40);
+  CHECK(rgba[3] == 0x80);
+  CHECK_THROWS_AS(expandToRgba(r8, TextureFormat::BC1, rgba.data(), 1),
+                  std::invalid_argument);
+}
+
+TEST_CASE("Texture keeps the channel count of uncompressed images") {
+  const uint32_t size = 8;
+  CompressedImage image{.format = TextureFormat::R8,
+                        .sRGB = true,
+                        .width = size,
+                        .height = size,
+                        .levelCount = 1,
+                        .data = std::vector<uint8_t>(size * size, 128)};
+  Texture texture(image);
+  CHECK_FALSE(texture.isCompressed());
+  CHECK(std::string(toString(texture.format())) == "R8");
+  CHECK(texture.pixelBytes() == size * size);
+  const auto rgba = texture.rgba8Pixels();
+  REQUIRE(rgba.size() == size * size * 4);
+  CHECK(rgba[2] == 128);
+  CHECK(rgba[3] == 255);
+  // CPU のミップと BC 圧縮は RGBA8 に広げてから行う
+  CHECK(texture.mipChain().size() ==
+        mipChainLayout(size, size).back().offset + 4);
+  texture.compress(TextureFormat::BC1);
+  CHECK(std::string(toString(texture.format())) == "BC1");
+
+  // R16 の DDS はそのまま読める
+  image.format = TextureFormat::R16;
+  image.sRGB = false;
+  image.data.assign(size * size * 2, 7);
+  const auto dds = loadDds(saveDds(image));
+  CHECK(std::string(toString(dds.format)) == "R16");
+  CHECK(dds.data == image.data);
+}
+
+TEST_CASE("TextureLoader loads files in parallel and reports failures") {
+  // 大きさの違う DDS を書き出して読み込ませる
+  const auto dir = std::filesystem::temp_directory_path() / "b3_loader_test";
+  std::filesystem::create_directories(dir);
+  std::vector<TextureLoader::Request> requests;
+  for (uint32_t i = 0; i < 8; ++i) {
+    const auto path = (dir / ("tex" + std::to_string(i) + ".dds")).string();
+    writeDds(path, 4u << (i % 4), static_cast<uint8_t>(i * 20));
+    requests.push_back({.filename = path, .sRGB = true});
+  }
+  requests.push_back({.filename = (dir / "missing.dds").string(),
+                      .sRGB = true});
+
+  TextureLoader loader(3);
+  CHECK(loader.threadCount() == 3);
+  auto futures = loader.loadAll(requests);
+  REQUIRE(futures.size() == requests.size());
+  for (uint32_t i = 0; i < 8; ++i) {
+    const auto texture = futures[i].get();
+    CHECK(texture->width() == 4u << (i % 4));
+    CHECK(texture->isCompressed());
+    CHECK(texture->sRGB());
+    CHECK(texture->loadTiming().decodeMs >= 0.0);
+  }
+  CHECK_THROWS(futures.back().get());
+
+  const auto stats = loader.stats();
+  CHECK(stats.loaded == 8);
+  CHECK(stats.failed == 1);
+  std::filesystem::remove_all(dir);
+}
+
+TEST_CASE("Texture releases its data and reloads it from the source") {
+  const auto dir = std::filesystem::temp_directory_path() / "b3_reload_test";
+  std::filesystem::create_directories(dir);
+  const auto path = (dir / "tex.dds").string();
+  writeDds(path, 16, 90);
+
+  Texture texture(TextureSource{.filename = path, .sRGB = true});
+  CHECK_FALSE(texture.keepPixels());
+  REQUIRE(texture.resident());
+  CHECK(texture.source().filename == path);
+  const auto blocks = texture.compressed().data;
+  CHECK(texture.residentBytes() == blocks.size());
+
+  texture.releasePixels();
+  CHECK_FALSE(texture.resident());
+  CHECK(texture.residentBytes() == 0);
+  CHECK(texture.width() == 16);
+  CHECK(std::string(toString(texture.format())) == "BC1");
+
+  texture.reload();
+  REQUIRE(texture.resident());
+  CHECK(texture.compressed().data == blocks);
+
+  // 読み込み元がないテクスチャは手放せない
+  Texture color(RGBAColor{.r = 1.f, .g = 0.f, .b = 0.f, .a = 1.f});
+  CHECK_FALSE(color.hasSource());
+  CHECK_THROWS_AS(color.releasePixels(), std::logic_error);
+  std::vector<uint8_t> rgba(color.width() * color.height() * 4);
+  color.decodeInto(rgba.data());
+  CHECK(rgba[0] == 255);
+  CHECK(rgba[1] == 0);
+  std::filesystem::remove_all(dir);
+}
+
+TEST_CASE("benchmark RGB to RGBA expansion" * doctest::skip()) {
+  const size_t count = 4096 * 4096;
+  std::vector<uint8_t> rgb(count * 3, 7);
+  std::vector<uint8_t> rgba(count * 4);
+  using ms = std::chrono::duration<double, std::milli>;
+  for (const auto level : {SimdLevel::Scalar, detectSimdLevel()}) {
+    expandRgbToRgba(rgb.data(), rgba.data(), count, level);
+    const auto start = std::chrono::steady_clock::now();
+    expandRgbToRgba(rgb.data(), rgba.data(), count, level);
+    const auto elapsed = ms(std::chrono::steady_clock::now() - start).count();
+    MESSAGE(std::string(toString(level))
+            << ": " << elapsed << " ms (" << count / elapsed / 1000.0
+            << " MPix/s)");
+  }
+}
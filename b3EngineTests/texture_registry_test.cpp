@@ -0,0 +1,182 @@
+#include "doctest.h"
+
+#include "b3/texture.hpp"
+#include "b3/texture_registry.hpp"
+
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+
+using namespace b3;
+
+namespace {
+
+std::shared_ptr<Texture> colorTexture(float r) {
+  return std::make_shared<Texture>(
+      RGBAColor{.r = r, .g = 0.f, .b = 0.f, .a = 1.f});
+}
+
+} // namespace
+
+TEST_CASE("TextureRegistry shares a slot between pointers and equal content") {
+  TextureRegistry registry(16);
+  auto red = colorTexture(1.f);
+  auto redCopy = colorTexture(1.f);
+  auto black = colorTexture(0.f);
+  CHECK(TextureRegistry::contentHash(*red) ==
+        TextureRegistry::contentHash(*redCopy));
+  CHECK(TextureRegistry::contentHash(*red) !=
+        TextureRegistry::contentHash(*black));
+
+  const auto a = registry.acquire(red);
+  CHECK(a.created);
+  // 同じポインタ
+  const auto b = registry.acquire(red);
+  CHECK_FALSE(b.created);
+  CHECK(b.slot == a.slot);
+  // 別のポインタで内容が同じ
+  const auto c = registry.acquire(redCopy);
+  CHECK_FALSE(c.created);
+  CHECK(c.slot == a.slot);
+  CHECK(registry.find(redCopy) == a.slot);
+  // 内容が違う
+  const auto d = registry.acquire(black);
+  CHECK(d.created);
+  CHECK(d.slot != a.slot);
+
+  CHECK(registry.textureCount() == 2);
+  CHECK(registry.aliasCount() == 3);
+  CHECK(registry.stats().deduplicated == 1);
+
+  // 最後の利用者が外れたときだけスロットが返る
+  CHECK(registry.release(red) == TextureRegistry::INVALID_SLOT);
+  CHECK(registry.release(red) == TextureRegistry::INVALID_SLOT);
+  CHECK(registry.find(red) == TextureRegistry::INVALID_SLOT);
+  CHECK(registry.release(redCopy) == a.slot);
+  CHECK(registry.textureCount() == 1);
+}
+
+TEST_CASE("TextureRegistry reuses freed slots only after freeSlot") {
+  TextureRegistry registry(2);
+  auto t0 = colorTexture(0.f);
+  auto t1 = colorTexture(0.5f);
+  auto t2 = colorTexture(1.f);
+  const auto s0 = registry.acquire(t0).slot;
+  const auto s1 = registry.acquire(t1).slot;
+  CHECK(s0 == 0);
+  CHECK(s1 == 1);
+  CHECK_THROWS_AS(registry.acquire(t2), std::runtime_error);
+
+  // 返されたスロットは freeSlot() までは使わない
+  CHECK(registry.release(t0) == s0);
+  CHECK_THROWS_AS(registry.acquire(t2), std::runtime_error);
+  registry.freeSlot(s0);
+  const auto reused = registry.acquire(t2);
+  CHECK(reused.created);
+  CHECK(reused.slot == s0);
+  CHECK(registry.slotCount() == 2);
+
+  // 解放したテクスチャと同じ内容は、新しいスロットとして作り直す
+  CHECK(registry.release(t1) == s1);
+  registry.freeSlot(s1);
+  const auto again = registry.acquire(colorTexture(0.5f));
+  CHECK(again.created);
+  CHECK(again.slot == s1);
+}
+
+TEST_CASE("TextureRegistry compares compressed textures by their blocks") {
+  TextureRegistry registry(16);
+  auto red = colorTexture(1.f);
+  auto bc1 = colorTexture(1.f);
+  auto bc1Copy = colorTexture(1.f);
+  bc1->compress(TextureFormat::BC1);
+  bc1Copy->compress(TextureFormat::BC1);
+  CHECK(bc1->isCompressed());
+  CHECK(bc1->compressed().levelCount == 3);
+
+  const auto a = registry.acquire(red);
+  // 元の画素が同じでも形式が違えば別のスロット
+  const auto b = registry.acquire(bc1);
+  CHECK(b.created);
+  CHECK(b.slot != a.slot);
+  const auto c = registry.acquire(bc1Copy);
+  CHECK_FALSE(c.created);
+  CHECK(c.slot == b.slot);
+}
+
+TEST_CASE("TextureRegistry compares released textures by their source") {
+  const auto path = (std::filesystem::temp_directory_path() /
+                     "b3_registry_source_test.dds")
+                        .string();
+  auto red = colorTexture(1.f);
+  red->compress(TextureFormat::BC1);
+  const auto file = saveDds(red->compressed());
+  std::ofstream(path, std::ios::binary)
+      .write(reinterpret_cast<const char *>(file.data()),
+             static_cast<std::streamsize>(file.size()));
+
+  TextureRegistry registry(16);
+  auto loaded = std::make_shared<Texture>(TextureSource{.filename = path});
+  auto same = std::make_shared<Texture>(TextureSource{.filename = path});
+  auto srgb = std::make_shared<Texture>(
+      TextureSource{.filename = path, .sRGB = true});
+  const auto a = registry.acquire(loaded);
+  CHECK(a.created);
+  // 代表のテクスチャが画素を手放しても、同じファイルならまとめる
+  loaded->releasePixels();
+  const auto b = registry.acquire(same);
+  CHECK_FALSE(b.created);
+  CHECK(b.slot == a.slot);
+  CHECK(registry.acquire(srgb).created);
+
+  // 画素を持たないもの同士は読み込み元で引く
+  auto released = std::make_shared<Texture>(TextureSource{.filename = path});
+  auto releasedCopy =
+      std::make_shared<Texture>(TextureSource{.filename = path});
+  released->releasePixels();
+  releasedCopy->releasePixels();
+  const auto c = registry.acquire(released);
+  CHECK(c.created);
+  const auto d = registry.acquire(releasedCopy);
+  CHECK_FALSE(d.created);
+  CHECK(d.slot == c.slot);
+  std::filesystem::remove(path);
+}
+
+TEST_CASE("TextureRegistry hashes uncompressed DDS textures by their pixels") {
+  // RGBA8 の DDS は画素として読み込むので、その画素で比べる
+  const auto directory = std::filesystem::temp_directory_path();
+  const auto write = [&](const char *name, uint8_t value) {
+    const auto path = (directory / name).string();
+    const auto file = saveDds({.format = TextureFormat::RGBA8,
+                               .width = 8,
+                               .height = 8,
+                               .levelCount = 1,
+                               .data = std::vector<uint8_t>(8 * 8 * 4, value)});
+    std::ofstream(path, std::ios::binary)
+        .write(reinterpret_cast<const char *>(file.data()),
+               static_cast<std::streamsize>(file.size()));
+    return path;
+  };
+  const auto grayPath = write("b3_registry_rgba8_gray.dds", 128);
+  const auto whitePath = write("b3_registry_rgba8_white.dds", 255);
+
+  auto gray = std::make_shared<Texture>(grayPath, false);
+  CHECK_FALSE(gray->isCompressed());
+  CHECK(gray->resident());
+  REQUIRE(gray->pixelBytes() == 8 * 8 * 4);
+  CHECK(gray->pixels()[0] == 128);
+
+  TextureRegistry registry(16);
+  const auto a = registry.acquire(gray);
+  CHECK(a.created);
+  const auto b = registry.acquire(std::make_shared<Texture>(grayPath, false));
+  CHECK_FALSE(b.created);
+  CHECK(b.slot == a.slot);
+  const auto c = registry.acquire(std::make_shared<Texture>(whitePath, false));
+  CHECK(c.created);
+  CHECK(c.slot != a.slot);
+
+  std::filesystem::remove(grayPath);
+  std::filesystem::remove(whitePath);
+}
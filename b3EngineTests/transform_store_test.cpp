@@ -0,0 +1,195 @@
+#include "doctest.h"
+
+#include "b3/transform_store.hpp"
+
+#include <chrono>
+#include <memory>
+#include <random>
+#include <string>
+
+using namespace b3;
+
+static bool nearlyEqual(const glm::mat4 &a, const glm::mat4 &b) {
+  for (int c = 0; c < 4; ++c) {
+    for (int r = 0; r < 4; ++r) {
+      if (std::abs(a[c][r] - b[c][r]) > 1e-4f) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+static std::vector<SimdLevel> supportedLevels() {
+  std::vector<SimdLevel> levels{SimdLevel::Scalar};
+  for (auto level : {SimdLevel::SSE2, SimdLevel::AVX2, SimdLevel::AVX512}) {
+    if (level <= detectSimdLevel()) {
+      levels.push_back(level);
+    }
+  }
+  return levels;
+}
+
+// ランダムな木を作る。親を後から作ったノードにすることで並べ替えも通す。
+static std::vector<TransformStore::Handle> makeRandomTree(TransformStore &store,
+                                                          size_t count,
+                                                          uint32_t seed) {
+  std::mt19937 rng(seed);
+  std::uniform_real_distribution<float> pos(-10.f, 10.f);
+  std::uniform_real_distribution<float> angle(-3.f, 3.f);
+  std::vector<TransformStore::Handle> handles;
+  for (size_t i = 0; i < count; ++i) {
+    auto h = store.create();
+    store.setPosition(h, {pos(rng), pos(rng), pos(rng)});
+    store.setQuat(h, glm::quat(glm::vec3(angle(rng), angle(rng), angle(rng))));
+    handles.push_back(h);
+  }
+  for (size_t i = 0; i + 1 < count; ++i) {
+    if (rng() % 4 != 0) {
+      store.setParent(handles[i], handles[i + 1 + rng() % (count - i - 1)]);
+    }
+  }
+  return handles;
+}
+
+TEST_CASE("transform store SIMD paths match scalar") {
+  constexpr size_t count = 203; // SIMD 幅で割り切れない数
+  for (auto level : supportedLevels()) {
+    const std::string levelName = toString(level);
+    CAPTURE(levelName);
+    TransformStore reference;
+    TransformStore store;
+    auto refHandles = makeRandomTree(reference, count, 1);
+    auto handles = makeRandomTree(store, count, 1);
+    reference.update(SimdLevel::Scalar);
+    store.update(level);
+    CHECK(store.lastUpdatedCount() == count);
+    for (size_t i = 0; i < count; ++i) {
+      CHECK(nearlyEqual(store.worldMatrix(handles[i]),
+                        reference.worldMatrix(refHandles[i])));
+    }
+  }
+}
+
+TEST_CASE("transform store only recomputes changed subtrees") {
+  TransformStore store;
+  auto root = store.create();
+  auto child = store.create();
+  auto other = store.create();
+  store.setParent(child, root);
+  store.update();
+  CHECK(store.lastUpdatedCount() == 3);
+
+  // 変更がなければ何も計算しない
+  store.update();
+  CHECK(store.lastUpdatedCount() == 0);
+  CHECK_FALSE(store.dirty());
+
+  store.setPosition(root, {0.f, 2.f, 0.f});
+  store.update();
+  CHECK(store.lastUpdatedCount() == 2);
+  CHECK(store.worldMatrix(child)[3][1] == doctest::Approx(2.f));
+  CHECK(store.worldMatrix(other)[3][1] == doctest::Approx(0.f));
+}
+
+TEST_CASE("transform store reuses destroyed handles") {
+  TransformStore store;
+  auto a = store.create();
+  auto b = store.create();
+  store.setPosition(b, {1.f, 0.f, 0.f});
+  store.destroy(a);
+  store.update();
+  CHECK(store.size() == 1);
+  CHECK(store.worldMatrix(b)[3][0] == doctest::Approx(1.f));
+
+  auto c = store.create();
+  CHECK(c == a);
+  store.setPosition(c, {0.f, 0.f, 4.f});
+  CHECK(store.worldMatrix(c)[3][2] == doctest::Approx(4.f));
+  CHECK(store.worldMatrix(b)[3][0] == doctest::Approx(1.f));
+}
+
+// 以前の Node と同じく、ノードごとにヒープに置いて親を辿って計算する
+namespace {
+struct LegacyNode {
+  std::weak_ptr<LegacyNode> parent;
+  glm::vec3 pos{0.f};
+  glm::quat quat{glm::vec3{0.f}};
+
+  glm::mat4 localMatrix() const {
+    glm::mat4 m = glm::mat4_cast(quat);
+    m[3][0] = pos.x;
+    m[3][1] = pos.y;
+    m[3][2] = pos.z;
+    m[3][3] = 1.0f;
+    return m;
+  }
+  glm::mat4 worldMatrix() const {
+    if (auto p = parent.lock()) {
+      return p->worldMatrix() * localMatrix();
+    }
+    return localMatrix();
+  }
+};
+} // namespace
+
+// 時間がかかるので既定ではスキップする（--no-skip で実行）
+TEST_CASE("benchmark transform update" * doctest::skip()) {
+  using clock = std::chrono::steady_clock;
+  constexpr size_t count = 100000;
+  constexpr size_t childrenPerRoot = 3;
+  constexpr int frames = 20;
+
+  // 1ルート + 3子 のグループを並べ、毎フレーム全ルートを動かす
+  std::vector<std::shared_ptr<LegacyNode>> legacy;
+  for (size_t i = 0; i < count; ++i) {
+    auto node = std::make_shared<LegacyNode>();
+    if (i % (childrenPerRoot + 1) != 0) {
+      node->parent = legacy[i - i % (childrenPerRoot + 1)];
+    }
+    legacy.push_back(node);
+  }
+  float sink = 0.f;
+  auto start = clock::now();
+  for (int f = 0; f < frames; ++f) {
+    for (size_t i = 0; i < count; i += childrenPerRoot + 1) {
+      legacy[i]->pos = glm::vec3(static_cast<float>(f));
+    }
+    for (const auto &node : legacy) {
+      sink += node->worldMatrix()[3][0];
+    }
+  }
+  auto legacyMs =
+      std::chrono::duration<double, std::milli>(clock::now() - start).count() /
+      frames;
+  MESSAGE("legacy node: " << legacyMs << " ms/frame");
+
+  for (auto level : supportedLevels()) {
+    TransformStore store;
+    std::vector<TransformStore::Handle> handles;
+    for (size_t i = 0; i < count; ++i) {
+      auto h = store.create();
+      if (i % (childrenPerRoot + 1) != 0) {
+        store.setParent(h, handles[i - i % (childrenPerRoot + 1)]);
+      }
+      handles.push_back(h);
+    }
+    store.update(level);
+
+    start = clock::now();
+    for (int f = 0; f < frames; ++f) {
+      for (size_t i = 0; i < count; i += childrenPerRoot + 1) {
+        store.setPosition(handles[i], glm::vec3(static_cast<float>(f)));
+      }
+      store.update(level);
+    }
+    auto ms =
+        std::chrono::duration<double, std::milli>(clock::now() - start)
+            .count() /
+        frames;
+    sink += store.worldMatrix(handles[1])[3][0];
+    MESSAGE("transform store (" << std::string(toString(level)) << "): " << ms
+                                << " ms/frame, x" << legacyMs / ms);
+  }
+  CHECK(sink != 0.f);
+}
@@ -0,0 +1,95 @@
+#include "doctest.h"
+
+#include "b3/primitives/PlaneMesh.hpp"
+#include "b3/primitives/SphereMesh.hpp"
+#include "b3/vertex_quantization.hpp"
+
+#include <cmath>
+#include <cstring>
+
+using namespace b3;
+
+TEST_CASE("octahedral encoding round-trips unit normals") {
+  for (int i = 0; i < 64; ++i) {
+    for (int j = 0; j < 32; ++j) {
+      const float phi = float(i) / 64 * 2.f * glm::pi<float>();
+      const float theta = float(j) / 31 * glm::pi<float>();
+      const glm::vec3 n(std::sin(theta) * std::cos(phi),
+                        std::sin(theta) * std::sin(phi), std::cos(theta));
+      const auto e = encodeOctahedral(n);
+      REQUIRE(std::abs(e.x) <= 1.f);
+      REQUIRE(std::abs(e.y) <= 1.f);
+      REQUIRE(glm::dot(decodeOctahedral(e), n) == doctest::Approx(1.f));
+    }
+  }
+}
+
+TEST_CASE("quantized sphere stays within 16-bit precision") {
+  auto sphere = mesh::SphereMesh::generate(2.f, 32, 32);
+  const auto vertices = sphere->vertices();
+  const auto quantized = quantizeVertices(vertices);
+  REQUIRE(quantized.vertices.size() == vertices.size());
+  MESSAGE("position " << quantized.error.position << ", normal "
+                      << quantized.error.normalDegrees << " deg, uv "
+                      << quantized.error.texCoord);
+  // 直径 4 を 65535 段階にした刻みの半分と、UV の範囲 1 の刻みの半分
+  CHECK(quantized.error.position <= 4.f / 65534.f * std::sqrt(3.f));
+  CHECK(quantized.error.normalDegrees < 0.01f);
+  CHECK(quantized.error.texCoord <= 0.5f / 65535.f + 1e-6f);
+
+  for (size_t i = 0; i < vertices.size(); ++i) {
+    const auto decoded =
+        dequantizeVertex(quantized.vertices[i], quantized.dequantization);
+    REQUIRE(glm::length(decoded.position - vertices[i].position) <=
+            quantized.error.position);
+  }
+}
+
+TEST_CASE("flat meshes keep zero extent axes") {
+  auto plane = mesh::PlaneMesh::generate(3.f, 1.f, UpAxis::Z, 4, 4);
+  const auto quantized = quantizeVertices(plane->vertices());
+  const auto &dq = quantized.dequantization;
+  CHECK(dq.positionScale.z == 0.f);
+  CHECK(dq.positionScale.x == doctest::Approx(1.5f));
+  for (const auto &v : quantized.vertices) {
+    REQUIRE(v.position[2] == 0);
+  }
+  CHECK(quantized.error.position < 1e-4f);
+}
+
+TEST_CASE("vertex streams split positions from normals and UVs") {
+  for (const auto format : {VertexFormat::Float, VertexFormat::Packed}) {
+    const auto streams = vertexStreamLayout(format);
+    const size_t stride = format == VertexFormat::Float ? sizeof(Vertex)
+                                                        : sizeof(PackedVertex);
+    CHECK(streams.positionStride + streams.attributeStride == stride);
+    CHECK(streams.normalOffset < streams.texCoordOffset);
+    CHECK(streams.texCoordOffset < streams.attributeStride);
+  }
+  CHECK(vertexStreamLayout(VertexFormat::Float).positionStride == 12);
+  CHECK(vertexStreamLayout(VertexFormat::Packed).positionStride == 8);
+
+  std::vector<Vertex> vertices(3);
+  for (size_t i = 0; i < vertices.size(); ++i) {
+    vertices[i] = {.position = glm::vec3(float(i)),
+                   .normal = glm::vec3(0.f, 0.f, 1.f),
+                   .texCoord = glm::vec2(float(i) / 2)};
+  }
+  const auto streams = vertexStreamLayout(VertexFormat::Float);
+  std::vector<glm::vec3> positions(vertices.size());
+  copyVertexStream(vertices.data(), vertices.size(), sizeof(Vertex), 0,
+                   streams.positionStride,
+                   reinterpret_cast<uint8_t *>(positions.data()));
+  CHECK(positions[2].z == 2.f);
+
+  std::vector<uint8_t> attributes(vertices.size() * streams.attributeStride);
+  copyVertexStream(vertices.data(), vertices.size(), sizeof(Vertex),
+                   streams.positionStride, streams.attributeStride,
+                   attributes.data());
+  glm::vec2 texCoord;
+  std::memcpy(&texCoord,
+              &attributes[2 * streams.attributeStride + streams.texCoordOffset],
+              sizeof(texCoord));
+  CHECK(texCoord.x == 1.f);
+  CHECK(texCoord.y == 1.f);
+}
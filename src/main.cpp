@@ -13,7 +13,8 @@ int main(int argc, char *argv[]) {
   {
     auto mesh = mesh::PlaneMesh::generate(6, 6, UpAxis::Z, 1, 1);
     //auto texture = std::make_shared<Texture>(RGBAColor{.r = 1.f, .g = 0.f, .b = 0.f, .a = 1.f});
-    auto texture = std::make_shared<Texture>("images/floor.png", true);
+    auto texture = std::make_shared<Texture>(
+        TextureSource{.filename = "images/floor.png", .sRGB = true});
     auto node = std::make_shared<Node>(mesh, texture);
     node->setPosition(glm::vec3(0, 0, -0.5));
     node->setEulerAngle(glm::vec3(0, 0, 0));